@@ -0,0 +1,234 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "o126/aot.hpp"
+#include "o126/cpu/impl_decode.hpp"
+#include "o126/mapping.hpp"
+
+using namespace o126;
+
+// Translates the code reachable from the given entry points of a ROM image into C++ blocks for AOT
+namespace {
+// BARRIER instructions, port accesses, are left to the interpreter so devices see exact timing
+using Flow = CPU::Layout::Flow;
+
+struct Inst final {
+    dword_t ea = {};
+    byte_t len = {};
+    // Prefixes followed by the opcode
+    std::vector<byte_t> ops = {};
+    Flow flow = Flow::NEXT;
+    dword_t target = ~dword_t{};
+};
+
+struct Image final {
+    std::span<byte_t const> bytes = {};
+    dword_t base = {};
+    CPU::Model model = {};
+
+    [[nodiscard]] bool contains(dword_t ea) const noexcept {
+        return ea >= base && ea - base < bytes.size();
+    }
+
+    [[nodiscard]] byte_t at(dword_t ea) const {
+        if (!contains(ea)) {
+            throw "Code runs off the image!";
+        }
+        return bytes[ea - base];
+    }
+};
+
+[[nodiscard]] Inst decode(Image const& image, dword_t ea) {
+    auto const layout = CPU::Layout::inst(image.model, [&](byte_t i) { return image.at(ea + i); });
+    auto result = Inst { .ea = ea, .len = layout.len, .flow = layout.flow };
+    if (layout.flow == Flow::INVALID) {
+        return result;
+    }
+    for (auto i = 0; i <= layout.prefixes; ++i) {
+        result.ops.push_back(image.at(ea + i));
+    }
+    if (layout.is_far()) {
+        result.target = layout.far.ea();
+    } else if (layout.flow == Flow::BRANCH || layout.flow == Flow::JUMP || layout.flow == Flow::CALL) {
+        result.target = static_cast<dword_t>(ea + layout.len + layout.rel);
+    }
+    return result;
+}
+
+struct Translator final {
+    static constexpr std::size_t MAX_INSTS = 64;
+
+    Image const& image;
+    std::vector<dword_t> pending = {};
+    std::set<dword_t> starts = {};
+    std::map<dword_t, std::vector<Inst>> blocks = {};
+
+    void enter(dword_t ea) {
+        if (image.contains(ea) && starts.insert(ea).second) {
+            pending.push_back(ea);
+        }
+    }
+
+    void walk(dword_t ea) {
+        auto body = std::vector<Inst>{};
+        auto const page = ea >> MEM::PAGE_BITS;
+        for (auto cur = ea; body.size() != MAX_INSTS; ) {
+            if (cur != ea && starts.contains(cur)) {
+                break;
+            }
+            if (!image.contains(cur) || cur >> MEM::PAGE_BITS != page) {
+                enter(cur);
+                break;
+            }
+            auto inst = Inst{};
+            try {
+                inst = decode(image, cur);
+            } catch (char const*) {
+                break;
+            }
+            if (inst.flow == Flow::INVALID || (cur + inst.len - 1) >> MEM::PAGE_BITS != page) {
+                break;
+            }
+            if (inst.flow == Flow::BARRIER) {
+                enter(cur + inst.len);
+                break;
+            }
+            body.push_back(inst);
+            cur += inst.len;
+            if (inst.flow == Flow::NEXT) {
+                if (body.size() == MAX_INSTS) {
+                    enter(cur);
+                }
+                continue;
+            }
+            if (inst.flow != Flow::RETURN) {
+                enter(inst.target);
+            }
+            if (inst.flow != Flow::JUMP && inst.flow != Flow::RETURN) {
+                enter(cur);
+            }
+            break;
+        }
+        if (body.size() > 1) {
+            blocks[ea] = std::move(body);
+        }
+    }
+
+    void run() {
+        while (!pending.empty()) {
+            auto const ea = pending.back();
+            pending.pop_back();
+            walk(ea);
+        }
+    }
+};
+
+[[nodiscard]] char const* model_name(CPU::Model model) noexcept {
+    switch (model) {
+    case CPU::Model::I8088:
+        return "I8088";
+    case CPU::Model::I8086:
+        return "I8086";
+    case CPU::Model::V20:
+        return "V20";
+    default:
+        return "I80186";
+    }
+}
+
+[[nodiscard]] CPU::Model model_parse(std::string const& name) {
+    if (name == "8088") {
+        return CPU::Model::I8088;
+    } else if (name == "8086") {
+        return CPU::Model::I8086;
+    } else if (name == "v20") {
+        return CPU::Model::V20;
+    } else if (name == "80186") {
+        return CPU::Model::I80186;
+    }
+    throw "Unknown CPU model!";
+}
+
+void emit(std::FILE* out, Image const& image, Translator const& translator, std::string const& name) {
+    std::fprintf(out, "// Generated by o126-aot, do not edit\n");
+    std::fprintf(out, "#include \"o126/aot.hpp\"\n");
+    std::fprintf(out, "#include \"o126/cpu/impl_exe.hpp\"\n\n");
+    std::fprintf(out, "namespace {\n");
+    std::fprintf(out, "using o126::AOT;\n");
+    std::fprintf(out, "using o126::BUS;\n");
+    std::fprintf(out, "using o126::CPU;\n");
+    std::fprintf(out, "constexpr auto MODEL = CPU::Model::%s;\n", model_name(image.model));
+    for (auto const& [ea, body] : translator.blocks) {
+        std::fprintf(out, "\n[[nodiscard]] CPU::Result block_%05X(CPU& cpu, BUS& bus) noexcept {\n", ea);
+        std::fprintf(out, "    auto const ip = cpu.reg_get(CPU::REG::IP);\n");
+        std::fprintf(out, "    auto result = CPU::Result{};\n");
+        auto offset = dword_t{};
+        for (auto const& inst : body) {
+            offset += inst.len;
+            auto ops = std::string{};
+            for (auto const op : inst.ops) {
+                char hex[8] = {};
+                std::snprintf(hex, sizeof(hex), ", 0x%02X", op);
+                ops += hex;
+            }
+            if (&inst == &body.back()) {
+                std::fprintf(out, "    (void)AOT::step<MODEL%s>(cpu, bus, ip + %u, result);\n", ops.c_str(), offset);
+                break;
+            }
+            std::fprintf(out, "    if (!AOT::step<MODEL%s>(cpu, bus, ip + %u, result)) {\n", ops.c_str(), offset);
+            std::fprintf(out, "        return result;\n");
+            std::fprintf(out, "    }\n");
+        }
+        std::fprintf(out, "    return result;\n");
+        std::fprintf(out, "}\n");
+    }
+    std::fprintf(out, "\nconstexpr AOT::Block BLOCKS[] = {\n");
+    for (auto const& [ea, body] : translator.blocks) {
+        std::fprintf(out, "    { 0x%05X, %zu, &block_%05X },\n", ea, body.size(), ea);
+    }
+    std::fprintf(out, "};\n");
+    std::fprintf(out, "}\n\n");
+    std::fprintf(out, "extern o126::AOT::Module const %s;\n", name.c_str());
+    std::fprintf(out, "o126::AOT::Module const %s = { MODEL, 0x%05X, 0x%zX, 0x%016llXull, BLOCKS };\n",
+                 name.c_str(), image.base, image.bytes.size(), static_cast<unsigned long long>(AOT::hash(image.bytes)));
+}
+}
+
+int main(int argc, char** argv) {
+    if (argc < 7) {
+        std::fprintf(stderr, "usage: %s image base model name output.cpp entry...\n", argv[0]);
+        std::fprintf(stderr, "  base and entries are hex linear addresses, model is 8088, 8086, v20 or 80186\n");
+        return 1;
+    }
+    try {
+        auto const mapping = MAPPING(argv[1]);
+        auto const image = Image {
+            .bytes = mapping.bytes(),
+            .base = static_cast<dword_t>(std::strtoul(argv[2], nullptr, 16)),
+            .model = model_parse(argv[3]),
+        };
+        if (image.base + image.bytes.size() > MEM::SIZE) {
+            throw "Image does not fit the address space!";
+        }
+        auto translator = Translator { .image = image };
+        for (auto i = 6; i < argc; ++i) {
+            translator.enter(static_cast<dword_t>(std::strtoul(argv[i], nullptr, 16)));
+        }
+        translator.run();
+        auto const out = std::fopen(argv[5], "w");
+        if (!out) {
+            throw "Failed to open output!";
+        }
+        emit(out, image, translator, argv[4]);
+        std::fclose(out);
+        std::fprintf(stderr, "%zu blocks\n", translator.blocks.size());
+    } catch (char const* error) {
+        std::fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    return 0;
+}
@@ -1,90 +1,666 @@
 #include <iostream>
+#include <algorithm>
 #include <array>
 #include <filesystem>
 #include <fstream>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 #include <type_traits>
 #include <utility>
-#include "o126/cpu.hpp"
+#include "o126/dos.hpp"
+#include "o126/mapping.hpp"
+#include "o126/pc.hpp"
+#include "o126/snapshot.hpp"
 
 using namespace o126;
 
-struct MEM : BUS {
-    std::array<byte_t, 0x10'00'00> data = {};
+void test_inst(std::string name) {
+    printf("Testing %s:\n", name.c_str());
+    auto pc = std::make_unique<PC>();
+    pc->mem.load_bios("80186_tests/"+name+".bin");
+    for (;;) {
+        auto const result = pc->step();
+        if (result == CPU::Result::HALT) {
+            break;
+        }
+    }
+
+    auto const expected = MAPPING("80186_tests/res_"+name+".bin");
+    auto const result = expected.bytes();
+    for (dword_t i = 0; i < result.size(); i += MEM::PAGE_SIZE) {
+        auto const size = std::min<std::size_t>(result.size() - i, MEM::PAGE_SIZE);
+        auto const actual = pc->mem.page_read(i).first(size);
+        if (std::equal(actual.begin(), actual.end(), result.begin() + i)) {
+            continue;
+        }
+        for (std::size_t j = 0; j != size; j += 1) {
+            if (actual[j] != result[i + j]) {
+                printf("Bad (%zu): %02X should be %02X\n", i + j, actual[j], result[i + j]);
+            }
+        }
+    }
+}
+
+// Known answers for the exact FPU, b is loaded first so a is ST(0) and b is ST(1) when the operations run
+// Stores go to memory and the bytes are compared with expected, the first 8 in sig and the next 2 in se
+struct FPUVector final {
+    char const* name;
+    word_t control; // precision and rounding
+    FPU::F80 a;
+    FPU::F80 b;
+    std::array<word_t, 2> ops; // ESC codes of register forms, 0 for none
+    word_t store; // ESC code of a memory form store
+    int size;
+    FPU::F80 expected;
+    word_t flags; // condition and exception bits of the status word
+};
 
-    constexpr MEM() noexcept = default;
+// ESC codes are the low three bits of the ESC byte followed by ModRM
+constexpr word_t FADD = 0x00C1; // FADD ST, ST(1)
+constexpr word_t FMUL = 0x00C9; // FMUL ST, ST(1)
+constexpr word_t FDIV = 0x00F1; // FDIV ST, ST(1)
+constexpr word_t FPREM = 0x01F8;
+constexpr word_t FST32 = 0x0116;
+constexpr word_t FIST32 = 0x0316;
+constexpr word_t FSTP80 = 0x033E;
+constexpr word_t FIST16 = 0x0716;
+constexpr word_t FBSTP = 0x0736;
+constexpr word_t FISTP64 = 0x073E;
 
-    void load_bios(std::string filename) {
-        std::ifstream file(filename, std::ios::binary);
-        if (!file) {
-            throw "Failed to open BIOS file!";
+// Control word fields, the vectors run with every exception masked
+constexpr word_t MASKED = 0x00FF;
+constexpr word_t SINGLE = 0x0000;
+constexpr word_t DOUBLE = 0x0200;
+constexpr word_t EXTENDED = 0x0300;
+constexpr word_t NEAREST = 0x0000;
+constexpr word_t DOWN = 0x0400;
+constexpr word_t UP = 0x0800;
+constexpr word_t CHOP = 0x0C00;
+
+constexpr FPU::F80 ONE = { 0x8000'0000'0000'0000, 0x3FFF };
+constexpr FPU::F80 THREE = { 0xC000'0000'0000'0000, 0x4000 };
+
+constexpr FPUVector fpu_vectors[] = {
+    // 1/3 rounded in each mode, the bits after the last one kept are 1010...
+    { "div nearest", EXTENDED | NEAREST, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'AAAB, 0x3FFD }, 0x0020 },
+    { "div chop", EXTENDED | CHOP, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'AAAA, 0x3FFD }, 0x0020 },
+    { "div up", EXTENDED | UP, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'AAAB, 0x3FFD }, 0x0020 },
+    { "div down", EXTENDED | DOWN, ONE.with_sign(true), THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'AAAB, 0xBFFD }, 0x0020 },
+    { "div up negative", EXTENDED | UP, ONE.with_sign(true), THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'AAAA, 0xBFFD }, 0x0020 },
+    // Precision control narrows the significand to 24 and 53 bits
+    { "div single", SINGLE | NEAREST, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AB00'0000'0000, 0x3FFD }, 0x0020 },
+    { "div single chop", SINGLE | CHOP, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AA00'0000'0000, 0x3FFD }, 0x0020 },
+    { "div double", DOUBLE | NEAREST, ONE, THREE, { FDIV }, FSTP80, 10, { 0xAAAA'AAAA'AAAA'A800, 0x3FFD }, 0x0020 },
+    // 1 + 2^-24 is halfway between two singles
+    { "fst m32 tie", EXTENDED | NEAREST, { 0x8000'0080'0000'0000, 0x3FFF }, {}, {}, FST32, 4, { 0x3F80'0000, 0 }, 0x0020 },
+    { "fst m32 up", EXTENDED | UP, { 0x8000'0080'0000'0000, 0x3FFF }, {}, {}, FST32, 4, { 0x3F80'0001, 0 }, 0x0020 },
+    // Denormal results, underflow is only reported when the result is also inexact
+    { "fst m32 denormal", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0x3F7D }, {}, {}, FST32, 4, { 0x0008'0000, 0 }, 0x0000 },
+    { "fst m32 underflow", EXTENDED | NEAREST, { 0xC000'0000'0000'0000, 0x3F6A }, {}, {}, FST32, 4, { 0x0000'0002, 0 }, 0x0030 },
+    { "mul underflow", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0x0001 }, { 0xC000'0000'0000'0001, 0x3FFE }, { FMUL }, FSTP80, 10, { 0x6000'0000'0000'0000, 0 }, 0x0030 },
+    { "mul underflow up", EXTENDED | UP, { 0x8000'0000'0000'0000, 0x0001 }, { 0xC000'0000'0000'0001, 0x3FFE }, { FMUL }, FSTP80, 10, { 0x6000'0000'0000'0001, 0 }, 0x0030 },
+    { "add denormals", EXTENDED | NEAREST, { 1, 0 }, { 1, 0 }, { FADD }, FSTP80, 10, { 2, 0 }, 0x0002 },
+    // The quotient bits land in C0, C3 and C1 unless C2 says the remainder is only partial
+    { "fprem", EXTENDED | NEAREST, { 0xA000'0000'0000'0000, 0x4002 }, THREE, { FPREM }, FSTP80, 10, ONE, 0x4200 },
+    { "fprem negative", EXTENDED | NEAREST, { 0xA000'0000'0000'0000, 0xC002 }, THREE, { FPREM }, FSTP80, 10, ONE.with_sign(true), 0x4200 },
+    { "fprem partial", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0x4063 }, THREE, { FPREM }, FSTP80, 10, { 0x8000'0000'0000'0000, 0x4023 }, 0x0400 },
+    { "fprem twice", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0x4063 }, THREE, { FPREM, FPREM }, FSTP80, 10, ONE, 0x0300 },
+    // Integer stores round with the rounding control and store the indefinite when out of range
+    { "fist m16 nearest", EXTENDED | NEAREST, { 0xA000'0000'0000'0000, 0x4000 }, {}, {}, FIST16, 2, { 0x0002, 0 }, 0x0020 },
+    { "fist m16 up", EXTENDED | UP, { 0xA000'0000'0000'0000, 0x4000 }, {}, {}, FIST16, 2, { 0x0003, 0 }, 0x0020 },
+    { "fist m16 down", EXTENDED | DOWN, { 0xA000'0000'0000'0000, 0xC000 }, {}, {}, FIST16, 2, { 0xFFFD, 0 }, 0x0020 },
+    { "fist m16 chop", EXTENDED | CHOP, { 0xA000'0000'0000'0000, 0xC000 }, {}, {}, FIST16, 2, { 0xFFFE, 0 }, 0x0020 },
+    { "fist m16 min", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0xC00E }, {}, {}, FIST16, 2, { 0x8000, 0 }, 0x0000 },
+    { "fist m16 overflow", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0x400E }, {}, {}, FIST16, 2, { 0x8000, 0 }, 0x0001 },
+    { "fist m32 nearest", EXTENDED | NEAREST, { 0xEB79'A2B8'0000'0000, 0x4019 }, {}, {}, FIST32, 4, { 0x075B'CD16, 0 }, 0x0020 },
+    { "fist m32 chop", EXTENDED | CHOP, { 0xEB79'A2B8'0000'0000, 0x4019 }, {}, {}, FIST32, 4, { 0x075B'CD15, 0 }, 0x0020 },
+    { "fistp m64 min", EXTENDED | NEAREST, { 0x8000'0000'0000'0000, 0xC03E }, {}, {}, FISTP64, 8, { 0x8000'0000'0000'0000, 0 }, 0x0000 },
+    { "fbstp", EXTENDED | NEAREST, { 0xDB4D'A5D3'1879'A700, 0x4037 }, {}, {}, FBSTP, 10, { 0x3456'7890'1234'5678, 0x0012 }, 0x0000 },
+    { "fbstp tie", EXTENDED | NEAREST, { 0xC0E6'0000'0000'0000, 0xC00C }, {}, {}, FBSTP, 10, { 0x0000'0000'0001'2346, 0x8000 }, 0x0020 },
+    { "fbstp overflow", EXTENDED | NEAREST, { 0xDE0B'6B3A'7640'0000, 0x403A }, {}, {}, FBSTP, 10, { 0xC000'0000'0000'0000, 0xFFFF }, 0x0001 },
+};
+
+void test_fpu() {
+    printf("Testing fpu:\n");
+    auto const control_at = FAR(0x100, 0);
+    auto const operand_at = FAR(0x110, 0);
+    auto const result_at = FAR(0x120, 0);
+    for (auto const& vector : fpu_vectors) {
+        auto pc = std::make_unique<PC>();
+        pc->fpu.mode = FPU::Mode::EXACT;
+        pc->fpu.reset();
+        auto const esc = [&](word_t code, FAR addr) {
+            pc->fpu.esc(code, {}, addr, *pc);
+        };
+        pc->write_word(control_at, MASKED | vector.control);
+        esc(0x012E, control_at); // FLDCW
+        for (auto const& value : { vector.b, vector.a }) {
+            for (auto i = 0; i != 4; ++i) {
+                pc->write_word(operand_at + static_cast<sword_t>(i * 2), static_cast<word_t>(value.sig >> (i * 16)));
+            }
+            pc->write_word(operand_at + 8, value.se);
+            esc(0x032E, operand_at); // FLD m80
+        }
+        for (auto const op : vector.ops) {
+            if (op) {
+                esc(op, {});
+            }
+        }
+        esc(vector.store, result_at);
+
+        auto actual = FPU::F80 {};
+        for (auto i = 0; i != vector.size; ++i) {
+            auto const val = pc->read_byte(result_at + static_cast<sword_t>(i));
+            if (i < 8) {
+                actual.sig |= std::uint64_t{val} << (i * 8);
+            } else {
+                actual.se = static_cast<word_t>(actual.se | val << ((i - 8) * 8));
+            }
         }
-        auto const data_size =  static_cast<std::ptrdiff_t>(data.size());
-        auto const file_size = static_cast<std::ptrdiff_t>(std::filesystem::file_size(filename));
-        auto const offset = data_size - file_size;
-        if (offset < 0 || offset > data_size) {
-            throw "BIOS file too big!";
+        auto const flags = static_cast<word_t>(pc->fpu.status_get() & 0x473F);
+        if (actual.sig != vector.expected.sig || actual.se != vector.expected.se) {
+            printf("Bad (%s): %04X %016llX should be %04X %016llX\n", vector.name, actual.se, static_cast<unsigned long long>(actual.sig),
+                vector.expected.se, static_cast<unsigned long long>(vector.expected.sig));
+        }
+        if (flags != vector.flags) {
+            printf("Bad (%s): status %04X should be %04X\n", vector.name, flags, vector.flags);
         }
-        file.read(reinterpret_cast<char*>(data.data() + offset), file_size);
     }
+}
+
+// Images for the machine tests, written next to each other in the temporary directory
+std::filesystem::path test_file(std::string name, std::span<byte_t const> bytes) {
+    auto const path = std::filesystem::temp_directory_path() / ("o126_" + name);
+    std::filesystem::create_directories(path.parent_path());
+    auto file = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<char const*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return path;
+}
 
-    constexpr virtual byte_t read_byte(FAR addr) noexcept override {
-        auto const lo = data[addr.ea()];
-        return lo;
+void test_fork() {
+    printf("Testing fork:\n");
+    auto bios = std::vector<byte_t>(0x10000);
+    for (std::size_t i = 0; i != bios.size(); ++i) {
+        bios[i] = static_cast<byte_t>(i * 7 + 3);
     }
-    constexpr virtual void write_byte(FAR addr, byte_t val) noexcept override {
-        data[addr.ea()] = val;
+    auto const path = test_file("fork.bin", bios);
+    auto parent = std::make_unique<PC>();
+    parent->mem.load_bios(path.string());
+    parent->mem.write_byte(0x1000, 0x11);
+    auto child = parent->fork();
+
+    // Both sides write the same shared RAM page
+    child->mem.write_byte(0x1000, 0x22);
+    parent->mem.write_byte(0x1001, 0x33);
+    if (parent->mem.read_byte(0x1000) != 0x11 || child->mem.read_byte(0x1000) != 0x22) {
+        printf("Bad (ram): parent %02X child %02X\n", parent->mem.read_byte(0x1000), child->mem.read_byte(0x1000));
     }
-    constexpr virtual word_t read_word(FAR addr) noexcept override {
-        auto const lo = data[addr.ea()];
-        auto const hi = data[(addr + 1).ea()];
-        return static_cast<word_t>(lo | (hi << 8));
+    if (child->mem.read_byte(0x1001) != 0) {
+        printf("Bad (ram): child sees the parent's write\n");
     }
-    constexpr virtual void write_word(FAR addr, word_t val) noexcept override {
-        data[addr.ea()] = static_cast<byte_t>(val);
-        data[(addr + 1).ea()] = static_cast<byte_t>(val >> 8);
+
+    // The first write to the BIOS copies its page, the mapping and the other instance keep the image
+    auto const image = ROM::open(path);
+    child->mem.write_byte(0xF0010, 0xAA);
+    if (child->mem.read_byte(0xF0010) != 0xAA || parent->mem.read_byte(0xF0010) != bios[0x10]) {
+        printf("Bad (rom cow): parent %02X child %02X\n", parent->mem.read_byte(0xF0010), child->mem.read_byte(0xF0010));
     }
+    auto const copied = child->mem.page_read(0xF0000);
+    for (dword_t i = 0; i != MEM::PAGE_SIZE; ++i) {
+        if (i != 0x10 && copied[i] != bios[i]) {
+            printf("Bad (rom cow %u): %02X should be %02X\n", i, copied[i], bios[i]);
+        }
+    }
+    if (copied.data() == image->bytes().data() || parent->mem.page_read(0xF0000).data() != image->bytes().data()) {
+        printf("Bad (rom cow): page mapping\n");
+    }
+    if (image->bytes()[0x10] != bios[0x10]) {
+        printf("Bad (rom cow): image written\n");
+    }
+
+    // Each consumer sees every write since its own last collect
+    auto map = std::vector<std::uint64_t>{};
+    auto const first = parent->mem.dirty_attach();
+    auto const second = parent->mem.dirty_attach();
+    parent->mem.dirty_collect(first, map);
+    parent->mem.dirty_collect(second, map);
+    auto const dirty = [&](std::size_t consumer) {
+        parent->mem.dirty_collect(consumer, map);
+        auto result = std::vector<dword_t>{};
+        for (dword_t page = 0; page != MEM::PAGES; ++page) {
+            if (map[page / 64] >> (page % 64) & 1) {
+                result.push_back(page);
+            }
+        }
+        return result;
+    };
+    parent->mem.write_byte(0x3000, 1);
+    if (dirty(first) != std::vector<dword_t>{ 3 }) {
+        printf("Bad (dirty): first consumer after one write\n");
+    }
+    parent->mem.write_byte(0x5000, 1);
+    if (dirty(second) != std::vector<dword_t>{ 3, 5 }) {
+        printf("Bad (dirty): second consumer after both writes\n");
+    }
+    if (dirty(first) != std::vector<dword_t>{ 5 }) {
+        printf("Bad (dirty): first consumer after the second write\n");
+    }
+    if (!dirty(second).empty()) {
+        printf("Bad (dirty): second consumer collected twice\n");
+    }
+    parent->mem.dirty_detach(second);
+    parent->mem.dirty_detach(first);
+}
+
+void test_snapshot() {
+    printf("Testing snapshot:\n");
+    auto bios = std::vector<byte_t>(0x10000);
+    auto option = std::vector<byte_t>(MEM::PAGE_SIZE);
+    for (std::size_t i = 0; i != bios.size(); ++i) {
+        bios[i] = static_cast<byte_t>(i * 5 + 1);
+    }
+    for (std::size_t i = 0; i != option.size(); ++i) {
+        option[i] = static_cast<byte_t>(i ^ 0x5A);
+    }
+    auto const bios_path = test_file("snapshot_bios.bin", bios);
+    auto const option_path = test_file("snapshot_option.bin", option);
+    auto const configure = [&](PC& pc) {
+        pc.mem.load_bios(bios_path.string());
+        pc.mem.map_rom(0xC8000, ROM::open(option_path), false);
+    };
+    auto const key = SNAPSHOT::key(bios, "test");
+    auto const path = std::filesystem::temp_directory_path() / "o126_test.snap";
+
+    auto saved = std::make_unique<PC>();
+    configure(*saved);
+    saved->cpu.reg_set(CPU::REG::AX, 0x1234);
+    saved->cpu.reg_set(CPU::REG::SP, 0xFFFE);
+    for (dword_t i = 0; i != MEM::PAGE_SIZE; ++i) {
+        saved->mem.write_byte(0x2000 + i, static_cast<byte_t>(i + 9));
+    }
+    saved->mem.write_byte(0xF2000, 0x77);
+    SNAPSHOT::save(*saved, path, key);
 
-    constexpr virtual byte_t in_byte(word_t port) noexcept override {
-        (void)port;
-        return {};
+    // Only the written RAM and BIOS pages are stored, the rest of the BIOS comes from the configuration
+    auto stored = dword_t{};
+    std::ifstream(path, std::ios::binary).seekg(12).read(reinterpret_cast<char*>(&stored), sizeof(stored));
+    if (stored != 2) {
+        printf("Bad (pages): %u stored\n", stored);
     }
-    constexpr virtual void out_byte(word_t port, byte_t val) noexcept override {
-        (void)port;
-        (void)val;
+
+    // Everything the snapshot holds is overwritten first, the page at 4000h is zero when saved
+    auto restored = std::make_unique<PC>();
+    configure(*restored);
+    restored->cpu.reg_set(CPU::REG::AX, 0x5678);
+    restored->mem.write_byte(0x2000, 0xFF);
+    restored->mem.write_byte(0x4000, 0xFF);
+    restored->mem.write_byte(0xF3000, 0xFF);
+    SNAPSHOT::restore(*restored, path, key);
+
+    auto lhs = STATE::Writer{};
+    auto rhs = STATE::Writer{};
+    saved->serialize_board(lhs);
+    restored->serialize_board(rhs);
+    if (lhs.data != rhs.data) {
+        printf("Bad (board): state differs after restore\n");
+    }
+    for (dword_t page = 0; page != MEM::PAGES; ++page) {
+        auto const expected = saved->mem.page_read(page << MEM::PAGE_BITS);
+        auto const actual = restored->mem.page_read(page << MEM::PAGE_BITS);
+        if (!std::equal(actual.begin(), actual.end(), expected.begin())) {
+            printf("Bad (page %05X): differs after restore\n", page << MEM::PAGE_BITS);
+        }
     }
-    constexpr virtual word_t in_word(word_t port) noexcept override {
-        (void)port;
-        return {};
+    if (!restored->mem.page_rom(0xC8000 >> MEM::PAGE_BITS)) {
+        printf("Bad (rom): option ROM no longer mapped\n");
     }
-    constexpr virtual void out_word(word_t port, word_t val) noexcept override {
-        (void)port;
-        (void)val;
+    if (!restored->mem.page_rom(0xF3000 >> MEM::PAGE_BITS) || restored->mem.page_rom(0xF2000 >> MEM::PAGE_BITS)) {
+        printf("Bad (rom): BIOS pages not mapped as saved\n");
     }
+    std::filesystem::remove(path);
+
+    // A section from a newer build is refused rather than misread
+    lhs.data[4] += 1;
+    auto reader = STATE::Reader{ lhs.data };
+    try {
+        restored->serialize_board(reader);
+        printf("Bad (version): unknown section version accepted\n");
+    } catch (char const* e) {
+        if (std::string(e) != "Unsupported state section version!") {
+            printf("Bad (version): %s\n", e);
+        }
+    }
+}
+
+// Sets up the timer interupt, then reads the PIT counter and calls a host hook on INT 60h in a loop, runs at 0040:0000
+constexpr byte_t replay_program[] = {
+    0xFA, 0x31, 0xC0, 0x8E, 0xD8, 0x8E, 0xD0, 0xBC, 0x00, 0x70, // cli, ds = ss = 0, sp = 7000h
+    0xC7, 0x06, 0x20, 0x00, 0x3F, 0x00, 0x8C, 0x0E, 0x22, 0x00, // IRQ 0 vector
+    0xB0, 0x13, 0xE6, 0x20, 0xB0, 0x08, 0xE6, 0x21, 0xB0, 0x01, 0xE6, 0x21, 0xB0, 0xFE, 0xE6, 0x21, // PIC
+    0xB0, 0x34, 0xE6, 0x43, 0xB0, 0x00, 0xE6, 0x40, 0xB0, 0x02, 0xE6, 0x40, // PIT count 200h
+    0xFB, // sti
+    0xE4, 0x40, 0x00, 0x06, 0x00, 0x06, // in al, 40h; add [600h], al
+    0xCD, 0x60, 0x01, 0x06, 0x02, 0x06, // int 60h; add [602h], ax
+    0xEB, 0xF2,
+    0xFF, 0x06, 0x00, 0x05, 0x50, 0xB0, 0x20, 0xE6, 0x20, 0x58, 0xCF, // inc word [500h], EOI, iret
 };
 
-void test_inst(std::string name) {
-    printf("Testing %s:\n", name.c_str());
-    auto mem = MEM();
-    mem.load_bios("80186_tests/"+name+".bin");
-    auto cpu = CPU{};
-    for (;;) {
-        auto const result = cpu.exec(mem);
-        if (result == CPU::Result::HALT) {
-            break;
+void test_replay() {
+    printf("Testing replay:\n");
+    auto start = std::make_unique<PC>();
+    start->mem.copy_in(0x400, replay_program);
+    start->cpu.seg_set(CPU::SEG::CS, 0x0040);
+    start->cpu.reg_set(CPU::REG::IP, 0x0000);
+    // Something from outside the machine, a second run of the hook gives other answers
+    auto const hook = [](PC& pc, word_t& calls) {
+        pc.hle.hook_vector(0x60, [&pc, &calls](CPU& cpu, BUS&) {
+            calls += 1;
+            cpu.reg_set(CPU::REG::AX, calls);
+            pc.mem.write_byte(0x700 + (calls & 0xFF), static_cast<byte_t>(calls));
+            return true;
+        }, true);
+    };
+
+    auto recorded = start->fork();
+    auto recorded_calls = word_t{};
+    hook(*recorded, recorded_calls);
+    auto recording = REPLAY(nullptr, recorded->retired);
+    auto const mark = recording.mark();
+    recorded->replay = &recording;
+    for (auto i = 0; i != 20000; ++i) {
+        (void)recorded->step();
+    }
+    recorded->replay = nullptr;
+
+    auto played = start->fork();
+    auto played_calls = word_t{1000};
+    hook(*played, played_calls);
+    auto playback = REPLAY(recording, mark);
+    played->replay = &playback;
+    while (played->retired < recorded->retired && !playback.diverged) {
+        (void)played->step();
+    }
+    played->replay = nullptr;
+
+    if (playback.diverged) {
+        printf("Bad (diverged): at %llu of %llu\n", static_cast<unsigned long long>(played->retired),
+            static_cast<unsigned long long>(recorded->retired));
+    }
+    if (recorded_calls == 0 || recorded->mem.read_byte(0x500) == 0 || played_calls != 1000) {
+        printf("Bad (inputs): %u hook calls, %u interupts, hook ran %u times on playback\n", recorded_calls,
+            recorded->mem.read_byte(0x500), played_calls - 1000);
+    }
+    auto lhs = STATE::Writer{};
+    auto rhs = STATE::Writer{};
+    recorded->serialize_board(lhs);
+    played->serialize_board(rhs);
+    if (lhs.data != rhs.data) {
+        printf("Bad (board): state differs after playback\n");
+    }
+    for (dword_t page = 0; page != MEM::PAGES; ++page) {
+        auto const expected = recorded->mem.page_read(page << MEM::PAGE_BITS);
+        auto const actual = played->mem.page_read(page << MEM::PAGE_BITS);
+        if (!std::equal(actual.begin(), actual.end(), expected.begin())) {
+            printf("Bad (page %05X): differs after playback\n", page << MEM::PAGE_BITS);
         }
     }
+}
 
-    std::ifstream file("80186_tests/res_"+name+".bin", std::ios::binary);
-    if (!file) {
-        throw "Failed to open verification file!";
+void test_dma() {
+    printf("Testing dma:\n");
+    auto mem = std::make_unique<MEM>();
+    auto sched = SCHED{};
+    auto dma = DMA{};
+    // Channel 2, page register 81h, address on port 4 and count on port 5
+    auto const program = [&](byte_t mode, byte_t page, word_t addr, word_t count) {
+        dma.out_byte(0x0A, 0x06);
+        dma.out_byte(0x0C, 0);
+        dma.out_byte(0x0B, static_cast<byte_t>(mode | 2));
+        dma.out_byte(0x81, page);
+        dma.out_byte(0x04, static_cast<byte_t>(addr));
+        dma.out_byte(0x04, static_cast<byte_t>(addr >> 8));
+        dma.out_byte(0x05, static_cast<byte_t>(count));
+        dma.out_byte(0x05, static_cast<byte_t>(count >> 8));
+        dma.out_byte(0x0A, 0x02);
+    };
+    auto const expect = [&](char const* name, std::initializer_list<std::pair<dword_t, byte_t>> bytes) {
+        for (auto const& [ea, val] : bytes) {
+            if (mem->read_byte(ea) != val) {
+                printf("Bad (%s): %05X is %02X should be %02X\n", name, ea, mem->read_byte(ea), val);
+            }
+        }
+    };
+    auto const data = std::array<byte_t, 4>{ 1, 2, 3, 4 };
+    constexpr byte_t WRITE = 0x44; // single mode, device to memory
+    constexpr byte_t READ = 0x48; // single mode, memory to device
+    constexpr byte_t AUTOINIT = 0x10;
+    constexpr byte_t DECREMENT = 0x20;
+
+    // The address counter wraps within its 64K page, the page register does not carry
+    program(WRITE, 0x01, 0xFFFE, 3);
+    if (dma.write(*mem, sched, 2, data) != 4) {
+        printf("Bad (wrap): transfer size\n");
+    }
+    expect("wrap", { { 0x1FFFE, 1 }, { 0x1FFFF, 2 }, { 0x10000, 3 }, { 0x10001, 4 }, { 0x20000, 0 } });
+    if (!dma.terminal_count(2) || !dma.masked(2)) {
+        printf("Bad (wrap): terminal count should mask the channel\n");
     }
-    byte_t c = 0;
-    for (word_t i = 0; file.read(reinterpret_cast<char*>(&c), 1); i += 1) {
-        byte_t c2 = mem.data[i];
-        if (c2 != c) {
-            printf("Bad (%d): %02X should be %02X\n", i, c2, c);
+
+    program(WRITE | DECREMENT, 0x03, 0x0001, 3);
+    (void)dma.write(*mem, sched, 2, data);
+    expect("decrement", { { 0x30001, 1 }, { 0x30000, 2 }, { 0x3FFFF, 3 }, { 0x3FFFE, 4 }, { 0x2FFFF, 0 } });
+
+    // Terminal count stops a longer transfer and shows in the status register until it is read
+    program(WRITE, 0x04, 0x0000, 1);
+    if (dma.write(*mem, sched, 2, data) != 2 || (dma.in_byte(0x08) & 0x04) == 0 || dma.terminal_count(2)) {
+        printf("Bad (terminal count): status\n");
+    }
+    expect("terminal count", { { 0x40000, 1 }, { 0x40001, 2 }, { 0x40002, 0 } });
+    program(WRITE, 0x04, 0x0100, 3);
+    if (dma.write(*mem, sched, 2, std::span(data).first(2)) != 2 || dma.terminal_count(2) || dma.masked(2)) {
+        printf("Bad (terminal count): reached early\n");
+    }
+
+    // Autoinit reloads the address and count and keeps the channel unmasked
+    program(WRITE | AUTOINIT, 0x05, 0x0010, 1);
+    (void)dma.write(*mem, sched, 2, std::span(data).first(2));
+    if (!dma.terminal_count(2) || dma.masked(2)) {
+        printf("Bad (autoinit): status after the first block\n");
+    }
+    (void)dma.write(*mem, sched, 2, std::span(data).last(2));
+    expect("autoinit", { { 0x50010, 3 }, { 0x50011, 4 }, { 0x50012, 0 } });
+    // Low byte first, after clearing the flip-flop
+    auto const counter = [&](word_t port) {
+        auto const lo = dma.in_byte(port);
+        return word_pack(lo, dma.in_byte(port));
+    };
+    dma.out_byte(0x0C, 0);
+    auto const addr = counter(0x04);
+    auto const count = counter(0x05);
+    if (addr != 0x0010 || count != 1) {
+        printf("Bad (autoinit): reloaded %04X %04X\n", addr, count);
+    }
+
+    // Memory to device gives back what the first two writes left, in the order they were written
+    auto out = std::array<byte_t, 4>{};
+    program(READ, 0x01, 0xFFFE, 3);
+    if (dma.read(*mem, sched, 2, out) != 4 || out != data) {
+        printf("Bad (read): %02X %02X %02X %02X\n", out[0], out[1], out[2], out[3]);
+    }
+    program(READ | DECREMENT, 0x03, 0x0001, 3);
+    if (dma.read(*mem, sched, 2, out) != 4 || out != data) {
+        printf("Bad (read decrement): %02X %02X %02X %02X\n", out[0], out[1], out[2], out[3]);
+    }
+}
+
+void test_fdc() {
+    printf("Testing fdc:\n");
+    // 360K, every byte tells its sector
+    auto image = std::vector<byte_t>(360 * 1024);
+    for (std::size_t i = 0; i != image.size(); ++i) {
+        image[i] = static_cast<byte_t>(i / DISK::SECTOR_SIZE * 3 + i % 7);
+    }
+    auto const path = test_file("fdc.img", image);
+    auto pc = std::make_unique<PC>();
+    pc->drives[0].open(path.string(), false);
+    pc->out_byte(0x3F2, 0x1C);
+    auto const program = [&](byte_t mode, byte_t page, word_t count) {
+        for (auto const& [port, val] : std::initializer_list<std::pair<word_t, byte_t>>{
+                 { 0x0A, 0x06 }, { 0x0C, 0 }, { 0x0B, mode }, { 0x81, page }, { 0x04, 0 }, { 0x04, 0 },
+                 { 0x05, static_cast<byte_t>(count) }, { 0x05, static_cast<byte_t>(count >> 8) }, { 0x0A, 0x02 } }) {
+            pc->out_byte(port, val);
+        }
+    };
+    // Command and C, H, R, N, EOT, gap and data length, then the seven result bytes
+    auto const run = [&](byte_t op, byte_t cylinder, byte_t sector) {
+        for (auto const val : { op, byte_t{0}, cylinder, byte_t{0}, sector, byte_t{2}, byte_t{9}, byte_t{0x2A}, byte_t{0xFF} }) {
+            pc->out_byte(0x3F5, val);
+        }
+        auto result = std::array<byte_t, 7>{};
+        for (auto& val : result) {
+            val = pc->in_byte(0x3F5);
+        }
+        return result;
+    };
+    auto const sector = [&](dword_t lba) {
+        return std::span(image).subspan(lba * DISK::SECTOR_SIZE, DISK::SECTOR_SIZE);
+    };
+
+    // Read data ends at terminal count after two sectors, the result points at the next one
+    program(0x46, 0x02, 2 * DISK::SECTOR_SIZE - 1);
+    auto result = run(0x46, 1, 3);
+    if ((result[0] & 0xC0) != 0 || result[3] != 1 || result[5] != 5) {
+        printf("Bad (read): ST0 %02X C %u R %u\n", result[0], result[3], result[5]);
+    }
+    auto const read = pc->mem.page_read(0x20000).first(2 * DISK::SECTOR_SIZE);
+    if (!std::equal(read.begin(), read.begin() + DISK::SECTOR_SIZE, sector(20).begin())
+        || !std::equal(read.begin() + DISK::SECTOR_SIZE, read.end(), sector(21).begin())) {
+        printf("Bad (read): memory does not hold sectors 20 and 21\n");
+    }
+    if (pc->mem.read_byte(0x20400) != 0) {
+        printf("Bad (read): ran past terminal count\n");
+    }
+
+    // Read ID finds the head where the last seek left it, reading cylinder 1 does not move it
+    auto const read_id = [&] {
+        pc->out_byte(0x3F5, 0x4A);
+        pc->out_byte(0x3F5, 0x00);
+        auto result = std::array<byte_t, 7>{};
+        for (auto& val : result) {
+            val = pc->in_byte(0x3F5);
+        }
+        return result;
+    };
+    result = read_id();
+    if ((result[0] & 0xC0) != 0 || result[3] != 0 || result[5] < 1 || result[5] > 9 || result[6] != 2) {
+        printf("Bad (read ID): ST0 %02X C %u R %u N %u\n", result[0], result[3], result[5], result[6]);
+    }
+    for (auto const val : { byte_t{0x0F}, byte_t{0}, byte_t{7}, byte_t{0x08} }) {
+        pc->out_byte(0x3F5, val);
+    }
+    (void)pc->in_byte(0x3F5);
+    (void)pc->in_byte(0x3F5);
+    result = read_id();
+    if ((result[0] & 0xC0) != 0 || result[3] != 7) {
+        printf("Bad (read ID): after seek ST0 %02X C %u\n", result[0], result[3]);
+    }
+
+    // Write data takes one sector from memory and leaves the next one alone
+    for (dword_t i = 0; i != DISK::SECTOR_SIZE; ++i) {
+        pc->mem.write_byte(0x30000 + i, 0xA5);
+    }
+    program(0x4A, 0x03, DISK::SECTOR_SIZE - 1);
+    result = run(0x45, 2, 1);
+    if ((result[0] & 0xC0) != 0 || result[5] != 2) {
+        printf("Bad (write): ST0 %02X R %u\n", result[0], result[5]);
+    }
+    auto const written = pc->drives[0].run(36, 2);
+    if (!std::all_of(written.begin(), written.begin() + DISK::SECTOR_SIZE, [](byte_t val) { return val == 0xA5; })
+        || !std::equal(written.begin() + DISK::SECTOR_SIZE, written.end(), sector(37).begin())) {
+        printf("Bad (write): disk does not hold the written sector\n");
+    }
+}
+
+void test_dos() {
+    printf("Testing dos:\n");
+    // Three paragraph header with two relocations, the second one in the paragraph after the image start
+    auto exe = std::vector<byte_t>(0x30 + 0x40);
+    auto const set = [&](std::size_t offset, word_t val) {
+        exe[offset] = static_cast<byte_t>(val);
+        exe[offset + 1] = static_cast<byte_t>(val >> 8);
+    };
+    exe[0] = 'M';
+    exe[1] = 'Z';
+    set(0x02, static_cast<word_t>(exe.size()));
+    set(0x04, 1);
+    set(0x06, 2);
+    set(0x08, 3);
+    set(0x0A, 0x10);
+    set(0x0C, 0xFFFF);
+    set(0x0E, 0x0002); // SS
+    set(0x10, 0x0100); // SP
+    set(0x14, 0x0004); // IP
+    set(0x16, 0x0001); // CS
+    set(0x18, 0x1C);
+    set(0x1C, 0x0000);
+    set(0x1E, 0x0000);
+    set(0x20, 0x0002);
+    set(0x22, 0x0001);
+    set(0x30 + 0x00, 0x0000);
+    set(0x30 + 0x12, 0x0003);
+    set(0x30 + 0x20, 0x1234);
+    // Past the end the header gives, not part of the image
+    exe.insert(exe.end(), 16, 0xEE);
+    auto const dir = test_file("dos/TEST.EXE", exe).parent_path();
+
+    auto pc = std::make_unique<PC>();
+    auto dos = DOS(*pc, dir);
+    dos.exec("TEST.EXE", "ARG");
+    auto const psp = dos.psp;
+    auto const start = static_cast<word_t>(psp + 0x10);
+    auto const word = [&](FAR addr) {
+        return pc->read_word(addr);
+    };
+    auto const check = [&](char const* name, word_t actual, word_t expected) {
+        if (actual != expected) {
+            printf("Bad (%s): %04X should be %04X\n", name, actual, expected);
+        }
+    };
+    check("relocation", word({ 0x0000, start }), start);
+    check("relocation", word({ 0x0012, start }), static_cast<word_t>(start + 3));
+    check("image", word({ 0x0020, start }), 0x1234);
+    check("image end", pc->mem.read_byte(FAR(0x0040, start).ea()), 0);
+    check("CS", pc->cpu.seg_get(CPU::SEG::CS), static_cast<word_t>(start + 1));
+    check("IP", pc->cpu.reg_get(CPU::REG::IP), 0x0004);
+    check("SS", pc->cpu.seg_get(CPU::SEG::SS), static_cast<word_t>(start + 2));
+    check("SP", pc->cpu.reg_get(CPU::REG::SP), 0x0100);
+    check("DS", pc->cpu.seg_get(CPU::SEG::DS), psp);
+    check("ES", pc->cpu.seg_get(CPU::SEG::ES), psp);
+
+    // PSP with INT 20h at its start, the command tail and an environment ending in the program path
+    check("INT 20h", word({ 0x0000, psp }), 0x20CD);
+    if (word({ 0x0002, psp }) <= start) {
+        printf("Bad (PSP): memory top %04X\n", word({ 0x0002, psp }));
+    }
+    auto const text = [&](FAR addr, std::size_t size) {
+        auto result = std::string{};
+        for (auto i = std::size_t{}; i != size; ++i) {
+            result += static_cast<char>(pc->mem.read_byte((addr + static_cast<sword_t>(i)).ea()));
         }
+        return result;
+    };
+    if (text({ 0x80, psp }, 6) != std::string("\x04 ARG\r")) {
+        printf("Bad (PSP): command tail\n");
+    }
+    auto const env = word({ 0x2C, psp });
+    auto const strings = text({ 0, env }, 0x80);
+    auto const end = strings.find(std::string("\0\0", 2));
+    if (!strings.starts_with("COMSPEC=") || end == std::string::npos
+        || strings.compare(end + 2, 14, std::string("\x01\0C:\\TEST.EXE\0", 14)) != 0) {
+        printf("Bad (environment): %s\n", strings.c_str());
     }
 }
 
@@ -108,5 +684,13 @@ int main() {
 
 //    test_inst("datatrnf"); // broken test ??
 
+    test_fpu();
+    test_fork();
+    test_snapshot();
+    test_replay();
+    test_dma();
+    test_fdc();
+    test_dos();
+
     return 0;
 }
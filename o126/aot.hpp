@@ -0,0 +1,93 @@
+#ifndef O126_AOT_HPP
+#define O126_AOT_HPP
+#include "common.hpp"
+#include "bus.hpp"
+#include "cpu.hpp"
+#include "mem.hpp"
+#include "rom.hpp"
+#include <array>
+#include <memory>
+#include <span>
+
+// Guest code translated ahead of time by o126-aot, a block runs only while its page still maps the image it came from
+struct o126::AOT final {
+    // Straight-line run of instructions inside one page, the last one may branch
+    struct Block final {
+        dword_t ea = {};
+        word_t count = {};
+        CPU::Result (*run)(CPU& cpu, BUS& bus) noexcept = {};
+    };
+
+    // Everything the tool emits for one image
+    struct Module final {
+        CPU::Model model = {};
+        dword_t base = {};
+        dword_t size = {};
+        std::uint64_t hash = {};
+        std::span<Block const> blocks = {};
+    };
+
+    CPU::Model const model;
+private:
+    using Entries = std::array<Block const*, MEM::PAGE_SIZE>;
+
+    MEM const& mem;
+    std::shared_ptr<ROM::Image const> image;
+    // Where each page has to read from for its blocks to be valid
+    std::array<byte_t const*, MEM::PAGES> pages = {};
+    std::array<std::unique_ptr<Entries>, MEM::PAGES> entries = {};
+public:
+    // FNV-1a, only used to tie a module to the image it was generated from
+    [[nodiscard]] static constexpr std::uint64_t hash(std::span<byte_t const> bytes) noexcept {
+        auto result = std::uint64_t{0xCBF2'9CE4'8422'2325};
+        for (auto const byte : bytes) {
+            result = (result ^ byte) * 0x100'0000'01B3;
+        }
+        return result;
+    }
+
+    AOT(MEM const& mem, Module const& module, std::shared_ptr<ROM::Image const> image)
+        : model(module.model), mem(mem), image(std::move(image)) {
+        auto const bytes = this->image->bytes();
+        if (bytes.size() != module.size || hash(bytes) != module.hash) {
+            throw "AOT module does not match the image!";
+        }
+        for (auto const& block : module.blocks) {
+            auto const page = block.ea >> MEM::PAGE_BITS;
+            auto const first = page << MEM::PAGE_BITS;
+            // Pages only partly covered by the image are copied into RAM, so they never match
+            if (first < module.base || first + MEM::PAGE_SIZE > module.base + module.size) {
+                continue;
+            }
+            if (!entries[page]) {
+                entries[page] = std::make_unique<Entries>();
+                pages[page] = bytes.data() + (first - module.base);
+            }
+            (*entries[page])[block.ea & MEM::PAGE_MASK] = &block;
+        }
+    }
+
+    AOT(AOT const&) = delete;
+    AOT& operator=(AOT const&) = delete;
+
+    [[nodiscard]] Block const* find(dword_t ea) const noexcept {
+        auto const page = ea >> MEM::PAGE_BITS;
+        if (!entries[page]) {
+            return nullptr;
+        }
+        auto const block = (*entries[page])[ea & MEM::PAGE_MASK];
+        if (!block || mem.page_read(ea).data() - (ea & MEM::PAGE_MASK) != pages[page]) {
+            return nullptr;
+        }
+        return block;
+    }
+
+    // One instruction with its prefixes, false once execution left the straight line
+    template <CPU::Model MODEL, byte_t... OPS>
+    [[nodiscard]] static bool step(CPU& cpu, BUS& bus, word_t next, CPU::Result& result) noexcept {
+        ((result = cpu.exec_op<MODEL, OPS>(bus)), ...);
+        return result == CPU::Result::DONE && cpu.reg_get(CPU::REG::IP) == next;
+    }
+};
+
+#endif // O126_AOT_HPP
@@ -0,0 +1,194 @@
+#ifndef O126_BIOS_HPP
+#define O126_BIOS_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "disk.hpp"
+#include "hle.hpp"
+#include "pc.hpp"
+
+// BIOS services implemented on the host, each one reads its arguments from and returns results in the guest registers
+struct o126::BIOS {
+private:
+    using REG = CPU::REG;
+    using SEG = CPU::SEG;
+
+    // Last status bytes in the BIOS data area
+    static constexpr dword_t FLOPPY_STATUS = 0x441;
+    static constexpr dword_t DISK_STATUS = 0x474;
+    static constexpr dword_t DISK_COUNT = 0x475;
+
+    static constexpr void set_carry(PC& pc, bool carry) noexcept {
+        auto flags = pc.cpu.flags_get();
+        flags.carry = carry;
+        pc.cpu.flags_set(flags);
+    }
+
+    // Floppies are 00h-01h and hard disks 80h-81h, the drive table holds them in that order
+    [[nodiscard]] static DISK* drive(PC& pc, byte_t dl) noexcept {
+        auto const index = std::size_t{dl & 0x80 ? 2u + (dl & 0x7F) : dl};
+        if (index >= std::size(pc.drives) || (dl & 0x7F) > 1) {
+            return nullptr;
+        }
+        return &pc.drives[index];
+    }
+
+    [[nodiscard]] static byte_t count(PC& pc, bool hard) noexcept {
+        auto const first = hard ? 2 : 0;
+        return static_cast<byte_t>(pc.drives[first].present() + pc.drives[first + 1].present());
+    }
+
+    static void status(PC& pc, byte_t dl, byte_t code) noexcept {
+        pc.mem.write_byte(dl & 0x80 ? DISK_STATUS : FLOPPY_STATUS, code);
+        pc.cpu.reg8_set(REG::AH, code);
+        set_carry(pc, code != 0);
+    }
+
+    // Cylinder in CH and the top two bits of CL, sector in the low six bits of CL, head in DH
+    [[nodiscard]] static dword_t lba(PC& pc, DISK const& disk) noexcept {
+        auto const cx = pc.cpu.reg_get(REG::CX);
+        auto const cylinder = static_cast<word_t>((cx >> 8) | ((cx & 0xC0) << 2));
+        auto const sector = static_cast<byte_t>(cx & 0x3F);
+        return disk.lba(cylinder, pc.cpu.reg8_get(REG::DH), sector);
+    }
+
+    [[nodiscard]] static byte_t floppy_type(DISK const& disk) noexcept {
+        switch (disk.chs().sectors) {
+        case 15:
+            return 2; // 1.2M
+        case 18:
+            return 4; // 1.44M
+        case 36:
+            return 6; // 2.88M
+        default:
+            return disk.chs().cylinders > 40 ? 3 : 1; // 720K or 360K
+        }
+    }
+public:
+    /// INT 13h disk services, sector data moves between the image and guest memory in bulk
+    static void int13(PC& pc) {
+        auto& cpu = pc.cpu;
+        auto const function = cpu.reg8_get(REG::AH);
+        auto const dl = cpu.reg8_get(REG::DL);
+        auto* const disk = drive(pc, dl);
+        if (function == 0x01) {
+            auto const last = pc.mem.read_byte(dl & 0x80 ? DISK_STATUS : FLOPPY_STATUS);
+            cpu.reg8_set(REG::AL, last);
+            status(pc, dl, last);
+            return;
+        }
+        if (function == 0x08 && !(dl & 0x80)) {
+            // Floppy parameters are reported for any valid unit so the caller learns the drive count
+            auto const present = disk && disk->present();
+            auto const& chs = present ? disk->chs() : DISK::Geometry{};
+            auto const max_cylinder = static_cast<word_t>(present ? chs.cylinders - 1 : 0);
+            cpu.reg_set(REG::AX, 0);
+            cpu.reg8_set(REG::BL, present ? floppy_type(*disk) : 0);
+            cpu.reg8_set(REG::CH, static_cast<byte_t>(max_cylinder));
+            cpu.reg8_set(REG::CL, static_cast<byte_t>((present ? chs.sectors : 0) | ((max_cylinder >> 2) & 0xC0)));
+            cpu.reg8_set(REG::DH, static_cast<byte_t>(present ? chs.heads - 1 : 0));
+            cpu.reg8_set(REG::DL, count(pc, false));
+            // Diskette parameter table from the INT 1Eh vector
+            cpu.reg_set(REG::DI, word_pack(pc.mem.read_byte(0x78), pc.mem.read_byte(0x79)));
+            cpu.seg_set(SEG::ES, word_pack(pc.mem.read_byte(0x7A), pc.mem.read_byte(0x7B)));
+            status(pc, dl, 0x00);
+            return;
+        }
+        if (function == 0x15) {
+            auto const present = disk && disk->present();
+            auto const type = static_cast<byte_t>(!present ? 0x00 : disk->hard_disk() ? 0x03 : 0x01);
+            if (type == 0x03) {
+                auto const sectors = disk->sectors();
+                cpu.reg_set(REG::CX, static_cast<word_t>(sectors >> 16));
+                cpu.reg_set(REG::DX, static_cast<word_t>(sectors));
+            }
+            set_carry(pc, false);
+            cpu.reg8_set(REG::AH, type);
+            return;
+        }
+        if (!disk || !disk->present()) {
+            status(pc, dl, dl & 0x80 ? 0x01 : 0x80); // invalid drive or floppy timeout
+            return;
+        }
+
+        auto const sectors = cpu.reg8_get(REG::AL);
+        auto const ea = FAR { cpu.reg_get(REG::BX), cpu.seg_get(SEG::ES) }.ea();
+        switch (function) {
+        case 0x00: // reset
+        case 0x0D: // alternate reset
+        case 0x10: // test ready
+        case 0x11: // recalibrate
+        case 0x16: // change line, images never change underneath the guest
+            status(pc, dl, 0x00);
+            break;
+        case 0x02: // read
+        case 0x03: // write
+        case 0x04: { // verify
+            auto const start = lba(pc, *disk);
+            if (start == disk->sectors() || sectors == 0) {
+                cpu.reg8_set(REG::AL, 0);
+                status(pc, dl, 0x04);
+                break;
+            }
+            auto const done = std::min<dword_t>(sectors, disk->sectors() - start);
+            auto ok = true;
+            if (function == 0x02) {
+                ok = disk->read(start, done, pc.mem, ea);
+            } else if (function == 0x03) {
+                ok = disk->write(start, done, pc.mem, ea);
+            }
+            cpu.reg8_set(REG::AL, static_cast<byte_t>(ok ? done : 0));
+            status(pc, dl, ok && done == sectors ? 0x00 : 0x04);
+            break;
+        }
+        case 0x05: { // format track, every sector of the track is filled with F6h
+            auto const& chs = disk->chs();
+            auto const cx = cpu.reg_get(REG::CX);
+            auto const cylinder = static_cast<word_t>((cx >> 8) | ((cx & 0xC0) << 2));
+            auto const start = disk->lba(cylinder, cpu.reg8_get(REG::DH), 1);
+            if (start == disk->sectors()) {
+                status(pc, dl, 0x04);
+                break;
+            }
+            auto const fill = std::vector<byte_t>(std::size_t{chs.sectors} * DISK::SECTOR_SIZE, 0xF6);
+            (void)disk->write(start, fill);
+            status(pc, dl, 0x00);
+            break;
+        }
+        case 0x08: { // hard disk parameters, the last cylinder is kept for diagnostics
+            auto const& chs = disk->chs();
+            auto const max_cylinder = static_cast<word_t>(chs.cylinders >= 2 ? chs.cylinders - 2 : 0);
+            cpu.reg8_set(REG::AL, 0);
+            cpu.reg8_set(REG::CH, static_cast<byte_t>(max_cylinder));
+            cpu.reg8_set(REG::CL, static_cast<byte_t>(chs.sectors | ((max_cylinder >> 2) & 0xC0)));
+            cpu.reg8_set(REG::DH, static_cast<byte_t>(chs.heads - 1));
+            cpu.reg8_set(REG::DL, count(pc, true));
+            status(pc, dl, 0x00);
+            break;
+        }
+        case 0x0C: { // seek
+            auto const start = lba(pc, *disk);
+            status(pc, dl, start == disk->sectors() ? 0x40 : 0x00);
+            break;
+        }
+        default:
+            status(pc, dl, 0x01);
+            break;
+        }
+    }
+
+    // Keeps the hard disk count in the data area in sync with the attached images
+    static void int13_init(PC& pc) noexcept {
+        pc.mem.write_byte(DISK_COUNT, count(pc, true));
+    }
+
+    /// Replaces the guest firmware routines with the native ones above
+    static void install(PC& pc) {
+        int13_init(pc);
+        pc.hle.hook_vector(0x13, [&pc](CPU&, BUS&) {
+            int13(pc);
+            return true;
+        });
+    }
+};
+
+#endif // O126_BIOS_HPP
@@ -0,0 +1,269 @@
+#ifndef O126_BISECT_HPP
+#define O126_BISECT_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "disasm.hpp"
+#include "mem.hpp"
+#include "merkle.hpp"
+#include "pc.hpp"
+#include "state.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// First instruction after which two machines stop agreeing, for telling apart configurations that should behave the same
+// Hashes are compared every interval instructions and a mismatching interval is searched by rerunning both sides from
+// forks of the last matching point, so neither machine may be recording or playing back a replay log meanwhile
+// Both machines in one process share the same compiled IMPL::EXE, so side by side they can only differ in what the
+// serialized state leaves out, such as translated modules, HLE hooks and host devices; a change to IMPL::EXE itself is
+// checked by saving a hash stream with record() in one build and running compare() against it in the other
+struct o126::BISECT final {
+    static constexpr std::uint64_t NEVER = ~std::uint64_t{};
+    static constexpr std::size_t BYTES_SHOWN = 16;
+
+    struct Report final {
+        bool diverged = {};
+        // Instructions both sides agree on, the divergent one comes right after
+        std::uint64_t retired = {};
+        FAR at = {};
+        std::string inst = {};
+        // One line per register, memory byte or board section that differs afterwards
+        std::string diff = {};
+    };
+private:
+    using REG = CPU::REG;
+    using SEG = CPU::SEG;
+
+    static constexpr char const* reg_names[9] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "ip" };
+    static constexpr char const* seg_names[4] = { "es", "cs", "ss", "ds" };
+
+    // Stops short when the guest halted with interupts disabled, nothing would ever wake it
+    static void run(PC& pc, std::uint64_t retired) noexcept {
+        pc.stop_at = retired;
+        while (pc.retired < retired && !(pc.halted && !pc.cpu.interupt_enabled())) {
+            (void)pc.step();
+        }
+        pc.stop_at = NEVER;
+    }
+
+    [[nodiscard]] static FAR where(PC const& pc) noexcept {
+        return { pc.cpu.reg_get(REG::IP), pc.cpu.seg_get(SEG::CS) };
+    }
+
+    [[nodiscard]] static std::string disassemble(PC const& pc) {
+        byte_t code[16] = {};
+        auto at = where(pc);
+        for (auto& byte : code) {
+            byte = pc.mem.read_byte(at.ea());
+            at += 1;
+        }
+        return DISASM::decode(code, where(pc).disp, pc.cpu.model_get()).text;
+    }
+
+    template <typename... Args>
+    static void line(std::string& out, char const* format, Args... args) {
+        char buffer[96] = {};
+        std::snprintf(buffer, sizeof(buffer), format, args...);
+        out += buffer;
+        out += '\n';
+    }
+
+    // Board sections are compared as stored, the CPU registers get one line each
+    static void diff_board(PC& lhs, PC& rhs, std::string& out) {
+        for (auto i = 0; i != 9; ++i) {
+            auto const a = lhs.cpu.reg_get(static_cast<REG>(i));
+            auto const b = rhs.cpu.reg_get(static_cast<REG>(i));
+            if (a != b) {
+                line(out, "%s: 0x%04X 0x%04X", reg_names[i], a, b);
+            }
+        }
+        for (auto i = 0; i != 4; ++i) {
+            auto const a = lhs.cpu.seg_get(static_cast<SEG>(i));
+            auto const b = rhs.cpu.seg_get(static_cast<SEG>(i));
+            if (a != b) {
+                line(out, "%s: 0x%04X 0x%04X", seg_names[i], a, b);
+            }
+        }
+        auto const flags_lhs = CPU::flags_pack(lhs.cpu.flags_get());
+        auto const flags_rhs = CPU::flags_pack(rhs.cpu.flags_get());
+        if (flags_lhs != flags_rhs) {
+            line(out, "flags: 0x%04X 0x%04X", flags_lhs, flags_rhs);
+        }
+        auto board_lhs = STATE::Writer{};
+        auto board_rhs = STATE::Writer{};
+        lhs.serialize_board(board_lhs);
+        rhs.serialize_board(board_rhs);
+        auto const sections = [](std::span<byte_t const> data) {
+            auto result = std::vector<std::span<byte_t const>>{};
+            for (auto pos = std::size_t{}; pos + 12 <= data.size();) {
+                auto const size = static_cast<std::size_t>(data[pos + 8] | data[pos + 9] << 8 | data[pos + 10] << 16 | data[pos + 11] << 24);
+                result.push_back(data.subspan(pos, std::min(12 + size, data.size() - pos)));
+                pos += 12 + size;
+            }
+            return result;
+        };
+        auto const a = sections(board_lhs.data);
+        auto const b = sections(board_rhs.data);
+        for (auto i = std::size_t{}; i != std::min(a.size(), b.size()); ++i) {
+            if (!std::equal(a[i].begin(), a[i].end(), b[i].begin(), b[i].end())) {
+                line(out, "section %.4s differs", reinterpret_cast<char const*>(a[i].data()));
+            }
+        }
+    }
+
+    static void diff_memory(PC const& lhs, PC const& rhs, std::vector<dword_t> const& pages, std::string& out) {
+        auto shown = std::size_t{};
+        auto total = std::size_t{};
+        for (auto const page : pages) {
+            auto const a = lhs.mem.page_read(page << MEM::PAGE_BITS);
+            auto const b = rhs.mem.page_read(page << MEM::PAGE_BITS);
+            for (auto i = std::size_t{}; i != MEM::PAGE_SIZE; ++i) {
+                if (a[i] == b[i]) {
+                    continue;
+                }
+                total += 1;
+                if (shown != BYTES_SHOWN) {
+                    shown += 1;
+                    line(out, "[0x%05X]: 0x%02X 0x%02X", (page << MEM::PAGE_BITS) + static_cast<dword_t>(i), a[i], b[i]);
+                }
+            }
+        }
+        if (total > shown) {
+            line(out, "... %zu more bytes", total - shown);
+        }
+    }
+
+    [[nodiscard]] static bool same(PC& lhs, PC& rhs, MERKLE& hash_lhs, MERKLE& hash_rhs) {
+        return lhs.retired == rhs.retired && hash_lhs.state() == hash_rhs.state();
+    }
+public:
+    // Runs both machines, which have to start in step, to instruction limit or the first divergence
+    // Both are left right after the divergent instruction, or where they stopped when none was found
+    [[nodiscard]] static Report bisect(PC& lhs, PC& rhs, std::uint64_t limit, std::uint64_t interval = 0x10000) {
+        if (lhs.retired != rhs.retired) {
+            throw "Machines are not at the same instruction!";
+        }
+        auto hash_lhs = MERKLE(lhs);
+        auto hash_rhs = MERKLE(rhs);
+        auto result = Report{};
+        auto lo = lhs.retired;
+        if (same(lhs, rhs, hash_lhs, hash_rhs)) {
+            // Forks of the last point both sides still agreed on
+            auto fork_lhs = lhs.fork();
+            auto fork_rhs = rhs.fork();
+            auto hi = NEVER;
+            while (lo < limit) {
+                auto const next = std::min(limit, lo + std::max<std::uint64_t>(interval, 1));
+                run(lhs, next);
+                run(rhs, next);
+                if (!same(lhs, rhs, hash_lhs, hash_rhs)) {
+                    hi = next;
+                    break;
+                }
+                if (lhs.retired != next) {
+                    result.retired = lhs.retired;
+                    return result;
+                }
+                fork_lhs = lhs.fork();
+                fork_rhs = rhs.fork();
+                lo = next;
+            }
+            if (hi == NEVER) {
+                result.retired = lo;
+                return result;
+            }
+            // Coarse to fine, every probe restarts from the latest matching forks
+            while (hi - lo > 1) {
+                auto const mid = lo + (hi - lo) / 2;
+                lhs.share(*fork_lhs);
+                rhs.share(*fork_rhs);
+                run(lhs, mid);
+                run(rhs, mid);
+                if (same(lhs, rhs, hash_lhs, hash_rhs) && lhs.retired == mid) {
+                    fork_lhs = lhs.fork();
+                    fork_rhs = rhs.fork();
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+            lhs.share(*fork_lhs);
+            rhs.share(*fork_rhs);
+            result.at = where(lhs);
+            // A halted step is the interupt that wakes it, the instruction shown is where it will return to
+            result.inst = lhs.halted ? "(halted) " + disassemble(lhs) : disassemble(lhs);
+            if (where(rhs).ea() != result.at.ea()) {
+                result.inst += " / " + disassemble(rhs);
+            }
+            run(lhs, lo + 1);
+            run(rhs, lo + 1);
+            (void)same(lhs, rhs, hash_lhs, hash_rhs);
+        } else {
+            // Apart before the first instruction, nothing to search
+            result.at = where(lhs);
+            result.inst = disassemble(lhs);
+        }
+        result.diverged = true;
+        result.retired = lo;
+        if (lhs.retired != rhs.retired) {
+            line(result.diff, "retired: %llu %llu", static_cast<unsigned long long>(lhs.retired), static_cast<unsigned long long>(rhs.retired));
+        }
+        diff_board(lhs, rhs, result.diff);
+        diff_memory(lhs, rhs, MERKLE::diff(hash_lhs, hash_rhs), result.diff);
+        return result;
+    }
+
+    // State hashes of count points interval instructions apart, the first one before running at all
+    // Shorter when the guest halted for good before the last point
+    [[nodiscard]] static std::vector<std::uint64_t> record(PC& pc, std::size_t count, std::uint64_t interval) {
+        auto hash = MERKLE(pc);
+        auto result = std::vector<std::uint64_t>{};
+        auto const start = pc.retired;
+        for (auto i = std::size_t{}; i != count; ++i) {
+            run(pc, start + i * interval);
+            if (pc.retired != start + i * interval) {
+                break;
+            }
+            result.push_back(hash.state());
+        }
+        return result;
+    }
+
+    // Checks a run against a stream from record taken at the same starting point, the stream stands in for the other side
+    // A mismatch is only narrowed down to its interval, the machine is left at the start of it so the reference can
+    // record a finer stream from there
+    [[nodiscard]] static Report compare(PC& pc, std::span<std::uint64_t const> hashes, std::uint64_t interval) {
+        auto hash = MERKLE(pc);
+        auto result = Report{};
+        auto const start = pc.retired;
+        auto last = std::unique_ptr<PC>{};
+        for (auto i = std::size_t{}; i != hashes.size(); ++i) {
+            auto const at = start + i * interval;
+            run(pc, at);
+            if (pc.retired == at && hash.state() == hashes[i]) {
+                last = pc.fork();
+                continue;
+            }
+            result.diverged = true;
+            if (last) {
+                pc.share(*last);
+            }
+            result.retired = last ? at - interval : start;
+            result.at = where(pc);
+            result.inst = disassemble(pc);
+            if (last) {
+                line(result.diff, "state hash differs within %llu instructions", static_cast<unsigned long long>(interval));
+            } else {
+                line(result.diff, "state hash differs before the first instruction");
+            }
+            return result;
+        }
+        result.retired = pc.retired;
+        return result;
+    }
+};
+
+#endif // O126_BISECT_HPP
@@ -13,10 +13,38 @@ using sbyte_t = std::int8_t;
 using sword_t = std::int16_t;
 using sdword_t = std::int32_t;
 
+struct AOT;
+struct BIOS;
+struct BISECT;
 struct BUS;
+struct CONSOLE;
 struct CPU;
+struct DISASM;
+struct DISK;
+struct DMA;
+struct DOS;
+struct EMS;
+struct FDC;
+struct FPU;
+struct HLE;
+struct MAPPING;
+struct MEM;
+struct MERKLE;
+struct PC;
 struct PIC;
 struct PIT;
+struct REPLAY;
+struct REWIND;
+struct RING;
+struct ROM;
+struct RUNAHEAD;
+struct SCHED;
+struct SNAPSHOT;
+struct SPEAKER;
+struct STATE;
+struct TRACE;
+struct UART;
+struct VIDEO;
 
 template <typename T>
 [[nodiscard]] static constexpr auto to_signed(T val) noexcept {
@@ -0,0 +1,144 @@
+#ifndef O126_CONSOLE_HPP
+#define O126_CONSOLE_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "hle.hpp"
+#include "pc.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+// INT 10h teletype and write string output as a host text stream, for batch jobs nobody watches
+struct o126::CONSOLE {
+public:
+    static constexpr std::size_t FLUSH_SIZE = 0x10000;
+private:
+    using REG = CPU::REG;
+    using SEG = CPU::SEG;
+
+    // BIOS data area
+    static constexpr dword_t COLUMNS = 0x44A;
+    static constexpr dword_t CURSOR = 0x450;
+    static constexpr dword_t PAGE = 0x462;
+    static constexpr dword_t ROWS = 0x484; // EGA and later, zero means 25
+
+    PC& pc;
+    std::FILE* file;
+    std::string buffer = {};
+
+    [[nodiscard]] byte_t columns() const noexcept {
+        return std::max<byte_t>(pc.mem.read_byte(COLUMNS), 1);
+    }
+
+    [[nodiscard]] byte_t rows() const noexcept {
+        auto const last = pc.mem.read_byte(ROWS);
+        return static_cast<byte_t>(last ? last + 1 : 25);
+    }
+
+    void append(byte_t c) {
+        switch (c) {
+        case '\r':
+        case '\a':
+            return;
+        default:
+            buffer.push_back(static_cast<char>(c));
+        }
+        if (buffer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    // Cursor movement only, the screen behind it is left alone
+    void advance(byte_t page, byte_t c) noexcept {
+        auto const cursor = CURSOR + (page & 7) * 2u;
+        auto col = pc.mem.read_byte(cursor);
+        auto row = pc.mem.read_byte(cursor + 1);
+        switch (c) {
+        case '\r':
+            col = 0;
+            break;
+        case '\n':
+            row += 1;
+            break;
+        case '\b':
+            col = static_cast<byte_t>(col ? col - 1 : 0);
+            break;
+        case '\a':
+            break;
+        default:
+            if (++col >= columns()) {
+                col = 0;
+                row += 1;
+            }
+            break;
+        }
+        pc.mem.write_byte(cursor, col);
+        pc.mem.write_byte(cursor + 1, std::min<byte_t>(row, static_cast<byte_t>(rows() - 1)));
+    }
+
+    // Returns false to let the guest BIOS draw as well
+    bool int10() {
+        auto& cpu = pc.cpu;
+        auto const function = cpu.reg8_get(REG::AH);
+        if (function == 0x0E) {
+            auto const c = cpu.reg8_get(REG::AL);
+            append(c);
+            if (screen) {
+                return false;
+            }
+            advance(pc.mem.read_byte(PAGE), c);
+            return true;
+        }
+        if (function == 0x13) {
+            auto const mode = cpu.reg8_get(REG::AL);
+            auto const page = cpu.reg8_get(REG::BH);
+            auto const count = cpu.reg_get(REG::CX);
+            auto text = FAR { cpu.reg_get(REG::BP), cpu.seg_get(SEG::ES) };
+            auto const cursor = CURSOR + (page & 7) * 2u;
+            auto const saved = word_pack(pc.mem.read_byte(cursor), pc.mem.read_byte(cursor + 1));
+            pc.mem.write_byte(cursor, cpu.reg8_get(REG::DL));
+            pc.mem.write_byte(cursor + 1, cpu.reg8_get(REG::DH));
+            for (auto i = word_t{}; i != count; ++i) {
+                auto const c = pc.mem.read_byte(text.ea());
+                text += mode & 2 ? 2 : 1;
+                append(c);
+                advance(page, c);
+            }
+            // Mode bit 0 leaves the cursor after the string
+            if (screen || !(mode & 1)) {
+                pc.mem.write_byte(cursor, static_cast<byte_t>(saved));
+                pc.mem.write_byte(cursor + 1, static_cast<byte_t>(saved >> 8));
+            }
+            return !screen;
+        }
+        return false;
+    }
+public:
+    // With a screen attached the guest BIOS still draws every character into video RAM
+    bool screen = {};
+
+    explicit CONSOLE(PC& pc, std::FILE* file = stdout) noexcept : pc(pc), file(file) {}
+
+    CONSOLE(CONSOLE const&) = delete;
+    CONSOLE& operator=(CONSOLE const&) = delete;
+
+    ~CONSOLE() {
+        flush();
+    }
+
+    void flush() noexcept {
+        if (!buffer.empty()) {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            std::fflush(file);
+            buffer.clear();
+        }
+    }
+
+    void install() {
+        pc.hle.hook_vector(0x10, [this](CPU&, BUS&) {
+            return int10();
+        }, true);
+    }
+};
+
+#endif // O126_CONSOLE_HPP
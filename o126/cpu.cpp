@@ -1,18 +1,45 @@
 #include <cstdio>
+#include <utility>
+#include "aot.hpp"
 #include "cpu/impl_exe.hpp"
+#include "trace.hpp"
 
-o126::CPU::Result o126::CPU::exec(BUS &bus) noexcept {
+o126::CPU::Result o126::CPU::exec(BUS &bus, std::uint32_t budget) noexcept {
+    if (trace) [[unlikely]] {
+        auto traced = TRACE::Bus { *trace, bus, *this };
+        auto const result = interpret(traced);
+        trace->instruction(*this, traced);
+        return result;
+    }
     auto ctx = IMPL::CTX { *this, bus };
     // auto const ip = ctx.ptr_get(REG::IP, SEG::CS);
+    if (aot && aot->model == model && !flags.trap) {
+        if (auto const block = aot->find(ctx.ptr_get(REG::IP, SEG::CS).ea()); block && block->count <= budget) {
+            retired = 0;
+            auto const result = block->run(*this, bus);
+            if (auto const flags = ctx.flags_get<Flags>(); flags.trap) {
+                ctx.push_frame_interupt();
+                (void)ctx.end_interupt(1);
+            }
+            return result;
+        }
+    }
+    return interpret(bus);
+}
+
+o126::CPU::Result o126::CPU::interpret(BUS& bus) noexcept {
+    auto ctx = IMPL::CTX { *this, bus };
+    retired = 0;
     for (;;) {
         auto const op = ctx.fetch<byte_t>();
-        auto const result = IMPL::EXE::table.ops[op](ctx);
+        auto const result = table->ops[op](ctx);
         switch(result) {
         case Result::PREFIX:
             continue;
         case Result::HALT:
         case Result::WAIT:
         case Result::DONE:
+            retired = 1;
             if (auto const flags = ctx.flags_get<Flags>(); flags.trap) {
                 ctx.push_frame_interupt();
                 (void)ctx.end_interupt(1);
@@ -22,20 +49,47 @@ o126::CPU::Result o126::CPU::exec(BUS &bus) noexcept {
     }
 }
 
-bool o126::CPU::interupt(BUS& bus) noexcept {
+bool o126::CPU::interupt(BUS& bus, byte_t index) noexcept {
     auto ctx = IMPL::CTX { *this, bus };
     auto const flags = ctx.flags_get<Flags>();
     if (flags.interupt) {
-        ctx.push_frame_interupt();
-        (void)ctx.end_interupt(1);
+        interupt_enter(bus, index);
         return true;
     }
     return false;
 }
 
 bool o126::CPU::interupt_nmi(BUS& bus) noexcept {
-    auto ctx = IMPL::CTX { *this, bus };
-    ctx.push_frame_interupt();
-    (void)ctx.end_interupt(2);
+    interupt_enter(bus, 2);
     return true;
 }
+
+// Not part of any instruction, hooks it reaches see nothing retired yet
+void o126::CPU::interupt_enter(BUS& bus, byte_t index) noexcept {
+    auto const saved = std::exchange(retired, 0);
+    if (trace) [[unlikely]] {
+        auto traced = TRACE::Bus { *trace, bus, *this };
+        auto ctx = IMPL::CTX { *this, traced };
+        ctx.push_frame_interupt();
+        (void)ctx.end_interupt(index);
+        trace->interupt(*this, traced, index);
+    } else {
+        auto ctx = IMPL::CTX { *this, bus };
+        ctx.push_frame_interupt();
+        (void)ctx.end_interupt(index);
+    }
+    retired = saved;
+}
+
+o126::CPU::OPTable const* o126::CPU::table_get(Model model) noexcept {
+    switch (model) {
+    case Model::I8088:
+        return &IMPL::EXE<Model::I8088>::table;
+    case Model::I8086:
+        return &IMPL::EXE<Model::I8086>::table;
+    case Model::V20:
+        return &IMPL::EXE<Model::V20>::table;
+    default:
+        return &IMPL::EXE<Model::I80186>::table;
+    }
+}
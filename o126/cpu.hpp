@@ -11,7 +11,15 @@ public:
         HALT,
         WAIT,
     };
-private:
+
+    // Instruction set variants, each one gets its own dispatch table so nothing checks the model per opcode
+    enum class Model : byte_t {
+        I8088, // same instructions as the 8086, narrower bus
+        I8086, // 60h-6Fh alias Jcc, 0Fh is POP CS, shift counts are not masked
+        V20, // 80186 instructions plus the NEC 0Fh extensions, shift counts are not masked
+        I80186,
+    };
+
     enum class REG : sbyte_t {
         NONE = - 1,
         AX = 0, // Accumulator
@@ -47,12 +55,6 @@ private:
         COUNT = 4,
     };
 
-    enum class REP : sbyte_t {
-        NONE = -1,
-        NOT_ZERO = 0,
-        ZERO = 1,
-    };
-
     struct Flags final {
         bool carry : 1 = {};        // 0    1           0x0001
         bool reserved1 : 1 = {};    // 1    2           0x0002
@@ -72,6 +74,13 @@ private:
         bool reserved15 : 1 = {};   // 15   32768       0x8000
     };
 
+private:
+    enum class REP : sbyte_t {
+        NONE = -1,
+        NOT_ZERO = 0,
+        ZERO = 1,
+    };
+
     struct Prefix final {
         bool lock = {};
         SEG seg = SEG::NONE;
@@ -83,12 +92,158 @@ private:
     Prefix prefix = {};
     std::uint8_t inst_len = {};
     Flags flags = {};
+    // Instructions completed by the last exec call, while one runs the ones before it
+    std::uint32_t retired = {};
 
     struct IMPL;
+    struct OPTable;
+    Model model = Model::I80186;
+    OPTable const* table = table_get(Model::I80186);
+
+    [[nodiscard]] static OPTable const* table_get(Model model) noexcept;
+    Result interpret(BUS& bus) noexcept;
+    void interupt_enter(BUS& bus, byte_t index) noexcept;
 public:
-    Result exec(BUS& bus) noexcept;
-    bool interupt(BUS& bus) noexcept;
+    // Optional native service hooks, owned by whoever sets it
+    HLE* hle = {};
+    // Optional coprocessor behind the ESC opcodes, without one they only compute their address
+    FPU* fpu = {};
+    // Optional ahead-of-time translated code, blocks only run when they fit in the budget
+    AOT const* aot = {};
+    // Optional log of every instruction and interupt, translated blocks are bypassed while it is set
+    TRACE* trace = {};
+    // Optional export of taken branches, interupts, port accesses and memory writes to another process
+    RING* ring = {};
+
+    // Runs one instruction, or one translated block of at most budget instructions
+    Result exec(BUS& bus, std::uint32_t budget = 1) noexcept;
+    bool interupt(BUS& bus, byte_t index) noexcept;
     bool interupt_nmi(BUS& bus) noexcept;
+
+    // One instruction whose opcode byte is known in advance, for translated code
+    template <Model MODEL, byte_t OP>
+    Result exec_op(BUS& bus) noexcept;
+
+    // Length, prefixes and control flow of an instruction without running it, for tools that walk code
+    struct Layout;
+
+    [[nodiscard]] constexpr std::uint32_t retired_get() const noexcept {
+        return retired;
+    }
+
+    [[nodiscard]] constexpr Model model_get() const noexcept {
+        return model;
+    }
+
+    void model_set(Model val) noexcept {
+        model = val;
+        table = table_get(val);
+    }
+
+    [[nodiscard]] constexpr bool interupt_enabled() const noexcept {
+        return flags.interupt;
+    }
+
+    /// Register access for host code, byte registers use the AL-BH names
+    [[nodiscard]] constexpr word_t reg_get(REG reg) const noexcept {
+        return regs[static_cast<int>(reg)];
+    }
+
+    constexpr void reg_set(REG reg, word_t val) noexcept {
+        regs[static_cast<int>(reg)] = val;
+    }
+
+    [[nodiscard]] constexpr byte_t reg8_get(REG reg) const noexcept {
+        return static_cast<byte_t>(regs[static_cast<int>(reg) & 3] >> ((static_cast<int>(reg) & 4) * 2));
+    }
+
+    constexpr void reg8_set(REG reg, byte_t val) noexcept {
+        auto& result = regs[static_cast<int>(reg) & 3];
+        if (static_cast<int>(reg) & 4) {
+            result = static_cast<word_t>((result & 0x00FF) | (val << 8));
+        } else {
+            result = static_cast<word_t>((result & 0xFF00) | val);
+        }
+    }
+
+    [[nodiscard]] constexpr word_t seg_get(SEG seg) const noexcept {
+        return segs[static_cast<int>(seg) & 3];
+    }
+
+    constexpr void seg_set(SEG seg, word_t val) noexcept {
+        segs[static_cast<int>(seg) & 3] = val;
+    }
+
+    [[nodiscard]] constexpr Flags flags_get() const noexcept {
+        return flags;
+    }
+
+    constexpr void flags_set(Flags val) noexcept {
+        flags = val;
+    }
+
+    // All sixteen bits at their architectural positions, reserved ones included
+    [[nodiscard]] static constexpr word_t flags_pack(Flags val) noexcept {
+        word_t result = {};
+        result |= static_cast<word_t>(val.carry << 0);
+        result |= static_cast<word_t>(val.reserved1 << 1);
+        result |= static_cast<word_t>(val.parity << 2);
+        result |= static_cast<word_t>(val.reserved3 << 3);
+        result |= static_cast<word_t>(val.auxiliary << 4);
+        result |= static_cast<word_t>(val.reserved5 << 5);
+        result |= static_cast<word_t>(val.zero << 6);
+        result |= static_cast<word_t>(val.sign << 7);
+        result |= static_cast<word_t>(val.trap << 8);
+        result |= static_cast<word_t>(val.interupt << 9);
+        result |= static_cast<word_t>(val.direction << 10);
+        result |= static_cast<word_t>(val.overflow << 11);
+        result |= static_cast<word_t>(val.reserved12 << 12);
+        result |= static_cast<word_t>(val.reserved13 << 13);
+        result |= static_cast<word_t>(val.reserved14 << 14);
+        result |= static_cast<word_t>(val.reserved15 << 15);
+        return result;
+    }
+
+    [[nodiscard]] static constexpr Flags flags_unpack(word_t val) noexcept {
+        Flags result = {};
+        result.carry = val & (1 << 0);
+        result.reserved1 = val & (1 << 1);
+        result.parity = val & (1 << 2);
+        result.reserved3 = val & (1 << 3);
+        result.auxiliary = val & (1 << 4);
+        result.reserved5 = val & (1 << 5);
+        result.zero = val & (1 << 6);
+        result.sign = val & (1 << 7);
+        result.trap = val & (1 << 8);
+        result.interupt = val & (1 << 9);
+        result.direction = val & (1 << 10);
+        result.overflow = val & (1 << 11);
+        result.reserved12 = val & (1 << 12);
+        result.reserved13 = val & (1 << 13);
+        result.reserved14 = val & (1 << 14);
+        result.reserved15 = val & (1 << 15);
+        return result;
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        s(model);
+        if constexpr (S::LOADING) {
+            table = table_get(model);
+        }
+        s(regs);
+        s(segs);
+        s(prefix.lock);
+        s(prefix.seg);
+        s(prefix.rep);
+        s(inst_len);
+        auto bits = flags_pack(flags);
+        s(bits);
+        if constexpr (S::LOADING) {
+            flags = flags_unpack(bits);
+        }
+    }
 };
 
 #endif // O126_HPP
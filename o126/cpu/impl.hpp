@@ -32,7 +32,9 @@ struct o126::CPU::IMPL final {
     template <typename type>
     struct MISC;
     struct Decode;
+    template <Model MODEL>
     struct EXE;
+    struct NEC;
 
     /// Utility functions
     [[nodiscard]] static constexpr bool match8(char const(&data)[9], byte_t value) {
@@ -54,3 +56,7 @@ struct o126::CPU::IMPL final {
         return true;
     }
 };
+
+struct o126::CPU::OPTable final {
+    Result(* const ops[256])(IMPL::CTX) noexcept;
+};
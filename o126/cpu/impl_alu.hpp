@@ -126,7 +126,7 @@ struct o126::CPU::IMPL::ALU final {
     };
 
     [[nodiscard]] static constexpr Result op_rol(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs %= BIT_COUNT;
             auto const result = std::rotl(lhs, rhs % BIT_COUNT);
 
@@ -139,7 +139,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_ror(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs %= BIT_COUNT;
             auto const result = std::rotr(lhs, rhs % BIT_COUNT);
 
@@ -152,7 +152,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_rcl(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs %= BIT_NEXT;
             auto const lhs_c = (flags.carry << BIT_COUNT) | lhs;
             auto const result = (lhs_c << rhs) | (lhs_c >> (BIT_NEXT - rhs));
@@ -166,7 +166,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_rcr(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs %= BIT_NEXT;
             auto const lhs_c = (flags.carry << BIT_COUNT) | lhs;
             auto const result = (lhs_c >> rhs) | (lhs_c << (BIT_NEXT - rhs));
@@ -180,7 +180,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_shl(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs = std::min(rhs, BIT_NEXT);
             auto const result = lhs << rhs;
 
@@ -194,7 +194,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_shr(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs = std::min(rhs, BIT_NEXT);
             auto const result = lhs >> rhs;
 
@@ -211,7 +211,7 @@ struct o126::CPU::IMPL::ALU final {
     }
 
     [[nodiscard]] static constexpr Result op_sar(Flags flags, type lhs, byte_t rhs) noexcept {
-        if (rhs %= 32) {
+        if (rhs) {
             rhs = std::min(rhs, BIT_NEXT);
             auto const result = static_cast<stype>(lhs) >> rhs;
 
@@ -1,5 +1,8 @@
 #pragma once
 #include "impl.hpp"
+#include "../hle.hpp"
+#include "../ring.hpp"
+#include "../trace.hpp"
 #include <concepts>
 #include <utility>
 
@@ -183,21 +186,35 @@ struct o126::CPU::IMPL::CTX final {
     /// Port read/write
     template <std::same_as<byte_t> T>
     [[nodiscard]] constexpr byte_t port_get(word_t port) const noexcept {
-        return bus.in_byte(port);
+        auto const result = bus.in_byte(port);
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->in(port, result, 1);
+        }
+        return result;
     }
 
     template <std::same_as<word_t> T>
     [[nodiscard]] constexpr word_t port_get(word_t port) const noexcept {
-        return bus.in_word(port);
+        auto const result = bus.in_word(port);
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->in(port, result, 2);
+        }
+        return result;
     }
 
     template <std::same_as<byte_t> T>
     constexpr void port_set(word_t port, byte_t val) const noexcept {
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->out(port, val, 1);
+        }
         bus.out_byte(port, val);
     }
 
     template <std::same_as<word_t> T>
     constexpr void port_set(word_t port, word_t val) const noexcept {
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->out(port, val, 2);
+        }
         bus.out_word(port, val);
     }
 
@@ -221,11 +238,17 @@ struct o126::CPU::IMPL::CTX final {
 
     template <std::same_as<byte_t> T>
     constexpr void mem_set(FAR addr, byte_t val) const noexcept {
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->write(addr, val, 1);
+        }
         bus.write_byte(addr, val);
     }
 
     template <std::same_as<word_t> T>
     constexpr void mem_set(FAR addr, word_t val) const noexcept {
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->write(addr, val, 2);
+        }
         bus.write_word(addr, val);
     }
 
@@ -423,6 +446,9 @@ struct o126::CPU::IMPL::CTX final {
         cpu.inst_len += 1;
         auto const addr = ptr_inc_post(REG::IP, SEG::CS, 1);
         auto const result = mem_get<byte_t>(addr);
+        if (cpu.trace) [[unlikely]] {
+            cpu.trace->fetched(result);
+        }
         return result;
     }
 
@@ -431,6 +457,11 @@ struct o126::CPU::IMPL::CTX final {
         cpu.inst_len += 2;
         auto const addr = ptr_inc_post(REG::IP, SEG::CS, 2);
         auto const result = mem_get<word_t>(addr);
+        if (cpu.trace) [[unlikely]] {
+            auto const [lo, hi] = word_unpack(result);
+            cpu.trace->fetched(lo);
+            cpu.trace->fetched(hi);
+        }
         return result;
     }
 
@@ -486,26 +517,74 @@ struct o126::CPU::IMPL::CTX final {
 
     [[nodiscard]] constexpr Result end_jmp_rel(sword_t diff) const noexcept {
         reg_add(REG::IP, diff);
-        cpu.prefix = {};
-        cpu.inst_len = {};
-        return Result::DONE;
+        return end_block();
     }
 
     [[nodiscard]] constexpr Result end_jmp_near(word_t addr) const noexcept {
         reg_set<word_t>(REG::IP, addr);
-        cpu.prefix = {};
-        cpu.inst_len = {};
-        return Result::DONE;
+        return end_block();
     }
 
     [[nodiscard]] constexpr Result end_jmp_far(FAR addr) const noexcept {
         ptr_set(REG::IP, SEG::CS, addr);
+        return end_block();
+    }
+
+    // Every taken branch enters a new block, the only place a hooked code address is looked up
+    [[nodiscard]] constexpr Result end_block() const noexcept {
         cpu.prefix = {};
         cpu.inst_len = {};
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->block(ptr_get(REG::IP, SEG::CS));
+        }
+        if (cpu.hle && cpu.hle->has_code(ptr_get(REG::IP, SEG::CS).ea())) [[unlikely]] {
+            hle_code();
+        }
         return Result::DONE;
     }
 
+    /// Native hooks
+    void hle_code() const {
+        auto kind = HLE::Return::NONE;
+        if (!cpu.hle->call_code(ptr_get(REG::IP, SEG::CS).ea(), cpu, bus, kind)) {
+            return;
+        }
+        switch (kind) {
+        case HLE::Return::NEAR:
+            reg_set<word_t>(REG::IP, pop_frame_near());
+            break;
+        case HLE::Return::FAR:
+            ptr_set(REG::IP, SEG::CS, pop_frame_far());
+            break;
+        case HLE::Return::INTERUPT:
+            hle_return_interupt();
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Like IRET except only IF and TF come back from the frame, results in the other flags survive
+    constexpr void hle_return_interupt() const noexcept {
+        auto const addr = pop_frame_far();
+        auto const saved = pop<word_t>();
+        auto flags = flags_get<Flags>();
+        flags.trap = saved & (1 << 8);
+        flags.interupt = saved & (1 << 9);
+        flags_set<Flags>(flags);
+        ptr_set(REG::IP, SEG::CS, addr);
+    }
+
     [[nodiscard]] constexpr Result end_interupt(byte_t index) const noexcept {
+        if (cpu.ring) [[unlikely]] {
+            cpu.ring->interupt(ptr_get(REG::IP, SEG::CS), index);
+        }
+        if (cpu.hle && cpu.hle->has_vector(index)) [[unlikely]] {
+            if (cpu.hle->call_vector(index, cpu, bus)) {
+                hle_return_interupt();
+                return end_block();
+            }
+        }
         auto flags = flags_get<Flags>();
         flags.interupt = false;
         flags.trap = false;
@@ -1,6 +1,7 @@
 #pragma once
 #include "impl.hpp"
 #include "impl_ctx.hpp"
+#include <array>
 
 struct o126::CPU::IMPL::Decode final {
 #pragma clang diagnostic push
@@ -113,3 +114,192 @@ struct o126::CPU::IMPL::Decode final {
     }
 #pragma clang diagnostic pop
 };
+
+struct o126::CPU::Layout final {
+    // The opcode a model executes in place of op, the 8086 decodes the 80186 additions as older instructions
+    [[nodiscard]] static constexpr byte_t alias(Model model, byte_t op) noexcept {
+        if (model == Model::V20 || model == Model::I80186) {
+            return op;
+        }
+        if (op >= 0x60 && op <= 0x6F) {
+            return static_cast<byte_t>(op + 0x10);
+        }
+        if (op == 0xC0 || op == 0xC1 || op == 0xC8 || op == 0xC9) {
+            return static_cast<byte_t>(op + 0x02);
+        }
+        if (op == 0xF1) {
+            return 0xF0;
+        }
+        return op;
+    }
+
+    // Segment overrides, LOCK and REP, as returned by alias
+    [[nodiscard]] static constexpr bool prefix(byte_t op) noexcept {
+        return op == 0x26 || op == 0x2E || op == 0x36 || op == 0x3E || op == 0xF0 || op == 0xF2 || op == 0xF3;
+    }
+
+    // What an instruction does to the straight line of code around it
+    enum class Flow : byte_t {
+        NEXT,
+        BRANCH, // conditional, continues at the target or after it
+        JUMP, // continues at the target
+        CALL, // continues at the target, returns after it
+        STOP, // may interupt or change what the machine checks between instructions, usually continues after it
+        RETURN, // no static successor
+        BARRIER, // port access
+        INVALID,
+    };
+
+    // Tools give up on more prefixes than this, the CPU itself takes any number
+    static constexpr byte_t PREFIXES_MAX = 4;
+
+    struct Inst final {
+        byte_t len = {};
+        byte_t prefixes = {};
+        // As the model executes it
+        byte_t op = {};
+        bool has_modrm = {};
+        byte_t modrm = {};
+        Flow flow = Flow::NEXT;
+        // Target of a relative branch from the end of the instruction, or of a far one
+        sword_t rel = {};
+        FAR far = {};
+
+        [[nodiscard]] constexpr bool is_far() const noexcept {
+            return op == 0x9A || op == 0xEA;
+        }
+    };
+
+    struct Shape final {
+        bool modrm;
+        // Immediate, relative target or far pointer bytes after the modrm operand
+        byte_t imm;
+        Flow flow;
+    };
+
+    // Indexed by the opcode as returned by alias, fields that depend on the modrm byte are filled in by inst
+    [[nodiscard]] static constexpr std::array<Shape, 256> shapes() noexcept {
+        auto result = std::array<Shape, 256>{};
+        for (auto op = 0; op != 0x40; ++op) {
+            auto const low = op & 7;
+            result[op] = { low < 4, static_cast<byte_t>(low == 4 ? 1 : low == 5 ? 2 : 0), Flow::NEXT };
+        }
+        auto const set = [&](int first, int last, Shape shape) {
+            for (auto op = first; op <= last; ++op) {
+                result[op] = shape;
+            }
+        };
+        // Extended on the 80186 and V20, POP CS on the 8086
+        set(0x0F, 0x0F, { false, 0, Flow::INVALID });
+        set(0x62, 0x62, { true, 0, Flow::NEXT });
+        set(0x63, 0x67, { false, 0, Flow::INVALID });
+        set(0x68, 0x68, { false, 2, Flow::NEXT });
+        set(0x69, 0x69, { true, 2, Flow::NEXT });
+        set(0x6A, 0x6A, { false, 1, Flow::NEXT });
+        set(0x6B, 0x6B, { true, 1, Flow::NEXT });
+        set(0x6C, 0x6F, { false, 0, Flow::BARRIER });
+        set(0x70, 0x7F, { false, 1, Flow::BRANCH });
+        set(0x80, 0x80, { true, 1, Flow::NEXT });
+        set(0x81, 0x81, { true, 2, Flow::NEXT });
+        set(0x82, 0x83, { true, 1, Flow::NEXT });
+        set(0x84, 0x8F, { true, 0, Flow::NEXT });
+        set(0x9A, 0x9A, { false, 4, Flow::CALL });
+        // WAIT lets the coprocessor interupt, POPF may set the trap flag
+        set(0x9B, 0x9B, { false, 0, Flow::STOP });
+        set(0x9D, 0x9D, { false, 0, Flow::STOP });
+        set(0xA0, 0xA3, { false, 2, Flow::NEXT });
+        set(0xA8, 0xA8, { false, 1, Flow::NEXT });
+        set(0xA9, 0xA9, { false, 2, Flow::NEXT });
+        set(0xB0, 0xB7, { false, 1, Flow::NEXT });
+        set(0xB8, 0xBF, { false, 2, Flow::NEXT });
+        set(0xC0, 0xC1, { true, 1, Flow::NEXT });
+        set(0xC2, 0xC2, { false, 2, Flow::RETURN });
+        set(0xC3, 0xC3, { false, 0, Flow::RETURN });
+        set(0xC4, 0xC5, { true, 0, Flow::NEXT });
+        set(0xC6, 0xC6, { true, 1, Flow::NEXT });
+        set(0xC7, 0xC7, { true, 2, Flow::NEXT });
+        set(0xC8, 0xC8, { false, 3, Flow::NEXT });
+        set(0xCA, 0xCA, { false, 2, Flow::RETURN });
+        set(0xCB, 0xCB, { false, 0, Flow::RETURN });
+        set(0xCC, 0xCC, { false, 0, Flow::STOP });
+        set(0xCD, 0xCD, { false, 1, Flow::STOP });
+        set(0xCE, 0xCE, { false, 0, Flow::STOP });
+        set(0xCF, 0xCF, { false, 0, Flow::RETURN });
+        set(0xD0, 0xD3, { true, 0, Flow::NEXT });
+        set(0xD4, 0xD5, { false, 1, Flow::NEXT });
+        // The coprocessor may raise its interupt, which the machine checks after every instruction
+        set(0xD8, 0xDF, { true, 0, Flow::STOP });
+        set(0xE0, 0xE3, { false, 1, Flow::BRANCH });
+        set(0xE4, 0xE7, { false, 1, Flow::BARRIER });
+        set(0xE8, 0xE8, { false, 2, Flow::CALL });
+        set(0xE9, 0xE9, { false, 2, Flow::JUMP });
+        set(0xEA, 0xEA, { false, 4, Flow::JUMP });
+        set(0xEB, 0xEB, { false, 1, Flow::JUMP });
+        set(0xEC, 0xEF, { false, 0, Flow::BARRIER });
+        set(0xF1, 0xF1, { false, 0, Flow::INVALID });
+        set(0xF4, 0xF4, { false, 0, Flow::STOP });
+        set(0xF6, 0xF7, { true, 0, Flow::NEXT });
+        set(0xFB, 0xFB, { false, 0, Flow::STOP });
+        set(0xFE, 0xFF, { true, 0, Flow::NEXT });
+        return result;
+    }
+
+    // Length and flow of the instruction whose bytes at(0), at(1), ... returns, at may throw to stop early
+    template <typename F>
+    [[nodiscard]] static Inst inst(Model model, F&& at) {
+        static constexpr auto const table = shapes();
+        auto result = Inst{};
+        auto pos = byte_t{};
+        auto const u8 = [&] { return static_cast<byte_t>(at(pos++)); };
+        auto op = alias(model, u8());
+        while (prefix(op)) {
+            if (result.prefixes == PREFIXES_MAX) {
+                // Taken as an invalid opcode
+                result.op = op;
+                result.flow = Flow::INVALID;
+                result.len = pos;
+                return result;
+            }
+            result.prefixes += 1;
+            op = alias(model, u8());
+        }
+        auto const shape = table[op];
+        result.op = op;
+        result.flow = shape.flow;
+        auto imm = shape.imm;
+        if (op == 0x0F && (model == Model::I8086 || model == Model::I8088)) {
+            // POP CS moves execution somewhere no tool can follow
+            result.flow = Flow::RETURN;
+        }
+        if (shape.modrm) {
+            result.has_modrm = true;
+            result.modrm = u8();
+            auto const mod = result.modrm >> 6;
+            auto const reg = (result.modrm >> 3) & 7;
+            auto const disp = mod == 0b00 ? ((result.modrm & 7) == 6 ? 2 : 0) : mod == 0b11 ? 0 : mod;
+            for (auto i = 0; i != disp; ++i) {
+                (void)u8();
+            }
+            if (op == 0x8E && (reg & 3) == 1) {
+                result.flow = Flow::RETURN;
+            } else if ((op == 0xF6 || op == 0xF7) && reg < 2) {
+                imm = op == 0xF6 ? 1 : 2;
+            } else if (op == 0xFF && (reg == 2 || reg == 3)) {
+                result.flow = Flow::STOP;
+            } else if (op == 0xFF && (reg == 4 || reg == 5)) {
+                result.flow = Flow::RETURN;
+            }
+        }
+        auto value = dword_t{};
+        for (auto i = 0; i != imm; ++i) {
+            value |= dword_t{u8()} << (i * 8);
+        }
+        if (result.is_far()) {
+            result.far = { static_cast<word_t>(value), static_cast<word_t>(value >> 16) };
+        } else if (result.flow == Flow::BRANCH || result.flow == Flow::JUMP || result.flow == Flow::CALL) {
+            result.rel = imm == 1 ? static_cast<sbyte_t>(value) : static_cast<sword_t>(value);
+        }
+        result.len = pos;
+        return result;
+    }
+};
@@ -5,10 +5,33 @@
 #include "impl_ctx.hpp"
 #include "impl_decode.hpp"
 #include "impl_misc.hpp"
+#include "impl_nec.hpp"
+#include "../fpu.hpp"
 
+template <o126::CPU::Model MODEL>
 struct o126::CPU::IMPL::EXE final {
 #pragma clang diagnostic push
 #pragma clang diagnostic ignored "-Wundefined-inline"
+    // 80186 instruction set, on the 8086 its opcodes alias older ones as told by Layout::alias
+    static constexpr bool EXTENDED = MODEL == Model::V20 || MODEL == Model::I80186;
+    // Only Intel's 80186 truncates shift and rotate counts to 5 bits
+    static constexpr bool SHIFT_MASK = MODEL == Model::I80186;
+
+    [[nodiscard]] static constexpr byte_t shift_count(byte_t count) noexcept {
+        if constexpr (SHIFT_MASK) {
+            return count & 31;
+        }
+        return count;
+    }
+
+    // NEC parts fetch the AAM/AAD operand but always work in base 10
+    [[nodiscard]] static constexpr byte_t bcd_base(byte_t imm) noexcept {
+        if constexpr (MODEL == Model::V20) {
+            return 10;
+        }
+        return imm;
+    }
+
     // MOV rmW, rW
     template <byte_t OP> requires(match8("1000100w", OP))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
@@ -131,7 +154,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // POP sr
-    template <byte_t OP> requires(match8("000sr111", OP))
+    template <byte_t OP> requires(match8("000sr111", OP) && (OP != 0x0F || !EXTENDED))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         constexpr auto const seg = static_cast<SEG>((OP >> 3) & 3);
         auto const value = ctx.pop<word_t>();
@@ -356,7 +379,7 @@ struct o126::CPU::IMPL::EXE final {
     // AAM im
     template <byte_t OP> requires(match8("11010100", OP))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
-        auto const imm = Decode::imm<byte_t>(ctx);
+        auto const imm = bcd_base(Decode::imm<byte_t>(ctx));
         auto const [lo, hi] = ctx.pair_get<byte_t>();
         auto const flags = ctx.flags_get<Flags>();
         auto const result = BCD::op_aam(flags, lo, imm);
@@ -373,7 +396,7 @@ struct o126::CPU::IMPL::EXE final {
     // AAD im
     template <byte_t OP> requires(match8("11010101", OP))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
-        auto const imm = Decode::imm<byte_t>(ctx);
+        auto const imm = bcd_base(Decode::imm<byte_t>(ctx));
         auto const [lo, hi] = ctx.pair_get<byte_t>();
         auto const flags = ctx.flags_get<Flags>();
         auto const result = BCD::op_aad(flags, lo, hi, imm);
@@ -830,19 +853,26 @@ struct o126::CPU::IMPL::EXE final {
         return ctx.end_halt();
     }
 
-    // WAIT
+    // WAIT, the coprocessor finishes every instruction before the next one is fetched
     template <byte_t OP> requires(match8("10011011", OP))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        if (ctx.cpu.fpu) {
+            return ctx.end_next();
+        }
         return ctx.end_wait();
     }
 
     // ESC rm
     template <byte_t OP> requires(match8("11011xxx", OP))
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
-        auto const [opt, rm] = Decode::opt_rm(ctx);
-        (void)opt;
-        (void)rm;
-        // TODO: do what here?
+        auto const modrm = ctx.fetch<byte_t>();
+        auto const mod = modrm >> 6;
+        auto const addr = mod == 0b11 ? FAR {} : Decode::mod_table[mod][modrm & 7](ctx);
+        if (auto const fpu = ctx.cpu.fpu) {
+            auto const ip = ctx.reg_get<word_t>(REG::IP);
+            auto const inst = FAR { static_cast<word_t>(ip - ctx.cpu.inst_len), ctx.seg_get(SEG::CS) };
+            fpu->esc(static_cast<word_t>(((OP & 7) << 8) | modrm), inst, addr, ctx.bus);
+        }
         return ctx.end_next();
     }
 
@@ -960,7 +990,7 @@ struct o126::CPU::IMPL::EXE final {
         using type = Decode::type<OP & 0b1>;
         auto const [rot, rm] = Decode::opt_rm(ctx);
         auto const lhs = ctx.rm_get<type>(rm);
-        auto const rhs = ctx.reg_get<byte_t>(REG::CL);
+        auto const rhs = shift_count(ctx.reg_get<byte_t>(REG::CL));
         auto const flags = ctx.flags_get<Flags>();
         auto const result = ALU<type>::table_rot[rot](flags, lhs, rhs);
         ctx.flags_set<Flags>(result.flags);
@@ -985,11 +1015,11 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // ROT_OP rm, imm
-    template <byte_t OP> requires(match8("1100000w", OP))
+    template <byte_t OP> requires(match8("1100000w", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         using type = Decode::type<OP & 0b1>;
         auto const [rot, rm] = Decode::opt_rm(ctx);
-        auto const imm = Decode::imm<byte_t>(ctx);
+        auto const imm = shift_count(Decode::imm<byte_t>(ctx));
         auto const lhs = ctx.rm_get<type>(rm);
         auto const flags = ctx.flags_get<Flags>();
         auto const result = ALU<type>::table_rot[rot](flags, lhs, imm);
@@ -999,7 +1029,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // ENTER imm16, imm8
-    template <byte_t OP> requires(match8("11001000", OP))
+    template <byte_t OP> requires(match8("11001000", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         auto const size = Decode::imm<word_t>(ctx);
         auto const level = Decode::imm<byte_t>(ctx);
@@ -1008,14 +1038,14 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // LEAVE
-    template <byte_t OP> requires(match8("11001001", OP))
+    template <byte_t OP> requires(match8("11001001", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         ctx.pop_frame_local();
         return ctx.end_next();
     }
 
     // PUSH imW
-    template <byte_t OP> requires(match8("011010w0", OP))
+    template <byte_t OP> requires(match8("011010w0", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         using type = Decode::type<!(OP & 0b10)>;
         auto const imm = Decode::imm<type>(ctx);
@@ -1024,7 +1054,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // IMUL imW
-    template <byte_t OP> requires(match8("011010w1", OP))
+    template <byte_t OP> requires(match8("011010w1", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         using type = Decode::type<!(OP & 0b10)>;
         auto const [reg, rm] = Decode::reg_rm(ctx);
@@ -1039,7 +1069,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // INS
-    template <byte_t OP> requires(match8("0110110w", OP))
+    template <byte_t OP> requires(match8("0110110w", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         using type = Decode::type<OP & 0b1>;
         return ctx.end_repeat([](CTX ctx) -> bool {
@@ -1052,7 +1082,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // OUTS
-    template <byte_t OP> requires(match8("0110111w", OP))
+    template <byte_t OP> requires(match8("0110111w", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         using type = Decode::type<OP & 0b1>;
         return ctx.end_repeat([](CTX ctx) -> bool {
@@ -1065,7 +1095,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // PUSHA
-    template <byte_t OP> requires(match8("01100000", OP))
+    template <byte_t OP> requires(match8("01100000", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         auto const ax = ctx.reg_get<word_t>(REG::AX);
         auto const cx = ctx.reg_get<word_t>(REG::CX);
@@ -1087,7 +1117,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // POPA
-    template <byte_t OP> requires(match8("01100001", OP))
+    template <byte_t OP> requires(match8("01100001", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         auto const di = ctx.pop<word_t>();
         auto const si = ctx.pop<word_t>();
@@ -1109,7 +1139,7 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // BOUND
-    template <byte_t OP> requires(match8("01100010", OP))
+    template <byte_t OP> requires(match8("01100010", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         auto const [reg, rm] = Decode::reg_rm(ctx);
         if (rm.is_reg) {
@@ -1125,28 +1155,48 @@ struct o126::CPU::IMPL::EXE final {
     }
 
     // RESERVED63
-    template <byte_t OP> requires(match8("01100011", OP))
+    template <byte_t OP> requires(match8("01100011", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         return ctx.end_bad();
     }
 
     // RESERVED64-67
-    template <byte_t OP> requires(match8("011001xx", OP))
+    template <byte_t OP> requires(match8("011001xx", OP) && EXTENDED)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        return ctx.end_bad();
+    }
+
+    // RESERVED0F
+    template <byte_t OP> requires(match8("00001111", OP) && MODEL == Model::I80186)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         return ctx.end_bad();
     }
 
+    // NEC extensions
+    template <byte_t OP> requires(match8("00001111", OP) && MODEL == Model::V20)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const op2 = ctx.fetch<byte_t>();
+        return NEC::table.ops[op2](ctx);
+    }
+
     // ResultF1
-    template <byte_t OP> requires(match8("11110001", OP))
+    template <byte_t OP> requires(match8("11110001", OP) && EXTENDED)
     [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
         return ctx.end_bad();
     }
 
-    struct OPTable {
-        Result(* const ops[256])(CTX) noexcept;
-    };
     static constexpr auto const table = []<std::size_t...OP>(std::index_sequence<OP...>) consteval {
-        return OPTable {  &op<OP>... };
+        return OPTable {  &op<Layout::alias(MODEL, OP)>... };
     } (std::make_index_sequence<256>());
 #pragma clang diagnostic pop
 };
+
+template <o126::CPU::Model MODEL, o126::byte_t OP>
+inline o126::CPU::Result o126::CPU::exec_op(BUS& bus) noexcept {
+    auto ctx = IMPL::CTX { *this, bus };
+    inst_len += 1;
+    ctx.reg_add(REG::IP, 1);
+    auto const result = IMPL::EXE<MODEL>::template op<Layout::alias(MODEL, OP)>(ctx);
+    retired += result != Result::PREFIX;
+    return result;
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include "impl.hpp"
+#include "impl_ctx.hpp"
+#include "impl_decode.hpp"
+
+// NEC V20 instructions behind the 0Fh prefix, 8080 emulation mode is not supported
+struct o126::CPU::IMPL::NEC final {
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wundefined-inline"
+    /// Packed BCD digits, operands are assumed to be valid
+    [[nodiscard]] static constexpr byte_t bcd_add(byte_t lhs, byte_t rhs, bool& carry) noexcept {
+        auto lo = (lhs & 0xF) + (rhs & 0xF) + carry;
+        auto hi = (lhs >> 4) + (rhs >> 4);
+        if (lo > 9) {
+            lo -= 10;
+            hi += 1;
+        }
+        carry = hi > 9;
+        if (carry) {
+            hi -= 10;
+        }
+        return static_cast<byte_t>((hi << 4) | lo);
+    }
+
+    [[nodiscard]] static constexpr byte_t bcd_sub(byte_t lhs, byte_t rhs, bool& borrow) noexcept {
+        auto lo = (lhs & 0xF) - (rhs & 0xF) - borrow;
+        auto hi = (lhs >> 4) - (rhs >> 4);
+        if (lo < 0) {
+            lo += 10;
+            hi -= 1;
+        }
+        borrow = hi < 0;
+        if (borrow) {
+            hi += 10;
+        }
+        return static_cast<byte_t>((hi << 4) | lo);
+    }
+
+    // Bit fields are at most 16 bits wide starting anywhere in a word, so two words always cover one
+    [[nodiscard]] static constexpr dword_t field_get(CTX ctx, FAR addr) noexcept {
+        auto const lo = ctx.mem_get<word_t>(addr);
+        auto const hi = ctx.mem_get<word_t>(addr + 2);
+        return static_cast<dword_t>(lo | (hi << 16));
+    }
+
+    [[nodiscard]] static constexpr Result field_impl(CTX ctx, bool insert, REG offset_reg, byte_t len) noexcept {
+        auto const offset = ctx.reg_get<byte_t>(offset_reg) & 15;
+        auto const bits = (len & 15) + 1;
+        auto const mask = static_cast<dword_t>(((dword_t{1} << bits) - 1) << offset);
+        auto const index = insert ? REG::DI : REG::SI;
+        auto const addr = insert ? ctx.ptr_get(REG::DI, SEG::ES) : ctx.ptr_get(REG::SI, SEG::DS_OR_PREFIX);
+        auto const value = field_get(ctx, addr);
+        if (insert) {
+            auto const field = static_cast<dword_t>(ctx.reg_get<word_t>(REG::AX)) << offset;
+            auto const result = (value & ~mask) | (field & mask);
+            ctx.mem_set<word_t>(addr, static_cast<word_t>(result));
+            if (offset + bits > 16) {
+                ctx.mem_set<word_t>(addr + 2, static_cast<word_t>(result >> 16));
+            }
+        } else {
+            ctx.reg_set<word_t>(REG::AX, static_cast<word_t>((value & mask) >> offset));
+        }
+        auto const next = offset + bits;
+        if (next > 15) {
+            ctx.reg_add(index, 2);
+        }
+        ctx.reg_set<byte_t>(offset_reg, static_cast<byte_t>(next & 15));
+        return ctx.end_next();
+    }
+
+    // Unassigned, BRKEM included
+    template <byte_t OP> requires(!match8("0001xxxx", OP) && OP != 0x20 && OP != 0x22 && OP != 0x26 && OP != 0x28
+                                  && OP != 0x2A && OP != 0x31 && OP != 0x33 && OP != 0x39 && OP != 0x3B)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        return ctx.end_bad();
+    }
+
+    // TEST1/CLR1/SET1/NOT1 rmW, CL/imm
+    template <byte_t OP> requires(match8("0001ibbw", OP))
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        using type = Decode::type<OP & 0b1>;
+        constexpr auto const bit_op = (OP >> 1) & 3;
+        auto const [opt, rm] = Decode::opt_rm(ctx);
+        auto index = byte_t{};
+        if constexpr (OP & 0b1000) {
+            index = Decode::imm<byte_t>(ctx);
+        } else {
+            index = ctx.reg_get<byte_t>(REG::CL);
+        }
+        auto const mask = static_cast<type>(1u << (index % (sizeof(type) * 8)));
+        auto const lhs = ctx.rm_get<type>(rm);
+        if constexpr (bit_op == 0) {
+            auto flags = ctx.flags_get<Flags>();
+            flags.zero = !(lhs & mask);
+            flags.carry = false;
+            flags.overflow = false;
+            ctx.flags_set<Flags>(flags);
+        } else if constexpr (bit_op == 1) {
+            ctx.rm_set<type>(rm, static_cast<type>(lhs & ~mask));
+        } else if constexpr (bit_op == 2) {
+            ctx.rm_set<type>(rm, static_cast<type>(lhs | mask));
+        } else {
+            ctx.rm_set<type>(rm, static_cast<type>(lhs ^ mask));
+        }
+        return ctx.end_next();
+    }
+
+    // ADD4S/SUB4S/CMP4S, CL digits of DS:SI against ES:DI
+    template <byte_t OP> requires(OP == 0x20 || OP == 0x22 || OP == 0x26)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const count = (ctx.reg_get<byte_t>(REG::CL) + 1) / 2;
+        auto const src = ctx.ptr_get(REG::SI, SEG::DS_OR_PREFIX);
+        auto const dst = ctx.ptr_get(REG::DI, SEG::ES);
+        auto carry = false;
+        auto zero = true;
+        for (auto i = 0; i != count; ++i) {
+            auto const lhs = ctx.mem_get<byte_t>(dst + static_cast<sword_t>(i));
+            auto const rhs = ctx.mem_get<byte_t>(src + static_cast<sword_t>(i));
+            auto const result = OP == 0x20 ? bcd_add(lhs, rhs, carry) : bcd_sub(lhs, rhs, carry);
+            zero = zero && result == 0;
+            if constexpr (OP != 0x26) {
+                ctx.mem_set<byte_t>(dst + static_cast<sword_t>(i), result);
+            }
+        }
+        auto flags = ctx.flags_get<Flags>();
+        flags.carry = carry;
+        flags.zero = zero;
+        ctx.flags_set<Flags>(flags);
+        return ctx.end_next();
+    }
+
+    // ROL4 rm8, the low nibble of AL feeds in from the right
+    template <byte_t OP> requires(OP == 0x28)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const [opt, rm] = Decode::opt_rm(ctx);
+        auto const al = ctx.reg_get<byte_t>(REG::AL);
+        auto const value = ctx.rm_get<byte_t>(rm);
+        ctx.rm_set<byte_t>(rm, static_cast<byte_t>((value << 4) | (al & 0xF)));
+        ctx.reg_set<byte_t>(REG::AL, static_cast<byte_t>((al & 0xF0) | (value >> 4)));
+        return ctx.end_next();
+    }
+
+    // ROR4 rm8, the low nibble of AL feeds in from the left
+    template <byte_t OP> requires(OP == 0x2A)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const [opt, rm] = Decode::opt_rm(ctx);
+        auto const al = ctx.reg_get<byte_t>(REG::AL);
+        auto const value = ctx.rm_get<byte_t>(rm);
+        ctx.rm_set<byte_t>(rm, static_cast<byte_t>((al << 4) | (value >> 4)));
+        ctx.reg_set<byte_t>(REG::AL, static_cast<byte_t>((al & 0xF0) | (value & 0xF)));
+        return ctx.end_next();
+    }
+
+    // INS/EXT r8, r8 with the bit offset in the rm register and the length minus one in the reg register
+    template <byte_t OP> requires(OP == 0x31 || OP == 0x33)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const [len_reg, rm] = Decode::reg_rm(ctx);
+        if (!rm.is_reg) {
+            return ctx.end_bad();
+        }
+        auto const len = ctx.reg_get<byte_t>(len_reg);
+        return field_impl(ctx, OP == 0x31, rm.reg, len);
+    }
+
+    // INS/EXT r8, imm4
+    template <byte_t OP> requires(OP == 0x39 || OP == 0x3B)
+    [[nodiscard]] static constexpr Result op(CTX ctx) noexcept {
+        auto const [opt, rm] = Decode::opt_rm(ctx);
+        auto const len = Decode::imm<byte_t>(ctx);
+        if (!rm.is_reg) {
+            return ctx.end_bad();
+        }
+        return field_impl(ctx, OP == 0x39, rm.reg, len);
+    }
+
+    static constexpr auto const table = []<std::size_t...OP>(std::index_sequence<OP...>) consteval {
+        return OPTable {  &op<OP>... };
+    } (std::make_index_sequence<256>());
+#pragma clang diagnostic pop
+};
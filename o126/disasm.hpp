@@ -0,0 +1,398 @@
+#ifndef O126_DISASM_HPP
+#define O126_DISASM_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "cpu/impl_decode.hpp"
+#include <array>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Intel syntax text of one instruction, for reports rather than round trips through an assembler
+struct o126::DISASM final {
+    struct Result final {
+        std::string text = {};
+        byte_t len = {};
+    };
+private:
+    enum class Arg : byte_t {
+        NONE,
+        EB, // modrm operand
+        EV,
+        GB, // modrm register
+        GV,
+        SW, // modrm segment register
+        M, // modrm memory operand without a size
+        IB,
+        IV,
+        IS, // immediate byte sign extended to a word
+        JB, // relative target
+        JV,
+        AP, // far pointer
+        OB, // direct address
+        OV,
+        ONE,
+        AL,
+        AX,
+        CL,
+        DX,
+        RB, // register in the low opcode bits
+        RV,
+        ES,
+        CS,
+        SS,
+        DS,
+    };
+
+    struct Op final {
+        std::string_view name = {};
+        Arg lhs = Arg::NONE;
+        Arg rhs = Arg::NONE;
+        Arg third = Arg::NONE;
+    };
+
+    static constexpr std::string_view reg8[8] = { "al", "cl", "dl", "bl", "ah", "ch", "dh", "bh" };
+    static constexpr std::string_view reg16[8] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di" };
+    static constexpr std::string_view sreg[8] = { "es", "cs", "ss", "ds", "es", "cs", "ss", "ds" };
+    static constexpr std::string_view bases[8] = { "bx+si", "bx+di", "bp+si", "bp+di", "si", "di", "bp", "bx" };
+    static constexpr std::string_view alu[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+    static constexpr std::string_view shifts[8] = { "rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar" };
+    static constexpr std::string_view unary[8] = { "test", "test", "not", "neg", "mul", "imul", "div", "idiv" };
+    static constexpr std::string_view conds[16] = {
+        "jo", "jno", "jb", "jnb", "jz", "jnz", "jbe", "ja", "js", "jns", "jp", "jnp", "jl", "jge", "jle", "jg",
+    };
+
+    // Evaluated inside decode, the default member initializers of Op are not usable before the class is complete
+    [[nodiscard]] static constexpr std::array<Op, 256> build() noexcept {
+        auto result = std::array<Op, 256>{};
+        for (auto i = 0; i != 8; ++i) {
+            result[i * 8 + 0] = { alu[i], Arg::EB, Arg::GB };
+            result[i * 8 + 1] = { alu[i], Arg::EV, Arg::GV };
+            result[i * 8 + 2] = { alu[i], Arg::GB, Arg::EB };
+            result[i * 8 + 3] = { alu[i], Arg::GV, Arg::EV };
+            result[i * 8 + 4] = { alu[i], Arg::AL, Arg::IB };
+            result[i * 8 + 5] = { alu[i], Arg::AX, Arg::IV };
+            result[0x40 + i] = { "inc", Arg::RV };
+            result[0x48 + i] = { "dec", Arg::RV };
+            result[0x50 + i] = { "push", Arg::RV };
+            result[0x58 + i] = { "pop", Arg::RV };
+            result[0x90 + i] = { "xchg", Arg::AX, Arg::RV };
+            result[0xB0 + i] = { "mov", Arg::RB, Arg::IB };
+            result[0xB8 + i] = { "mov", Arg::RV, Arg::IV };
+        }
+        result[0x90] = { "nop" };
+        for (auto i = 0; i != 4; ++i) {
+            auto const seg = static_cast<Arg>(static_cast<int>(Arg::ES) + i);
+            result[i * 8 + 0x06] = { "push", seg };
+            result[i * 8 + 0x07] = { "pop", seg };
+        }
+        result[0x27] = { "daa" };
+        result[0x2F] = { "das" };
+        result[0x37] = { "aaa" };
+        result[0x3F] = { "aas" };
+        result[0x60] = { "pusha" };
+        result[0x61] = { "popa" };
+        result[0x62] = { "bound", Arg::GV, Arg::M };
+        result[0x68] = { "push", Arg::IV };
+        result[0x69] = { "imul", Arg::GV, Arg::EV, Arg::IV };
+        result[0x6A] = { "push", Arg::IS };
+        result[0x6B] = { "imul", Arg::GV, Arg::EV, Arg::IS };
+        result[0x6C] = { "insb" };
+        result[0x6D] = { "insw" };
+        result[0x6E] = { "outsb" };
+        result[0x6F] = { "outsw" };
+        for (auto i = 0; i != 16; ++i) {
+            result[0x70 + i] = { conds[i], Arg::JB };
+        }
+        result[0x84] = { "test", Arg::EB, Arg::GB };
+        result[0x85] = { "test", Arg::EV, Arg::GV };
+        result[0x86] = { "xchg", Arg::EB, Arg::GB };
+        result[0x87] = { "xchg", Arg::EV, Arg::GV };
+        result[0x88] = { "mov", Arg::EB, Arg::GB };
+        result[0x89] = { "mov", Arg::EV, Arg::GV };
+        result[0x8A] = { "mov", Arg::GB, Arg::EB };
+        result[0x8B] = { "mov", Arg::GV, Arg::EV };
+        result[0x8C] = { "mov", Arg::EV, Arg::SW };
+        result[0x8D] = { "lea", Arg::GV, Arg::M };
+        result[0x8E] = { "mov", Arg::SW, Arg::EV };
+        result[0x8F] = { "pop", Arg::EV };
+        result[0x98] = { "cbw" };
+        result[0x99] = { "cwd" };
+        result[0x9A] = { "call", Arg::AP };
+        result[0x9B] = { "wait" };
+        result[0x9C] = { "pushf" };
+        result[0x9D] = { "popf" };
+        result[0x9E] = { "sahf" };
+        result[0x9F] = { "lahf" };
+        result[0xA0] = { "mov", Arg::AL, Arg::OB };
+        result[0xA1] = { "mov", Arg::AX, Arg::OV };
+        result[0xA2] = { "mov", Arg::OB, Arg::AL };
+        result[0xA3] = { "mov", Arg::OV, Arg::AX };
+        result[0xA4] = { "movsb" };
+        result[0xA5] = { "movsw" };
+        result[0xA6] = { "cmpsb" };
+        result[0xA7] = { "cmpsw" };
+        result[0xA8] = { "test", Arg::AL, Arg::IB };
+        result[0xA9] = { "test", Arg::AX, Arg::IV };
+        result[0xAA] = { "stosb" };
+        result[0xAB] = { "stosw" };
+        result[0xAC] = { "lodsb" };
+        result[0xAD] = { "lodsw" };
+        result[0xAE] = { "scasb" };
+        result[0xAF] = { "scasw" };
+        result[0xC2] = { "ret", Arg::IV };
+        result[0xC3] = { "ret" };
+        result[0xC4] = { "les", Arg::GV, Arg::M };
+        result[0xC5] = { "lds", Arg::GV, Arg::M };
+        result[0xC6] = { "mov", Arg::EB, Arg::IB };
+        result[0xC7] = { "mov", Arg::EV, Arg::IV };
+        result[0xC8] = { "enter", Arg::IV, Arg::IB };
+        result[0xC9] = { "leave" };
+        result[0xCA] = { "retf", Arg::IV };
+        result[0xCB] = { "retf" };
+        result[0xCC] = { "int3" };
+        result[0xCD] = { "int", Arg::IB };
+        result[0xCE] = { "into" };
+        result[0xCF] = { "iret" };
+        result[0xD4] = { "aam", Arg::IB };
+        result[0xD5] = { "aad", Arg::IB };
+        result[0xD6] = { "salc" };
+        result[0xD7] = { "xlat" };
+        result[0xE0] = { "loopnz", Arg::JB };
+        result[0xE1] = { "loopz", Arg::JB };
+        result[0xE2] = { "loop", Arg::JB };
+        result[0xE3] = { "jcxz", Arg::JB };
+        result[0xE4] = { "in", Arg::AL, Arg::IB };
+        result[0xE5] = { "in", Arg::AX, Arg::IB };
+        result[0xE6] = { "out", Arg::IB, Arg::AL };
+        result[0xE7] = { "out", Arg::IB, Arg::AX };
+        result[0xE8] = { "call", Arg::JV };
+        result[0xE9] = { "jmp", Arg::JV };
+        result[0xEA] = { "jmp", Arg::AP };
+        result[0xEB] = { "jmp", Arg::JB };
+        result[0xEC] = { "in", Arg::AL, Arg::DX };
+        result[0xED] = { "in", Arg::AX, Arg::DX };
+        result[0xEE] = { "out", Arg::DX, Arg::AL };
+        result[0xEF] = { "out", Arg::DX, Arg::AX };
+        result[0xF4] = { "hlt" };
+        result[0xF5] = { "cmc" };
+        result[0xF8] = { "clc" };
+        result[0xF9] = { "stc" };
+        result[0xFA] = { "cli" };
+        result[0xFB] = { "sti" };
+        result[0xFC] = { "cld" };
+        result[0xFD] = { "std" };
+        return result;
+    }
+
+    // Bytes past the end of the span read as zero, the length still tells how many were needed
+    struct Reader final {
+        std::span<byte_t const> code;
+        std::size_t pos = {};
+        char const* seg = {};
+
+        [[nodiscard]] byte_t byte() noexcept {
+            auto const result = pos < code.size() ? code[pos] : byte_t{};
+            pos += 1;
+            return result;
+        }
+
+        [[nodiscard]] word_t word() noexcept {
+            auto const lo = byte();
+            return word_pack(lo, byte());
+        }
+    };
+
+    [[nodiscard]] static std::string hex(unsigned val) {
+        char buffer[16] = {};
+        std::snprintf(buffer, sizeof(buffer), "0x%X", val);
+        return buffer;
+    }
+
+    [[nodiscard]] static std::string memory(Reader& in, byte_t modrm, std::string_view size) {
+        auto const mod = modrm >> 6;
+        auto const rm = modrm & 7;
+        auto result = std::string(size);
+        if (!result.empty()) {
+            result += ' ';
+        }
+        if (in.seg) {
+            result += in.seg;
+            result += ':';
+        }
+        result += '[';
+        if (mod == 0 && rm == 6) {
+            result += hex(in.word());
+        } else {
+            result += bases[rm];
+            auto const disp = mod == 1 ? static_cast<sword_t>(static_cast<sbyte_t>(in.byte())) : mod == 2 ? static_cast<sword_t>(in.word()) : sword_t{};
+            if (disp < 0) {
+                result += '-' + hex(static_cast<unsigned>(-disp));
+            } else if (disp > 0) {
+                result += '+' + hex(static_cast<unsigned>(disp));
+            }
+        }
+        return result + ']';
+    }
+
+    [[nodiscard]] static std::string operand(Reader& in, Arg arg, byte_t op, byte_t modrm, word_t ip) {
+        auto const rm_reg = (modrm >> 6) == 3;
+        switch (arg) {
+        case Arg::EB:
+            return rm_reg ? std::string(reg8[modrm & 7]) : memory(in, modrm, "byte");
+        case Arg::EV:
+            return rm_reg ? std::string(reg16[modrm & 7]) : memory(in, modrm, "word");
+        case Arg::M:
+            return rm_reg ? std::string(reg16[modrm & 7]) : memory(in, modrm, "");
+        case Arg::GB:
+            return std::string(reg8[(modrm >> 3) & 7]);
+        case Arg::GV:
+            return std::string(reg16[(modrm >> 3) & 7]);
+        case Arg::SW:
+            return std::string(sreg[(modrm >> 3) & 7]);
+        case Arg::IB:
+            return hex(in.byte());
+        case Arg::IV:
+            return hex(in.word());
+        case Arg::IS: {
+            auto const val = static_cast<sbyte_t>(in.byte());
+            return val < 0 ? '-' + hex(static_cast<unsigned>(-val)) : hex(static_cast<unsigned>(val));
+        }
+        case Arg::JB: {
+            auto const disp = static_cast<sbyte_t>(in.byte());
+            return hex(static_cast<word_t>(ip + in.pos + disp));
+        }
+        case Arg::JV: {
+            auto const disp = in.word();
+            return hex(static_cast<word_t>(ip + in.pos + disp));
+        }
+        case Arg::AP: {
+            auto const disp = in.word();
+            return hex(in.word()) + ':' + hex(disp);
+        }
+        case Arg::OB:
+        case Arg::OV:
+            return std::string(arg == Arg::OB ? "byte " : "word ") + (in.seg ? std::string(in.seg) + ':' : "") + '[' + hex(in.word()) + ']';
+        case Arg::ONE:
+            return "1";
+        case Arg::AL:
+            return "al";
+        case Arg::AX:
+            return "ax";
+        case Arg::CL:
+            return "cl";
+        case Arg::DX:
+            return "dx";
+        case Arg::RB:
+            return std::string(reg8[op & 7]);
+        case Arg::RV:
+            return std::string(reg16[op & 7]);
+        case Arg::ES:
+        case Arg::CS:
+        case Arg::SS:
+        case Arg::DS:
+            return std::string(sreg[static_cast<int>(arg) - static_cast<int>(Arg::ES)]);
+        default:
+            return {};
+        }
+    }
+
+    // Opcodes whose meaning depends on the reg field of their modrm byte
+    [[nodiscard]] static bool group(byte_t op, byte_t reg, Op& result) noexcept {
+        switch (op) {
+        case 0x80:
+        case 0x82:
+            result = { alu[reg], Arg::EB, Arg::IB };
+            return true;
+        case 0x81:
+            result = { alu[reg], Arg::EV, Arg::IV };
+            return true;
+        case 0x83:
+            result = { alu[reg], Arg::EV, Arg::IS };
+            return true;
+        case 0xC0:
+        case 0xC1:
+        case 0xD0:
+        case 0xD1:
+        case 0xD2:
+        case 0xD3: {
+            auto const size = op & 1 ? Arg::EV : Arg::EB;
+            result = { shifts[reg], size, op >= 0xD2 ? Arg::CL : op >= 0xD0 ? Arg::ONE : Arg::IB };
+            return true;
+        }
+        case 0xF6:
+        case 0xF7: {
+            auto const size = op & 1 ? Arg::EV : Arg::EB;
+            result = { unary[reg], size, reg < 2 ? (op & 1 ? Arg::IV : Arg::IB) : Arg::NONE };
+            return true;
+        }
+        case 0xFE:
+            result = reg < 2 ? Op { reg ? "dec" : "inc", Arg::EB } : Op {};
+            return true;
+        case 0xFF: {
+            static constexpr Op ops[8] = {
+                { "inc", Arg::EV }, { "dec", Arg::EV }, { "call", Arg::EV }, { "call far", Arg::M },
+                { "jmp", Arg::EV }, { "jmp far", Arg::M }, { "push", Arg::EV }, {},
+            };
+            result = ops[reg];
+            return true;
+        }
+        default:
+            if (op >= 0xD8 && op <= 0xDF) {
+                result = { "esc", Arg::M };
+                return true;
+            }
+            return false;
+        }
+    }
+public:
+    // ip is where the instruction starts in its code segment, relative targets are shown as offsets in it
+    [[nodiscard]] static Result decode(std::span<byte_t const> code, word_t ip, CPU::Model model = CPU::Model::I80186) {
+        static constexpr auto const table = build();
+        auto const layout = CPU::Layout::inst(model, [&](byte_t i) { return i < code.size() ? code[i] : byte_t{}; });
+        auto in = Reader { code };
+        auto prefixes = std::string{};
+        for (; in.pos != layout.prefixes; in.pos += 1) {
+            auto const op = CPU::Layout::alias(model, code[in.pos]);
+            if (op == 0xF0) {
+                prefixes += "lock ";
+            } else if (op == 0xF2) {
+                prefixes += "repnz ";
+            } else if (op == 0xF3) {
+                prefixes += "rep ";
+            } else {
+                static constexpr char const* names[4] = { "es", "cs", "ss", "ds" };
+                in.seg = names[(op >> 3) & 3];
+            }
+        }
+        auto const raw = in.byte();
+        auto const op = layout.op;
+        auto entry = table[op];
+        auto const modrm = layout.modrm;
+        if (layout.has_modrm) {
+            in.pos += 1;
+            (void)group(op, (modrm >> 3) & 7, entry);
+        }
+        auto result = Result{};
+        if (layout.flow == CPU::Layout::Flow::INVALID || entry.name.empty()) {
+            result.text = "db " + hex(raw);
+            result.len = static_cast<byte_t>(in.pos);
+            return result;
+        }
+        result.text = prefixes + std::string(entry.name);
+        // Memory operands come first in the encoding, immediates after them
+        auto separator = " ";
+        for (auto const arg : { entry.lhs, entry.rhs, entry.third }) {
+            if (arg == Arg::NONE) {
+                break;
+            }
+            result.text += separator + operand(in, arg, op, modrm, ip);
+            separator = ", ";
+        }
+        result.len = layout.len;
+        return result;
+    }
+};
+
+#endif // O126_DISASM_HPP
@@ -0,0 +1,253 @@
+#ifndef O126_DISK_HPP
+#define O126_DISK_HPP
+#include "common.hpp"
+#include "mapping.hpp"
+#include "mem.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Raw sector image, the file is mapped read-only and every write lands in a private overlay
+struct o126::DISK {
+public:
+    static constexpr std::size_t SECTOR_SIZE = 512;
+
+    struct Geometry final {
+        word_t cylinders = {};
+        byte_t heads = {};
+        byte_t sectors = {};
+    };
+
+    // Read-only mapping of an image file, shared by every DISK opened from it
+    using Image = MAPPING;
+private:
+    static constexpr std::size_t CHUNK_SECTORS = 8;
+    static constexpr std::size_t CHUNK_SIZE = CHUNK_SECTORS * SECTOR_SIZE;
+
+    struct Floppy {
+        std::size_t size;
+        Geometry geometry;
+    };
+
+    static constexpr Floppy floppies[] = {
+        { 160 * 1024, { 40, 1, 8 } },
+        { 180 * 1024, { 40, 1, 9 } },
+        { 320 * 1024, { 40, 2, 8 } },
+        { 360 * 1024, { 40, 2, 9 } },
+        { 720 * 1024, { 80, 2, 9 } },
+        { 1200 * 1024, { 80, 2, 15 } },
+        { 1440 * 1024, { 80, 2, 18 } },
+        { 2880 * 1024, { 80, 2, 36 } },
+    };
+
+    std::shared_ptr<Image const> image = {};
+    // Chunks are shared with forked instances until either side writes them
+    std::vector<std::shared_ptr<byte_t[]>> overlay = {};
+    dword_t count = {};
+    Geometry geometry = {};
+    bool hard = {};
+
+    // Private copy of the chunk holding lba, created from the base image on first write
+    byte_t* chunk(dword_t lba) {
+        auto& result = overlay[lba / CHUNK_SECTORS];
+        if (!result) {
+            result = std::make_shared<byte_t[]>(CHUNK_SIZE);
+            auto const offset = (lba / CHUNK_SECTORS) * CHUNK_SIZE;
+            auto const size = std::min(CHUNK_SIZE, image->size - std::min(image->size, offset));
+            std::memcpy(result.get(), image->data + offset, size);
+        } else if (result.use_count() != 1) {
+            auto copy = std::make_shared_for_overwrite<byte_t[]>(CHUNK_SIZE);
+            std::memcpy(copy.get(), result.get(), CHUNK_SIZE);
+            result = std::move(copy);
+        }
+        return result.get();
+    }
+public:
+    DISK() noexcept = default;
+    DISK(DISK const&) = delete;
+    DISK& operator=(DISK const&) = delete;
+
+    void open(std::string filename, bool hard_disk) {
+        attach(std::make_shared<Image const>(filename), hard_disk);
+    }
+
+    // Same image and contents as other, written chunks are shared until either side writes them again
+    void share(DISK const& other) {
+        image = other.image;
+        overlay = other.overlay;
+        count = other.count;
+        geometry = other.geometry;
+        hard = other.hard;
+    }
+
+    // Shares an already mapped image, for example between instances started from the same base
+    void attach(std::shared_ptr<Image const> base, bool hard_disk) {
+        if (base->size < SECTOR_SIZE) {
+            throw "Bad disk image size!";
+        }
+        auto const sectors = static_cast<dword_t>(base->size / SECTOR_SIZE);
+        auto result = Geometry{};
+        if (!hard_disk) {
+            auto const it = std::find_if(std::begin(floppies), std::end(floppies), [&](Floppy const& floppy) {
+                return floppy.size == base->size;
+            });
+            if (it == std::end(floppies)) {
+                throw "Unknown floppy image size!";
+            }
+            result = it->geometry;
+        } else if (auto const cylinders = sectors / (4 * 17); cylinders <= 1024) {
+            result = { static_cast<word_t>(std::max<dword_t>(cylinders, 1)), 4, 17 };
+        } else {
+            result = { static_cast<word_t>(std::min<dword_t>(sectors / (16 * 63), 1024)), 16, 63 };
+        }
+        image = std::move(base);
+        overlay.clear();
+        overlay.resize((sectors + CHUNK_SECTORS - 1) / CHUNK_SECTORS);
+        count = std::min<dword_t>(sectors, dword_t{result.cylinders} * result.heads * result.sectors);
+        geometry = result;
+        hard = hard_disk;
+    }
+
+    void close() noexcept {
+        image.reset();
+        overlay.clear();
+        count = {};
+        geometry = {};
+    }
+
+    [[nodiscard]] bool present() const noexcept {
+        return image != nullptr;
+    }
+
+    [[nodiscard]] bool hard_disk() const noexcept {
+        return hard;
+    }
+
+    [[nodiscard]] dword_t sectors() const noexcept {
+        return count;
+    }
+
+    [[nodiscard]] Geometry const& chs() const noexcept {
+        return geometry;
+    }
+
+    [[nodiscard]] std::shared_ptr<Image const> const& base() const noexcept {
+        return image;
+    }
+
+    // Sector numbers start at 1, returns sectors() when the address is outside the disk
+    [[nodiscard]] dword_t lba(word_t cylinder, byte_t head, byte_t sector) const noexcept {
+        if (cylinder >= geometry.cylinders || head >= geometry.heads || sector == 0 || sector > geometry.sectors) {
+            return count;
+        }
+        return (dword_t{cylinder} * geometry.heads + head) * geometry.sectors + sector - 1;
+    }
+
+    // Longest contiguous run of sector data starting at lba, at most sectors long
+    [[nodiscard]] std::span<byte_t const> run(dword_t lba, dword_t sectors) const noexcept {
+        auto const index = lba / CHUNK_SECTORS;
+        if (auto const& copy = overlay[index]) {
+            auto const first = lba % CHUNK_SECTORS;
+            auto const size = std::min<std::size_t>(sectors, CHUNK_SECTORS - first);
+            return { copy.get() + first * SECTOR_SIZE, size * SECTOR_SIZE };
+        }
+        auto end = lba;
+        while (end != lba + sectors && !overlay[end / CHUNK_SECTORS]) {
+            end = std::min(lba + sectors, static_cast<dword_t>((end / CHUNK_SECTORS + 1) * CHUNK_SECTORS));
+        }
+        return { image->data + std::size_t{lba} * SECTOR_SIZE, std::size_t{end - lba} * SECTOR_SIZE };
+    }
+
+    // Copies into guest memory with one memcpy per contiguous run, false when out of range
+    bool read(dword_t lba, dword_t sectors, MEM& mem, dword_t ea) const noexcept {
+        if (lba > count || sectors > count - lba) {
+            return false;
+        }
+        while (sectors) {
+            auto const data = run(lba, sectors);
+            auto const done = static_cast<dword_t>(data.size() / SECTOR_SIZE);
+            mem.copy_in(ea, data);
+            ea += static_cast<dword_t>(data.size());
+            lba += done;
+            sectors -= done;
+        }
+        return true;
+    }
+
+    bool write(dword_t lba, std::span<byte_t const> data) {
+        auto const sectors = static_cast<dword_t>(data.size() / SECTOR_SIZE);
+        if (lba > count || sectors > count - lba) {
+            return false;
+        }
+        for (auto i = dword_t{}; i != sectors;) {
+            auto const first = (lba + i) % CHUNK_SECTORS;
+            auto const size = std::min<dword_t>(sectors - i, static_cast<dword_t>(CHUNK_SECTORS - first));
+            std::memcpy(chunk(lba + i) + first * SECTOR_SIZE, data.data() + std::size_t{i} * SECTOR_SIZE, size * SECTOR_SIZE);
+            i += size;
+        }
+        return true;
+    }
+
+    bool write(dword_t lba, dword_t sectors, MEM const& mem, dword_t ea) {
+        if (lba > count || sectors > count - lba) {
+            return false;
+        }
+        for (auto i = dword_t{}; i != sectors;) {
+            auto const first = (lba + i) % CHUNK_SECTORS;
+            auto const size = std::min<dword_t>(sectors - i, static_cast<dword_t>(CHUNK_SECTORS - first));
+            auto const dst = std::span<byte_t>(chunk(lba + i) + first * SECTOR_SIZE, size * SECTOR_SIZE);
+            mem.copy_out(ea + i * static_cast<dword_t>(SECTOR_SIZE), dst);
+            i += size;
+        }
+        return true;
+    }
+
+    // Writes the image with the overlay applied
+    void save(std::string filename) const {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw "Failed to open disk image for writing!";
+        }
+        for (auto lba = dword_t{}; lba != count;) {
+            auto const data = run(lba, count - lba);
+            file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size()));
+            lba += static_cast<dword_t>(data.size() / SECTOR_SIZE);
+        }
+    }
+
+    /// Machine state, only the overlay is stored and the base image has to be attached already
+    template <typename S>
+    void serialize(S& s) {
+        auto chunks = static_cast<dword_t>(std::count_if(overlay.begin(), overlay.end(), [](auto const& chunk) {
+            return chunk != nullptr;
+        }));
+        s(chunks);
+        if constexpr (S::LOADING) {
+            for (auto& chunk : overlay) {
+                chunk.reset();
+            }
+            for (auto i = dword_t{}; i != chunks; ++i) {
+                auto index = dword_t{};
+                s(index);
+                if (index >= overlay.size()) {
+                    throw "Disk overlay does not match the image!";
+                }
+                overlay[index] = std::make_shared_for_overwrite<byte_t[]>(CHUNK_SIZE);
+                s.bytes({ overlay[index].get(), CHUNK_SIZE });
+            }
+        } else {
+            for (auto i = dword_t{}; i != overlay.size(); ++i) {
+                if (overlay[i]) {
+                    s(i);
+                    s.bytes({ overlay[i].get(), CHUNK_SIZE });
+                }
+            }
+        }
+    }
+};
+
+#endif // O126_DISK_HPP
@@ -0,0 +1,263 @@
+#ifndef O126_DMA_HPP
+#define O126_DMA_HPP
+#include "common.hpp"
+#include "mem.hpp"
+#include "sched.hpp"
+#include <algorithm>
+#include <span>
+
+struct o126::DMA {
+private:
+    enum class Type : byte_t {
+        VERIFY = 0b00,
+        WRITE = 0b01, // device to memory
+        READ = 0b10, // memory to device
+        ILLEGAL = 0b11,
+    };
+
+    enum class Mode : byte_t {
+        DEMAND = 0b00,
+        SINGLE = 0b01,
+        BLOCK = 0b10,
+        CASCADE = 0b11,
+    };
+
+    struct Channel {
+        word_t base_addr = {};
+        word_t base_count = {};
+        word_t addr = {};
+        word_t count = {};
+        Type type = {};
+        Mode mode = {};
+        bool autoinit = {};
+        bool decrement = {};
+    };
+
+    // Page register index for each channel in the 0x80-0x8F block
+    static constexpr byte_t page_index[4] = { 0x7, 0x3, 0x1, 0x2 };
+
+    // 4 states per transfer plus the wait state inserted on the PC/XT
+    static constexpr std::uint64_t CYCLES_PER_TRANSFER = 5;
+
+    Channel channels[4] = {};
+    byte_t pages[16] = {};
+    byte_t command = {};
+    byte_t status = {};
+    byte_t mask = 0b1111;
+    byte_t temp = {};
+    bool flipflop = {};
+
+    constexpr byte_t access(word_t& reg) noexcept {
+        auto const [lo, hi] = word_unpack(reg);
+        flipflop = !flipflop;
+        return flipflop ? lo : hi;
+    }
+
+    constexpr void access(word_t& reg, byte_t val) noexcept {
+        auto const [lo, hi] = word_unpack(reg);
+        flipflop = !flipflop;
+        reg = flipflop ? word_pack(val, hi) : word_pack(lo, val);
+    }
+
+    [[nodiscard]] constexpr bool ready(byte_t index, Type type) const noexcept {
+        auto const& channel = channels[index];
+        if (command & 0b100) {
+            return false;
+        }
+        if (mask & (1 << index)) {
+            return false;
+        }
+        if (channel.mode == Mode::CASCADE) {
+            return false;
+        }
+        return channel.type == type || channel.type == Type::VERIFY;
+    }
+
+    // Calls func once per run that does not cross the 64K boundary of the 8237 address counter
+    template <typename F>
+    constexpr std::size_t transfer(SCHED& sched, byte_t index, std::size_t size, F&& func) noexcept {
+        auto& channel = channels[index];
+        auto const remaining = channel.count + std::size_t{1};
+        auto const total = std::min(size, remaining);
+        auto done = std::size_t{};
+        while (done != total) {
+            auto const page = static_cast<dword_t>(pages[page_index[index]]) << 16;
+            auto const room = channel.decrement ? channel.addr + 1u : 0x10000u - channel.addr;
+            auto const run = std::min<std::size_t>(total - done, room);
+            if (channel.type != Type::VERIFY) {
+                auto const lo = channel.decrement ? channel.addr + 1u - run : channel.addr;
+                func(page | static_cast<dword_t>(lo), done, run, channel.decrement);
+            }
+            channel.addr += static_cast<word_t>(channel.decrement ? -run : run);
+            done += run;
+        }
+        channel.count -= static_cast<word_t>(total);
+        status &= static_cast<byte_t>(~(0x10 << index));
+        if (total == remaining) {
+            status |= static_cast<byte_t>(1 << index);
+            if (channel.autoinit) {
+                channel.addr = channel.base_addr;
+                channel.count = channel.base_count;
+            } else {
+                mask |= static_cast<byte_t>(1 << index);
+            }
+        }
+        sched.charge(total * CYCLES_PER_TRANSFER);
+        return total;
+    }
+public:
+    /// Port interface
+    [[nodiscard]] static constexpr bool has_port(word_t port) noexcept {
+        return port < 0x10 || (port >= 0x80 && port < 0x90);
+    }
+
+    constexpr byte_t in_byte(word_t port) noexcept {
+        if (port >= 0x80) {
+            return pages[port & 0xF];
+        }
+        if (port < 0x08) {
+            auto& channel = channels[port >> 1];
+            return access(port & 1 ? channel.count : channel.addr);
+        }
+        switch (port) {
+        case 0x08: {
+            auto const result = status;
+            status &= 0xF0;
+            return result;
+        }
+        case 0x0D:
+            return temp;
+        default:
+            return 0xFF;
+        }
+    }
+
+    constexpr void out_byte(word_t port, byte_t val) noexcept {
+        if (port >= 0x80) {
+            pages[port & 0xF] = val;
+            return;
+        }
+        if (port < 0x08) {
+            auto& channel = channels[port >> 1];
+            if (port & 1) {
+                access(channel.base_count, val);
+                channel.count = channel.base_count;
+            } else {
+                access(channel.base_addr, val);
+                channel.addr = channel.base_addr;
+            }
+            return;
+        }
+        switch (port) {
+        case 0x08:
+            command = val;
+            break;
+        case 0x09:
+            if (val & 0b100) {
+                status |= static_cast<byte_t>(0x10 << (val & 3));
+            } else {
+                status &= static_cast<byte_t>(~(0x10 << (val & 3)));
+            }
+            break;
+        case 0x0A:
+            if (val & 0b100) {
+                mask |= static_cast<byte_t>(1 << (val & 3));
+            } else {
+                mask &= static_cast<byte_t>(~(1 << (val & 3)));
+            }
+            break;
+        case 0x0B: {
+            auto& channel = channels[val & 3];
+            channel.type = static_cast<Type>((val >> 2) & 3);
+            channel.autoinit = val & 0x10;
+            channel.decrement = val & 0x20;
+            channel.mode = static_cast<Mode>(val >> 6);
+            break;
+        }
+        case 0x0C:
+            flipflop = false;
+            break;
+        case 0x0D:
+            command = {};
+            status = {};
+            temp = {};
+            flipflop = false;
+            mask = 0b1111;
+            break;
+        case 0x0E:
+            mask = {};
+            break;
+        case 0x0F:
+            mask = val & 0b1111;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /// Device interface
+    [[nodiscard]] constexpr bool terminal_count(byte_t index) const noexcept {
+        return status & (1 << index);
+    }
+
+    [[nodiscard]] constexpr bool masked(byte_t index) const noexcept {
+        return mask & (1 << index);
+    }
+
+    // Device to memory, returns number of bytes the channel accepted before terminal count
+    std::size_t write(MEM& mem, SCHED& sched, byte_t index, std::span<byte_t const> src) noexcept {
+        if (!ready(index, Type::WRITE)) {
+            return 0;
+        }
+        return transfer(sched, index, src.size(), [&](dword_t ea, std::size_t pos, std::size_t size, bool reverse) {
+            auto const run = src.subspan(pos, size);
+            if (!reverse) {
+                mem.copy_in(ea, run);
+                return;
+            }
+            byte_t buffer[256];
+            for (auto i = std::size_t{}; i < size; i += sizeof(buffer)) {
+                auto const chunk = std::min(sizeof(buffer), size - i);
+                std::reverse_copy(run.begin() + i, run.begin() + i + chunk, buffer);
+                mem.copy_in(static_cast<dword_t>(ea + size - i - chunk), { buffer, chunk });
+            }
+        });
+    }
+
+    // Memory to device, returns number of bytes the channel provided before terminal count
+    std::size_t read(MEM& mem, SCHED& sched, byte_t index, std::span<byte_t> dst) noexcept {
+        if (!ready(index, Type::READ)) {
+            return 0;
+        }
+        return transfer(sched, index, dst.size(), [&](dword_t ea, std::size_t pos, std::size_t size, bool reverse) {
+            auto const run = dst.subspan(pos, size);
+            mem.copy_out(ea, run);
+            if (reverse) {
+                std::reverse(run.begin(), run.end());
+            }
+        });
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        for (auto& channel : channels) {
+            s(channel.base_addr);
+            s(channel.base_count);
+            s(channel.addr);
+            s(channel.count);
+            s(channel.type);
+            s(channel.mode);
+            s(channel.autoinit);
+            s(channel.decrement);
+        }
+        s(pages);
+        s(command);
+        s(status);
+        s(mask);
+        s(temp);
+        s(flipflop);
+    }
+};
+
+#endif // O126_DMA_HPP
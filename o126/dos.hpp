@@ -0,0 +1,1126 @@
+#ifndef O126_DOS_HPP
+#define O126_DOS_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "hle.hpp"
+#include "mapping.hpp"
+#include "pc.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// INT 20h/21h services against a host directory that appears to the guest as drive C:
+struct o126::DOS {
+public:
+    // First paragraph after the interupt table, BIOS data area and the stubs below
+    static constexpr word_t ARENA_START = 0x0060;
+    static constexpr word_t ARENA_END = 0xA000;
+private:
+    using REG = CPU::REG;
+    using SEG = CPU::SEG;
+
+    // HLT loop that ends a program without a parent, then an IRET that fails every unhandled call
+    static constexpr word_t STUB_SEG = 0x0050;
+    static constexpr word_t STUB_EXIT = 0x0000;
+    static constexpr word_t STUB_UNHANDLED = 0x0004;
+    static constexpr byte_t stub[] = {
+        0xF4, 0xEB, 0xFD, 0x90, // hlt; jmp $-1; nop
+        0xB8, 0x01, 0x00, 0xF9, 0xCA, 0x02, 0x00, // mov ax, 1; stc; retf 2
+    };
+
+    static constexpr std::size_t HANDLES = 20;
+
+    // Environment of a program started from the host, the literal adds the second terminating zero
+    static constexpr char default_env[] = "COMSPEC=C:\\COMMAND.COM\0PATH=C:\\\0";
+
+    enum class Error : word_t {
+        NONE = 0x00,
+        FUNCTION = 0x01,
+        FILE_NOT_FOUND = 0x02,
+        PATH_NOT_FOUND = 0x03,
+        TOO_MANY_FILES = 0x04,
+        ACCESS_DENIED = 0x05,
+        HANDLE = 0x06,
+        MEMORY = 0x08,
+        BLOCK = 0x09,
+        DRIVE = 0x0F,
+        FORMAT = 0x0B,
+        CURRENT_DIRECTORY = 0x10,
+        NO_MORE_FILES = 0x12,
+    };
+
+    struct Handle {
+        std::FILE* file = nullptr;
+        bool device = {}; // console or NUL, never closed or seeked
+        bool writing = {};
+        word_t owner = {};
+    };
+
+    struct Block {
+        word_t size = {};
+        word_t owner = {};
+    };
+
+    struct Entry {
+        std::string name = {};
+        dword_t size = {};
+        word_t time = {};
+        word_t date = {};
+        byte_t attr = {};
+    };
+
+    struct Search {
+        std::vector<Entry> entries = {};
+        std::size_t next = {};
+    };
+
+    // State of a parent suspended in INT 21h function 4Bh
+    struct Caller {
+        FAR stack = {};
+        FAR dta = {};
+    };
+
+    PC& pc;
+    std::filesystem::path root;
+    std::vector<std::string> cwd = {};
+    Handle handles[HANDLES] = {};
+    std::map<word_t, Block> blocks = {};
+    std::unordered_map<dword_t, Search> searches = {};
+    std::vector<Caller> callers = {};
+    FAR dta = { 0x80, 0 };
+
+    /// Guest registers and memory
+    void set_carry(bool carry) noexcept {
+        auto flags = pc.cpu.flags_get();
+        flags.carry = carry;
+        pc.cpu.flags_set(flags);
+    }
+
+    void set_zero(bool zero) noexcept {
+        auto flags = pc.cpu.flags_get();
+        flags.zero = zero;
+        pc.cpu.flags_set(flags);
+    }
+
+    void ok() noexcept {
+        set_carry(false);
+    }
+
+    void fail(Error error) noexcept {
+        pc.cpu.reg_set(REG::AX, static_cast<word_t>(error));
+        set_carry(true);
+    }
+
+    [[nodiscard]] FAR ptr(SEG seg, REG reg) const noexcept {
+        return { pc.cpu.reg_get(reg), pc.cpu.seg_get(seg) };
+    }
+
+    [[nodiscard]] std::string string_get(FAR addr, char end = '\0', std::size_t max = 128) const {
+        auto result = std::string{};
+        for (auto i = std::size_t{}; i != max; ++i) {
+            auto const c = static_cast<char>(pc.mem.read_byte((addr + static_cast<sword_t>(i)).ea()));
+            if (c == end) {
+                break;
+            }
+            result.push_back(c);
+        }
+        return result;
+    }
+
+    void string_set(FAR addr, std::string const& value) noexcept {
+        for (auto i = std::size_t{}; i != value.size(); ++i) {
+            pc.mem.write_byte((addr + static_cast<sword_t>(i)).ea(), static_cast<byte_t>(value[i]));
+        }
+        pc.mem.write_byte((addr + static_cast<sword_t>(value.size())).ea(), 0);
+    }
+
+    void word_set(dword_t ea, word_t value) noexcept {
+        auto const [lo, hi] = word_unpack(value);
+        pc.mem.write_byte(ea, lo);
+        pc.mem.write_byte(ea + 1, hi);
+    }
+
+    [[nodiscard]] word_t word_get(dword_t ea) const noexcept {
+        return word_pack(pc.mem.read_byte(ea), pc.mem.read_byte(ea + 1));
+    }
+
+    // Host I/O straight from and into guest memory one page at a time, reads into ROM are discarded
+    std::size_t file_read(std::FILE* file, dword_t ea, std::size_t size) noexcept {
+        auto done = std::size_t{};
+        while (done != size) {
+            auto const at = static_cast<dword_t>(ea + done);
+            auto const run = std::min<std::size_t>(size - done, MEM::PAGE_SIZE - (at & MEM::PAGE_MASK));
+            byte_t scratch[MEM::PAGE_SIZE];
+            auto const dst = pc.mem.page_write(at, run);
+            auto const got = std::fread(dst.empty() ? scratch : dst.data(), 1, run, file);
+            done += got;
+            if (got != run) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    std::size_t file_write(std::FILE* file, dword_t ea, std::size_t size) noexcept {
+        auto done = std::size_t{};
+        while (done != size) {
+            auto const at = static_cast<dword_t>(ea + done);
+            auto const run = std::min<std::size_t>(size - done, MEM::PAGE_SIZE - (at & MEM::PAGE_MASK));
+            auto const put = std::fwrite(pc.mem.page_read(at).data(), 1, run, file);
+            done += put;
+            if (put != run) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    /// Paths
+    [[nodiscard]] static std::string upper(std::string value) {
+        std::transform(value.begin(), value.end(), value.begin(), [](char c) {
+            return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+        });
+        return value;
+    }
+
+    // Normalized components below the root, false when the path names another drive
+    bool split(std::string path, std::vector<std::string>& result) const {
+        std::replace(path.begin(), path.end(), '/', '\\');
+        if (path.size() >= 2 && path[1] == ':') {
+            if (std::toupper(static_cast<unsigned char>(path[0])) != 'C') {
+                return false;
+            }
+            path.erase(0, 2);
+        }
+        result = path.starts_with('\\') ? std::vector<std::string>{} : cwd;
+        auto start = std::size_t{};
+        while (start <= path.size()) {
+            auto const end = std::min(path.find('\\', start), path.size());
+            auto const part = upper(path.substr(start, end - start));
+            if (part == "..") {
+                // Never climbs above the sandbox root
+                if (!result.empty()) {
+                    result.pop_back();
+                }
+            } else if (!part.empty() && part != ".") {
+                result.push_back(part);
+            }
+            start = end + 1;
+        }
+        return true;
+    }
+
+    // Host names are matched case-insensitively, new names are created in upper case
+    [[nodiscard]] std::filesystem::path host(std::vector<std::string> const& parts) const {
+        auto result = root;
+        for (auto const& part : parts) {
+            auto name = part;
+            auto error = std::error_code{};
+            for (auto it = std::filesystem::directory_iterator(result, error); !error && it != std::filesystem::directory_iterator{}; it.increment(error)) {
+                if (upper(it->path().filename().string()) == part) {
+                    name = it->path().filename().string();
+                    break;
+                }
+            }
+            result /= name;
+        }
+        return result;
+    }
+
+    [[nodiscard]] bool resolve(FAR addr, std::filesystem::path& result) const {
+        auto parts = std::vector<std::string>{};
+        if (!split(string_get(addr), parts)) {
+            return false;
+        }
+        result = host(parts);
+        return true;
+    }
+
+    [[nodiscard]] static bool device_name(std::string const& path, char const* name) {
+        auto const upper_path = upper(path);
+        auto const pos = upper_path.find_last_of("\\/:");
+        auto base = pos == std::string::npos ? upper_path : upper_path.substr(pos + 1);
+        if (auto const dot = base.find('.'); dot != std::string::npos) {
+            base.erase(dot);
+        }
+        return base == name;
+    }
+
+    // 8.3 names padded to the 11 characters of a directory entry, wildcards expanded to '?'
+    [[nodiscard]] static bool fcb_name(std::string const& name, char (&result)[11]) {
+        std::fill(std::begin(result), std::end(result), ' ');
+        auto const dot = name.find('.');
+        auto const base = name.substr(0, dot);
+        auto const ext = dot == std::string::npos ? std::string{} : name.substr(dot + 1);
+        if (base.size() > 8 || ext.size() > 3 || ext.find('.') != std::string::npos) {
+            return false;
+        }
+        auto const fill = [&](std::string const& part, std::size_t offset, std::size_t size) {
+            for (auto i = std::size_t{}; i != size; ++i) {
+                if (i < part.size() && part[i] == '*') {
+                    std::fill(result + offset + i, result + offset + size, '?');
+                    return;
+                }
+                if (i < part.size()) {
+                    result[offset + i] = part[i];
+                }
+            }
+        };
+        fill(base, 0, 8);
+        fill(ext, 8, 3);
+        return true;
+    }
+
+    [[nodiscard]] static std::pair<word_t, word_t> dos_time(std::time_t time) noexcept {
+        auto local = std::tm{};
+        ::localtime_r(&time, &local);
+        auto const year = std::max(local.tm_year - 80, 0);
+        return {
+            static_cast<word_t>((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2)),
+            static_cast<word_t>((year << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday),
+        };
+    }
+
+    /// Handles
+    [[nodiscard]] Handle* handle(word_t index) noexcept {
+        if (index >= HANDLES || (!handles[index].file && !handles[index].device)) {
+            return nullptr;
+        }
+        return &handles[index];
+    }
+
+    [[nodiscard]] int handle_free() const noexcept {
+        for (auto i = 0; i != static_cast<int>(HANDLES); ++i) {
+            if (!handles[i].file && !handles[i].device) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void handle_close(Handle& entry) noexcept {
+        if (entry.file && !entry.device) {
+            std::fclose(entry.file);
+        }
+        entry = {};
+    }
+
+    // Update streams need a seek whenever the direction changes
+    static void handle_direction(Handle& entry, bool writing) noexcept {
+        if (!entry.device && entry.writing != writing) {
+            std::fseek(entry.file, 0, SEEK_CUR);
+        }
+        entry.writing = writing;
+    }
+
+    void open(FAR name, char const* mode) {
+        auto const path_name = string_get(name);
+        auto const index = handle_free();
+        if (index < 0) {
+            fail(Error::TOO_MANY_FILES);
+            return;
+        }
+        if (device_name(path_name, "NUL")) {
+            handles[index] = { nullptr, true, false, psp };
+        } else if (device_name(path_name, "CON")) {
+            handles[index] = { stdout, true, false, psp };
+        } else {
+            auto path = std::filesystem::path{};
+            if (!resolve(name, path)) {
+                fail(Error::PATH_NOT_FOUND);
+                return;
+            }
+            if (std::filesystem::is_directory(path)) {
+                fail(Error::ACCESS_DENIED);
+                return;
+            }
+            auto* const file = std::fopen(path.c_str(), mode);
+            if (!file) {
+                fail(mode[0] == 'r' ? Error::FILE_NOT_FOUND : Error::ACCESS_DENIED);
+                return;
+            }
+            handles[index] = { file, false, false, psp };
+        }
+        pc.cpu.reg_set(REG::AX, static_cast<word_t>(index));
+        ok();
+    }
+
+    /// Memory arena, one paragraph in front of every block stays free like a DOS memory control block
+    [[nodiscard]] word_t largest() const noexcept {
+        auto result = word_t{};
+        auto start = ARENA_START;
+        for (auto const& [seg, block] : blocks) {
+            if (seg - 1 > start) {
+                result = std::max<word_t>(result, static_cast<word_t>(seg - 1 - start - 1));
+            }
+            start = static_cast<word_t>(seg + block.size);
+        }
+        if (ARENA_END > start + 1) {
+            result = std::max<word_t>(result, static_cast<word_t>(ARENA_END - start - 1));
+        }
+        return result;
+    }
+
+    // Space after seg up to the next block or the end of the arena
+    [[nodiscard]] word_t room(word_t seg) const noexcept {
+        auto const next = blocks.upper_bound(seg);
+        auto const limit = next == blocks.end() ? ARENA_END : static_cast<word_t>(next->first - 1);
+        return static_cast<word_t>(limit - seg);
+    }
+
+    /// Process control
+    void terminate(byte_t code) {
+        exit_code = code;
+        for (auto i = std::size_t{5}; i != HANDLES; ++i) {
+            if (handles[i].owner == psp) {
+                handle_close(handles[i]);
+            }
+        }
+        std::fflush(stdout);
+        for (auto it = blocks.begin(); it != blocks.end();) {
+            it = it->second.owner == psp ? blocks.erase(it) : std::next(it);
+        }
+        auto target = FAR { STUB_EXIT, STUB_SEG };
+        if (psp) {
+            auto const base = FAR { 0, psp }.ea();
+            auto const disp = word_get(base + 0x0A);
+            auto const seg = word_get(base + 0x0C);
+            if (disp || seg) {
+                target = { disp, seg };
+            }
+            psp = word_get(base + 0x16);
+        }
+        // A parent gets its own stack back with the frame of its EXEC call on top
+        if (!callers.empty()) {
+            auto const caller = callers.back();
+            callers.pop_back();
+            pc.cpu.seg_set(SEG::SS, caller.stack.seg);
+            pc.cpu.reg_set(REG::SP, caller.stack.disp);
+            dta = caller.dta;
+            set_carry(false);
+        } else {
+            terminated = true;
+        }
+        // The interupt frame on the guest stack now returns to the terminate address from the PSP
+        auto const frame = ptr(SEG::SS, REG::SP).ea();
+        word_set(frame + 0, target.disp);
+        word_set(frame + 2, target.seg);
+    }
+
+    /// Program loading
+    // Environment strings of an existing block including the empty string that ends them
+    [[nodiscard]] std::string env_strings(word_t seg) const {
+        auto result = std::string{};
+        auto const base = FAR { 0, seg }.ea();
+        for (auto i = dword_t{}; i != 0x8000; ++i) {
+            auto const c = static_cast<char>(pc.mem.read_byte(base + i));
+            result.push_back(c);
+            if (c == '\0' && (result.size() == 1 || result[result.size() - 2] == '\0')) {
+                break;
+            }
+        }
+        return result;
+    }
+
+    void psp_build(word_t seg, word_t size, word_t env, word_t parent, std::string const& tail) {
+        auto const base = FAR { 0, seg }.ea();
+        for (auto i = dword_t{}; i != 0x100; ++i) {
+            pc.mem.write_byte(base + i, 0);
+        }
+        pc.mem.write_byte(base + 0x00, 0xCD); // INT 20h
+        pc.mem.write_byte(base + 0x01, 0x20);
+        word_set(base + 0x02, static_cast<word_t>(seg + size));
+        word_set(base + 0x16, parent);
+        // Job file table, the handles themselves are shared by every process
+        for (auto i = dword_t{}; i != HANDLES; ++i) {
+            pc.mem.write_byte(base + 0x18 + i, static_cast<byte_t>(i < 5 ? i : 0xFF));
+        }
+        word_set(base + 0x2C, env);
+        word_set(base + 0x32, HANDLES);
+        word_set(base + 0x34, 0x18);
+        word_set(base + 0x36, seg);
+        pc.mem.write_byte(base + 0x50, 0xCD); // INT 21h; RETF
+        pc.mem.write_byte(base + 0x51, 0x21);
+        pc.mem.write_byte(base + 0x52, 0xCB);
+        for (auto const fcb : { 0x5Cu, 0x6Cu }) {
+            for (auto i = dword_t{1}; i != 12; ++i) {
+                pc.mem.write_byte(base + fcb + i, ' ');
+            }
+        }
+        auto const length = std::min<std::size_t>(tail.size(), 126);
+        pc.mem.write_byte(base + 0x80, static_cast<byte_t>(length));
+        for (auto i = std::size_t{}; i != length; ++i) {
+            pc.mem.write_byte(base + 0x81 + static_cast<dword_t>(i), static_cast<byte_t>(tail[i]));
+        }
+        pc.mem.write_byte(base + 0x81 + static_cast<dword_t>(length), '\r');
+    }
+
+    // Maps the program, builds its environment and PSP and makes the PSP current
+    Error load(std::string const& name, std::string const& tail, word_t env_from, FAR& entry, FAR& stack) {
+        auto parts = std::vector<std::string>{};
+        if (!split(name, parts) || parts.empty()) {
+            return Error::PATH_NOT_FOUND;
+        }
+        auto const path = host(parts);
+        if (!std::filesystem::is_regular_file(path)) {
+            return Error::FILE_NOT_FOUND;
+        }
+        auto const file = MAPPING(path.string());
+        auto const bytes = file.bytes();
+        auto const field = [&](std::size_t offset) {
+            return offset + 1 < bytes.size() ? word_pack(bytes[offset], bytes[offset + 1]) : word_t{};
+        };
+        auto const exe = bytes.size() >= 0x1C && ((bytes[0] == 'M' && bytes[1] == 'Z') || (bytes[0] == 'Z' && bytes[1] == 'M'));
+
+        auto image = bytes;
+        auto min_extra = dword_t{0x10};
+        auto max_extra = dword_t{0xFFFF};
+        if (exe) {
+            auto const header = std::size_t{field(0x08)} * 16;
+            auto const last = field(0x02) & 511u;
+            auto const end = std::min(std::size_t{field(0x04)} * 512 - (last ? 512 - last : 0), bytes.size());
+            if (header > end) {
+                return Error::FORMAT;
+            }
+            image = bytes.subspan(header, end - header);
+            min_extra = field(0x0A);
+            max_extra = field(0x0C);
+        } else if (bytes.size() > 0xFF00) {
+            return Error::FORMAT;
+        }
+
+        auto env_data = env_from ? env_strings(env_from) : psp ? env_strings(word_get(FAR { 0x2C, psp }.ea())) : std::string(default_env, sizeof(default_env));
+        auto program = std::string("C:\\");
+        for (auto const& part : parts) {
+            program += part + (&part != &parts.back() ? "\\" : "");
+        }
+        env_data += std::string("\x01\x00", 2) + program + '\0';
+        auto const env = allocate(static_cast<word_t>((env_data.size() + 15) / 16), 0);
+        if (!env) {
+            return Error::MEMORY;
+        }
+
+        auto const image_paras = static_cast<dword_t>((image.size() + 15) / 16);
+        auto const need = 0x10 + image_paras + min_extra;
+        auto const avail = dword_t{largest()};
+        if (need > avail) {
+            blocks.erase(env);
+            return Error::MEMORY;
+        }
+        auto const size = static_cast<word_t>(std::min(avail, std::max(need, 0x10 + image_paras + max_extra)));
+        auto const seg = allocate(size, 0);
+        blocks[seg].owner = seg;
+        blocks[env].owner = seg;
+        pc.mem.copy_in(FAR { 0, env }.ea(), { reinterpret_cast<byte_t const*>(env_data.data()), env_data.size() });
+
+        auto const start = static_cast<word_t>(seg + 0x10);
+        pc.mem.copy_in(FAR { 0, start }.ea(), image);
+        if (exe) {
+            auto const table = std::size_t{field(0x18)};
+            for (auto i = std::size_t{}; i != field(0x06) && table + i * 4 + 4 <= bytes.size(); ++i) {
+                auto const ea = FAR { field(table + i * 4), static_cast<word_t>(start + field(table + i * 4 + 2)) }.ea();
+                word_set(ea, static_cast<word_t>(word_get(ea) + start));
+            }
+            entry = { field(0x14), static_cast<word_t>(start + field(0x16)) };
+            stack = { field(0x10), static_cast<word_t>(start + field(0x0E)) };
+        } else {
+            // RET from the top of the stack lands on the INT 20h at PSP:0000
+            auto const sp = static_cast<word_t>(size >= 0x1000 ? 0xFFFE : size * 16 - 2);
+            word_set(FAR { sp, seg }.ea(), 0);
+            entry = { 0x100, seg };
+            stack = { sp, seg };
+        }
+        psp_build(seg, size, env, psp, tail);
+        psp = seg;
+        dta = { 0x80, seg };
+        return Error::NONE;
+    }
+
+    void exec_child() {
+        auto& cpu = pc.cpu;
+        auto const block = ptr(SEG::ES, REG::BX).ea();
+        auto const tail_ptr = FAR { word_get(block + 2), word_get(block + 4) };
+        auto const tail_size = pc.mem.read_byte(tail_ptr.ea());
+        auto const tail = string_get(tail_ptr + 1, '\r', tail_size);
+        auto const caller = Caller { ptr(SEG::SS, REG::SP), dta };
+        auto const frame = caller.stack.ea();
+        auto entry = FAR {};
+        auto stack = FAR {};
+        if (auto const error = load(string_get(ptr(SEG::DS, REG::DX)), tail, word_get(block), entry, stack); error != Error::NONE) {
+            fail(error);
+            return;
+        }
+        callers.push_back(caller);
+        // Returning from the child resumes the parent right after its INT 21h
+        auto const base = FAR { 0, psp }.ea();
+        word_set(base + 0x0A, word_get(frame + 0));
+        word_set(base + 0x0C, word_get(frame + 2));
+        // The frame popped on the way out of this call now enters the child
+        stack -= 6;
+        word_set(stack.ea() + 0, entry.disp);
+        word_set(stack.ea() + 2, entry.seg);
+        word_set(stack.ea() + 4, 0x0202);
+        cpu.seg_set(SEG::SS, stack.seg);
+        cpu.reg_set(REG::SP, stack.disp);
+        cpu.seg_set(SEG::DS, psp);
+        cpu.seg_set(SEG::ES, psp);
+        cpu.reg_set(REG::AX, 0);
+        ok();
+    }
+
+    void find(bool first) {
+        auto const key = dta.ea();
+        if (first) {
+            auto parts = std::vector<std::string>{};
+            if (!split(string_get(ptr(SEG::DS, REG::DX)), parts) || parts.empty()) {
+                fail(Error::PATH_NOT_FOUND);
+                return;
+            }
+            char pattern[11] = {};
+            if (!fcb_name(parts.back(), pattern)) {
+                fail(Error::FILE_NOT_FOUND);
+                return;
+            }
+            parts.pop_back();
+            auto const attr = pc.cpu.reg8_get(REG::CL);
+            auto search = Search{};
+            auto error = std::error_code{};
+            for (auto it = std::filesystem::directory_iterator(host(parts), error); !error && it != std::filesystem::directory_iterator{}; it.increment(error)) {
+                auto const name = upper(it->path().filename().string());
+                char fcb[11] = {};
+                if (!fcb_name(name, fcb) || name.find_first_of("*? ") != std::string::npos) {
+                    continue;
+                }
+                if (!std::equal(std::begin(fcb), std::end(fcb), std::begin(pattern), [](char a, char b) {
+                        return b == '?' || a == b;
+                    })) {
+                    continue;
+                }
+                struct stat info = {};
+                if (::stat(it->path().c_str(), &info) < 0) {
+                    continue;
+                }
+                auto const directory = S_ISDIR(info.st_mode);
+                if (directory && !(attr & 0x10)) {
+                    continue;
+                }
+                auto const [time, date] = dos_time(info.st_mtime);
+                search.entries.push_back({
+                    name,
+                    static_cast<dword_t>(directory ? 0 : info.st_size),
+                    time,
+                    date,
+                    static_cast<byte_t>(directory ? 0x10 : 0x20),
+                });
+            }
+            searches[key] = std::move(search);
+        }
+        auto const it = searches.find(key);
+        if (it == searches.end() || it->second.next == it->second.entries.size()) {
+            searches.erase(key);
+            fail(first ? Error::FILE_NOT_FOUND : Error::NO_MORE_FILES);
+            return;
+        }
+        auto const& entry = it->second.entries[it->second.next++];
+        pc.mem.write_byte(key + 0x15, entry.attr);
+        word_set(key + 0x16, entry.time);
+        word_set(key + 0x18, entry.date);
+        word_set(key + 0x1A, static_cast<word_t>(entry.size));
+        word_set(key + 0x1C, static_cast<word_t>(entry.size >> 16));
+        string_set(dta + 0x1E, entry.name);
+        ok();
+    }
+
+    bool int21() {
+        auto& cpu = pc.cpu;
+        switch (cpu.reg8_get(REG::AH)) {
+        case 0x00: // terminate
+            terminate(0);
+            return true;
+        case 0x01: // read character with echo
+        case 0x07: // direct read character
+        case 0x08: { // read character
+            std::fflush(stdout);
+            auto const c = std::getchar();
+            cpu.reg8_set(REG::AL, static_cast<byte_t>(c == EOF ? 0x1A : c));
+            if (cpu.reg8_get(REG::AH) == 0x01 && c != EOF) {
+                std::putchar(c);
+            }
+            return true;
+        }
+        case 0x02: // write character
+            std::putchar(cpu.reg8_get(REG::DL));
+            cpu.reg8_set(REG::AL, cpu.reg8_get(REG::DL));
+            return true;
+        case 0x06: // direct console I/O
+            if (cpu.reg8_get(REG::DL) == 0xFF) {
+                std::fflush(stdout);
+                auto const c = std::getchar();
+                set_zero(c == EOF);
+                cpu.reg8_set(REG::AL, static_cast<byte_t>(c == EOF ? 0 : c));
+            } else {
+                std::putchar(cpu.reg8_get(REG::DL));
+                cpu.reg8_set(REG::AL, cpu.reg8_get(REG::DL));
+            }
+            return true;
+        case 0x09: { // write '$' terminated string
+            auto const text = string_get(ptr(SEG::DS, REG::DX), '$', 0x10000);
+            std::fwrite(text.data(), 1, text.size(), stdout);
+            cpu.reg8_set(REG::AL, '$');
+            return true;
+        }
+        case 0x0A: { // buffered line input
+            std::fflush(stdout);
+            auto const buffer = ptr(SEG::DS, REG::DX);
+            auto const max = pc.mem.read_byte(buffer.ea());
+            auto count = byte_t{};
+            for (auto c = std::getchar(); c != EOF && c != '\n'; c = std::getchar()) {
+                if (count + 1 < max && c != '\r') {
+                    pc.mem.write_byte((buffer + static_cast<sword_t>(2 + count++)).ea(), static_cast<byte_t>(c));
+                }
+            }
+            pc.mem.write_byte((buffer + 1).ea(), count);
+            pc.mem.write_byte((buffer + static_cast<sword_t>(2 + count)).ea(), '\r');
+            return true;
+        }
+        case 0x0B: // input status, batch jobs never have a key waiting
+            cpu.reg8_set(REG::AL, 0x00);
+            return true;
+        case 0x0E: // select drive
+            cpu.reg8_set(REG::AL, 3);
+            return true;
+        case 0x19: // current drive
+            cpu.reg8_set(REG::AL, 2);
+            return true;
+        case 0x1A: // set disk transfer address
+            dta = ptr(SEG::DS, REG::DX);
+            return true;
+        case 0x25: { // set interupt vector
+            auto const ea = dword_t{cpu.reg8_get(REG::AL)} * 4;
+            word_set(ea + 0, cpu.reg_get(REG::DX));
+            word_set(ea + 2, cpu.seg_get(SEG::DS));
+            return true;
+        }
+        case 0x2A: { // date
+            auto const now = std::time(nullptr);
+            auto local = std::tm{};
+            ::localtime_r(&now, &local);
+            cpu.reg_set(REG::CX, static_cast<word_t>(local.tm_year + 1900));
+            cpu.reg8_set(REG::DH, static_cast<byte_t>(local.tm_mon + 1));
+            cpu.reg8_set(REG::DL, static_cast<byte_t>(local.tm_mday));
+            cpu.reg8_set(REG::AL, static_cast<byte_t>(local.tm_wday));
+            return true;
+        }
+        case 0x2C: { // time
+            auto const now = std::time(nullptr);
+            auto local = std::tm{};
+            ::localtime_r(&now, &local);
+            cpu.reg8_set(REG::CH, static_cast<byte_t>(local.tm_hour));
+            cpu.reg8_set(REG::CL, static_cast<byte_t>(local.tm_min));
+            cpu.reg8_set(REG::DH, static_cast<byte_t>(local.tm_sec));
+            cpu.reg8_set(REG::DL, 0);
+            return true;
+        }
+        case 0x2F: // get disk transfer address
+            cpu.reg_set(REG::BX, dta.disp);
+            cpu.seg_set(SEG::ES, dta.seg);
+            return true;
+        case 0x30: // version, reports DOS 5.0
+            cpu.reg_set(REG::AX, 0x0005);
+            cpu.reg_set(REG::BX, 0);
+            cpu.reg_set(REG::CX, 0);
+            return true;
+        case 0x33: // Ctrl-Break checking is always off
+            cpu.reg8_set(REG::DL, 0);
+            return true;
+        case 0x35: { // get interupt vector
+            auto const ea = dword_t{cpu.reg8_get(REG::AL)} * 4;
+            cpu.reg_set(REG::BX, word_get(ea + 0));
+            cpu.seg_set(SEG::ES, word_get(ea + 2));
+            return true;
+        }
+        case 0x36: { // free disk space, in 32K clusters capped at what a word can count
+            auto error = std::error_code{};
+            auto const space = std::filesystem::space(root, error);
+            auto const clusters = [](std::uintmax_t bytes) {
+                return static_cast<word_t>(std::min<std::uintmax_t>(bytes / 0x8000, 0xFFFE));
+            };
+            cpu.reg_set(REG::AX, 64);
+            cpu.reg_set(REG::BX, error ? word_t{} : clusters(space.available));
+            cpu.reg_set(REG::CX, 512);
+            cpu.reg_set(REG::DX, error ? word_t{} : clusters(space.capacity));
+            return true;
+        }
+        case 0x39: // make directory
+        case 0x3A: // remove directory
+        case 0x41: { // delete file
+            auto path = std::filesystem::path{};
+            if (!resolve(ptr(SEG::DS, REG::DX), path)) {
+                fail(Error::PATH_NOT_FOUND);
+                return true;
+            }
+            auto const function = cpu.reg8_get(REG::AH);
+            if (function == 0x3A && path == host(cwd)) {
+                fail(Error::CURRENT_DIRECTORY);
+                return true;
+            }
+            auto const result = function == 0x39 ? ::mkdir(path.c_str(), 0755) : function == 0x3A ? ::rmdir(path.c_str()) : ::unlink(path.c_str());
+            if (result < 0) {
+                fail(errno == ENOENT ? (function == 0x41 ? Error::FILE_NOT_FOUND : Error::PATH_NOT_FOUND) : Error::ACCESS_DENIED);
+                return true;
+            }
+            ok();
+            return true;
+        }
+        case 0x3B: { // change directory
+            auto parts = std::vector<std::string>{};
+            if (!split(string_get(ptr(SEG::DS, REG::DX)), parts) || !std::filesystem::is_directory(host(parts))) {
+                fail(Error::PATH_NOT_FOUND);
+                return true;
+            }
+            cwd = std::move(parts);
+            ok();
+            return true;
+        }
+        case 0x3C: // create or truncate
+            open(ptr(SEG::DS, REG::DX), "w+b");
+            return true;
+        case 0x3D: // open
+            open(ptr(SEG::DS, REG::DX), (cpu.reg8_get(REG::AL) & 3) == 0 ? "rb" : "r+b");
+            return true;
+        case 0x3E: { // close
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            if (!entry) {
+                fail(Error::HANDLE);
+                return true;
+            }
+            handle_close(*entry);
+            ok();
+            return true;
+        }
+        case 0x3F: // read
+        case 0x40: { // write
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            if (!entry) {
+                fail(Error::HANDLE);
+                return true;
+            }
+            auto const writing = cpu.reg8_get(REG::AH) == 0x40;
+            auto const size = cpu.reg_get(REG::CX);
+            auto const ea = ptr(SEG::DS, REG::DX).ea();
+            if (!entry->file) {
+                cpu.reg_set(REG::AX, writing ? size : 0); // NUL
+                ok();
+                return true;
+            }
+            if (writing && size == 0 && !entry->device) {
+                // Zero length write truncates or extends the file at the current position
+                std::fflush(entry->file);
+                (void)::ftruncate(::fileno(entry->file), std::ftell(entry->file));
+                cpu.reg_set(REG::AX, 0);
+                ok();
+                return true;
+            }
+            handle_direction(*entry, writing);
+            auto* const file = entry->device && !writing ? stdin : entry->file;
+            if (file == stdin) {
+                std::fflush(stdout);
+            }
+            auto const done = writing ? file_write(file, ea, size) : file_read(file, ea, size);
+            cpu.reg_set(REG::AX, static_cast<word_t>(done));
+            ok();
+            return true;
+        }
+        case 0x42: { // seek
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            auto const origin = cpu.reg8_get(REG::AL);
+            if (!entry || origin > 2) {
+                fail(!entry ? Error::HANDLE : Error::FUNCTION);
+                return true;
+            }
+            auto position = long{};
+            if (!entry->device) {
+                auto const offset = static_cast<sdword_t>((dword_t{cpu.reg_get(REG::CX)} << 16) | cpu.reg_get(REG::DX));
+                std::fseek(entry->file, offset, origin == 0 ? SEEK_SET : origin == 1 ? SEEK_CUR : SEEK_END);
+                entry->writing = false;
+                position = std::ftell(entry->file);
+            }
+            cpu.reg_set(REG::AX, static_cast<word_t>(position));
+            cpu.reg_set(REG::DX, static_cast<word_t>(position >> 16));
+            ok();
+            return true;
+        }
+        case 0x43: { // file attributes, setting them is accepted and ignored
+            auto path = std::filesystem::path{};
+            struct stat info = {};
+            if (!resolve(ptr(SEG::DS, REG::DX), path) || ::stat(path.c_str(), &info) < 0) {
+                fail(Error::FILE_NOT_FOUND);
+                return true;
+            }
+            if (cpu.reg8_get(REG::AL) == 0) {
+                cpu.reg_set(REG::CX, S_ISDIR(info.st_mode) ? 0x10 : 0x20);
+            }
+            ok();
+            return true;
+        }
+        case 0x44: { // IOCTL, only device information
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            if (!entry) {
+                fail(Error::HANDLE);
+                return true;
+            }
+            switch (cpu.reg8_get(REG::AL)) {
+            case 0x00:
+                cpu.reg_set(REG::DX, entry->device ? (entry->file ? 0x80D3 : 0x8084) : 0x0002);
+                ok();
+                return true;
+            case 0x01:
+                ok();
+                return true;
+            default:
+                fail(Error::FUNCTION);
+                return true;
+            }
+        }
+        case 0x45: // duplicate handle
+        case 0x46: { // force duplicate handle
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            auto const forced = cpu.reg8_get(REG::AH) == 0x46;
+            auto const index = forced ? cpu.reg_get(REG::CX) : handle_free();
+            if (!entry || index < 0 || index >= static_cast<int>(HANDLES)) {
+                fail(!entry ? Error::HANDLE : Error::TOO_MANY_FILES);
+                return true;
+            }
+            auto copy = *entry;
+            if (!copy.device) {
+                std::fflush(copy.file);
+                copy.file = ::fdopen(::dup(::fileno(copy.file)), "r+b");
+                if (!copy.file) {
+                    copy.file = ::fdopen(::dup(::fileno(entry->file)), "rb");
+                }
+                if (!copy.file) {
+                    fail(Error::TOO_MANY_FILES);
+                    return true;
+                }
+            }
+            handle_close(handles[index]);
+            handles[index] = copy;
+            if (!forced) {
+                cpu.reg_set(REG::AX, static_cast<word_t>(index));
+            }
+            ok();
+            return true;
+        }
+        case 0x47: { // current directory
+            if (auto const drive = cpu.reg8_get(REG::DL); drive != 0 && drive != 3) {
+                fail(Error::DRIVE);
+                return true;
+            }
+            auto result = std::string{};
+            for (auto const& part : cwd) {
+                result += result.empty() ? part : "\\" + part;
+            }
+            string_set(ptr(SEG::DS, REG::SI), result);
+            ok();
+            return true;
+        }
+        case 0x48: { // allocate memory
+            auto const size = cpu.reg_get(REG::BX);
+            auto const seg = allocate(size, psp);
+            if (!seg) {
+                cpu.reg_set(REG::BX, largest());
+                fail(Error::MEMORY);
+                return true;
+            }
+            cpu.reg_set(REG::AX, seg);
+            ok();
+            return true;
+        }
+        case 0x49: // free memory
+            if (!blocks.erase(cpu.seg_get(SEG::ES))) {
+                fail(Error::BLOCK);
+                return true;
+            }
+            ok();
+            return true;
+        case 0x4A: { // resize memory
+            auto const seg = cpu.seg_get(SEG::ES);
+            auto const it = blocks.find(seg);
+            if (it == blocks.end()) {
+                fail(Error::BLOCK);
+                return true;
+            }
+            auto const size = cpu.reg_get(REG::BX);
+            if (size > room(seg)) {
+                cpu.reg_set(REG::BX, room(seg));
+                fail(Error::MEMORY);
+                return true;
+            }
+            it->second.size = size;
+            ok();
+            return true;
+        }
+        case 0x31: // terminate and stay resident, the memory is kept
+            if (auto const it = blocks.find(psp); it != blocks.end()) {
+                it->second.size = cpu.reg_get(REG::DX);
+                it->second.owner = 0xFFFF;
+            }
+            terminate(cpu.reg8_get(REG::AL));
+            return true;
+        case 0x4B: // load and execute, overlays and load-only are left to the guest
+            if (cpu.reg8_get(REG::AL) != 0x00) {
+                return false;
+            }
+            exec_child();
+            return true;
+        case 0x4C: // terminate with exit code
+            terminate(cpu.reg8_get(REG::AL));
+            return true;
+        case 0x4D: // exit code of the last child
+            cpu.reg_set(REG::AX, exit_code);
+            ok();
+            return true;
+        case 0x4E: // find first
+        case 0x4F: // find next
+            find(cpu.reg8_get(REG::AH) == 0x4E);
+            return true;
+        case 0x50: // set PSP
+            psp = cpu.reg_get(REG::BX);
+            return true;
+        case 0x51: // get PSP
+        case 0x62:
+            cpu.reg_set(REG::BX, psp);
+            return true;
+        case 0x56: { // rename
+            auto from = std::filesystem::path{};
+            auto to = std::filesystem::path{};
+            if (!resolve(ptr(SEG::DS, REG::DX), from) || !resolve(ptr(SEG::ES, REG::DI), to)) {
+                fail(Error::PATH_NOT_FOUND);
+                return true;
+            }
+            if (std::filesystem::exists(to) || std::rename(from.c_str(), to.c_str()) != 0) {
+                fail(std::filesystem::exists(from) ? Error::ACCESS_DENIED : Error::FILE_NOT_FOUND);
+                return true;
+            }
+            ok();
+            return true;
+        }
+        case 0x57: { // file date and time, setting them is accepted and ignored
+            auto* const entry = handle(cpu.reg_get(REG::BX));
+            struct stat info = {};
+            if (!entry || entry->device || ::fstat(::fileno(entry->file), &info) < 0) {
+                fail(Error::HANDLE);
+                return true;
+            }
+            if (cpu.reg8_get(REG::AL) == 0) {
+                auto const [time, date] = dos_time(info.st_mtime);
+                cpu.reg_set(REG::CX, time);
+                cpu.reg_set(REG::DX, date);
+            }
+            ok();
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+public:
+    word_t psp = {};
+    byte_t exit_code = {};
+    bool terminated = {};
+
+    // The directory becomes the root of drive C:, nothing outside it is reachable from the guest
+    DOS(PC& pc, std::filesystem::path directory) : pc(pc), root(std::filesystem::absolute(directory)) {
+        handles[0] = { stdin, true, false };
+        handles[1] = { stdout, true, false };
+        handles[2] = { stderr, true, false };
+        handles[3] = { nullptr, true, false };
+        handles[4] = { nullptr, true, false };
+    }
+
+    DOS(DOS const&) = delete;
+    DOS& operator=(DOS const&) = delete;
+
+    ~DOS() {
+        for (auto& entry : handles) {
+            handle_close(entry);
+        }
+        std::fflush(stdout);
+    }
+
+    // Returns the segment of a new block of size paragraphs, 0 when it does not fit
+    word_t allocate(word_t size, word_t owner) {
+        auto start = ARENA_START;
+        for (auto const& [seg, block] : blocks) {
+            if (start + 1 + size <= seg - 1) {
+                break;
+            }
+            start = static_cast<word_t>(seg + block.size);
+        }
+        if (start + 1 + size > ARENA_END) {
+            return 0;
+        }
+        auto const seg = static_cast<word_t>(start + 1);
+        blocks[seg] = { size, owner };
+        return seg;
+    }
+
+    // Starts a program from the sandbox as the first process, CS:IP, SS:SP and DS/ES are set directly
+    void exec(std::string name, std::string tail = {}) {
+        auto entry = FAR {};
+        auto stack = FAR {};
+        if (load(name, tail.empty() || tail.starts_with(' ') ? tail : " " + tail, 0, entry, stack) != Error::NONE) {
+            throw "Failed to load program!";
+        }
+        auto& cpu = pc.cpu;
+        auto const base = FAR { 0, psp }.ea();
+        word_set(base + 0x0A, STUB_EXIT);
+        word_set(base + 0x0C, STUB_SEG);
+        cpu.seg_set(SEG::CS, entry.seg);
+        cpu.reg_set(REG::IP, entry.disp);
+        cpu.seg_set(SEG::SS, stack.seg);
+        cpu.reg_set(REG::SP, stack.disp);
+        cpu.seg_set(SEG::DS, psp);
+        cpu.seg_set(SEG::ES, psp);
+        cpu.reg_set(REG::AX, 0);
+        auto flags = cpu.flags_get();
+        flags.interupt = true;
+        cpu.flags_set(flags);
+        terminated = false;
+        pc.halted = false;
+    }
+
+    [[nodiscard]] word_t available() const noexcept {
+        return largest();
+    }
+
+    void install() {
+        pc.mem.copy_in(FAR { 0, STUB_SEG }.ea(), stub);
+        // Vectors that nothing claimed yet fail cleanly instead of jumping to address 0
+        for (auto const index : { 0x20, 0x21 }) {
+            auto const ea = static_cast<dword_t>(index * 4);
+            if (!word_get(ea) && !word_get(ea + 2)) {
+                word_set(ea + 0, STUB_UNHANDLED);
+                word_set(ea + 2, STUB_SEG);
+            }
+        }
+        pc.hle.hook_vector(0x20, [this](CPU&, BUS&) {
+            terminate(0);
+            return true;
+        }, true);
+        pc.hle.hook_vector(0x21, [this](CPU&, BUS&) {
+            return int21();
+        }, true);
+    }
+};
+
+#endif // O126_DOS_HPP
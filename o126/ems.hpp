@@ -0,0 +1,497 @@
+#ifndef O126_EMS_HPP
+#define O126_EMS_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "hle.hpp"
+#include "mem.hpp"
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <span>
+#include <vector>
+
+// LIM EMS 4.0 board with its INT 67h driver, bank switches only repoint the page frame's entries in MEM
+// Pages are reference counted so forked machines share every one neither side has mapped since
+struct o126::EMS {
+public:
+    static constexpr word_t FRAME_SEG = 0xE000;
+    static constexpr dword_t PAGE_SIZE = 0x4000;
+    static constexpr byte_t FRAME_PAGES = 4;
+    static constexpr std::size_t HANDLES = 255;
+private:
+    using REG = CPU::REG;
+    using SEG = CPU::SEG;
+
+    // Guests look for the driver name at offset 0Ah of the INT 67h vector segment, the IRET is never reached
+    static constexpr word_t DRIVER_SEG = 0x0058;
+    static constexpr byte_t driver[] = {
+        0xCF, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, 0x90, // iret; nop ...
+        'E', 'M', 'M', 'X', 'X', 'X', 'X', '0',
+    };
+
+    static constexpr word_t UNMAPPED = 0xFFFF;
+    static constexpr dword_t MEM_PAGES = PAGE_SIZE / MEM::PAGE_SIZE;
+    static constexpr dword_t FRAME_FIRST = dword_t{FRAME_SEG} << 4 >> MEM::PAGE_BITS;
+    // Four pairs of handle and logical page
+    static constexpr byte_t MAP_SIZE = FRAME_PAGES * 4;
+
+    enum class Status : byte_t {
+        NONE = 0x00,
+        HANDLE = 0x83,
+        FUNCTION = 0x84,
+        NO_HANDLES = 0x85,
+        SAVED = 0x86,
+        TOO_MANY = 0x87,
+        NOT_ENOUGH = 0x88,
+        ZERO = 0x89,
+        LOGICAL = 0x8A,
+        PHYSICAL = 0x8B,
+        ALREADY_SAVED = 0x8D,
+        NOT_SAVED = 0x8E,
+        SUBFUNCTION = 0x8F,
+        NAME_EXISTS = 0xA1,
+    };
+
+    struct Mapping {
+        word_t handle = UNMAPPED;
+        word_t logical = UNMAPPED;
+    };
+
+    struct Handle {
+        bool used = {};
+        bool saved = {};
+        std::vector<word_t> pages = {};
+        byte_t name[8] = {};
+        std::array<Mapping, FRAME_PAGES> context = {};
+    };
+
+    using Block = std::array<byte_t, PAGE_SIZE>;
+
+    MEM& mem;
+    CPU& cpu;
+    std::vector<std::shared_ptr<Block>> storage;
+    std::vector<word_t> free_pages = {};
+    std::array<Handle, HANDLES> handles = {};
+    std::array<Mapping, FRAME_PAGES> frame = {};
+
+    void status(Status value) noexcept {
+        auto const ax = cpu.reg_get(REG::AX);
+        cpu.reg_set(REG::AX, word_pack(static_cast<byte_t>(ax), static_cast<byte_t>(value)));
+    }
+
+    // Mapped pages are written through MEM directly, so they are never shared
+    [[nodiscard]] byte_t* own(word_t page) {
+        if (storage[page].use_count() != 1) {
+            storage[page] = std::make_shared<Block>(*storage[page]);
+        }
+        return storage[page]->data();
+    }
+
+    [[nodiscard]] Handle* handle(word_t index) noexcept {
+        return index < HANDLES && handles[index].used ? &handles[index] : nullptr;
+    }
+
+    // Free pages are handed out lowest first
+    void free_rebuild() {
+        auto used = std::vector<bool>(total());
+        for (auto const& entry : handles) {
+            for (auto const page : entry.pages) {
+                used[page] = true;
+            }
+        }
+        free_pages.clear();
+        for (auto page = total(); page != 0; --page) {
+            if (!used[page - 1u]) {
+                free_pages.push_back(static_cast<word_t>(page - 1u));
+            }
+        }
+    }
+
+    /// Page frame
+    void map(byte_t physical, Mapping mapping) {
+        frame[physical] = mapping;
+        auto const first = FRAME_FIRST + physical * MEM_PAGES;
+        if (mapping.logical == UNMAPPED) {
+            for (auto i = dword_t{}; i != MEM_PAGES; ++i) {
+                mem.unmap_page(first + i);
+            }
+            return;
+        }
+        auto const data = own(handles[mapping.handle].pages[mapping.logical]);
+        for (auto i = dword_t{}; i != MEM_PAGES; ++i) {
+            mem.map_page(first + i, data + i * MEM::PAGE_SIZE);
+        }
+    }
+
+    [[nodiscard]] Status map_checked(byte_t physical, word_t index, word_t logical) {
+        auto const entry = handle(index);
+        if (!entry) {
+            return Status::HANDLE;
+        }
+        if (physical >= FRAME_PAGES) {
+            return Status::PHYSICAL;
+        }
+        if (logical != UNMAPPED && logical >= entry->pages.size()) {
+            return Status::LOGICAL;
+        }
+        map(physical, logical == UNMAPPED ? Mapping {} : Mapping { index, logical });
+        return Status::NONE;
+    }
+
+    // Drops frame entries that point past the end of a handle that shrank or went away
+    void unmap_stale(word_t index) {
+        for (auto physical = byte_t{}; physical != FRAME_PAGES; ++physical) {
+            auto const mapping = frame[physical];
+            if (mapping.handle == index && (!handles[index].used || mapping.logical >= handles[index].pages.size())) {
+                map(physical, {});
+            }
+        }
+    }
+
+    [[nodiscard]] Status resize(word_t index, word_t count) {
+        auto& entry = handles[index];
+        if (count > total()) {
+            return Status::TOO_MANY;
+        }
+        if (count > entry.pages.size() && count - entry.pages.size() > free_pages.size()) {
+            return Status::NOT_ENOUGH;
+        }
+        while (entry.pages.size() < count) {
+            entry.pages.push_back(free_pages.back());
+            free_pages.pop_back();
+        }
+        while (entry.pages.size() > count) {
+            free_pages.push_back(entry.pages.back());
+            entry.pages.pop_back();
+        }
+        unmap_stale(index);
+        return Status::NONE;
+    }
+
+    void map_store(FAR addr, std::array<Mapping, FRAME_PAGES> const& mappings) noexcept {
+        for (auto const& mapping : mappings) {
+            word_set(addr, mapping.handle);
+            word_set(addr + 2, mapping.logical);
+            addr = addr + 4;
+        }
+    }
+
+    void map_load(FAR addr) {
+        for (auto physical = byte_t{}; physical != FRAME_PAGES; ++physical) {
+            auto const index = word_get(addr);
+            auto const logical = word_get(addr + 2);
+            if (map_checked(physical, index, logical) != Status::NONE) {
+                map(physical, {});
+            }
+            addr = addr + 4;
+        }
+    }
+
+    /// Guest memory
+    void word_set(FAR addr, word_t value) noexcept {
+        auto const [lo, hi] = word_unpack(value);
+        mem.write_byte(addr.ea(), lo);
+        mem.write_byte((addr + 1).ea(), hi);
+    }
+
+    [[nodiscard]] word_t word_get(FAR addr) const noexcept {
+        return word_pack(mem.read_byte(addr.ea()), mem.read_byte((addr + 1).ea()));
+    }
+
+    [[nodiscard]] FAR ptr(SEG seg, REG reg) const noexcept {
+        return { cpu.reg_get(reg), cpu.seg_get(seg) };
+    }
+
+    /// Services
+    [[nodiscard]] Status int67() {
+        auto const ax = cpu.reg_get(REG::AX);
+        auto const al = static_cast<byte_t>(ax);
+        auto const bx = cpu.reg_get(REG::BX);
+        auto const dx = cpu.reg_get(REG::DX);
+        switch (ax >> 8) {
+        case 0x40: // get status
+            return Status::NONE;
+        case 0x41: // get page frame
+            cpu.reg_set(REG::BX, FRAME_SEG);
+            return Status::NONE;
+        case 0x42: // get page counts
+            cpu.reg_set(REG::BX, static_cast<word_t>(free_pages.size()));
+            cpu.reg_set(REG::DX, total());
+            return Status::NONE;
+        case 0x43: { // allocate pages
+            if (bx == 0) {
+                return Status::ZERO;
+            }
+            auto const found = std::find_if(handles.begin() + 1, handles.end(), [](Handle const& entry) {
+                return !entry.used;
+            });
+            if (found == handles.end()) {
+                return Status::NO_HANDLES;
+            }
+            auto const result = resize(static_cast<word_t>(found - handles.begin()), bx);
+            if (result == Status::NONE) {
+                found->used = true;
+                cpu.reg_set(REG::DX, static_cast<word_t>(found - handles.begin()));
+            }
+            return result;
+        }
+        case 0x44: // map or unmap one page
+            return map_checked(al, dx, bx);
+        case 0x45: { // deallocate pages
+            auto const entry = handle(dx);
+            if (!entry) {
+                return Status::HANDLE;
+            }
+            if (entry->saved) {
+                return Status::SAVED;
+            }
+            (void)resize(dx, 0);
+            // The operating system handle stays allocated with no pages
+            if (dx != 0) {
+                *entry = {};
+            }
+            return Status::NONE;
+        }
+        case 0x46: // get version
+            cpu.reg_set(REG::AX, 0x0040);
+            return Status::NONE;
+        case 0x47: { // save page map
+            auto const entry = handle(dx);
+            if (!entry) {
+                return Status::HANDLE;
+            }
+            if (entry->saved) {
+                return Status::ALREADY_SAVED;
+            }
+            entry->context = frame;
+            entry->saved = true;
+            return Status::NONE;
+        }
+        case 0x48: { // restore page map
+            auto const entry = handle(dx);
+            if (!entry) {
+                return Status::HANDLE;
+            }
+            if (!entry->saved) {
+                return Status::NOT_SAVED;
+            }
+            entry->saved = false;
+            for (auto physical = byte_t{}; physical != FRAME_PAGES; ++physical) {
+                auto const mapping = entry->context[physical];
+                if (map_checked(physical, mapping.handle, mapping.logical) != Status::NONE) {
+                    map(physical, {});
+                }
+            }
+            return Status::NONE;
+        }
+        case 0x4B: // get handle count
+            cpu.reg_set(REG::BX, static_cast<word_t>(std::count_if(handles.begin(), handles.end(), [](Handle const& entry) {
+                return entry.used;
+            })));
+            return Status::NONE;
+        case 0x4C: { // get handle pages
+            auto const entry = handle(dx);
+            if (!entry) {
+                return Status::HANDLE;
+            }
+            cpu.reg_set(REG::BX, static_cast<word_t>(entry->pages.size()));
+            return Status::NONE;
+        }
+        case 0x4D: { // get all handle pages
+            auto addr = ptr(SEG::ES, REG::DI);
+            auto count = word_t{};
+            for (auto index = word_t{}; index != HANDLES; ++index) {
+                if (handles[index].used) {
+                    word_set(addr, index);
+                    word_set(addr + 2, static_cast<word_t>(handles[index].pages.size()));
+                    addr = addr + 4;
+                    ++count;
+                }
+            }
+            cpu.reg_set(REG::BX, count);
+            return Status::NONE;
+        }
+        case 0x4E: // get or set page map
+            switch (al) {
+            case 0x00:
+                map_store(ptr(SEG::ES, REG::DI), frame);
+                return Status::NONE;
+            case 0x01:
+                map_load(ptr(SEG::DS, REG::SI));
+                return Status::NONE;
+            case 0x02:
+                map_store(ptr(SEG::ES, REG::DI), frame);
+                map_load(ptr(SEG::DS, REG::SI));
+                return Status::NONE;
+            case 0x03:
+                cpu.reg_set(REG::AX, MAP_SIZE);
+                return Status::NONE;
+            default:
+                return Status::SUBFUNCTION;
+            }
+        case 0x50: { // map or unmap several pages, by number or by segment
+            if (al > 0x01) {
+                return Status::SUBFUNCTION;
+            }
+            auto addr = ptr(SEG::DS, REG::SI);
+            for (auto i = cpu.reg_get(REG::CX); i != 0; --i) {
+                auto const logical = word_get(addr);
+                auto physical = word_get(addr + 2);
+                if (al == 0x01) {
+                    auto const offset = static_cast<word_t>(physical - FRAME_SEG);
+                    physical = offset % (PAGE_SIZE >> 4) == 0 ? static_cast<word_t>(offset / (PAGE_SIZE >> 4)) : word_t{0xFF};
+                }
+                auto const result = map_checked(static_cast<byte_t>(std::min<word_t>(physical, 0xFF)), dx, logical);
+                if (result != Status::NONE) {
+                    return result;
+                }
+                addr = addr + 4;
+            }
+            return Status::NONE;
+        }
+        case 0x51: { // reallocate pages
+            if (!handle(dx)) {
+                return Status::HANDLE;
+            }
+            auto const result = resize(dx, bx);
+            cpu.reg_set(REG::BX, static_cast<word_t>(handles[dx].pages.size()));
+            return result;
+        }
+        case 0x53: { // get or set handle name
+            auto const entry = handle(dx);
+            if (!entry) {
+                return Status::HANDLE;
+            }
+            if (al == 0x00) {
+                mem.copy_in(ptr(SEG::ES, REG::DI).ea(), entry->name);
+                return Status::NONE;
+            }
+            if (al != 0x01) {
+                return Status::SUBFUNCTION;
+            }
+            byte_t name[8] = {};
+            mem.copy_out(ptr(SEG::DS, REG::SI).ea(), name);
+            auto const blank = std::all_of(std::begin(name), std::end(name), [](byte_t c) {
+                return c == 0;
+            });
+            for (auto const& other : handles) {
+                if (!blank && &other != entry && other.used && std::equal(std::begin(name), std::end(name), other.name)) {
+                    return Status::NAME_EXISTS;
+                }
+            }
+            std::copy(std::begin(name), std::end(name), entry->name);
+            return Status::NONE;
+        }
+        case 0x58: // get mappable physical address array
+            if (al > 0x01) {
+                return Status::SUBFUNCTION;
+            }
+            if (al == 0x00) {
+                auto addr = ptr(SEG::ES, REG::DI);
+                for (auto physical = word_t{}; physical != FRAME_PAGES; ++physical) {
+                    word_set(addr, static_cast<word_t>(FRAME_SEG + physical * (PAGE_SIZE >> 4)));
+                    word_set(addr + 2, physical);
+                    addr = addr + 4;
+                }
+            }
+            cpu.reg_set(REG::CX, FRAME_PAGES);
+            return Status::NONE;
+        default:
+            return Status::FUNCTION;
+        }
+    }
+public:
+    // Owned by a PC, which hands it its own memory and CPU
+    EMS(MEM& mem, CPU& cpu, word_t pages) : mem(mem), cpu(cpu), storage(pages) {
+        for (auto& block : storage) {
+            block = std::make_shared<Block>();
+        }
+        handles[0].used = true;
+        free_rebuild();
+    }
+
+    EMS(EMS const&) = delete;
+    EMS& operator=(EMS const&) = delete;
+
+    [[nodiscard]] word_t total() const noexcept {
+        return static_cast<word_t>(storage.size());
+    }
+
+    [[nodiscard]] static constexpr bool frame_has(dword_t page) noexcept {
+        return page >= FRAME_FIRST && page < FRAME_FIRST + FRAME_PAGES * MEM_PAGES;
+    }
+
+    void install(HLE& hle) {
+        mem.copy_in(FAR { 0, DRIVER_SEG }.ea(), driver);
+        word_set({ 0x67 * 4, 0 }, 0);
+        word_set({ 0x67 * 4 + 2, 0 }, DRIVER_SEG);
+        hle.hook_vector(0x67, [this](CPU&, BUS&) {
+            status(int67());
+            return true;
+        });
+    }
+
+    // Points the frame at the mapped pages again, after the memory under it was replaced
+    void remap() {
+        for (auto physical = byte_t{}; physical != FRAME_PAGES; ++physical) {
+            map(physical, frame[physical]);
+        }
+    }
+
+    // Takes over the pages of other without copying them, the frames of both sides are mapped again
+    void share(EMS& other) {
+        storage = other.storage;
+        other.remap();
+        remap();
+    }
+
+    // Handles and the page frame, the driver stub and its vector belong to install
+    // Loading leaves the frame for remap, once the memory under it is in place
+    template <typename S>
+    void serialize(S& s) {
+        for (auto& entry : handles) {
+            s(entry.used);
+            s(entry.saved);
+            auto count = static_cast<word_t>(entry.pages.size());
+            s(count);
+            if constexpr (S::LOADING) {
+                entry.pages.resize(count);
+            }
+            for (auto& page : entry.pages) {
+                s(page);
+                if (page >= total()) {
+                    throw "EMS state does not match the board!";
+                }
+            }
+            s(entry.name);
+            for (auto& mapping : entry.context) {
+                s(mapping.handle);
+                s(mapping.logical);
+            }
+        }
+        for (auto& mapping : frame) {
+            s(mapping.handle);
+            s(mapping.logical);
+            if (mapping.logical != UNMAPPED && (mapping.handle >= HANDLES || mapping.logical >= handles[mapping.handle].pages.size())) {
+                throw "EMS state does not match the board!";
+            }
+        }
+        if constexpr (S::LOADING) {
+            free_rebuild();
+        }
+    }
+
+    // Contents of the board, kept apart from serialize since fork shares them instead
+    template <typename S>
+    void serialize_pages(S& s) {
+        for (auto page = word_t{}; page != total(); ++page) {
+            if constexpr (S::LOADING) {
+                s.bytes(std::span(own(page), PAGE_SIZE));
+            } else {
+                s.bytes(*storage[page]);
+            }
+        }
+    }
+};
+
+#endif // O126_EMS_HPP
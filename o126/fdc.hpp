@@ -0,0 +1,321 @@
+#ifndef O126_FDC_HPP
+#define O126_FDC_HPP
+#include "common.hpp"
+#include "disk.hpp"
+#include "dma.hpp"
+#include "mem.hpp"
+#include "sched.hpp"
+#include <algorithm>
+#include <initializer_list>
+#include <span>
+#include <vector>
+
+// NEC 765 on DMA channel 2, commands finish as soon as the last parameter byte arrives
+struct o126::FDC {
+private:
+    enum class Phase : byte_t {
+        COMMAND,
+        EXECUTE,
+        RESULT,
+    };
+
+    static constexpr byte_t DMA_CHANNEL = 2;
+
+    // Disks spin at 300 RPM, N is the size code of 512 byte sectors
+    static constexpr std::uint64_t REVOLUTION = SCHED::CLOCK / 5;
+    static constexpr byte_t SIZE_CODE = 2;
+    static_assert(std::size_t{128} << SIZE_CODE == DISK::SECTOR_SIZE);
+
+    // Parameter bytes including the command byte, indexed by the low 5 bits
+    static constexpr byte_t lengths[32] = {
+        1, 1, 9, 3, 2, 9, 9, 2, 1, 9, 2, 1, 9, 6, 1, 3,
+        1, 9, 1, 1, 1, 1, 1, 1, 1, 9, 1, 1, 1, 9, 1, 1,
+    };
+
+    byte_t command[9] = {};
+    byte_t command_size = {};
+    byte_t result[7] = {};
+    byte_t result_size = {};
+    byte_t result_pos = {};
+    byte_t cylinders[4] = {};
+    byte_t st0 = {};
+    byte_t dor = {};
+    byte_t reset_sense = {};
+    bool interupt = {};
+    Phase phase = Phase::COMMAND;
+    std::vector<byte_t> buffer = {};
+
+    constexpr void finish(std::initializer_list<byte_t> values, bool raise) noexcept {
+        result_size = {};
+        result_pos = {};
+        for (auto const val : values) {
+            result[result_size++] = val;
+        }
+        phase = result_size ? Phase::RESULT : Phase::COMMAND;
+        command_size = {};
+        if (raise) {
+            interupt = true;
+        }
+    }
+
+    // Read, write and format share the drive and head selection in the second byte
+    [[nodiscard]] constexpr byte_t unit() const noexcept {
+        return command[1] & 0b111;
+    }
+
+    void transfer(std::span<DISK> drives, MEM& mem, SCHED& sched, DMA& dma, bool write) {
+        auto const drive = static_cast<std::size_t>(command[1] & 3);
+        auto const multi = command[0] & 0x80;
+        auto cylinder = command[2];
+        auto head = command[3];
+        auto sector = command[4];
+        auto const eot = command[6];
+        if (drive >= drives.size() || !drives[drive].present() || (head & 1) != ((command[1] >> 2) & 1)) {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x01, 0x00, cylinder, head, sector, command[5] }, true);
+            return;
+        }
+        auto& disk = drives[drive];
+        auto const start = disk.lba(cylinder, head, sector);
+        if (start == disk.sectors() || sector > eot) {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x04, 0x00, cylinder, head, sector, command[5] }, true);
+            return;
+        }
+        // Sectors up to the end of track, continuing on the second side in multi-track mode
+        auto count = dword_t{ static_cast<byte_t>(eot - sector + 1) };
+        if (multi && head == 0 && disk.chs().heads > 1) {
+            count += eot;
+        }
+        count = std::min(count, disk.sectors() - start);
+
+        auto done = dword_t{};
+        auto stopped = false;
+        auto overrun = false;
+        while (done != count && !stopped) {
+            auto accepted = std::size_t{};
+            auto size = std::size_t{};
+            if (!write) {
+                auto const data = disk.run(start + done, count - done);
+                size = data.size();
+                accepted = dma.write(mem, sched, DMA_CHANNEL, data);
+            } else {
+                buffer.resize(std::size_t{count - done} * DISK::SECTOR_SIZE);
+                size = buffer.size();
+                accepted = dma.read(mem, sched, DMA_CHANNEL, buffer);
+                // A sector cut short by terminal count is padded with what was already there
+                auto const sectors = (accepted + DISK::SECTOR_SIZE - 1) / DISK::SECTOR_SIZE;
+                if (accepted % DISK::SECTOR_SIZE) {
+                    auto const tail = disk.run(static_cast<dword_t>(start + done + accepted / DISK::SECTOR_SIZE), 1);
+                    std::copy(tail.begin() + static_cast<std::ptrdiff_t>(accepted % DISK::SECTOR_SIZE), tail.end(),
+                              buffer.begin() + static_cast<std::ptrdiff_t>(accepted));
+                }
+                (void)disk.write(start + done, { buffer.data(), sectors * DISK::SECTOR_SIZE });
+            }
+            // A masked or unprogrammed channel never answers the request, the controller gives up with an overrun
+            if (accepted == 0) {
+                overrun = true;
+                break;
+            }
+            done += static_cast<dword_t>((accepted + DISK::SECTOR_SIZE - 1) / DISK::SECTOR_SIZE);
+            // The channel masks itself on terminal count unless it is in autoinit mode
+            stopped = accepted != size || dma.masked(DMA_CHANNEL);
+        }
+
+        // Position of the sector after the last one transferred
+        for (auto i = dword_t{}; i != done; ++i) {
+            if (sector++ == eot) {
+                sector = 1;
+                if (multi && head == 0) {
+                    head = 1;
+                } else {
+                    head = multi ? 0 : head;
+                    ++cylinder;
+                }
+            }
+        }
+        if (overrun) {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x10, 0x00, cylinder, head, sector, command[5] }, true);
+        } else if (stopped) {
+            finish({ unit(), 0x00, 0x00, cylinder, head, sector, command[5] }, true);
+        } else {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x80, 0x00, cylinder, head, sector, command[5] }, true);
+        }
+    }
+
+    void format(std::span<DISK> drives, MEM& mem, SCHED& sched, DMA& dma) {
+        auto const drive = static_cast<std::size_t>(command[1] & 3);
+        auto const head = static_cast<byte_t>((command[1] >> 2) & 1);
+        auto const count = command[3];
+        if (drive >= drives.size() || !drives[drive].present()) {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x01, 0x00, cylinders[drive & 3], head, 1, command[2] }, true);
+            return;
+        }
+        auto& disk = drives[drive];
+        // Four ID bytes per sector come in over DMA, the data field is filled with the gap byte
+        auto ids = std::vector<byte_t>(std::size_t{count} * 4);
+        if (dma.read(mem, sched, DMA_CHANNEL, ids) == 0 && !ids.empty()) {
+            finish({ static_cast<byte_t>(0x40 | unit()), 0x10, 0x00, cylinders[drive], head, 1, command[2] }, true);
+            return;
+        }
+        buffer.assign(DISK::SECTOR_SIZE, command[5]);
+        for (auto i = std::size_t{}; i != count; ++i) {
+            auto const lba = disk.lba(ids[i * 4 + 0], ids[i * 4 + 1], ids[i * 4 + 2]);
+            if (lba != disk.sectors()) {
+                (void)disk.write(lba, buffer);
+            }
+        }
+        finish({ unit(), 0x00, 0x00, cylinders[drive], head, count, command[2] }, true);
+    }
+public:
+    [[nodiscard]] static constexpr bool has_port(word_t port) noexcept {
+        return port == 0x3F2 || port == 0x3F4 || port == 0x3F5 || port == 0x3F7;
+    }
+
+    // IRQ 6, the DMA and interupt enable bit of the digital output register gates it
+    [[nodiscard]] constexpr bool irq() const noexcept {
+        return interupt && (dor & 0x08);
+    }
+
+    // Set once the last parameter byte has been written, execute() must run before the next access
+    [[nodiscard]] constexpr bool pending() const noexcept {
+        return phase == Phase::EXECUTE;
+    }
+
+    constexpr byte_t in_byte(word_t port) noexcept {
+        switch (port) {
+        case 0x3F2:
+            return dor;
+        case 0x3F4: // main status: ready, direction and busy
+            switch (phase) {
+            case Phase::RESULT:
+                return 0xD0;
+            default:
+                return command_size ? 0x90 : 0x80;
+            }
+        case 0x3F5:
+            if (phase != Phase::RESULT) {
+                return 0xFF;
+            }
+            interupt = false;
+            if (result_pos + 1 == result_size) {
+                phase = Phase::COMMAND;
+            }
+            return result[result_pos++];
+        default:
+            return 0x00;
+        }
+    }
+
+    constexpr void out_byte(word_t port, byte_t val) noexcept {
+        switch (port) {
+        case 0x3F2:
+            // Leaving reset reports a ready line change on every drive
+            if (!(dor & 0x04) && (val & 0x04)) {
+                phase = Phase::COMMAND;
+                command_size = {};
+                reset_sense = 4;
+                interupt = true;
+            }
+            dor = val;
+            break;
+        case 0x3F5:
+            if (phase != Phase::COMMAND || !(dor & 0x04)) {
+                break;
+            }
+            command[command_size++] = val;
+            if (command_size == lengths[command[0] & 0x1F]) {
+                phase = Phase::EXECUTE;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void execute(std::span<DISK> drives, MEM& mem, SCHED& sched, DMA& dma) {
+        auto const drive = static_cast<std::size_t>(command[1] & 3);
+        switch (command[0] & 0x1F) {
+        case 0x03: // specify, only DMA mode is supported
+            finish({}, false);
+            break;
+        case 0x04: { // sense drive status
+            auto const present = drive < drives.size() && drives[drive].present();
+            auto const two_sided = present && drives[drive].chs().heads > 1;
+            auto const st3 = (present ? 0x20 : 0x00) | (cylinders[drive] == 0 ? 0x10 : 0x00)
+                           | (two_sided ? 0x08 : 0x00) | unit();
+            finish({ static_cast<byte_t>(st3) }, false);
+            break;
+        }
+        case 0x05: // write data
+        case 0x09: // write deleted data
+            transfer(drives, mem, sched, dma, true);
+            break;
+        case 0x06: // read data
+        case 0x0C: // read deleted data
+            transfer(drives, mem, sched, dma, false);
+            break;
+        case 0x07: // recalibrate
+            cylinders[drive] = 0;
+            st0 = static_cast<byte_t>(0x20 | drive);
+            finish({}, true);
+            break;
+        case 0x08: // sense interupt status
+            interupt = false;
+            if (reset_sense) {
+                auto const index = static_cast<byte_t>(4 - reset_sense--);
+                finish({ static_cast<byte_t>(0xC0 | index), cylinders[index] }, false);
+            } else if (st0) {
+                auto const val = st0;
+                st0 = {};
+                finish({ val, cylinders[val & 3] }, false);
+            } else {
+                finish({ 0x80 }, false);
+            }
+            break;
+        case 0x0A: { // read ID, of the sector that comes under the head next
+            auto const head = static_cast<byte_t>((command[1] >> 2) & 1);
+            if (drive >= drives.size() || !drives[drive].present() || cylinders[drive] >= drives[drive].chs().cylinders
+                || head >= drives[drive].chs().heads) {
+                finish({ static_cast<byte_t>(0x40 | unit()), 0x01, 0x00, cylinders[drive], head, 1, SIZE_CODE }, true);
+                break;
+            }
+            auto const sectors = drives[drive].chs().sectors;
+            auto const passing = sched.now % REVOLUTION * sectors / REVOLUTION;
+            auto const sector = static_cast<byte_t>((passing + 1) % sectors + 1);
+            finish({ unit(), 0x00, 0x00, cylinders[drive], head, sector, SIZE_CODE }, true);
+            break;
+        }
+        case 0x0D: // format track
+            format(drives, mem, sched, dma);
+            break;
+        case 0x0F: // seek
+            cylinders[drive] = command[2];
+            st0 = static_cast<byte_t>(0x20 | unit());
+            finish({}, true);
+            break;
+        case 0x10: // version, reports a plain 765A
+            finish({ 0x80 }, false);
+            break;
+        default: // invalid command
+            finish({ 0x80 }, false);
+            break;
+        }
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        s(command);
+        s(command_size);
+        s(result);
+        s(result_size);
+        s(result_pos);
+        s(cylinders);
+        s(st0);
+        s(dor);
+        s(reset_sense);
+        s(interupt);
+        s(phase);
+    }
+};
+
+#endif // O126_FDC_HPP
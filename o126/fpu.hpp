@@ -0,0 +1,1413 @@
+#ifndef O126_FPU_HPP
+#define O126_FPU_HPP
+#include "common.hpp"
+#include "bus.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+// 8087 coprocessor fed by the CPU's ESC opcodes, registers always hold the exact 80-bit format
+struct o126::FPU final {
+    // EXACT rounds every result in software as the 8087 does, FAST computes in host long double
+    enum class Mode : byte_t {
+        EXACT,
+        FAST,
+    };
+
+    // Extended real as stored in a register or in memory
+    struct F80 final {
+        std::uint64_t sig = {};
+        word_t se = {}; // sign in bit 15, biased exponent below it
+
+        [[nodiscard]] constexpr bool sign() const noexcept {
+            return se >> 15;
+        }
+
+        [[nodiscard]] constexpr word_t biased() const noexcept {
+            return se & 0x7FFF;
+        }
+
+        [[nodiscard]] constexpr bool is_special() const noexcept {
+            return biased() == 0x7FFF;
+        }
+
+        [[nodiscard]] constexpr bool is_nan() const noexcept {
+            return is_special() && (sig << 1) != 0;
+        }
+
+        [[nodiscard]] constexpr bool is_inf() const noexcept {
+            return is_special() && (sig << 1) == 0;
+        }
+
+        [[nodiscard]] constexpr bool is_zero() const noexcept {
+            return !is_special() && sig == 0;
+        }
+
+        [[nodiscard]] constexpr bool is_denormal() const noexcept {
+            return biased() == 0 && sig != 0;
+        }
+
+        [[nodiscard]] constexpr F80 with_sign(bool value) const noexcept {
+            return { sig, static_cast<word_t>((se & 0x7FFF) | (value << 15)) };
+        }
+    };
+
+    Mode mode = Mode::EXACT;
+private:
+    __extension__ using u128 = unsigned __int128;
+
+    /// Status and control words
+    static constexpr word_t IE = 0x0001; // invalid operation, also stack overflow and underflow
+    static constexpr word_t DE = 0x0002; // denormalized operand
+    static constexpr word_t ZE = 0x0004; // zero divide
+    static constexpr word_t OE = 0x0008; // overflow
+    static constexpr word_t UE = 0x0010; // underflow
+    static constexpr word_t PE = 0x0020; // precision
+    static constexpr word_t EXCEPTIONS = 0x003F;
+    static constexpr word_t IR = 0x0080; // interupt request
+    static constexpr word_t C0 = 0x0100;
+    static constexpr word_t C1 = 0x0200;
+    static constexpr word_t C2 = 0x0400;
+    static constexpr word_t C3 = 0x4000;
+    static constexpr word_t CONDITION = C0 | C1 | C2 | C3;
+    static constexpr word_t IEM = 0x0080; // interupt enable mask
+    static constexpr word_t CONTROL_INIT = 0x03FF;
+
+    enum class Round : byte_t {
+        NEAREST,
+        DOWN,
+        UP,
+        CHOP,
+    };
+
+    // Finite value sig * 2^(exp - 127), normalized values have bit 127 set
+    struct Real {
+        bool sign = {};
+        std::int32_t exp = {};
+        u128 sig = {};
+    };
+
+    struct Format {
+        int bits = {};
+        std::int32_t emin = {};
+        std::int32_t emax = {};
+    };
+
+    static constexpr Format SINGLE = { 24, -126, 127 };
+    static constexpr Format DOUBLE = { 53, -1022, 1023 };
+    static constexpr Format EXTENDED = { 64, -16382, 16383 };
+
+    static constexpr F80 INDEFINITE = { 0xC000'0000'0000'0000, 0xFFFF };
+    static constexpr F80 ONE = { 0x8000'0000'0000'0000, 0x3FFF };
+    static constexpr F80 constants[7] = {
+        ONE,
+        { 0xD49A'784B'CD1B'8AFE, 0x4000 }, // log2(10)
+        { 0xB8AA'3B29'5C17'F0BC, 0x3FFF }, // log2(e)
+        { 0xC90F'DAA2'2168'C235, 0x4000 }, // pi
+        { 0x9A20'9A84'FBCF'F799, 0x3FFD }, // log10(2)
+        { 0xB172'17F7'D1CF'79AC, 0x3FFE }, // ln(2)
+        { 0, 0 },
+    };
+
+    // Hosts whose long double is the same 80-bit format move registers by copying bytes
+    static constexpr bool HOST_EXTENDED = std::numeric_limits<long double>::digits == 64
+        && std::numeric_limits<long double>::max_exponent == 16384
+        && std::endian::native == std::endian::little;
+
+    F80 regs[8] = {};
+    byte_t empty = 0xFF; // one bit per physical register
+    byte_t top = {};
+    word_t control = CONTROL_INIT;
+    word_t status = {}; // without the TOP field
+    // Last non-control instruction for FSTENV and FSAVE
+    FAR last_inst = {};
+    word_t last_op = {};
+    FAR last_data = {};
+    // Exceptions of the instruction in flight
+    word_t raised = {};
+
+    /// 128-bit helpers
+    [[nodiscard]] static constexpr int clz(u128 value) noexcept {
+        auto const hi = static_cast<std::uint64_t>(value >> 64);
+        return hi ? std::countl_zero(hi) : 64 + std::countl_zero(static_cast<std::uint64_t>(value));
+    }
+
+    [[nodiscard]] static constexpr u128 shr_sticky(u128 value, std::uint32_t count) noexcept {
+        if (count == 0) {
+            return value;
+        }
+        if (count >= 128) {
+            return value != 0;
+        }
+        return (value >> count) | ((value << (128 - count)) != 0);
+    }
+
+    [[nodiscard]] static constexpr Real normalize(Real value) noexcept {
+        if (value.sig) {
+            auto const shift = clz(value.sig);
+            value.sig <<= shift;
+            value.exp -= shift;
+        }
+        return value;
+    }
+
+    /// Rounding and packing
+    [[nodiscard]] constexpr Round rounding() const noexcept {
+        return static_cast<Round>((control >> 10) & 3);
+    }
+
+    // Precision control only narrows the significand, the exponent keeps its extended range
+    [[nodiscard]] constexpr Format precision() const noexcept {
+        switch ((control >> 8) & 3) {
+        case 0:
+            return { SINGLE.bits, EXTENDED.emin, EXTENDED.emax };
+        case 2:
+            return { DOUBLE.bits, EXTENDED.emin, EXTENDED.emax };
+        default:
+            return EXTENDED;
+        }
+    }
+
+    // An exponent above emax marks infinity, denormals keep exp at emin with bit 127 clear
+    [[nodiscard]] constexpr Real round(Real value, Format format) noexcept {
+        if (!value.sig) {
+            return value;
+        }
+        value = normalize(value);
+        auto tiny = false;
+        if (value.exp < format.emin) {
+            value.sig = shr_sticky(value.sig, static_cast<std::uint32_t>(format.emin - value.exp));
+            value.exp = format.emin;
+            tiny = true;
+        }
+        auto const drop = 128 - format.bits;
+        auto const mask = (u128{1} << drop) - 1;
+        auto const half = u128{1} << (drop - 1);
+        auto const rest = value.sig & mask;
+        value.sig &= ~mask;
+        auto up = false;
+        switch (rounding()) {
+        case Round::NEAREST:
+            up = rest > half || (rest == half && ((value.sig >> drop) & 1));
+            break;
+        case Round::DOWN:
+            up = rest && value.sign;
+            break;
+        case Round::UP:
+            up = rest && !value.sign;
+            break;
+        case Round::CHOP:
+            break;
+        }
+        if (rest) {
+            raised |= PE;
+            if (tiny) {
+                raised |= UE;
+            }
+        }
+        if (up) {
+            value.sig += u128{1} << drop;
+            if (!value.sig) {
+                value.sig = u128{1} << 127;
+                value.exp += 1;
+            }
+        }
+        if (value.exp > format.emax) {
+            raised |= OE | PE;
+            auto const round = rounding();
+            if (round == Round::NEAREST || (round == Round::UP && !value.sign) || (round == Round::DOWN && value.sign)) {
+                value.exp = format.emax + 1;
+                value.sig = u128{1} << 127;
+            } else {
+                value.exp = format.emax;
+                value.sig = ~mask;
+            }
+        }
+        return value;
+    }
+
+    [[nodiscard]] static constexpr F80 pack(Real value) noexcept {
+        auto const sign = static_cast<word_t>(value.sign << 15);
+        if (!value.sig) {
+            return { 0, sign };
+        }
+        if (value.exp > EXTENDED.emax) {
+            return { std::uint64_t{1} << 63, static_cast<word_t>(sign | 0x7FFF) };
+        }
+        auto const sig = static_cast<std::uint64_t>(value.sig >> 64);
+        if (!(value.sig >> 127)) {
+            return { sig, sign };
+        }
+        return { sig, static_cast<word_t>(sign | (value.exp + 0x3FFF)) };
+    }
+
+    [[nodiscard]] constexpr F80 result(Real value) noexcept {
+        return pack(round(value, precision()));
+    }
+
+    // Finite values only, unnormals and denormals come back normalized
+    [[nodiscard]] constexpr Real unpack(F80 value) noexcept {
+        if (value.is_denormal()) {
+            raised |= DE;
+        }
+        auto const biased = value.biased();
+        return normalize({ value.sign(), biased ? biased - 0x3FFF : EXTENDED.emin, u128{value.sig} << 64 });
+    }
+
+    /// Special operands
+    [[nodiscard]] constexpr F80 invalid() noexcept {
+        raised |= IE;
+        return INDEFINITE;
+    }
+
+    // Signaling NaNs raise invalid, the NaN with the larger significand wins
+    [[nodiscard]] constexpr F80 nan(F80 lhs, F80 rhs) noexcept {
+        auto const quiet = std::uint64_t{1} << 62;
+        if ((lhs.is_nan() && !(lhs.sig & quiet)) || (rhs.is_nan() && !(rhs.sig & quiet))) {
+            raised |= IE;
+        }
+        auto result = lhs.is_nan() && (!rhs.is_nan() || (lhs.sig << 1) >= (rhs.sig << 1)) ? lhs : rhs;
+        result.sig |= quiet;
+        return result;
+    }
+
+    [[nodiscard]] static constexpr F80 zero(bool sign) noexcept {
+        return { 0, static_cast<word_t>(sign << 15) };
+    }
+
+    [[nodiscard]] static constexpr F80 inf(bool sign) noexcept {
+        return { std::uint64_t{1} << 63, static_cast<word_t>((sign << 15) | 0x7FFF) };
+    }
+
+    /// Host conversion
+    [[nodiscard]] static long double host(F80 value) noexcept {
+        if constexpr (HOST_EXTENDED) {
+            auto result = 0.0L;
+            std::memcpy(&result, &value.sig, sizeof(value.sig));
+            std::memcpy(reinterpret_cast<byte_t*>(&result) + sizeof(value.sig), &value.se, sizeof(value.se));
+            return result;
+        } else {
+            if (value.is_nan()) {
+                return std::copysign(std::numeric_limits<long double>::quiet_NaN(), value.sign() ? -1.0L : 1.0L);
+            }
+            if (value.is_inf()) {
+                return value.sign() ? -std::numeric_limits<long double>::infinity() : std::numeric_limits<long double>::infinity();
+            }
+            auto const biased = value.biased() ? value.biased() : 1;
+            auto const result = std::ldexp(static_cast<long double>(value.sig), biased - 0x3FFF - 63);
+            return value.sign() ? -result : result;
+        }
+    }
+
+    [[nodiscard]] F80 host(long double value) noexcept {
+        if constexpr (HOST_EXTENDED) {
+            auto result = F80 {};
+            std::memcpy(&result.sig, &value, sizeof(result.sig));
+            std::memcpy(&result.se, reinterpret_cast<byte_t const*>(&value) + sizeof(result.sig), sizeof(result.se));
+            return result;
+        } else {
+            if (std::isnan(value)) {
+                return INDEFINITE.with_sign(std::signbit(value));
+            }
+            if (std::isinf(value)) {
+                return inf(std::signbit(value));
+            }
+            if (value == 0) {
+                return zero(std::signbit(value));
+            }
+            auto exp = 0;
+            auto const frac = std::frexp(std::fabs(value), &exp);
+            auto const sig = static_cast<std::uint64_t>(std::ldexp(frac, 64));
+            return pack(round({ std::signbit(value), exp - 1, u128{sig} << 64 }, EXTENDED));
+        }
+    }
+
+    // Host arithmetic reports only the exceptions a result can show
+    [[nodiscard]] F80 host_result(long double value, long double lhs, long double rhs) noexcept {
+        if (std::isnan(value) && !std::isnan(lhs) && !std::isnan(rhs)) {
+            raised |= IE;
+            return INDEFINITE;
+        }
+        if (std::isinf(value) && std::isfinite(lhs) && std::isfinite(rhs)) {
+            raised |= rhs == 0 ? ZE : OE;
+        }
+        return host(value);
+    }
+
+    /// Arithmetic
+    [[nodiscard]] constexpr F80 add(F80 lhs, F80 rhs, bool subtract) noexcept {
+        if (lhs.is_nan() || rhs.is_nan()) {
+            return nan(lhs, rhs);
+        }
+        auto const rhs_sign = rhs.sign() != subtract;
+        if (lhs.is_inf()) {
+            return rhs.is_inf() && lhs.sign() != rhs_sign ? invalid() : lhs;
+        }
+        if (rhs.is_inf()) {
+            return inf(rhs_sign);
+        }
+        if (lhs.is_zero() && rhs.is_zero()) {
+            return zero(lhs.sign() == rhs_sign ? lhs.sign() : rounding() == Round::DOWN);
+        }
+        if (lhs.is_zero()) {
+            return result(unpack(rhs.with_sign(rhs_sign)));
+        }
+        if (rhs.is_zero()) {
+            return result(unpack(lhs));
+        }
+        auto big = unpack(lhs);
+        auto small = unpack(rhs.with_sign(rhs_sign));
+        if (big.exp < small.exp) {
+            std::swap(big, small);
+        }
+        // One bit of headroom for the carry, the bits shifted out stay as sticky
+        auto const lhs_sig = shr_sticky(big.sig, 1);
+        auto const rhs_sig = shr_sticky(small.sig, static_cast<std::uint32_t>(big.exp - small.exp) + 1);
+        auto sum = Real { big.sign, big.exp + 1, {} };
+        if (big.sign == small.sign) {
+            sum.sig = lhs_sig + rhs_sig;
+        } else if (lhs_sig >= rhs_sig) {
+            sum.sig = lhs_sig - rhs_sig;
+        } else {
+            sum.sig = rhs_sig - lhs_sig;
+            sum.sign = small.sign;
+        }
+        if (!sum.sig) {
+            return zero(rounding() == Round::DOWN);
+        }
+        return result(sum);
+    }
+
+    [[nodiscard]] constexpr F80 mul(F80 lhs, F80 rhs) noexcept {
+        if (lhs.is_nan() || rhs.is_nan()) {
+            return nan(lhs, rhs);
+        }
+        auto const sign = lhs.sign() != rhs.sign();
+        if ((lhs.is_inf() && rhs.is_zero()) || (lhs.is_zero() && rhs.is_inf())) {
+            return invalid();
+        }
+        if (lhs.is_inf() || rhs.is_inf()) {
+            return inf(sign);
+        }
+        if (lhs.is_zero() || rhs.is_zero()) {
+            return zero(sign);
+        }
+        auto const a = unpack(lhs);
+        auto const b = unpack(rhs);
+        auto const product = (a.sig >> 64) * (b.sig >> 64);
+        return result({ sign, a.exp + b.exp + 1, product });
+    }
+
+    [[nodiscard]] constexpr F80 div(F80 lhs, F80 rhs) noexcept {
+        if (lhs.is_nan() || rhs.is_nan()) {
+            return nan(lhs, rhs);
+        }
+        auto const sign = lhs.sign() != rhs.sign();
+        if ((lhs.is_inf() && rhs.is_inf()) || (lhs.is_zero() && rhs.is_zero())) {
+            return invalid();
+        }
+        if (lhs.is_inf()) {
+            return inf(sign);
+        }
+        if (rhs.is_inf()) {
+            return zero(sign);
+        }
+        if (rhs.is_zero()) {
+            raised |= ZE;
+            return inf(sign);
+        }
+        if (lhs.is_zero()) {
+            return zero(sign);
+        }
+        auto const a = unpack(lhs);
+        auto const b = unpack(rhs);
+        auto const divisor = b.sig >> 64;
+        auto const dividend = a.sig >> 64;
+        // Two 64-bit quotient digits, the first one always has its top bit set
+        auto const shift = dividend >= divisor ? 63 : 64;
+        auto const first = (dividend << shift) / divisor;
+        auto const rest = (dividend << shift) % divisor;
+        auto const second = (rest << 64) / divisor;
+        auto const sticky = (rest << 64) % divisor != 0;
+        auto const quotient = (first << 64) | second | sticky;
+        return result({ sign, a.exp - b.exp - (shift - 63), quotient });
+    }
+
+    [[nodiscard]] constexpr F80 sqrt(F80 value) noexcept {
+        if (value.is_nan()) {
+            return nan(value, value);
+        }
+        if (value.is_zero()) {
+            return value;
+        }
+        if (value.sign()) {
+            return invalid();
+        }
+        if (value.is_inf()) {
+            return value;
+        }
+        auto const a = unpack(value);
+        auto const exp = a.exp - 63;
+        auto const odd = exp & 1;
+        auto const radicand = (a.sig >> 64) << (odd ? 63 : 64);
+        auto const half_exp = (exp - (odd ? 63 : 64)) / 2;
+        // Digit by digit, 64 pairs of radicand bits and two more of zeros give 66 root bits
+        auto root = u128{};
+        auto rest = u128{};
+        for (auto i = 0; i != 66; ++i) {
+            auto const pair = i < 64 ? (radicand >> (126 - 2 * i)) & 3 : 0;
+            rest = (rest << 2) | pair;
+            auto const trial = (root << 2) | 1;
+            root <<= 1;
+            if (rest >= trial) {
+                rest -= trial;
+                root |= 1;
+            }
+        }
+        return result({ false, half_exp + 124, (root << 1) | (rest != 0) });
+    }
+
+    // 0 ADD, 1 MUL, 4 SUB, 5 SUBR, 6 DIV, 7 DIVR as encoded in the reg field
+    [[nodiscard]] F80 arith(byte_t kind, F80 dst, F80 src) noexcept {
+        if (mode == Mode::FAST) {
+            auto const lhs = host(dst);
+            auto const rhs = host(src);
+            switch (kind) {
+            case 0:
+                return host_result(lhs + rhs, lhs, rhs);
+            case 1:
+                return host_result(lhs * rhs, lhs, rhs);
+            case 4:
+                return host_result(lhs - rhs, lhs, rhs);
+            case 5:
+                return host_result(rhs - lhs, rhs, lhs);
+            case 6:
+                return host_result(lhs / rhs, lhs, rhs);
+            default:
+                return host_result(rhs / lhs, rhs, lhs);
+            }
+        }
+        switch (kind) {
+        case 0:
+            return add(dst, src, false);
+        case 1:
+            return mul(dst, src);
+        case 4:
+            return add(dst, src, true);
+        case 5:
+            return add(src, dst, true);
+        case 6:
+            return div(dst, src);
+        default:
+            return div(src, dst);
+        }
+    }
+
+    // Sets C3, C2 and C0 like an integer compare would set ZF, PF and CF
+    constexpr void compare(F80 lhs, F80 rhs) noexcept {
+        status &= ~(C0 | C2 | C3);
+        if (lhs.is_nan() || rhs.is_nan()) {
+            raised |= IE;
+            status |= C0 | C2 | C3;
+            return;
+        }
+        if (lhs.is_zero() && rhs.is_zero()) {
+            status |= C3;
+            return;
+        }
+        auto const magnitude = [this](F80 value) {
+            if (value.is_inf()) {
+                return Real { value.sign(), std::numeric_limits<std::int32_t>::max(), {} };
+            }
+            if (value.is_zero()) {
+                return Real { value.sign(), std::numeric_limits<std::int32_t>::min(), {} };
+            }
+            return unpack(value);
+        };
+        auto const a = magnitude(lhs);
+        auto const b = magnitude(rhs);
+        auto less = false;
+        if (a.sign != b.sign) {
+            less = a.sign;
+        } else if (a.exp != b.exp || a.sig != b.sig) {
+            less = (a.exp < b.exp || (a.exp == b.exp && a.sig < b.sig)) != a.sign;
+        } else {
+            status |= C3;
+            return;
+        }
+        if (less) {
+            status |= C0;
+        }
+    }
+
+    /// Integers
+    struct Integer {
+        bool valid = {};
+        bool sign = {};
+        std::uint64_t magnitude = {};
+    };
+
+    // Rounds with the rounding control, invalid for NaN, infinity and anything from 2^64 up
+    [[nodiscard]] constexpr Integer integer(F80 value) noexcept {
+        if (value.is_special()) {
+            return {};
+        }
+        if (value.is_zero()) {
+            return { true, value.sign(), 0 };
+        }
+        auto const a = unpack(value);
+        if (a.exp >= 64) {
+            return {};
+        }
+        auto whole = u128{};
+        auto rest = a.sig;
+        auto half = u128{1} << 127;
+        auto below_half = a.exp < -1;
+        if (a.exp >= -1) {
+            auto const shift = 127 - a.exp;
+            whole = shift == 128 ? 0 : a.sig >> shift;
+            rest = shift == 128 ? a.sig : a.sig & ((u128{1} << shift) - 1);
+            half = u128{1} << (shift - 1);
+        }
+        auto up = false;
+        switch (rounding()) {
+        case Round::NEAREST:
+            up = !below_half && (rest > half || (rest == half && (whole & 1)));
+            break;
+        case Round::DOWN:
+            up = rest && a.sign;
+            break;
+        case Round::UP:
+            up = rest && !a.sign;
+            break;
+        case Round::CHOP:
+            break;
+        }
+        if (rest) {
+            raised |= PE;
+        }
+        whole += up;
+        if (whole >> 64) {
+            return {};
+        }
+        return { true, a.sign, static_cast<std::uint64_t>(whole) };
+    }
+
+    [[nodiscard]] constexpr F80 from_integer(bool sign, std::uint64_t magnitude) noexcept {
+        return pack(round({ sign, 63, u128{magnitude} << 64 }, EXTENDED));
+    }
+
+    [[nodiscard]] constexpr F80 from_integer(std::int64_t value) noexcept {
+        auto const sign = value < 0;
+        auto const magnitude = sign ? 0 - static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+        return from_integer(sign, magnitude);
+    }
+
+    // Out of range stores the integer indefinite, the most negative value of the width
+    [[nodiscard]] constexpr std::uint64_t to_integer(F80 value, int bits) noexcept {
+        auto const limit = std::uint64_t{1} << (bits - 1);
+        auto const indefinite = limit;
+        auto const whole = integer(value);
+        if (!whole.valid || whole.magnitude > limit - !whole.sign) {
+            raised |= IE;
+            return indefinite;
+        }
+        return whole.sign ? 0 - whole.magnitude : whole.magnitude;
+    }
+
+    /// Memory formats
+    [[nodiscard]] constexpr F80 from_real(std::uint64_t bits, Format format) noexcept {
+        auto const frac_bits = format.bits - 1;
+        auto const exp_bits = 64 - std::countl_zero(static_cast<std::uint64_t>(format.emax)) + 1;
+        auto const sign = (bits >> (frac_bits + exp_bits)) & 1;
+        auto const exp_max = (std::uint64_t{1} << exp_bits) - 1;
+        auto const biased = (bits >> frac_bits) & exp_max;
+        auto const frac = bits & ((std::uint64_t{1} << frac_bits) - 1);
+        auto const shift = 63 - frac_bits;
+        if (biased == exp_max) {
+            if (!frac) {
+                return inf(sign);
+            }
+            auto const result = F80 { (std::uint64_t{1} << 63) | (frac << shift), static_cast<word_t>((sign << 15) | 0x7FFF) };
+            return nan(result, result);
+        }
+        if (!biased && !frac) {
+            return zero(sign);
+        }
+        if (!biased) {
+            raised |= DE;
+            return pack(round({ static_cast<bool>(sign), format.emin, u128{frac} << (127 - frac_bits) }, EXTENDED));
+        }
+        auto const sig = (std::uint64_t{1} << frac_bits) | frac;
+        return pack({ static_cast<bool>(sign), static_cast<std::int32_t>(biased) - format.emax, u128{sig} << (127 - frac_bits) });
+    }
+
+    [[nodiscard]] constexpr std::uint64_t to_real(F80 value, Format format) noexcept {
+        auto const frac_bits = format.bits - 1;
+        auto const exp_bits = 64 - std::countl_zero(static_cast<std::uint64_t>(format.emax)) + 1;
+        auto const exp_max = (std::uint64_t{1} << exp_bits) - 1;
+        auto const frac_mask = (std::uint64_t{1} << frac_bits) - 1;
+        auto const shift = 63 - frac_bits;
+        auto const sign = std::uint64_t{value.sign()} << (frac_bits + exp_bits);
+        if (value.is_nan()) {
+            auto const quiet = nan(value, value);
+            return sign | (exp_max << frac_bits) | ((quiet.sig >> shift) & frac_mask);
+        }
+        if (value.is_inf()) {
+            return sign | (exp_max << frac_bits);
+        }
+        if (value.is_zero()) {
+            return sign;
+        }
+        auto const rounded = round(unpack(value), format);
+        if (rounded.exp > format.emax) {
+            return sign | (exp_max << frac_bits);
+        }
+        auto const frac = static_cast<std::uint64_t>(rounded.sig >> (127 - frac_bits));
+        if (!(rounded.sig >> 127)) {
+            return sign | frac;
+        }
+        auto const biased = static_cast<std::uint64_t>(rounded.exp + format.emax);
+        return sign | (biased << frac_bits) | (frac & frac_mask);
+    }
+
+    /// Stack
+    [[nodiscard]] constexpr byte_t phys(byte_t index) const noexcept {
+        return (top + index) & 7;
+    }
+
+    [[nodiscard]] constexpr bool is_empty(byte_t index) const noexcept {
+        return (empty >> phys(index)) & 1;
+    }
+
+    // Reading an empty register is a stack underflow, the masked response is the indefinite
+    [[nodiscard]] constexpr F80 get(byte_t index) noexcept {
+        if (is_empty(index)) {
+            return invalid();
+        }
+        return regs[phys(index)];
+    }
+
+    constexpr void set(byte_t index, F80 value) noexcept {
+        regs[phys(index)] = value;
+        empty &= ~(1 << phys(index));
+    }
+
+    // Pushing onto a full register is a stack overflow
+    constexpr void push(F80 value) noexcept {
+        top = (top - 1) & 7;
+        if (!is_empty(0)) {
+            value = invalid();
+        }
+        set(0, value);
+    }
+
+    constexpr void pop() noexcept {
+        empty |= 1 << phys(0);
+        top = (top + 1) & 7;
+    }
+
+    // Unmasked invalid, denormal and zero divide leave the destination alone
+    [[nodiscard]] constexpr bool blocked() const noexcept {
+        return raised & ~control & (IE | DE | ZE);
+    }
+
+    constexpr void store(byte_t index, F80 value) noexcept {
+        if (!blocked()) {
+            set(index, value);
+        }
+    }
+
+    [[nodiscard]] constexpr byte_t tag(byte_t reg) const noexcept {
+        if ((empty >> reg) & 1) {
+            return 3;
+        }
+        auto const value = regs[reg];
+        if (value.is_zero()) {
+            return 1;
+        }
+        if (value.is_special() || value.biased() == 0 || !(value.sig >> 63)) {
+            return 2;
+        }
+        return 0;
+    }
+
+    /// Bus access
+    [[nodiscard]] static std::uint64_t read(BUS& bus, FAR addr, int size) noexcept {
+        auto result = std::uint64_t{};
+        for (auto i = size; i != 0; --i) {
+            result = (result << 8) | bus.read_byte(addr + static_cast<sword_t>(i - 1));
+        }
+        return result;
+    }
+
+    static void write(BUS& bus, FAR addr, int size, std::uint64_t value) noexcept {
+        for (auto i = 0; i != size; ++i) {
+            bus.write_byte(addr + static_cast<sword_t>(i), static_cast<byte_t>(value >> (i * 8)));
+        }
+    }
+
+    [[nodiscard]] static F80 read80(BUS& bus, FAR addr) noexcept {
+        return { read(bus, addr, 8), static_cast<word_t>(read(bus, addr + 8, 2)) };
+    }
+
+    static void write80(BUS& bus, FAR addr, F80 value) noexcept {
+        write(bus, addr, 8, value.sig);
+        write(bus, addr + 8, 2, value.se);
+    }
+
+    // Operand of the memory forms of D8, DA, DC and DE
+    [[nodiscard]] F80 operand(BUS& bus, byte_t op, FAR addr) noexcept {
+        switch (op) {
+        case 0:
+            return from_real(read(bus, addr, 4), SINGLE);
+        case 2:
+            return from_integer(static_cast<std::int32_t>(read(bus, addr, 4)));
+        case 4:
+            return from_real(read(bus, addr, 8), DOUBLE);
+        default:
+            return from_integer(static_cast<sword_t>(read(bus, addr, 2)));
+        }
+    }
+
+    /// Environment
+    void env_store(BUS& bus, FAR addr) noexcept {
+        auto tags = word_t{};
+        for (auto reg = byte_t{}; reg != 8; ++reg) {
+            tags |= static_cast<word_t>(tag(reg) << (reg * 2));
+        }
+        auto const inst = last_inst.ea();
+        auto const data = last_data.ea();
+        write(bus, addr, 2, control);
+        write(bus, addr + 2, 2, status_get());
+        write(bus, addr + 4, 2, tags);
+        write(bus, addr + 6, 2, inst & 0xFFFF);
+        write(bus, addr + 8, 2, ((inst >> 4) & 0xF000) | (last_op & 0x07FF));
+        write(bus, addr + 10, 2, data & 0xFFFF);
+        write(bus, addr + 12, 2, (data >> 4) & 0xF000);
+    }
+
+    void env_load(BUS& bus, FAR addr) noexcept {
+        control = static_cast<word_t>(read(bus, addr, 2));
+        auto const value = static_cast<word_t>(read(bus, addr + 2, 2));
+        top = (value >> 11) & 7;
+        status = value & ~0x3800;
+        auto const tags = read(bus, addr + 4, 2);
+        empty = {};
+        for (auto reg = 0; reg != 8; ++reg) {
+            if (((tags >> (reg * 2)) & 3) == 3) {
+                empty |= static_cast<byte_t>(1 << reg);
+            }
+        }
+        auto const inst = static_cast<dword_t>(read(bus, addr + 6, 2) | ((read(bus, addr + 8, 2) & 0xF000) << 4));
+        auto const data = static_cast<dword_t>(read(bus, addr + 10, 2) | ((read(bus, addr + 12, 2) & 0xF000) << 4));
+        last_inst = { static_cast<word_t>(inst & 0xF), static_cast<word_t>(inst >> 4) };
+        last_op = static_cast<word_t>(read(bus, addr + 8, 2) & 0x07FF);
+        last_data = { static_cast<word_t>(data & 0xF), static_cast<word_t>(data >> 4) };
+    }
+
+    /// Instruction groups
+    void exec_arith(BUS& bus, byte_t op, byte_t modrm, FAR addr) noexcept {
+        auto const reg = static_cast<byte_t>((modrm >> 3) & 7);
+        auto const index = static_cast<byte_t>(modrm & 7);
+        auto const memory = (modrm >> 6) != 3;
+        auto const src = memory ? operand(bus, op, addr) : get(op == 0 ? index : 0);
+        auto const dst = get(memory || op == 0 ? 0 : index);
+        if (reg == 2 || reg == 3) {
+            // DE D9 is FCOMPP, the other register forms of DE pop once
+            auto const fcompp = !memory && op == 6 && reg == 3;
+            compare(get(0), memory || op == 0 ? src : get(fcompp ? 1 : index));
+            auto const pops = fcompp ? 2 : !memory && op == 6 ? 1 : reg == 3;
+            for (auto i = 0; i != pops && !blocked(); ++i) {
+                pop();
+            }
+            return;
+        }
+        // Register forms of DC and DE write ST(i) and swap the direction of SUB and DIV
+        auto const kind = !memory && op != 0 && reg >= 4 ? reg ^ 1 : reg;
+        auto const value = arith(static_cast<byte_t>(kind), dst, src);
+        store(memory || op == 0 ? 0 : index, value);
+        if (!memory && op == 6 && !blocked()) {
+            pop();
+        }
+    }
+
+    void exec_d9(BUS& bus, byte_t modrm, FAR addr) noexcept {
+        auto const reg = (modrm >> 3) & 7;
+        auto const index = static_cast<byte_t>(modrm & 7);
+        if ((modrm >> 6) != 3) {
+            switch (reg) {
+            case 0: // FLD m32
+                if (auto const value = from_real(read(bus, addr, 4), SINGLE); !blocked()) {
+                    push(value);
+                }
+                break;
+            case 2: // FST m32
+            case 3: // FSTP m32
+                if (auto const value = to_real(get(0), SINGLE); !blocked()) {
+                    write(bus, addr, 4, value);
+                    if (reg == 3) {
+                        pop();
+                    }
+                }
+                break;
+            case 4: // FLDENV
+                env_load(bus, addr);
+                break;
+            case 5: // FLDCW
+                control = static_cast<word_t>(read(bus, addr, 2));
+                break;
+            case 6: // FSTENV
+                env_store(bus, addr);
+                control |= EXCEPTIONS;
+                break;
+            case 7: // FSTCW
+                write(bus, addr, 2, control);
+                break;
+            default:
+                break;
+            }
+            return;
+        }
+        switch (reg) {
+        case 0: // FLD ST(i)
+            if (auto const value = get(index); !blocked()) {
+                push(value);
+            }
+            break;
+        case 1: { // FXCH ST(i)
+            auto const lhs = get(0);
+            auto const rhs = get(index);
+            if (!blocked()) {
+                set(0, rhs);
+                set(index, lhs);
+            }
+            break;
+        }
+        case 3: // FSTP ST(i), undocumented alias
+            if (auto const value = get(0); !blocked()) {
+                set(index, value);
+                pop();
+            }
+            break;
+        case 4:
+            exec_d9_e0(index);
+            break;
+        case 5: // FLD1, FLDL2T, FLDL2E, FLDPI, FLDLG2, FLDLN2, FLDZ
+            if (index != 7) {
+                push(constants[index]);
+            }
+            break;
+        case 6:
+        case 7:
+            exec_d9_f0(static_cast<byte_t>(modrm & 0x0F));
+            break;
+        default: // FNOP and reserved encodings
+            break;
+        }
+    }
+
+    void exec_d9_e0(byte_t index) noexcept {
+        switch (index) {
+        case 0: // FCHS
+        case 1: // FABS
+            if (auto const value = get(0); !blocked()) {
+                set(0, value.with_sign(index == 0 ? !value.sign() : false));
+            }
+            break;
+        case 4: // FTST
+            compare(get(0), zero(false));
+            break;
+        case 5: { // FXAM, empty registers are examined too
+            auto const value = regs[phys(0)];
+            auto const code = is_empty(0) ? C3 | C0
+                : value.is_nan() ? C0
+                : value.is_inf() ? C2 | C0
+                : value.is_zero() ? C3
+                : value.is_denormal() ? C3 | C2
+                : !(value.sig >> 63) ? word_t{0}
+                : C2;
+            status = static_cast<word_t>((status & ~CONDITION) | code | (value.sign() ? C1 : 0));
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void exec_d9_f0(byte_t index) noexcept {
+        switch (index) {
+        case 0x0: { // F2XM1
+            auto const value = get(0);
+            if (value.is_nan()) {
+                store(0, nan(value, value));
+            } else if (!blocked()) {
+                store(0, host(std::expm1(host(value) * std::log(2.0L))));
+            }
+            break;
+        }
+        case 0x1: // FYL2X
+        case 0x9: { // FYL2XP1
+            auto const x = get(0);
+            auto const y = get(1);
+            if (x.is_nan() || y.is_nan()) {
+                store(1, nan(x, y));
+            } else if (!blocked()) {
+                auto const hx = host(x);
+                if (index == 0x1 ? hx < 0 : hx < -1) {
+                    store(1, invalid());
+                } else {
+                    if (index == 0x1 && x.is_zero() && !y.is_zero()) {
+                        raised |= ZE;
+                    }
+                    auto const log = index == 0x1 ? std::log2(hx) : std::log1p(hx) / std::log(2.0L);
+                    store(1, host(host(y) * log));
+                }
+            }
+            if (!blocked()) {
+                pop();
+            }
+            break;
+        }
+        case 0x2: { // FPTAN, tangent as the ratio ST(1) / ST(0) with ST(0) = 1
+            auto const value = get(0);
+            if (value.is_nan() || value.is_inf()) {
+                store(0, value.is_nan() ? nan(value, value) : invalid());
+            } else if (!blocked()) {
+                set(0, host(std::tan(host(value))));
+                push(ONE);
+            }
+            break;
+        }
+        case 0x3: { // FPATAN
+            auto const x = get(0);
+            auto const y = get(1);
+            store(1, x.is_nan() || y.is_nan() ? nan(x, y) : host(std::atan2(host(y), host(x))));
+            if (!blocked()) {
+                pop();
+            }
+            break;
+        }
+        case 0x4: // FXTRACT
+            exec_fxtract();
+            break;
+        case 0x6: // FDECSTP
+            top = (top - 1) & 7;
+            break;
+        case 0x7: // FINCSTP
+            top = (top + 1) & 7;
+            break;
+        case 0x8: // FPREM
+            exec_fprem();
+            break;
+        case 0xA: { // FSQRT
+            auto const value = get(0);
+            if (mode == Mode::FAST && !value.is_nan()) {
+                auto const hv = host(value);
+                store(0, host_result(std::sqrt(hv), hv, 1));
+            } else {
+                store(0, sqrt(value));
+            }
+            break;
+        }
+        case 0xC: { // FRNDINT
+            auto const value = get(0);
+            if (value.is_nan()) {
+                store(0, nan(value, value));
+            } else if (!value.is_special() && !value.is_zero() && unpack(value).exp < 63) {
+                auto const whole = integer(value);
+                store(0, from_integer(value.sign(), whole.magnitude).with_sign(value.sign()));
+            }
+            break;
+        }
+        case 0xD: // FSCALE
+            exec_fscale();
+            break;
+        default: // FPREM1, FSINCOS, FSIN and FCOS came with later coprocessors
+            break;
+        }
+    }
+
+    void exec_fxtract() noexcept {
+        auto const value = get(0);
+        if (blocked()) {
+            return;
+        }
+        if (value.is_nan()) {
+            set(0, nan(value, value));
+            push(regs[phys(0)]);
+        } else if (value.is_inf()) {
+            set(0, inf(false));
+            push(value);
+        } else if (value.is_zero()) {
+            raised |= ZE;
+            if (!blocked()) {
+                set(0, inf(true));
+                push(value);
+            }
+        } else {
+            auto const a = unpack(value);
+            set(0, from_integer(a.exp));
+            push(pack({ a.sign, 0, a.sig }));
+        }
+    }
+
+    // Exact remainder of truncating division, at most 63 quotient bits per execution like the 8087
+    void exec_fprem() noexcept {
+        auto const lhs = get(0);
+        auto const rhs = get(1);
+        status &= ~CONDITION;
+        if (lhs.is_nan() || rhs.is_nan()) {
+            store(0, nan(lhs, rhs));
+            return;
+        }
+        if (lhs.is_inf() || rhs.is_zero()) {
+            store(0, invalid());
+            return;
+        }
+        if (lhs.is_zero() || rhs.is_inf() || blocked()) {
+            return;
+        }
+        auto const a = unpack(lhs);
+        auto const b = unpack(rhs);
+        auto diff = a.exp - b.exp;
+        if (diff < 0) {
+            return;
+        }
+        auto b_exp = b.exp;
+        if (diff > 63) {
+            b_exp += diff - 63;
+            diff = 63;
+            status |= C2;
+        }
+        auto const divisor = b.sig >> 64;
+        auto rest = a.sig >> 64;
+        auto quotient = std::uint64_t{};
+        for (auto i = diff; i >= 0; --i) {
+            quotient <<= 1;
+            if (rest >= divisor) {
+                rest -= divisor;
+                quotient |= 1;
+            }
+            if (i != 0) {
+                rest <<= 1;
+            }
+        }
+        if (!(status & C2)) {
+            status |= ((quotient & 4) ? C0 : 0) | ((quotient & 2) ? C3 : 0) | ((quotient & 1) ? C1 : 0);
+        }
+        set(0, rest ? pack(round({ a.sign, b_exp, rest << 64 }, EXTENDED)) : zero(a.sign));
+    }
+
+    void exec_fscale() noexcept {
+        auto const value = get(0);
+        auto const scale = get(1);
+        if (value.is_nan() || scale.is_nan()) {
+            store(0, nan(value, scale));
+            return;
+        }
+        if (scale.is_inf()) {
+            auto const grow = !scale.sign();
+            store(0, value.is_zero() && grow ? invalid() : value.is_inf() && !grow ? invalid()
+                : grow ? (value.is_zero() ? value : inf(value.sign())) : (value.is_inf() ? value : zero(value.sign())));
+            return;
+        }
+        if (value.is_special() || value.is_zero() || blocked()) {
+            return;
+        }
+        // Truncation toward zero, large counts clamp well past the exponent range
+        auto const saved = control;
+        control = static_cast<word_t>(control | 0x0C00);
+        auto const whole = integer(scale);
+        control = saved;
+        raised &= ~PE;
+        auto const count = static_cast<std::int32_t>(std::min<std::uint64_t>(whole.valid ? whole.magnitude : 0x10000, 0x10000));
+        auto a = unpack(value);
+        a.exp += scale.sign() ? -count : count;
+        set(0, pack(round(a, EXTENDED)));
+    }
+
+    void exec_db(BUS& bus, byte_t modrm, FAR addr) noexcept {
+        auto const reg = (modrm >> 3) & 7;
+        if ((modrm >> 6) == 3) {
+            switch (modrm) {
+            case 0xE0: // FENI
+                control &= ~IEM;
+                break;
+            case 0xE1: // FDISI
+                control |= IEM;
+                break;
+            case 0xE2: // FCLEX
+                status &= ~(EXCEPTIONS | IR);
+                break;
+            case 0xE3: // FINIT
+                reset();
+                break;
+            default:
+                break;
+            }
+            return;
+        }
+        switch (reg) {
+        case 0: // FILD m32
+            push(from_integer(static_cast<std::int32_t>(read(bus, addr, 4))));
+            break;
+        case 2: // FIST m32
+        case 3: // FISTP m32
+            if (auto const value = to_integer(get(0), 32); !blocked()) {
+                write(bus, addr, 4, value);
+                if (reg == 3) {
+                    pop();
+                }
+            }
+            break;
+        case 5: // FLD m80
+            push(read80(bus, addr));
+            break;
+        case 7: // FSTP m80
+            if (auto const value = get(0); !blocked()) {
+                write80(bus, addr, value);
+                pop();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void exec_dd(BUS& bus, byte_t modrm, FAR addr) noexcept {
+        auto const reg = (modrm >> 3) & 7;
+        auto const index = static_cast<byte_t>(modrm & 7);
+        if ((modrm >> 6) == 3) {
+            switch (reg) {
+            case 0: // FFREE ST(i)
+                empty |= static_cast<byte_t>(1 << phys(index));
+                break;
+            case 1: // FXCH ST(i), undocumented alias
+                exec_d9(bus, static_cast<byte_t>(0xC8 | index), addr);
+                break;
+            case 2: // FST ST(i)
+            case 3: // FSTP ST(i)
+                if (auto const value = get(0); !blocked()) {
+                    set(index, value);
+                    if (reg == 3) {
+                        pop();
+                    }
+                }
+                break;
+            default:
+                break;
+            }
+            return;
+        }
+        switch (reg) {
+        case 0: // FLD m64
+            if (auto const value = from_real(read(bus, addr, 8), DOUBLE); !blocked()) {
+                push(value);
+            }
+            break;
+        case 2: // FST m64
+        case 3: // FSTP m64
+            if (auto const value = to_real(get(0), DOUBLE); !blocked()) {
+                write(bus, addr, 8, value);
+                if (reg == 3) {
+                    pop();
+                }
+            }
+            break;
+        case 4: // FRSTOR
+            env_load(bus, addr);
+            for (auto i = byte_t{}; i != 8; ++i) {
+                regs[phys(i)] = read80(bus, addr + static_cast<sword_t>(14 + i * 10));
+            }
+            break;
+        case 6: // FSAVE
+            env_store(bus, addr);
+            for (auto i = byte_t{}; i != 8; ++i) {
+                write80(bus, addr + static_cast<sword_t>(14 + i * 10), regs[phys(i)]);
+            }
+            reset();
+            break;
+        case 7: // FSTSW m16
+            write(bus, addr, 2, status_get());
+            break;
+        default:
+            break;
+        }
+    }
+
+    void exec_df(BUS& bus, byte_t modrm, FAR addr) noexcept {
+        auto const reg = (modrm >> 3) & 7;
+        auto const index = static_cast<byte_t>(modrm & 7);
+        if ((modrm >> 6) == 3) {
+            switch (reg) {
+            case 0: // FFREEP ST(i), undocumented
+                empty |= static_cast<byte_t>(1 << phys(index));
+                pop();
+                break;
+            case 1: // FXCH ST(i), undocumented alias
+                exec_d9(bus, static_cast<byte_t>(0xC8 | index), addr);
+                break;
+            case 2: // FSTP ST(i), undocumented aliases
+            case 3:
+                exec_dd(bus, static_cast<byte_t>(0xD8 | index), addr);
+                break;
+            default:
+                break;
+            }
+            return;
+        }
+        switch (reg) {
+        case 0: // FILD m16
+            push(from_integer(static_cast<sword_t>(read(bus, addr, 2))));
+            break;
+        case 2: // FIST m16
+        case 3: // FISTP m16
+            if (auto const value = to_integer(get(0), 16); !blocked()) {
+                write(bus, addr, 2, value);
+                if (reg == 3) {
+                    pop();
+                }
+            }
+            break;
+        case 4: { // FBLD
+            auto magnitude = std::uint64_t{};
+            for (auto i = 8; i >= 0; --i) {
+                auto const pair = bus.read_byte(addr + static_cast<sword_t>(i));
+                magnitude = magnitude * 100 + (pair >> 4) * 10 + (pair & 0xF);
+            }
+            push(from_integer(bus.read_byte(addr + 9) >> 7, magnitude).with_sign(bus.read_byte(addr + 9) >> 7));
+            break;
+        }
+        case 5: // FILD m64
+            push(from_integer(static_cast<std::int64_t>(read(bus, addr, 8))));
+            break;
+        case 6: { // FBSTP, out of range stores the packed decimal indefinite
+            auto const value = get(0);
+            auto const whole = integer(value);
+            if (!whole.valid || whole.magnitude > 999'999'999'999'999'999) {
+                raised |= IE;
+            }
+            if (blocked()) {
+                break;
+            }
+            if (raised & IE) {
+                write(bus, addr, 8, 0);
+                write(bus, addr + 8, 2, 0xFFFF);
+                bus.write_byte(addr + 7, 0xC0);
+            } else {
+                auto magnitude = whole.magnitude;
+                for (auto i = 0; i != 9; ++i) {
+                    auto const lo = magnitude % 10;
+                    auto const hi = magnitude / 10 % 10;
+                    magnitude /= 100;
+                    bus.write_byte(addr + static_cast<sword_t>(i), static_cast<byte_t>((hi << 4) | lo));
+                }
+                bus.write_byte(addr + 9, value.sign() ? 0x80 : 0x00);
+            }
+            pop();
+            break;
+        }
+        case 7: // FISTP m64
+            if (auto const value = to_integer(get(0), 64); !blocked()) {
+                write(bus, addr, 8, value);
+                pop();
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Control instructions leave the recorded instruction and operand pointers alone
+    [[nodiscard]] static constexpr bool is_control(byte_t op, byte_t modrm) noexcept {
+        auto const memory = (modrm >> 6) != 3;
+        auto const reg = (modrm >> 3) & 7;
+        return (op == 1 && memory && reg >= 4) || (op == 3 && !memory && reg == 4) || (op == 5 && memory && reg >= 4);
+    }
+public:
+    void reset() noexcept {
+        control = CONTROL_INIT;
+        status = {};
+        top = {};
+        empty = 0xFF;
+    }
+
+    // Status word with the current stack top merged in
+    [[nodiscard]] constexpr word_t status_get() const noexcept {
+        return static_cast<word_t>(status | (top << 11));
+    }
+
+    [[nodiscard]] constexpr word_t control_get() const noexcept {
+        return control;
+    }
+
+    // Unmasked exceptions raise the INT pin until FCLEX unless FDISI masked it
+    [[nodiscard]] constexpr bool irq() const noexcept {
+        return (status & IR) && !(control & IEM);
+    }
+
+    // Register view for host code, index 0 is the stack top
+    [[nodiscard]] long double st(byte_t index) const noexcept {
+        return host(regs[phys(index)]);
+    }
+
+    // The 11 opcode bits are the low three of the ESC byte followed by ModRM, addr is the memory operand
+    void esc(word_t code, FAR inst, FAR addr, BUS& bus) noexcept {
+        auto const op = static_cast<byte_t>((code >> 8) & 7);
+        auto const modrm = static_cast<byte_t>(code);
+        raised = {};
+        if (!is_control(op, modrm)) {
+            last_inst = inst;
+            last_op = code & 0x07FF;
+            if ((modrm >> 6) != 3) {
+                last_data = addr;
+            }
+        }
+        switch (op) {
+        case 1:
+            exec_d9(bus, modrm, addr);
+            break;
+        case 3:
+            exec_db(bus, modrm, addr);
+            break;
+        case 5:
+            exec_dd(bus, modrm, addr);
+            break;
+        case 7:
+            exec_df(bus, modrm, addr);
+            break;
+        default:
+            // Only ESC 2 has no register forms on the 8087
+            if (op != 2 || (modrm >> 6) != 3) {
+                exec_arith(bus, op, modrm, addr);
+            }
+            break;
+        }
+        status |= raised & EXCEPTIONS;
+        if (status & ~control & EXCEPTIONS) {
+            status |= IR;
+        }
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        for (auto& reg : regs) {
+            s(reg.sig);
+            s(reg.se);
+        }
+        s(empty);
+        s(top);
+        s(control);
+        s(status);
+        s(last_inst);
+        s(last_op);
+        s(last_data);
+    }
+};
+
+#endif // O126_FPU_HPP
@@ -0,0 +1,101 @@
+#ifndef O126_HLE_HPP
+#define O126_HLE_HPP
+#include "common.hpp"
+#include "mem.hpp"
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Native handlers on interupt vectors and code addresses, looked up once per interupt or taken branch
+struct o126::HLE final {
+    // How control leaves a code hook, interupt vector hooks always return like an interupt
+    enum class Return : byte_t {
+        NONE, // handler sets CS:IP itself
+        NEAR,
+        FAR,
+        INTERUPT, // flags other than IF and TF are kept as the handler left them, like RETF 2
+    };
+
+    // Returning false runs the guest code the hook replaced instead
+    using Handler = std::function<bool(CPU& cpu, BUS& bus)>;
+    // Called in place of host hooks with the hook itself, for logging what it did or putting that back without it
+    using Journal = std::function<bool(Handler const& handler, CPU& cpu, BUS& bus)>;
+private:
+    struct Code {
+        Return kind = {};
+        Handler handler = {};
+    };
+
+    std::array<Handler, 256> vectors = {};
+    std::uint64_t vector_bits[4] = {};
+    std::uint64_t host_bits[4] = {};
+    std::vector<std::uint64_t> code_bits = {};
+    std::unordered_map<dword_t, Code> code = {};
+public:
+    Journal journal = {};
+
+    // A host hook reads or changes something outside the machine, such as the clock, the console or host files
+    // The others may only depend on machine state, so running them again gives the same result
+    void hook_vector(byte_t index, Handler handler, bool host = false) {
+        vector_bits[index >> 6] |= std::uint64_t{1} << (index & 63);
+        if (host) {
+            host_bits[index >> 6] |= std::uint64_t{1} << (index & 63);
+        } else {
+            host_bits[index >> 6] &= ~(std::uint64_t{1} << (index & 63));
+        }
+        vectors[index] = std::move(handler);
+    }
+
+    void unhook_vector(byte_t index) noexcept {
+        vector_bits[index >> 6] &= ~(std::uint64_t{1} << (index & 63));
+        host_bits[index >> 6] &= ~(std::uint64_t{1} << (index & 63));
+        vectors[index] = {};
+    }
+
+    void hook_code(dword_t ea, Return kind, Handler handler) {
+        ea &= MEM::MASK;
+        if (code_bits.empty()) {
+            code_bits.resize(MEM::SIZE / 64);
+        }
+        code_bits[ea >> 6] |= std::uint64_t{1} << (ea & 63);
+        code[ea] = { kind, std::move(handler) };
+    }
+
+    void unhook_code(dword_t ea) noexcept {
+        ea &= MEM::MASK;
+        if (!code_bits.empty()) {
+            code_bits[ea >> 6] &= ~(std::uint64_t{1} << (ea & 63));
+        }
+        code.erase(ea);
+    }
+
+    [[nodiscard]] constexpr bool has_vector(byte_t index) const noexcept {
+        return vector_bits[index >> 6] & (std::uint64_t{1} << (index & 63));
+    }
+
+    [[nodiscard]] bool has_code(dword_t ea) const noexcept {
+        return !code_bits.empty() && (code_bits[ea >> 6] & (std::uint64_t{1} << (ea & 63)));
+    }
+
+    [[nodiscard]] constexpr bool has_host() const noexcept {
+        return host_bits[0] | host_bits[1] | host_bits[2] | host_bits[3];
+    }
+
+    bool call_vector(byte_t index, CPU& cpu, BUS& bus) {
+        if (journal && (host_bits[index >> 6] & (std::uint64_t{1} << (index & 63)))) [[unlikely]] {
+            return journal(vectors[index], cpu, bus);
+        }
+        return vectors[index](cpu, bus);
+    }
+
+    // Kind is only meaningful when the handler accepted the call
+    bool call_code(dword_t ea, CPU& cpu, BUS& bus, Return& kind) {
+        auto& entry = code.at(ea);
+        kind = entry.kind;
+        return entry.handler(cpu, bus);
+    }
+};
+
+#endif // O126_HLE_HPP
@@ -0,0 +1,53 @@
+#ifndef O126_MAPPING_HPP
+#define O126_MAPPING_HPP
+#include "common.hpp"
+#include <span>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a whole file, pages come straight from the page cache and are shared between mappings
+struct o126::MAPPING final {
+    byte_t const* data = nullptr;
+    std::size_t size = {};
+
+    explicit MAPPING(std::string filename) {
+        auto const fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw "Failed to open file!";
+        }
+        struct stat info = {};
+        if (::fstat(fd, &info) < 0) {
+            ::close(fd);
+            throw "Failed to stat file!";
+        }
+        size = static_cast<std::size_t>(info.st_size);
+        if (size == 0) {
+            ::close(fd);
+            return;
+        }
+        auto const addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            throw "Failed to map file!";
+        }
+        data = static_cast<byte_t const*>(addr);
+    }
+
+    MAPPING(MAPPING const&) = delete;
+    MAPPING& operator=(MAPPING const&) = delete;
+
+    ~MAPPING() {
+        if (data) {
+            ::munmap(const_cast<byte_t*>(data), size);
+        }
+    }
+
+    [[nodiscard]] std::span<byte_t const> bytes() const noexcept {
+        return { data, size };
+    }
+};
+
+#endif // O126_MAPPING_HPP
@@ -0,0 +1,360 @@
+#ifndef O126_MEM_HPP
+#define O126_MEM_HPP
+#include "common.hpp"
+#include "rom.hpp"
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Guest address space as a table of 4 KiB pages, each backed by copy-on-write RAM or by a shared ROM mapping
+struct o126::MEM final {
+    static constexpr dword_t SIZE = 0x10'00'00;
+    static constexpr dword_t MASK = SIZE - 1;
+    static constexpr dword_t PAGE_BITS = 12;
+    static constexpr dword_t PAGE_SIZE = dword_t{1} << PAGE_BITS;
+    static constexpr dword_t PAGE_MASK = PAGE_SIZE - 1;
+    static constexpr dword_t PAGES = SIZE >> PAGE_BITS;
+private:
+    using Page = std::array<byte_t, PAGE_SIZE>;
+
+    enum class Kind : byte_t {
+        RAM, // shared pages are copied on the first write
+        ROM, // writes are dropped
+        ROM_COW, // first write copies the page into RAM
+        DEVICE,
+    };
+
+    // Reference counted so forked instances share every page neither side has written yet
+    std::array<std::shared_ptr<Page>, PAGES> ram = {};
+    std::array<byte_t const*, PAGES> reads = {};
+    // Null where a write has to go through write_fault
+    std::array<byte_t*, PAGES> writes = {};
+    std::array<Kind, PAGES> kinds = {};
+    // Keeps the mapping behind each ROM page alive, a mapping goes away with the last page using it
+    std::array<std::shared_ptr<ROM::Image const>, PAGES> owners = {};
+    // What map_rom put on each page, kept after the guest writes over it so a snapshot can put it back
+    struct Firmware final {
+        std::shared_ptr<ROM::Image const> image = {};
+        byte_t const* data = {};
+        bool writable = {};
+    };
+    std::array<Firmware, PAGES> firmware = {};
+    // Granules of 1 << dirty_bits bytes written since the last collect, folded into every consumer from there
+    dword_t dirty_bits = PAGE_BITS;
+    std::vector<std::uint64_t> dirty = std::vector<std::uint64_t>(dirty_words(PAGE_BITS));
+    std::vector<std::vector<std::uint64_t>> consumers = {};
+
+    [[nodiscard]] static constexpr std::size_t dirty_words(dword_t bits) noexcept {
+        return ((SIZE >> bits) + 63) / 64;
+    }
+
+    constexpr void dirty_mark(dword_t ea) noexcept {
+        auto const granule = ea >> dirty_bits;
+        dirty[granule >> 6] |= std::uint64_t{1} << (granule & 63);
+    }
+
+    constexpr void dirty_range(dword_t ea, std::size_t size) noexcept {
+        if (size == 0) {
+            return;
+        }
+        auto const last = static_cast<dword_t>(ea + size - 1) >> dirty_bits;
+        for (auto granule = ea >> dirty_bits; granule <= last; ++granule) {
+            dirty[granule >> 6] |= std::uint64_t{1} << (granule & 63);
+        }
+    }
+
+    // Whatever the page shows changed with its mapping
+    constexpr void dirty_page(dword_t page) noexcept {
+        dirty_range(page << PAGE_BITS, PAGE_SIZE);
+    }
+
+    // Untouched RAM in every instance, never written since it always has more than one owner
+    [[nodiscard]] static std::shared_ptr<Page> const& zero_page() {
+        static auto const result = std::make_shared<Page>();
+        return result;
+    }
+
+    // Writable only once this instance is the sole owner of the page
+    void map_ram(dword_t page) noexcept {
+        auto const data = ram[page]->data();
+        reads[page] = data;
+        writes[page] = ram[page].use_count() == 1 ? data : nullptr;
+        kinds[page] = Kind::RAM;
+        owners[page].reset();
+    }
+
+    [[nodiscard]] byte_t* ram_own(dword_t page) {
+        if (ram[page].use_count() != 1) {
+            ram[page] = std::make_shared<Page>(*ram[page]);
+        }
+        map_ram(page);
+        return ram[page]->data();
+    }
+
+    [[nodiscard]] bool write_fault(dword_t page) noexcept {
+        switch (kinds[page]) {
+        case Kind::RAM:
+            (void)ram_own(page);
+            return true;
+        case Kind::ROM_COW:
+            ram[page] = std::make_shared<Page>();
+            std::copy_n(reads[page], PAGE_SIZE, ram[page]->data());
+            map_ram(page);
+            return true;
+        default:
+            return false;
+        }
+    }
+public:
+    MEM() noexcept {
+        ram.fill(zero_page());
+        for (auto page = dword_t{}; page != PAGES; ++page) {
+            map_ram(page);
+        }
+    }
+
+    MEM(MEM const&) = delete;
+    MEM& operator=(MEM const&) = delete;
+
+    // Takes over the address space of other in O(pages), RAM stays shared until either side writes it
+    // Device pages fall back to the RAM underneath, the device has to map them again for this instance
+    void share(MEM& other) noexcept {
+        ram = other.ram;
+        reads = other.reads;
+        kinds = other.kinds;
+        owners = other.owners;
+        firmware = other.firmware;
+        for (auto page = dword_t{}; page != PAGES; ++page) {
+            dirty_page(page);
+            switch (kinds[page]) {
+            case Kind::RAM:
+                other.writes[page] = nullptr;
+                writes[page] = nullptr;
+                break;
+            case Kind::DEVICE:
+                map_ram(page);
+                break;
+            default:
+                writes[page] = nullptr;
+                break;
+            }
+        }
+    }
+
+    // Pages fully covered by the image point into the mapping, partial pages at either end are copied into RAM
+    void map_rom(dword_t ea, std::shared_ptr<ROM::Image const> image, bool writable) {
+        auto const src = image->bytes();
+        if (src.size() > SIZE - ea) {
+            throw "ROM image too big!";
+        }
+        auto const end = ea + static_cast<dword_t>(src.size());
+        for (auto page = ea >> PAGE_BITS; page << PAGE_BITS < end; ++page) {
+            auto const first = page << PAGE_BITS;
+            dirty_page(page);
+            if (first < ea || first + PAGE_SIZE > end) {
+                auto const from = std::max(first, ea);
+                auto const to = std::min(first + PAGE_SIZE, end);
+                std::copy_n(src.data() + (from - ea), to - from, ram_own(page) + (from - first));
+                firmware[page] = {};
+                continue;
+            }
+            firmware[page] = { image, src.data() + (first - ea), writable };
+            (void)map_firmware(page);
+        }
+    }
+
+    // Shows the page as map_rom left it, false when no ROM was mapped there
+    bool map_firmware(dword_t page) noexcept {
+        auto const& rom = firmware[page];
+        if (!rom.data) {
+            return false;
+        }
+        reads[page] = rom.data;
+        writes[page] = nullptr;
+        kinds[page] = rom.writable ? Kind::ROM_COW : Kind::ROM;
+        owners[page] = rom.image;
+        dirty_page(page);
+        return true;
+    }
+
+    // One page of an image that holds saved memory, the guest sees it as RAM that is copied on the first write
+    void map_image_page(dword_t page, std::shared_ptr<ROM::Image const> const& image, std::size_t offset) {
+        if (offset + PAGE_SIZE > image->size) {
+            throw "Image page out of range!";
+        }
+        reads[page] = image->bytes().data() + offset;
+        writes[page] = nullptr;
+        kinds[page] = Kind::ROM_COW;
+        owners[page] = image;
+        dirty_page(page);
+    }
+
+    void clear_page(dword_t page) noexcept {
+        ram[page] = zero_page();
+        map_ram(page);
+        dirty_page(page);
+    }
+
+    // ROM the guest has not written belongs to the configuration and is left out of saved state
+    [[nodiscard]] constexpr bool page_rom(dword_t page) const noexcept {
+        return kinds[page] == Kind::ROM || (kinds[page] == Kind::ROM_COW && reads[page] == firmware[page].data);
+    }
+
+    [[nodiscard]] constexpr bool page_readonly(dword_t page) const noexcept {
+        return kinds[page] == Kind::ROM;
+    }
+
+    [[nodiscard]] constexpr bool page_device(dword_t page) const noexcept {
+        return kinds[page] == Kind::DEVICE;
+    }
+
+    // Points a page at memory owned by a device such as an expanded memory board, until unmap_page restores RAM
+    // A copy-on-write image page is copied into RAM first, so that is what comes back
+    void map_page(dword_t page, byte_t* data) noexcept {
+        if (kinds[page] == Kind::ROM_COW) {
+            (void)write_fault(page);
+        }
+        reads[page] = data;
+        writes[page] = data;
+        kinds[page] = Kind::DEVICE;
+        owners[page].reset();
+        dirty_page(page);
+    }
+
+    void unmap_page(dword_t page) noexcept {
+        map_ram(page);
+        dirty_page(page);
+    }
+
+    // Places the image so that it ends at the top of the address space, writes copy the touched pages
+    void load_bios(std::string filename) {
+        auto image = ROM::open(filename);
+        if (image->size > SIZE) {
+            throw "BIOS file too big!";
+        }
+        auto const ea = SIZE - static_cast<dword_t>(image->size);
+        map_rom(ea, std::move(image), true);
+    }
+
+    /// Write tracking, each consumer sees every granule written since its own last collect
+    // Consumers start out with everything dirty, as do all of them after the granularity changes
+    [[nodiscard]] std::size_t dirty_attach() {
+        auto const free = std::find_if(consumers.begin(), consumers.end(), [](auto const& map) {
+            return map.empty();
+        });
+        if (free != consumers.end()) {
+            free->assign(dirty.size(), ~std::uint64_t{});
+            return static_cast<std::size_t>(free - consumers.begin());
+        }
+        consumers.emplace_back(dirty.size(), ~std::uint64_t{});
+        return consumers.size() - 1;
+    }
+
+    // The slot is handed out again by the next attach
+    void dirty_detach(std::size_t consumer) noexcept {
+        consumers[consumer] = {};
+    }
+
+    void dirty_granularity(dword_t bits) {
+        if (bits > PAGE_BITS) {
+            throw "Dirty granularity too big!";
+        }
+        dirty_bits = bits;
+        dirty.assign(dirty_words(bits), 0);
+        for (auto& map : consumers) {
+            if (!map.empty()) {
+                map.assign(dirty.size(), ~std::uint64_t{});
+            }
+        }
+    }
+
+    [[nodiscard]] constexpr dword_t dirty_granule() const noexcept {
+        return dword_t{1} << dirty_bits;
+    }
+
+    // Swaps the consumer's bitmap into map and starts it over empty, bit n covers bytes from n << dirty_bits
+    void dirty_collect(std::size_t consumer, std::vector<std::uint64_t>& map) {
+        for (auto i = std::size_t{}; i != dirty.size(); ++i) {
+            if (auto const bits = std::exchange(dirty[i], 0)) {
+                for (auto& other : consumers) {
+                    if (!other.empty()) {
+                        other[i] |= bits;
+                    }
+                }
+            }
+        }
+        map.assign(dirty.size(), 0);
+        map.swap(consumers[consumer]);
+    }
+
+    /// Single access
+    [[nodiscard]] constexpr byte_t read_byte(dword_t ea) const noexcept {
+        ea &= MASK;
+        return reads[ea >> PAGE_BITS][ea & PAGE_MASK];
+    }
+
+    constexpr void write_byte(dword_t ea, byte_t val) noexcept {
+        ea &= MASK;
+        auto const page = ea >> PAGE_BITS;
+        if (writes[page] || write_fault(page)) {
+            writes[page][ea & PAGE_MASK] = val;
+            dirty_mark(ea);
+        }
+    }
+
+    /// Page access, spans run from ea to the end of its page
+    [[nodiscard]] constexpr std::span<byte_t const> page_read(dword_t ea) const noexcept {
+        ea &= MASK;
+        return { reads[ea >> PAGE_BITS] + (ea & PAGE_MASK), PAGE_SIZE - (ea & PAGE_MASK) };
+    }
+
+    // What a page shows with a device mapping taken away, the device saves its own memory
+    [[nodiscard]] std::span<byte_t const> page_under(dword_t ea) const noexcept {
+        ea &= MASK;
+        auto const page = ea >> PAGE_BITS;
+        auto const data = kinds[page] == Kind::DEVICE ? ram[page]->data() : reads[page];
+        return { data + (ea & PAGE_MASK), PAGE_SIZE - (ea & PAGE_MASK) };
+    }
+
+    // Empty for a read-only ROM page, the whole span counts as written
+    [[nodiscard]] constexpr std::span<byte_t> page_write(dword_t ea, std::size_t size = PAGE_SIZE) noexcept {
+        ea &= MASK;
+        auto const page = ea >> PAGE_BITS;
+        if (!writes[page] && !write_fault(page)) {
+            return {};
+        }
+        size = std::min<std::size_t>(size, PAGE_SIZE - (ea & PAGE_MASK));
+        dirty_range(ea, size);
+        return { writes[page] + (ea & PAGE_MASK), size };
+    }
+
+    /// Bulk access, wraps around at the top of the address space
+    constexpr void copy_in(dword_t ea, std::span<byte_t const> src) noexcept {
+        while (!src.empty()) {
+            ea &= MASK;
+            auto const size = std::min<std::size_t>(src.size(), PAGE_SIZE - (ea & PAGE_MASK));
+            auto const dst = page_write(ea, size);
+            if (!dst.empty()) {
+                std::copy_n(src.data(), size, dst.data());
+            }
+            src = src.subspan(size);
+            ea += static_cast<dword_t>(size);
+        }
+    }
+
+    constexpr void copy_out(dword_t ea, std::span<byte_t> dst) const noexcept {
+        while (!dst.empty()) {
+            ea &= MASK;
+            auto const size = std::min<std::size_t>(dst.size(), PAGE_SIZE - (ea & PAGE_MASK));
+            std::copy_n(page_read(ea).data(), size, dst.data());
+            dst = dst.subspan(size);
+            ea += static_cast<dword_t>(size);
+        }
+    }
+};
+
+#endif // O126_MEM_HPP
@@ -0,0 +1,118 @@
+#ifndef O126_MERKLE_HPP
+#define O126_MERKLE_HPP
+#include "common.hpp"
+#include "mem.hpp"
+#include "pc.hpp"
+#include "state.hpp"
+#include <array>
+#include <bit>
+#include <span>
+#include <vector>
+
+// Hash of the whole machine kept up to date from dirty tracking, a query only rehashes the pages written since the last one
+// Pages are the leaves of a binary tree, the root is combined with a hash of the board state, disks are not included
+struct o126::MERKLE final {
+private:
+    PC& pc;
+    std::size_t consumer;
+    std::vector<std::uint64_t> dirty = {};
+    std::array<bool, MEM::PAGES> stale = {};
+    // Node 1 is the root, the children of node n are 2n and 2n + 1 and page p is node PAGES + p
+    std::array<std::uint64_t, MEM::PAGES * 2> nodes = {};
+    STATE::Writer board = {};
+
+    // Final mix of MurmurHash3
+    [[nodiscard]] static constexpr std::uint64_t mix(std::uint64_t val) noexcept {
+        val ^= val >> 33;
+        val *= 0xFF51'AFD7'ED55'8CCD;
+        val ^= val >> 33;
+        val *= 0xC4CE'B9FE'1A85'EC53;
+        val ^= val >> 33;
+        return val;
+    }
+
+    [[nodiscard]] static constexpr std::uint64_t combine(std::uint64_t lhs, std::uint64_t rhs) noexcept {
+        return mix(lhs ^ std::rotl(rhs, 29) ^ 0x9E37'79B9'7F4A'7C15);
+    }
+
+    // Eight bytes at a time, good enough to tell states apart and not meant to resist anyone
+    [[nodiscard]] static std::uint64_t hash(std::span<byte_t const> bytes) noexcept {
+        auto result = std::uint64_t{bytes.size()};
+        auto i = std::size_t{};
+        for (; i + 8 <= bytes.size(); i += 8) {
+            auto word = std::uint64_t{};
+            for (auto j = std::size_t{8}; j != 0; --j) {
+                word = (word << 8) | bytes[i + j - 1];
+            }
+            result = std::rotl(result ^ (word * 0x87C3'7B91'1142'53D5), 31) * 0x4CF5'AD43'2745'937F;
+        }
+        for (; i != bytes.size(); ++i) {
+            result = (result ^ bytes[i]) * 0x100'0000'01B3;
+        }
+        return mix(result);
+    }
+
+    void update() {
+        pc.mem.dirty_collect(consumer, dirty);
+        auto const shift = std::countr_zero(pc.mem.dirty_granule());
+        for (auto i = std::size_t{}; i != dirty.size(); ++i) {
+            for (auto bits = dirty[i]; bits; bits &= bits - 1) {
+                auto const granule = static_cast<dword_t>(i * 64 + static_cast<std::size_t>(std::countr_zero(bits)));
+                stale[(granule << shift) >> MEM::PAGE_BITS] = true;
+            }
+        }
+        for (auto page = dword_t{}; page != MEM::PAGES; ++page) {
+            if (!stale[page]) {
+                continue;
+            }
+            stale[page] = false;
+            nodes[MEM::PAGES + page] = hash(pc.mem.page_read(page << MEM::PAGE_BITS));
+            for (auto node = (MEM::PAGES + page) / 2; node != 0; node /= 2) {
+                nodes[node] = combine(nodes[node * 2], nodes[node * 2 + 1]);
+            }
+        }
+    }
+
+    static void diff(MERKLE const& lhs, MERKLE const& rhs, dword_t node, std::vector<dword_t>& pages) {
+        if (lhs.nodes[node] == rhs.nodes[node]) {
+            return;
+        }
+        if (node >= MEM::PAGES) {
+            pages.push_back(node - MEM::PAGES);
+            return;
+        }
+        diff(lhs, rhs, node * 2, pages);
+        diff(lhs, rhs, node * 2 + 1, pages);
+    }
+public:
+    // The first query hashes every page
+    explicit MERKLE(PC& pc) : pc(pc), consumer(pc.mem.dirty_attach()) {}
+
+    MERKLE(MERKLE const&) = delete;
+    MERKLE& operator=(MERKLE const&) = delete;
+
+    ~MERKLE() {
+        pc.mem.dirty_detach(consumer);
+    }
+
+    [[nodiscard]] std::uint64_t memory() {
+        update();
+        return nodes[1];
+    }
+
+    // Memory and board together, any instruction boundary will do
+    [[nodiscard]] std::uint64_t state() {
+        board.data.clear();
+        pc.serialize_board(board);
+        return combine(memory(), hash(board.data));
+    }
+
+    // Pages whose contents differ, found by walking down from the root as of both sides' last query
+    [[nodiscard]] static std::vector<dword_t> diff(MERKLE const& lhs, MERKLE const& rhs) {
+        auto result = std::vector<dword_t>{};
+        diff(lhs, rhs, 1, result);
+        return result;
+    }
+};
+
+#endif // O126_MERKLE_HPP
@@ -0,0 +1,452 @@
+#ifndef O126_PC_HPP
+#define O126_PC_HPP
+#include "common.hpp"
+#include "bus.hpp"
+#include "cpu.hpp"
+#include "disk.hpp"
+#include "dma.hpp"
+#include "ems.hpp"
+#include "fdc.hpp"
+#include "fpu.hpp"
+#include "hle.hpp"
+#include "mem.hpp"
+#include "pic.hpp"
+#include "pit.hpp"
+#include "replay.hpp"
+#include "sched.hpp"
+#include "speaker.hpp"
+#include "state.hpp"
+#include "uart.hpp"
+#include "video.hpp"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+struct o126::PC final : BUS {
+    // Rough average of 8088 instruction timings, the CPU core does not count cycles itself
+    static constexpr std::uint64_t CYCLES_PER_INST = 12;
+
+    CPU cpu = {};
+    FPU fpu = {};
+    MEM mem = {};
+    SCHED sched = {};
+    DMA dma = {};
+    FDC fdc = {};
+    HLE hle = {};
+    PIC pic = {};
+    PIT pit = {};
+    SPEAKER speaker = {};
+    UART com1 = { 0x3F8, 4 };
+    UART com2 = { 0x2F8, 3 };
+    VIDEO video = {};
+    // Floppy A: and B: followed by hard disks C: and D:
+    DISK drives[4] = {};
+    // Expanded memory board, see ems_install
+    std::optional<EMS> ems = {};
+    byte_t ppi_b = {};
+    // Bit 7 lets the coprocessor's INT pin through to NMI
+    byte_t nmi_mask = {};
+    bool fpu_irq = {};
+    bool halted = {};
+    std::uint64_t speaker_tick = {};
+    // Instructions retired since reset, the clock recorded inputs are stamped with
+    std::uint64_t retired = {};
+    // Records every port read and interupt, or feeds them back from a recording in place of what the devices answer
+    REPLAY* replay = {};
+    // Retired count translated blocks do not run past, for landing on an exact instruction
+    std::uint64_t stop_at = ~std::uint64_t{};
+    // Memory tracking slot for what host hooks write, attached on the first hook recorded
+    std::size_t hook_dirty = ~std::size_t{};
+    std::vector<std::uint64_t> hook_written = {};
+
+    PC() noexcept {
+        cpu.hle = &hle;
+        hle.journal = [this](HLE::Handler const& handler, CPU& cpu, BUS& bus) {
+            return hook(handler, cpu, bus);
+        };
+        cpu.fpu = &fpu;
+        sched.arm(SCHED::Timer::SPEAKER, SPEAKER::BLOCK_CYCLES);
+        sched.arm(SCHED::Timer::COM1, 0);
+        sched.arm(SCHED::Timer::COM2, 0);
+    }
+
+    CPU::Result step() noexcept {
+        if (replay && replay->playing) [[unlikely]] {
+            replay_interupts();
+        } else if (pic.output && cpu.interupt_enabled()) [[unlikely]] {
+            auto const vector = pic.acknowledge();
+            if (replay) {
+                replay->record(retired, REPLAY::Kind::IRQ, vector, sched.now);
+            }
+            (void)cpu.interupt(*this, vector);
+            halted = false;
+        }
+        if (halted) {
+            // Nothing executes until an interupt arrives, skip straight to the next timer
+            if (sched.next != SCHED::NEVER) {
+                sched.now = std::max(sched.now, sched.next);
+                dispatch();
+            }
+            return CPU::Result::HALT;
+        }
+        auto const result = cpu.exec(*this, cpu.aot ? budget() : 1);
+        halted = result == CPU::Result::HALT;
+        retired += cpu.retired_get();
+        if (fpu.irq() != fpu_irq) [[unlikely]] {
+            fpu_irq = !fpu_irq;
+            if (fpu_irq && (nmi_mask & 0x80) && !(replay && replay->playing)) {
+                if (replay) {
+                    replay->record(retired, REPLAY::Kind::NMI);
+                }
+                (void)cpu.interupt_nmi(*this);
+            }
+        }
+        sched.charge(CYCLES_PER_INST * cpu.retired_get());
+        if (sched.due()) [[unlikely]] {
+            dispatch();
+        }
+        return result;
+    }
+
+    // Instructions that can run before the next timer is due, so translated blocks see the same timing
+    // While playing back they also stop at the next logged input, and always at stop_at
+    [[nodiscard]] constexpr std::uint32_t budget() const noexcept {
+        auto result = ~std::uint64_t{};
+        if (sched.next != SCHED::NEVER) {
+            auto const left = sched.next > sched.now ? sched.next - sched.now : 0;
+            result = (left + CYCLES_PER_INST - 1) / CYCLES_PER_INST;
+        }
+        if (replay && replay->playing) {
+            auto const next = replay->next();
+            result = std::min(result, next > retired ? next - retired : 0);
+        }
+        result = std::min(result, stop_at > retired ? stop_at - retired : 0);
+        return static_cast<std::uint32_t>(std::clamp<std::uint64_t>(result, 1, ~std::uint32_t{}));
+    }
+
+    // Interupts are taken exactly where the recording took them with the vector it got, the PIC is only kept in step
+    // While halted the timers keep running until the cycle the recorded interupt arrived at
+    void replay_interupts() noexcept {
+        auto vector = byte_t{};
+        for (;;) {
+            switch (replay->interupt(retired, sched.now, vector)) {
+            case REPLAY::Kind::IRQ:
+                (void)pic.acknowledge();
+                (void)cpu.interupt(*this, vector);
+                halted = false;
+                break;
+            case REPLAY::Kind::NMI:
+                (void)cpu.interupt_nmi(*this);
+                break;
+            default:
+                return;
+            }
+        }
+    }
+
+    // Adds an expanded memory board of pages 16 KiB pages and hooks its driver
+    void ems_install(word_t pages) {
+        ems.emplace(mem, cpu, pages);
+        ems->install(hle);
+    }
+
+    // Device pages that no board of the machine maps could not be brought back by fork or restore
+    void device_check() const {
+        for (auto page = dword_t{}; page != MEM::PAGES; ++page) {
+            if (mem.page_device(page) && !(ems && EMS::frame_has(page))) {
+                throw "Memory mapped by a device outside the machine!";
+            }
+        }
+    }
+
+    // Host hooks answer from outside the machine, so a recording keeps what they did and playback puts that back
+    // without running them, which also keeps them from touching host files or the console a second time
+    bool hook(HLE::Handler const& handler, CPU& cpu, BUS& bus) {
+        if (!replay) {
+            return handler(cpu, bus);
+        }
+        // Within a translated block the CPU counts the instructions before the current one
+        auto const at = retired + cpu.retired_get();
+        if (replay->playing) {
+            auto accepted = false;
+            if (replay->hook(at, cpu, mem, accepted)) {
+                return accepted;
+            }
+            return handler(cpu, bus);
+        }
+        if (hook_dirty == ~std::size_t{}) {
+            hook_dirty = mem.dirty_attach();
+        }
+        mem.dirty_collect(hook_dirty, hook_written);
+        auto const accepted = handler(cpu, bus);
+        mem.dirty_collect(hook_dirty, hook_written);
+        replay->record_hook(at, accepted, cpu, mem, hook_written);
+        return accepted;
+    }
+
+    void dispatch() noexcept {
+        for (auto timer = sched.pop(); timer != SCHED::Timer::COUNT; timer = sched.pop()) {
+            switch (timer) {
+            case SCHED::Timer::PIT:
+                pic.pulse(0);
+                pit_arm();
+                break;
+            case SCHED::Timer::SPEAKER:
+                speaker_sync();
+                (void)speaker.render(sched.now);
+                sched.arm(SCHED::Timer::SPEAKER, sched.now + SPEAKER::BLOCK_CYCLES);
+                break;
+            case SCHED::Timer::COM1:
+                uart_poll(com1, timer);
+                break;
+            case SCHED::Timer::COM2:
+                uart_poll(com2, timer);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    /// Timer interupt on the rising edge of PIT channel 0
+    void pit_arm() noexcept {
+        auto const next = pit.next_rise(0, pit_tick());
+        if (next == ~std::uint64_t{}) {
+            sched.disarm(SCHED::Timer::PIT);
+        } else {
+            sched.arm(SCHED::Timer::PIT, next * PIT::DIVIDER);
+        }
+    }
+
+    /// Serial ports
+    void uart_poll(UART& uart, SCHED::Timer timer) noexcept {
+        auto const delay = uart.poll(sched.now);
+        sched.arm(timer, sched.now + delay);
+        pic.set_line(uart.line, uart.irq());
+    }
+
+    // Pulls the next poll in when the guest filled the transmit FIFO
+    void uart_kick(UART& uart, SCHED::Timer timer) noexcept {
+        auto const drained = uart.tx_cycles();
+        if (drained != SCHED::NEVER && sched.when(timer) > sched.now + drained) {
+            sched.arm(timer, sched.now + drained);
+        }
+        pic.set_line(uart.line, uart.irq());
+    }
+
+    /// Speaker, driven by PIT channel 2 and bits 0-1 of PPI port B
+    [[nodiscard]] constexpr std::uint64_t pit_tick() const noexcept {
+        return sched.now / PIT::DIVIDER;
+    }
+
+    // Queues the channel 2 transitions since the last sync while the speaker data bit is set
+    void speaker_sync() noexcept {
+        auto const tick = pit_tick();
+        if (ppi_b & 0b10) {
+            pit.edges(2, speaker_tick, tick, [&](std::uint64_t when, bool level) {
+                speaker.level(when * PIT::DIVIDER, level);
+            });
+        }
+        speaker_tick = tick;
+    }
+
+    void speaker_update() noexcept {
+        speaker.level(sched.now, (ppi_b & 0b10) && pit.out(2, pit_tick()));
+    }
+
+    constexpr virtual byte_t read_byte(FAR addr) noexcept override {
+        return mem.read_byte(addr.ea());
+    }
+    constexpr virtual void write_byte(FAR addr, byte_t val) noexcept override {
+        mem.write_byte(addr.ea(), val);
+    }
+    constexpr virtual word_t read_word(FAR addr) noexcept override {
+        auto const lo = mem.read_byte(addr.ea());
+        auto const hi = mem.read_byte((addr + 1).ea());
+        return word_pack(lo, hi);
+    }
+    constexpr virtual void write_word(FAR addr, word_t val) noexcept override {
+        auto const [lo, hi] = word_unpack(val);
+        mem.write_byte(addr.ea(), lo);
+        mem.write_byte((addr + 1).ea(), hi);
+    }
+
+    constexpr virtual byte_t in_byte(word_t port) noexcept override {
+        auto result = port_read(port);
+        if (replay) [[unlikely]] {
+            if (replay->playing) {
+                (void)replay->in(retired, result);
+            } else {
+                replay->record(retired, REPLAY::Kind::IN, result);
+            }
+        }
+        return result;
+    }
+
+    constexpr byte_t port_read(word_t port) noexcept {
+        if (DMA::has_port(port)) {
+            return dma.in_byte(port);
+        }
+        if (PIC::has_port(port)) {
+            return pic.in_byte(port);
+        }
+        if (PIT::has_port(port)) {
+            return port == 0x43 ? 0xFF : pit.get_counter(port & 3, pit_tick());
+        }
+        if (port == 0x61) {
+            return static_cast<byte_t>((ppi_b & 0xDF) | (pit.out(2, pit_tick()) << 5));
+        }
+        if (video.has_port(port)) {
+            return video.in_byte(port, sched.now);
+        }
+        if (FDC::has_port(port)) {
+            auto const result = fdc.in_byte(port);
+            pic.set_line(6, fdc.irq());
+            return result;
+        }
+        if (com1.has_port(port)) {
+            auto const result = com1.in_byte(port);
+            pic.set_line(com1.line, com1.irq());
+            return result;
+        }
+        if (com2.has_port(port)) {
+            auto const result = com2.in_byte(port);
+            pic.set_line(com2.line, com2.irq());
+            return result;
+        }
+        return 0xFF;
+    }
+    constexpr virtual void out_byte(word_t port, byte_t val) noexcept override {
+        if (DMA::has_port(port)) {
+            dma.out_byte(port, val);
+        } else if (PIC::has_port(port)) {
+            pic.out_byte(port, val);
+        } else if (PIT::has_port(port)) {
+            speaker_sync();
+            if (port == 0x43) {
+                pit.set_command(val, pit_tick());
+            } else {
+                pit.set_counter(port & 3, val, pit_tick());
+            }
+            speaker_update();
+            pit_arm();
+        } else if (port == 0x61) {
+            speaker_sync();
+            ppi_b = val;
+            pit.set_gate(2, val & 0b1, pit_tick());
+            speaker_update();
+        } else if (port == 0xA0) {
+            nmi_mask = val;
+        } else if (video.has_port(port)) {
+            video.out_byte(port, val);
+        } else if (FDC::has_port(port)) {
+            fdc.out_byte(port, val);
+            if (fdc.pending()) {
+                fdc.execute(std::span(drives).first(2), mem, sched, dma);
+            }
+            pic.set_line(6, fdc.irq());
+        } else if (com1.has_port(port)) {
+            com1.out_byte(port, val);
+            uart_kick(com1, SCHED::Timer::COM1);
+        } else if (com2.has_port(port)) {
+            com2.out_byte(port, val);
+            uart_kick(com2, SCHED::Timer::COM2);
+        }
+    }
+    constexpr virtual word_t in_word(word_t port) noexcept override {
+        auto const lo = in_byte(port);
+        auto const hi = in_byte(static_cast<word_t>(port + 1));
+        return word_pack(lo, hi);
+    }
+    constexpr virtual void out_word(word_t port, word_t val) noexcept override {
+        auto const [lo, hi] = word_unpack(val);
+        out_byte(port, lo);
+        out_byte(static_cast<word_t>(port + 1), hi);
+    }
+
+    // Takes over the state of other in O(pages), memory pages and disk chunks stay shared until either side writes them
+    // HLE hooks, a translated module and the replay log stay with this instance
+    void share(PC& other) {
+        other.device_check();
+        auto state = STATE::Writer{};
+        other.serialize_board(state);
+        auto reader = STATE::Reader{ state.data };
+        serialize_board(reader);
+        mem.share(other.mem);
+        if (ems) {
+            ems->share(*other.ems);
+        }
+        for (auto i = std::size_t{}; i != std::size(drives); ++i) {
+            drives[i].share(other.drives[i]);
+        }
+    }
+
+    // The child starts without HLE hooks or a translated module, both are bound to this instance
+    // An EMS board comes along without its driver hook, as do DOS and the console
+    [[nodiscard]] std::unique_ptr<PC> fork() {
+        auto child = std::make_unique<PC>();
+        child->share(*this);
+        return child;
+    }
+
+    /// Machine state, memory is stored separately so it can be laid out page aligned
+    // Loading leaves mapping the EMS frame to ems->remap, once the memory under it is restored
+    template <typename S>
+    void serialize(S& s) {
+        serialize_board(s);
+        s.section(STATE::tag("DRVS"), 1, [&](S& s) {
+            for (auto& drive : drives) {
+                drive.serialize(s);
+            }
+        });
+        s.section(STATE::tag("EMSP"), 1, [&](S& s) {
+            if (ems) {
+                ems->serialize_pages(s);
+            }
+        });
+    }
+
+    // Everything but memory, disks and expanded memory pages, all of which fork shares instead of copying
+    template <typename S>
+    void serialize_board(S& s) {
+        s.section(STATE::tag("CPU "), 1, [&](S& s) { cpu.serialize(s); });
+        s.section(STATE::tag("FPU "), 1, [&](S& s) { fpu.serialize(s); });
+        s.section(STATE::tag("SCHD"), 1, [&](S& s) { sched.serialize(s); });
+        s.section(STATE::tag("DMA "), 1, [&](S& s) { dma.serialize(s); });
+        s.section(STATE::tag("FDC "), 1, [&](S& s) { fdc.serialize(s); });
+        s.section(STATE::tag("PIC "), 1, [&](S& s) { pic.serialize(s); });
+        s.section(STATE::tag("PIT "), 1, [&](S& s) { pit.serialize(s); });
+        s.section(STATE::tag("SPKR"), 1, [&](S& s) { speaker.serialize(s); });
+        s.section(STATE::tag("COM1"), 1, [&](S& s) { com1.serialize(s); });
+        s.section(STATE::tag("COM2"), 1, [&](S& s) { com2.serialize(s); });
+        s.section(STATE::tag("VID "), 1, [&](S& s) { video.serialize(s); });
+        s.section(STATE::tag("EMS "), 1, [&](S& s) {
+            auto pages = ems ? ems->total() : word_t{};
+            s(pages);
+            if constexpr (S::LOADING) {
+                if (pages && !ems) {
+                    ems.emplace(mem, cpu, pages);
+                }
+                if ((ems ? ems->total() : word_t{}) != pages) {
+                    throw "EMS state does not match the board!";
+                }
+            }
+            if (ems) {
+                ems->serialize(s);
+            }
+        });
+        s.section(STATE::tag("BRD "), 2, [&](S& s) {
+            s(ppi_b);
+            s(halted);
+            s(speaker_tick);
+            s(nmi_mask);
+            s(fpu_irq);
+            s(retired);
+        });
+    }
+};
+
+#endif // O126_PC_HPP
@@ -1,12 +1,146 @@
 #ifndef O126_PIC_HPP
 #define O126_PIC_HPP
 #include "common.hpp"
+#include <bit>
 
 struct o126::PIC {
 private:
+    enum class Init : byte_t {
+        NONE,
+        ICW2,
+        ICW3,
+        ICW4,
+    };
 
+    byte_t irr = {};
+    byte_t isr = {};
+    byte_t imr = 0xFF;
+    byte_t lines = {};
+    byte_t vector = 0x08;
+    Init init = Init::NONE;
+    bool single = true;
+    bool need_icw4 = {};
+    bool auto_eoi = {};
+    bool read_isr = {};
+
+    // Lowest bit has the highest priority, only fixed priority is modeled
+    [[nodiscard]] static constexpr byte_t lowest(byte_t bits) noexcept {
+        return static_cast<byte_t>(bits & -bits);
+    }
+
+    constexpr void update() noexcept {
+        auto const request = lowest(irr & ~imr);
+        auto const service = lowest(isr);
+        output = request && (!service || request < service);
+    }
 public:
+    // Cached interupt request line, cheap to poll after every instruction
+    bool output = {};
+
+    [[nodiscard]] static constexpr bool has_port(word_t port) noexcept {
+        return port == 0x20 || port == 0x21;
+    }
+
+    constexpr byte_t in_byte(word_t port) const noexcept {
+        if (port & 1) {
+            return imr;
+        }
+        return read_isr ? isr : irr;
+    }
+
+    constexpr void out_byte(word_t port, byte_t val) noexcept {
+        if (!(port & 1)) {
+            if (val & 0x10) { // ICW1
+                irr = {};
+                isr = {};
+                imr = {};
+                single = val & 0x02;
+                need_icw4 = val & 0x01;
+                auto_eoi = false;
+                read_isr = false;
+                init = Init::ICW2;
+            } else if (val & 0x08) { // OCW3
+                if (val & 0x02) {
+                    read_isr = val & 0x01;
+                }
+            } else { // OCW2
+                switch (val >> 5) {
+                case 0b001: // non-specific EOI
+                    isr &= static_cast<byte_t>(isr - 1);
+                    break;
+                case 0b011: // specific EOI
+                    isr &= static_cast<byte_t>(~(1 << (val & 7)));
+                    break;
+                default:
+                    break;
+                }
+            }
+        } else {
+            switch (init) {
+            case Init::ICW2:
+                vector = val & 0xF8;
+                init = !single ? Init::ICW3 : need_icw4 ? Init::ICW4 : Init::NONE;
+                break;
+            case Init::ICW3:
+                init = need_icw4 ? Init::ICW4 : Init::NONE;
+                break;
+            case Init::ICW4:
+                auto_eoi = val & 0x02;
+                init = Init::NONE;
+                break;
+            case Init::NONE:
+                imr = val;
+                break;
+            }
+        }
+        update();
+    }
+
+    // Edge triggered, a request is latched on the rising edge of the line
+    constexpr void set_line(byte_t irq, bool level) noexcept {
+        auto const bit = static_cast<byte_t>(1 << irq);
+        if (level && !(lines & bit)) {
+            irr |= bit;
+        }
+        lines = static_cast<byte_t>(level ? lines | bit : lines & ~bit);
+        update();
+    }
+
+    constexpr void pulse(byte_t irq) noexcept {
+        set_line(irq, true);
+        set_line(irq, false);
+    }
+
+    // Interupt acknowledge cycle, moves the request in service and returns its vector
+    constexpr byte_t acknowledge() noexcept {
+        auto const request = lowest(irr & ~imr);
+        if (!request) {
+            return static_cast<byte_t>(vector | 7); // spurious
+        }
+        auto const irq = static_cast<byte_t>(std::countr_zero(request));
+        irr &= static_cast<byte_t>(~request);
+        if (!auto_eoi) {
+            isr |= request;
+        }
+        update();
+        return static_cast<byte_t>(vector | irq);
+    }
 
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        s(irr);
+        s(isr);
+        s(imr);
+        s(lines);
+        s(vector);
+        s(init);
+        s(single);
+        s(need_icw4);
+        s(auto_eoi);
+        s(read_isr);
+        s(output);
+    }
 };
 
 #endif // O126_PIC_HPP
@@ -2,7 +2,11 @@
 #define O126_PIT_HPP
 #include "common.hpp"
 
+// Counters are evaluated lazily from the tick they were loaded at instead of being stepped every clock
 struct o126::PIT {
+public:
+    // PIT input clock is the CPU clock divided by 4
+    static constexpr std::uint64_t DIVIDER = 4;
 private:
     enum class Mode : sbyte_t {
         NONE = -1,
@@ -29,40 +33,269 @@ private:
         word_t output_latch = {};
         bool output_latch_enable = {};
         bool input_latch_enable = {};
+        bool output_hi = {};
+        bool gate = true;
+        bool armed = {};
+        bool out = {};
         Latch latch = {};
         Mode mode = Mode::NONE;
+        std::uint64_t start = {};
+        std::uint64_t frozen = {};
     };
     Channel channels[3] = {};
+
+    [[nodiscard]] static constexpr std::uint64_t period(Channel const& channel) noexcept {
+        return channel.count ? channel.count : 0x10000;
+    }
+
+    [[nodiscard]] static constexpr std::uint64_t elapsed(Channel const& channel, std::uint64_t tick) noexcept {
+        switch (channel.mode) {
+        case Mode::INTERUPT_TERMINAL:
+        case Mode::SW_STROBE:
+            return channel.gate ? tick - channel.start : channel.frozen;
+        default:
+            return tick - channel.start;
+        }
+    }
+
+    [[nodiscard]] static constexpr word_t value(Channel const& channel, std::uint64_t tick) noexcept {
+        if (!channel.armed) {
+            return channel.count;
+        }
+        auto const n = period(channel);
+        auto const e = elapsed(channel, tick);
+        switch (channel.mode) {
+        case Mode::RATE:
+            return static_cast<word_t>(n - e % n);
+        case Mode::SQUARE_WAVE:
+            return static_cast<word_t>((n - (e * 2) % n) & ~1u);
+        default:
+            return static_cast<word_t>(n - e);
+        }
+    }
+
+    constexpr void load(Channel& channel, word_t count, std::uint64_t tick) noexcept {
+        channel.count = count;
+        channel.input_latch_enable = false;
+        switch (channel.mode) {
+        case Mode::INTERUPT_TERMINAL:
+            channel.out = false;
+            [[fallthrough]];
+        case Mode::SW_STROBE:
+        case Mode::RATE:
+        case Mode::SQUARE_WAVE:
+            channel.armed = true;
+            channel.start = tick;
+            channel.frozen = {};
+            break;
+        default:
+            break;
+        }
+    }
 public:
-    constexpr void set_command(byte_t command) noexcept {
+    [[nodiscard]] static constexpr bool has_port(word_t port) noexcept {
+        return port >= 0x40 && port < 0x44;
     }
 
-    constexpr byte_t get_counter(byte_t index) noexcept {
-        return 0;
+    constexpr void set_command(byte_t command, std::uint64_t tick) noexcept {
+        auto const index = command >> 6;
+        if (index == 3) {
+            return;
+        }
+        auto& channel = channels[index];
+        auto const latch = static_cast<Latch>((command >> 4) & 0b11);
+        if (latch == Latch::NONE) {
+            if (!channel.output_latch_enable) {
+                channel.output_latch = value(channel, tick);
+                channel.output_latch_enable = true;
+            }
+            return;
+        }
+        auto mode = static_cast<Mode>((command >> 1) & 0b111);
+        if (mode == Mode::RATE2) {
+            mode = Mode::RATE;
+        } else if (mode == Mode::SQUARE_WAVE2) {
+            mode = Mode::SQUARE_WAVE;
+        }
+        channel.latch = latch;
+        channel.mode = mode;
+        channel.armed = false;
+        channel.input_latch_enable = false;
+        channel.output_latch_enable = false;
+        channel.output_hi = false;
+        channel.out = mode != Mode::INTERUPT_TERMINAL;
     }
 
-    constexpr void set_counter(byte_t index, byte_t value) noexcept {
+    constexpr byte_t get_counter(byte_t index, std::uint64_t tick) noexcept {
+        auto& channel = channels[index];
+        auto const current = channel.output_latch_enable ? channel.output_latch : value(channel, tick);
+        auto const [lo, hi] = word_unpack(current);
+        switch (channel.latch) {
+        case Latch::LO:
+            channel.output_latch_enable = false;
+            return lo;
+        case Latch::HI:
+            channel.output_latch_enable = false;
+            return hi;
+        case Latch::LO_HI:
+            if (!channel.output_hi) {
+                channel.output_hi = true;
+                return lo;
+            }
+            channel.output_hi = false;
+            channel.output_latch_enable = false;
+            return hi;
+        default:
+            return 0xFF;
+        }
     }
 
-    constexpr void step(byte_t index) noexcept {
+    constexpr void set_counter(byte_t index, byte_t value, std::uint64_t tick) noexcept {
         auto& channel = channels[index];
-        switch (channel.mode) {
-        case Mode::NONE:
+        switch (channel.latch) {
+        case Latch::LO:
+            load(channel, value, tick);
             break;
-        case Mode::INTERUPT_TERMINAL: // Mode 0: interupt on terminal count
+        case Latch::HI:
+            load(channel, word_pack(0, value), tick);
             break;
-        case Mode::HW_ONESHOT: // Mode 1: hardware retriggerable one-shot
+        case Latch::LO_HI:
+            if (!channel.input_latch_enable) {
+                channel.input_latch = value;
+                channel.input_latch_enable = true;
+            } else {
+                load(channel, word_pack(static_cast<byte_t>(channel.input_latch), value), tick);
+            }
             break;
-        case Mode::RATE: // Mode 2: rate generator
-        case Mode::RATE2:
+        default:
             break;
+        }
+    }
+
+    constexpr void set_gate(byte_t index, bool gate, std::uint64_t tick) noexcept {
+        auto& channel = channels[index];
+        if (channel.gate == gate) {
+            return;
+        }
+        if (gate) {
+            switch (channel.mode) {
+            case Mode::HW_ONESHOT:
+            case Mode::HW_STROBE:
+                channel.armed = true;
+                [[fallthrough]];
+            case Mode::RATE:
+            case Mode::SQUARE_WAVE:
+                channel.start = tick;
+                break;
+            case Mode::INTERUPT_TERMINAL:
+            case Mode::SW_STROBE:
+                channel.start = tick - channel.frozen;
+                break;
+            default:
+                break;
+            }
+        } else {
+            channel.frozen = tick - channel.start;
+        }
+        channel.gate = gate;
+    }
+
+    [[nodiscard]] constexpr bool out(byte_t index, std::uint64_t tick) const noexcept {
+        auto const& channel = channels[index];
+        if (!channel.armed) {
+            return channel.out;
+        }
+        auto const n = period(channel);
+        auto const e = elapsed(channel, tick);
+        switch (channel.mode) {
+        case Mode::INTERUPT_TERMINAL: // Mode 0: interupt on terminal count
+        case Mode::HW_ONESHOT: // Mode 1: hardware retriggerable one-shot
+            return e >= n;
+        case Mode::RATE: // Mode 2: rate generator
+            return !channel.gate || e % n != n - 1;
         case Mode::SQUARE_WAVE: // Mode 3: square wave generator
-        case Mode::SQUARE_WAVE2:
-            break;
+            return !channel.gate || e % n < (n + 1) / 2;
         case Mode::SW_STROBE: // Mode 4: software triggered strobe
-            break;
         case Mode::HW_STROBE: // Mode 5: hardware retriggerable strobe
+            return e != n;
+        default:
+            return channel.out;
+        }
+    }
+
+    // First rising edge of the output after tick, all ones when there is none
+    [[nodiscard]] constexpr std::uint64_t next_rise(byte_t index, std::uint64_t tick) const noexcept {
+        auto result = ~std::uint64_t{};
+        edges(index, tick, tick + period(channels[index]) + 1, [&](std::uint64_t when, bool level) {
+            if (level && when < result) {
+                result = when;
+            }
+        });
+        return result;
+    }
+
+    // Calls func(tick, level) for every output transition in the range (from, to]
+    template <typename F>
+    constexpr void edges(byte_t index, std::uint64_t from, std::uint64_t to, F&& func) const noexcept {
+        auto const& channel = channels[index];
+        if (!channel.armed || to <= from) {
+            return;
+        }
+        auto const n = period(channel);
+        auto const emit = [&](std::uint64_t tick, bool level) {
+            if (tick > from && tick <= to) {
+                func(tick, level);
+            }
+        };
+        switch (channel.mode) {
+        case Mode::INTERUPT_TERMINAL:
+        case Mode::HW_ONESHOT:
+            if (channel.gate || channel.mode == Mode::HW_ONESHOT) {
+                emit(channel.start + n, true);
+            }
             break;
+        case Mode::SW_STROBE:
+        case Mode::HW_STROBE:
+            if (channel.gate || channel.mode == Mode::HW_STROBE) {
+                emit(channel.start + n, false);
+                emit(channel.start + n + 1, true);
+            }
+            break;
+        case Mode::RATE:
+        case Mode::SQUARE_WAVE: {
+            auto const low = channel.mode == Mode::RATE ? n - 1 : (n + 1) / 2;
+            if (!channel.gate || low == 0 || low >= n) {
+                break;
+            }
+            auto k = from > channel.start ? (from - channel.start) / n : 0;
+            for (auto base = channel.start + k * n; base <= to; base += n) {
+                emit(base + low, false);
+                emit(base + n, true);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        for (auto& channel : channels) {
+            s(channel.count);
+            s(channel.input_latch);
+            s(channel.output_latch);
+            s(channel.output_latch_enable);
+            s(channel.input_latch_enable);
+            s(channel.output_hi);
+            s(channel.gate);
+            s(channel.armed);
+            s(channel.out);
+            s(channel.latch);
+            s(channel.mode);
+            s(channel.start);
+            s(channel.frozen);
         }
     }
 };
@@ -0,0 +1,317 @@
+#ifndef O126_REPLAY_HPP
+#define O126_REPLAY_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "mapping.hpp"
+#include "mem.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Log of every input that does not follow from the machine state, timestamped in retired instructions
+// Each event is one varint holding the kind in its low bits and the delta to the previous event, then its value
+// Interupts also store the cycle they were taken at, since halted time passes without retiring instructions
+// Host hooks store what they did instead: the byte length of the rest, whether they took the call, every register
+// afterwards and runs of the memory they wrote, each as a varint address, a varint size and the bytes
+struct o126::REPLAY final {
+    static constexpr char MAGIC[8] = { 'O', '1', '2', '6', 'R', 'P', 'L', 'Y' };
+    static constexpr dword_t VERSION = 3;
+    static constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 8;
+    static constexpr std::size_t FLUSH_SIZE = 0x10000;
+
+    // Where the next recorded event goes, playback of an in memory log can start there
+    struct Mark final {
+        std::size_t pos = HEADER_SIZE;
+        std::uint64_t last = {};
+        std::uint64_t cycles = {};
+    };
+
+    enum class Kind : byte_t {
+        IN, // value read from a port
+        IRQ, // vector the PIC answered with
+        NMI,
+        HOOK, // what a host hook did to registers and memory
+        NONE,
+    };
+private:
+    static constexpr dword_t KIND_BITS = 3;
+    static constexpr std::size_t HOOK_REGS = 9 + 4 + 1;
+
+    std::FILE* file = {};
+    std::shared_ptr<MAPPING const> log = {};
+    std::span<byte_t const> source = {};
+    std::vector<byte_t> buffer = {};
+    std::uint64_t last = {};
+    std::uint64_t last_cycles = {};
+    std::size_t pos = {};
+    // Next event of the log while playing
+    Kind kind = Kind::NONE;
+    std::uint64_t when = {};
+    std::uint64_t cycles = {};
+    byte_t value = {};
+    std::span<byte_t const> hook_data = {};
+
+    static void put(std::vector<byte_t>& out, std::uint64_t val) {
+        while (val >= 0x80) {
+            out.push_back(static_cast<byte_t>(val | 0x80));
+            val >>= 7;
+        }
+        out.push_back(static_cast<byte_t>(val));
+    }
+
+    void put(std::uint64_t val) {
+        put(buffer, val);
+    }
+
+    void put_le(std::uint64_t val, int size) {
+        for (auto i = 0; i != size; ++i, val >>= 8) {
+            buffer.push_back(static_cast<byte_t>(val));
+        }
+    }
+
+    void put_event(std::uint64_t at, Kind event) {
+        put(((at - last) << KIND_BITS) | static_cast<byte_t>(event));
+        last = at;
+    }
+
+    [[nodiscard]] std::uint64_t get_le(std::size_t at, int size) const noexcept {
+        auto result = std::uint64_t{};
+        for (auto i = size; i != 0; --i) {
+            result = (result << 8) | source[at + static_cast<std::size_t>(i - 1)];
+        }
+        return result;
+    }
+
+    [[nodiscard]] static bool get(std::span<byte_t const> from, std::size_t& at, std::uint64_t& val) noexcept {
+        val = 0;
+        for (auto shift = 0; at != from.size() && shift < 64; shift += 7) {
+            auto const byte = from[at++];
+            val |= std::uint64_t{byte & 0x7Fu} << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    [[nodiscard]] bool get(std::uint64_t& val) noexcept {
+        return get(source, pos, val);
+    }
+
+    void advance() noexcept {
+        auto head = std::uint64_t{};
+        kind = Kind::NONE;
+        if (!get(head)) {
+            return;
+        }
+        when += head >> KIND_BITS;
+        kind = static_cast<Kind>(head & ((1u << KIND_BITS) - 1));
+        if (kind == Kind::HOOK) {
+            auto size = std::uint64_t{};
+            if (!get(size) || size > source.size() - pos || size < 1 + HOOK_REGS * 2) {
+                kind = Kind::NONE;
+                return;
+            }
+            hook_data = source.subspan(pos, static_cast<std::size_t>(size));
+            pos += static_cast<std::size_t>(size);
+            return;
+        }
+        if (kind != Kind::NMI) {
+            if (pos == source.size()) {
+                kind = Kind::NONE;
+                return;
+            }
+            value = source[pos++];
+        }
+        if (kind == Kind::IRQ) {
+            auto delta = std::uint64_t{};
+            if (!get(delta)) {
+                kind = Kind::NONE;
+                return;
+            }
+            cycles += delta;
+        }
+    }
+public:
+    bool const playing;
+    // Set once playback asked for something the log does not have next, execution is no longer the recorded one
+    bool diverged = {};
+
+    // Records into file starting at instruction start, the file stays open and owned by the caller
+    // Without a file the whole log stays in memory
+    REPLAY(std::FILE* file, std::uint64_t start) : file(file), last(start), playing(false) {
+        buffer.reserve(FLUSH_SIZE + 32);
+        buffer.insert(buffer.end(), std::begin(MAGIC), std::end(MAGIC));
+        put_le(VERSION, 4);
+        put_le(start, 8);
+    }
+
+    // Plays back a recorded log, the machine has to be in the state the recording started from
+    explicit REPLAY(std::string filename) : log(std::make_shared<MAPPING const>(std::move(filename))), source(log->bytes()), playing(true) {
+        if (source.size() < HEADER_SIZE || std::memcmp(source.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            throw "Not a replay log!";
+        }
+        if (get_le(sizeof(MAGIC), 4) != VERSION) {
+            throw "Unsupported replay log version!";
+        }
+        pos = HEADER_SIZE;
+        when = get_le(sizeof(MAGIC) + 4, 8);
+        advance();
+    }
+
+    // Plays back an in memory recording from a mark it handed out, the recorder must not grow the log meanwhile
+    REPLAY(REPLAY const& recording, Mark from) noexcept
+        : source(recording.data()), pos(from.pos), when(from.last), cycles(from.cycles), playing(true) {
+        advance();
+    }
+
+    REPLAY(REPLAY const&) = delete;
+    REPLAY& operator=(REPLAY const&) = delete;
+
+    ~REPLAY() {
+        flush();
+    }
+
+    // Batched so recording costs one write per FLUSH_SIZE bytes of log
+    void flush() noexcept {
+        if (file && !buffer.empty()) {
+            std::fwrite(buffer.data(), 1, buffer.size(), file);
+            std::fflush(file);
+            buffer.clear();
+        }
+    }
+
+    /// Recording
+    // Only complete while recording without a file
+    [[nodiscard]] std::span<byte_t const> data() const noexcept {
+        return buffer;
+    }
+
+    [[nodiscard]] Mark mark() const noexcept {
+        return { buffer.size(), last, last_cycles };
+    }
+
+    void record(std::uint64_t at, Kind event, byte_t val = {}, std::uint64_t now = {}) {
+        put_event(at, event);
+        if (event != Kind::NMI) {
+            buffer.push_back(val);
+        }
+        if (event == Kind::IRQ) {
+            put(now - last_cycles);
+            last_cycles = now;
+        }
+        if (buffer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    // Registers as the hook left them and the memory granules it wrote, written being a bitmap from MEM::dirty_collect
+    void record_hook(std::uint64_t at, bool accepted, CPU const& cpu, MEM const& mem, std::span<std::uint64_t const> written) {
+        auto data = std::vector<byte_t>{};
+        auto const put_word = [&](word_t val) {
+            data.push_back(static_cast<byte_t>(val));
+            data.push_back(static_cast<byte_t>(val >> 8));
+        };
+        data.push_back(accepted);
+        for (auto i = 0; i != 9; ++i) {
+            put_word(cpu.reg_get(static_cast<CPU::REG>(i)));
+        }
+        for (auto i = 0; i != 4; ++i) {
+            put_word(cpu.seg_get(static_cast<CPU::SEG>(i)));
+        }
+        put_word(CPU::flags_pack(cpu.flags_get()));
+        auto const granule = std::size_t{mem.dirty_granule()};
+        for (auto i = std::size_t{}; i != written.size() * 64; ++i) {
+            if (!(written[i >> 6] & (std::uint64_t{1} << (i & 63)))) {
+                continue;
+            }
+            auto end = i + 1;
+            while (end != written.size() * 64 && (written[end >> 6] & (std::uint64_t{1} << (end & 63)))) {
+                end += 1;
+            }
+            auto const ea = static_cast<dword_t>(i * granule);
+            auto const size = std::min<std::size_t>((end - i) * granule, MEM::SIZE - ea);
+            put(data, ea);
+            put(data, size);
+            auto const from = data.size();
+            data.resize(from + size);
+            mem.copy_out(ea, std::span(data).subspan(from));
+            i = end - 1;
+        }
+        put_event(at, Kind::HOOK);
+        put(data.size());
+        buffer.insert(buffer.end(), data.begin(), data.end());
+        if (buffer.size() >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    /// Playback
+    // Instruction of the next logged event, execution must not run past it in one go
+    [[nodiscard]] constexpr std::uint64_t next() const noexcept {
+        return kind == Kind::NONE ? ~std::uint64_t{} : when;
+    }
+
+    // Interupt logged for instruction at and due by cycle now, NONE once there are no more
+    [[nodiscard]] Kind interupt(std::uint64_t at, std::uint64_t now, byte_t& vector) noexcept {
+        if ((kind != Kind::IRQ && kind != Kind::NMI) || when != at || (kind == Kind::IRQ && cycles > now)) {
+            diverged = diverged || (kind != Kind::NONE && when < at);
+            return Kind::NONE;
+        }
+        auto const result = kind;
+        vector = value;
+        advance();
+        return result;
+    }
+
+    // Puts back what the host hook logged for instruction at, false when the log has none at this point
+    bool hook(std::uint64_t at, CPU& cpu, MEM& mem, bool& accepted) noexcept {
+        if (kind != Kind::HOOK || when != at) {
+            diverged = true;
+            return false;
+        }
+        auto const data = hook_data;
+        auto pos = std::size_t{};
+        auto const get_word = [&] {
+            pos += 2;
+            return word_pack(data[pos - 2], data[pos - 1]);
+        };
+        accepted = data[pos++];
+        for (auto i = 0; i != 9; ++i) {
+            cpu.reg_set(static_cast<CPU::REG>(i), get_word());
+        }
+        for (auto i = 0; i != 4; ++i) {
+            cpu.seg_set(static_cast<CPU::SEG>(i), get_word());
+        }
+        cpu.flags_set(CPU::flags_unpack(get_word()));
+        auto ea = std::uint64_t{};
+        auto size = std::uint64_t{};
+        while (pos != data.size()) {
+            if (!get(data, pos, ea) || !get(data, pos, size) || size > data.size() - pos) {
+                diverged = true;
+                break;
+            }
+            mem.copy_in(static_cast<dword_t>(ea), data.subspan(pos, static_cast<std::size_t>(size)));
+            pos += static_cast<std::size_t>(size);
+        }
+        advance();
+        return true;
+    }
+
+    // Replaces val with the logged read, false when the log has none at this point
+    bool in(std::uint64_t at, byte_t& val) noexcept {
+        if (kind != Kind::IN || when != at) {
+            diverged = true;
+            return false;
+        }
+        val = value;
+        advance();
+        return true;
+    }
+};
+
+#endif // O126_REPLAY_HPP
@@ -0,0 +1,185 @@
+#ifndef O126_REWIND_HPP
+#define O126_REWIND_HPP
+#include "common.hpp"
+#include "cpu.hpp"
+#include "pc.hpp"
+#include "replay.hpp"
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <utility>
+
+// Reverse execution of a live machine: running forward records every input and forks a checkpoint now and then,
+// going back restores the nearest earlier checkpoint and replays the log up to the instruction asked for
+// Host hooks are not run again while replaying, see REPLAY, so host files and the console only see the first run
+// Serial ports attached to a host endpoint are refused, the bytes they exchanged are gone and would be sent again,
+// as is memory mapped by a device outside the machine, which checkpoints could not bring back
+// An EMS board added with PC::ems_install is part of the machine and is checkpointed with it
+struct o126::REWIND final {
+    static constexpr std::uint64_t INTERVAL_MIN = 1'000;
+    static constexpr std::uint64_t INTERVAL_MAX = 100'000'000;
+    static constexpr std::uint64_t NEVER = ~std::uint64_t{};
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // Forked, so it only holds on to the pages written since
+    struct Checkpoint final {
+        std::unique_ptr<PC> pc = {};
+        REPLAY::Mark mark = {};
+    };
+
+    PC& pc;
+    REPLAY recorder;
+    std::unique_ptr<REPLAY> player = {};
+    std::deque<Checkpoint> checkpoints = {};
+    std::size_t capacity;
+    // Furthest instruction reached, everything up to it can be replayed
+    std::uint64_t head;
+    std::uint64_t interval = INTERVAL_MIN;
+    // Replaying one interval should never take longer than this
+    Clock::duration target;
+    Clock::time_point taken = Clock::now();
+
+    // Spacing follows the speed the guest just ran at, replay runs the same code path at about the same speed
+    void checkpoint() {
+        auto const now = Clock::now();
+        if (!checkpoints.empty()) {
+            auto const done = static_cast<double>(pc.retired - checkpoints.back().pc->retired);
+            auto const elapsed = std::chrono::duration<double>(now - taken).count();
+            if (elapsed > 0) {
+                auto const wanted = done / elapsed * std::chrono::duration<double>(target).count();
+                interval = static_cast<std::uint64_t>(std::clamp<double>(wanted, INTERVAL_MIN, INTERVAL_MAX));
+            }
+        }
+        if (checkpoints.size() == capacity) {
+            checkpoints.pop_front();
+        }
+        checkpoints.push_back({ pc.fork(), recorder.mark() });
+        taken = now;
+    }
+
+    static void check(PC const& pc) {
+        if (pc.com1.host.attached() || pc.com2.host.attached()) {
+            throw "Cannot rewind a serial port attached to the host!";
+        }
+        pc.device_check();
+    }
+
+    void restore(Checkpoint& checkpoint) {
+        check(pc);
+        pc.share(*checkpoint.pc);
+        player = std::make_unique<REPLAY>(recorder, checkpoint.mark);
+        pc.replay = player.get();
+    }
+
+    // Latest checkpoint at or before the instruction, null when history does not reach back that far
+    [[nodiscard]] Checkpoint* find(std::uint64_t retired) noexcept {
+        auto const it = std::upper_bound(checkpoints.begin(), checkpoints.end(), retired, [](std::uint64_t value, Checkpoint const& entry) {
+            return value < entry.pc->retired;
+        });
+        return it == checkpoints.begin() ? nullptr : &*std::prev(it);
+    }
+
+    // Translated blocks stop at limit, and at the end of the log while replaying
+    CPU::Result advance(std::uint64_t limit) {
+        // The log always ends after a whole step, once it runs out at the head recording picks up where it stopped
+        if (player && pc.retired >= head && player->next() == NEVER) {
+            pc.replay = &recorder;
+            player.reset();
+        }
+        if (!player && pc.retired - checkpoints.back().pc->retired >= interval) {
+            checkpoint();
+        }
+        pc.stop_at = player ? std::min(limit, head) : limit;
+        auto const result = pc.step();
+        pc.stop_at = NEVER;
+        head = std::max(head, pc.retired);
+        return result;
+    }
+
+    // False when the guest halted with interupts disabled first, nothing would ever wake it
+    bool run(std::uint64_t retired) {
+        while (pc.retired < retired) {
+            if (pc.halted && !player && !pc.cpu.interupt_enabled()) {
+                return false;
+            }
+            (void)advance(retired);
+        }
+        return true;
+    }
+public:
+    // Takes over pc.replay for as long as it lives, at most capacity checkpoints are kept
+    explicit REWIND(PC& pc, Clock::duration target = std::chrono::milliseconds(100), std::size_t capacity = 4096)
+        : pc(pc), recorder(nullptr, pc.retired), capacity(std::max<std::size_t>(capacity, 1)), head(pc.retired), target(target) {
+        check(pc);
+        pc.replay = &recorder;
+        checkpoint();
+    }
+
+    REWIND(REWIND const&) = delete;
+    REWIND& operator=(REWIND const&) = delete;
+
+    ~REWIND() {
+        pc.replay = nullptr;
+        pc.stop_at = NEVER;
+    }
+
+    // Oldest instruction still reachable
+    [[nodiscard]] std::uint64_t first() const noexcept {
+        return checkpoints.front().pc->retired;
+    }
+
+    [[nodiscard]] constexpr std::uint64_t last() const noexcept {
+        return head;
+    }
+
+    // Forward, replaying while behind the furthest point reached and recording past it
+    CPU::Result step() {
+        return advance(NEVER);
+    }
+
+    // Lands right before the instruction with that retired count, false when it lies outside the history
+    bool seek(std::uint64_t retired) {
+        auto const checkpoint = find(retired);
+        if (!checkpoint) {
+            return false;
+        }
+        if (retired < pc.retired || checkpoint->pc->retired > pc.retired) {
+            restore(*checkpoint);
+        }
+        return run(retired);
+    }
+
+    bool reverse_step() {
+        return pc.retired != 0 && seek(pc.retired - 1);
+    }
+
+    // Back to the latest earlier instruction breakpoint(pc) held before, one checkpoint interval at a time
+    // Stays put and returns false when the history has none
+    template <typename F>
+    bool reverse_continue(F&& breakpoint) {
+        auto const from = pc.retired;
+        auto end = from;
+        for (auto checkpoint = find(from ? from - 1 : 0); checkpoint && checkpoint->pc->retired < end;) {
+            auto const begin = checkpoint->pc->retired;
+            restore(*checkpoint);
+            auto found = NEVER;
+            while (pc.retired < end) {
+                if (breakpoint(std::as_const(pc))) {
+                    found = pc.retired;
+                }
+                (void)advance(pc.retired + 1);
+            }
+            if (found != NEVER) {
+                return seek(found);
+            }
+            end = begin;
+            checkpoint = begin ? find(begin - 1) : nullptr;
+        }
+        (void)seek(from);
+        return false;
+    }
+};
+
+#endif // O126_REWIND_HPP
@@ -0,0 +1,267 @@
+#ifndef O126_RING_HPP
+#define O126_RING_HPP
+#include "common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <iterator>
+#include <span>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Execution events in a shared memory ring for tools in another process, the CPU never waits for them
+// One producer writes slots in sequence and overwrites the oldest once the ring is full
+// A slot holds its sequence number plus one, 0 while it is being written, and one word of event data:
+// bits 0-7 the kind, 8-15 the vector or access width, 16-31 the value and 32-63 the address
+struct o126::RING final {
+    static constexpr char MAGIC[8] = { 'O', '1', '2', '6', 'R', 'I', 'N', 'G' };
+    static constexpr dword_t VERSION = 1;
+    static constexpr std::size_t HEADER_SIZE = 64;
+
+    enum class Kind : byte_t {
+        BLOCK, // taken branch, the address is the CS:IP it lands on
+        INTERUPT, // the address is the CS:IP it returns to
+        IN,
+        OUT,
+        WRITE, // only with writes set, the address is linear
+    };
+
+    struct Event final {
+        std::uint64_t seq = {};
+        Kind kind = {};
+        // Vector of an interupt, 1 or 2 for the width of an access
+        byte_t aux = {};
+        word_t val = {};
+        // CS:IP as seg << 16 | disp, a port, or a linear address
+        dword_t addr = {};
+    };
+
+    struct Header final {
+        char magic[8];
+        dword_t version;
+        dword_t capacity;
+        // Sequence number of the next event, everything before it has been published
+        std::atomic<std::uint64_t> head;
+    };
+
+    struct Slot final {
+        std::atomic<std::uint64_t> seq;
+        std::atomic<std::uint64_t> data;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "Shared counters must not take a lock!");
+    static_assert(sizeof(Header) <= HEADER_SIZE);
+    static_assert(sizeof(Slot) == 16);
+private:
+    struct Fd final {
+        int fd;
+
+        Fd(int fd) : fd(fd) {
+            if (fd < 0) {
+                throw "Failed to open ring!";
+            }
+        }
+
+        Fd(Fd const&) = delete;
+        Fd& operator=(Fd const&) = delete;
+
+        ~Fd() {
+            ::close(fd);
+        }
+    };
+
+    // Maps an open segment, checking the header when it comes from someone else
+    struct View final {
+        void* base = MAP_FAILED;
+        std::size_t size = {};
+        Header* header = {};
+        Slot* slots = {};
+        std::uint64_t mask = {};
+
+        View(int fd, std::size_t capacity, bool writable) {
+            if (!writable) {
+                struct stat info = {};
+                if (::fstat(fd, &info) < 0 || static_cast<std::size_t>(info.st_size) < HEADER_SIZE) {
+                    throw "Failed to stat ring!";
+                }
+                size = static_cast<std::size_t>(info.st_size);
+            } else {
+                size = HEADER_SIZE + capacity * sizeof(Slot);
+                if (::ftruncate(fd, static_cast<off_t>(size)) < 0) {
+                    throw "Failed to size ring!";
+                }
+            }
+            base = ::mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            if (base == MAP_FAILED) {
+                throw "Failed to map ring!";
+            }
+            header = static_cast<Header*>(base);
+            slots = reinterpret_cast<Slot*>(static_cast<byte_t*>(base) + HEADER_SIZE);
+            if (writable) {
+                std::copy(std::begin(MAGIC), std::end(MAGIC), header->magic);
+                header->version = VERSION;
+                header->capacity = static_cast<dword_t>(capacity);
+                header->head.store(0, std::memory_order_release);
+            } else if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header->magic) || header->version != VERSION
+                || !std::has_single_bit(header->capacity) || HEADER_SIZE + header->capacity * sizeof(Slot) > size) {
+                ::munmap(base, size);
+                throw "Not a ring!";
+            }
+            mask = header->capacity - 1;
+        }
+
+        View(View const&) = delete;
+        View& operator=(View const&) = delete;
+
+        ~View() {
+            ::munmap(base, size);
+        }
+    };
+
+    static int create(std::string const& name) noexcept {
+        return name.empty() ? ::memfd_create("o126-ring", MFD_CLOEXEC)
+                            : ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+
+    std::string name;
+    Fd fd;
+    View view;
+    // Only the producer advances it, the shared copy is for consumers
+    std::uint64_t head = {};
+
+    void push(Kind kind, byte_t aux, word_t val, dword_t addr) noexcept {
+        auto& slot = view.slots[head & view.mask];
+        slot.seq.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.data.store(static_cast<std::uint64_t>(kind) | std::uint64_t{aux} << 8 | std::uint64_t{val} << 16 | std::uint64_t{addr} << 32, std::memory_order_relaxed);
+        head += 1;
+        slot.seq.store(head, std::memory_order_release);
+        view.header->head.store(head, std::memory_order_release);
+    }
+
+    [[nodiscard]] static constexpr dword_t far_pack(FAR at) noexcept {
+        return static_cast<dword_t>(at.seg) << 16 | at.disp;
+    }
+public:
+    // Memory writes as well, usually far more of them than of everything else
+    bool writes = {};
+
+    // A named POSIX shared memory segment, or an anonymous memfd when name is empty
+    // capacity is rounded up to a power of two events of 16 bytes each
+    RING(std::string name, std::size_t capacity)
+        : name(std::move(name)), fd(create(this->name)), view(fd.fd, std::bit_ceil(std::max<std::size_t>(capacity, 2)), true) {}
+
+    RING(RING const&) = delete;
+    RING& operator=(RING const&) = delete;
+
+    // Mappings consumers already made stay valid, the name goes away with the producer
+    ~RING() {
+        if (!name.empty()) {
+            ::shm_unlink(name.c_str());
+        }
+    }
+
+    // For handing a memfd to a child process, or to a tool through /proc/<pid>/fd
+    [[nodiscard]] constexpr int fd_get() const noexcept {
+        return fd.fd;
+    }
+
+    [[nodiscard]] constexpr std::uint64_t head_get() const noexcept {
+        return head;
+    }
+
+    void block(FAR at) noexcept {
+        push(Kind::BLOCK, 0, 0, far_pack(at));
+    }
+
+    void interupt(FAR at, byte_t vector) noexcept {
+        push(Kind::INTERUPT, vector, 0, far_pack(at));
+    }
+
+    void in(word_t port, word_t val, byte_t width) noexcept {
+        push(Kind::IN, width, val, port);
+    }
+
+    void out(word_t port, word_t val, byte_t width) noexcept {
+        push(Kind::OUT, width, val, port);
+    }
+
+    void write(FAR addr, word_t val, byte_t width) noexcept {
+        if (writes) {
+            push(Kind::WRITE, width, val, addr.ea());
+        }
+    }
+
+    // Follows a ring from another process, starting at the oldest event still in it
+    struct Reader final {
+    private:
+        Fd fd;
+        View view;
+        std::uint64_t next = {};
+
+        static int open(std::string const& name) noexcept {
+            if (name.starts_with("/proc/")) {
+                return ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+            }
+            return ::shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+        }
+
+        // Oldest sequence number the producer may not have overwritten yet
+        [[nodiscard]] std::uint64_t oldest() const noexcept {
+            auto const head = view.header->head.load(std::memory_order_acquire);
+            return head > view.mask ? head - view.mask : 0;
+        }
+    public:
+        // Events the producer overwrote before they could be read
+        std::uint64_t lost = {};
+
+        // A named segment, or any path to the segment such as /proc/<pid>/fd/<fd> for a memfd
+        explicit Reader(std::string const& name)
+            : fd(open(name)), view(fd.fd, 0, false), next(oldest()) {}
+
+        Reader(Reader const&) = delete;
+        Reader& operator=(Reader const&) = delete;
+
+        [[nodiscard]] constexpr std::uint64_t capacity() const noexcept {
+            return view.mask + 1;
+        }
+
+        // Copies out what has been published since the last call, never more than fits
+        [[nodiscard]] std::size_t read(std::span<Event> out) noexcept {
+            auto const head = view.header->head.load(std::memory_order_acquire);
+            auto count = std::size_t{};
+            while (next < head && count != out.size()) {
+                if (head - next > view.mask + 1) {
+                    lost += head - view.mask - 1 - next;
+                    next = head - view.mask - 1;
+                }
+                auto const& slot = view.slots[next & view.mask];
+                auto const seq = slot.seq.load(std::memory_order_acquire);
+                auto const data = slot.data.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (seq != next + 1 || slot.seq.load(std::memory_order_relaxed) != seq) {
+                    // Lapped while reading, skip to what the producer has not reached yet
+                    auto const skip = std::max(next + 1, oldest());
+                    lost += skip - next;
+                    next = skip;
+                    continue;
+                }
+                out[count++] = {
+                    .seq = next,
+                    .kind = static_cast<Kind>(data & 0xFF),
+                    .aux = static_cast<byte_t>(data >> 8),
+                    .val = static_cast<word_t>(data >> 16),
+                    .addr = static_cast<dword_t>(data >> 32),
+                };
+                next += 1;
+            }
+            return count;
+        }
+    };
+};
+
+#endif // O126_RING_HPP
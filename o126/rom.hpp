@@ -0,0 +1,38 @@
+#ifndef O126_ROM_HPP
+#define O126_ROM_HPP
+#include "common.hpp"
+#include "mapping.hpp"
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Process wide cache of read-only ROM images, every instance mapping the same file shares one mapping
+struct o126::ROM final {
+    using Image = MAPPING;
+
+    [[nodiscard]] static std::shared_ptr<Image const> open(std::filesystem::path const& filename) {
+        auto const key = std::filesystem::weakly_canonical(filename).string();
+        auto const lock = std::lock_guard(cache().mutex);
+        auto& entry = cache().images[key];
+        if (auto image = entry.lock()) {
+            return image;
+        }
+        auto image = std::make_shared<Image const>(key);
+        entry = image;
+        return image;
+    }
+private:
+    struct Cache {
+        std::mutex mutex = {};
+        std::map<std::string, std::weak_ptr<Image const>> images = {};
+    };
+
+    static Cache& cache() noexcept {
+        static auto result = Cache{};
+        return result;
+    }
+};
+
+#endif // O126_ROM_HPP
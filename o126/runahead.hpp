@@ -0,0 +1,92 @@
+#ifndef O126_RUNAHEAD_HPP
+#define O126_RUNAHEAD_HPP
+#include "common.hpp"
+#include "pc.hpp"
+#include "sched.hpp"
+#include "uart.hpp"
+#include "video.hpp"
+#include <functional>
+#include <memory>
+
+// Shows the screen a few frames ahead of the machine input goes to, hiding the frames a guest takes to react to it
+// The speculative machine is a fork that keeps running on its own while no input arrives and is forked again once some does
+struct o126::RUNAHEAD final {
+    using Setup = std::function<void(PC& ahead)>;
+private:
+    PC& pc;
+    std::unique_ptr<PC> ahead;
+    unsigned frames;
+    // Serial input the guest has been handed so far, anything new means the speculation is wrong
+    std::uint64_t seen = {};
+    bool stale = true;
+
+    // Until the end of the frame, or until nothing is left that could wake a halted guest
+    static void run(PC& machine, unsigned count) noexcept {
+        auto const end = machine.sched.now + VIDEO::FRAME_CYCLES * count;
+        while (machine.sched.now < end && !(machine.halted && machine.sched.next == SCHED::NEVER)) {
+            (void)machine.step();
+        }
+    }
+
+    [[nodiscard]] std::uint64_t received() const noexcept {
+        return pc.com1.host.received + pc.com2.host.received;
+    }
+
+    // Speculative output goes nowhere, an attached endpoint still shows in the modem status the guest reads
+    static void detach(UART const& from, UART& to) {
+        if (from.host.attached()) {
+            to.host.open_file("/dev/null");
+        }
+    }
+public:
+    // setup runs once on the speculative machine, for the HLE hooks or translated module it should share with pc
+    // Fonts are copied over at this point, later changes to the video adapter's host side are not
+    RUNAHEAD(PC& pc, unsigned frames, Setup const& setup = {}) : pc(pc), ahead(pc.fork()), frames(frames), seen(received()) {
+        ahead->video = pc.video;
+        detach(pc.com1, ahead->com1);
+        detach(pc.com2, ahead->com2);
+        if (setup) {
+            setup(*ahead);
+        }
+    }
+
+    RUNAHEAD(RUNAHEAD const&) = delete;
+    RUNAHEAD& operator=(RUNAHEAD const&) = delete;
+
+    // Runs pc for one frame, then the speculative machine far enough to stay the given number of frames ahead
+    // Serial input pc read during the frame throws the speculation away, the rerun from pc costs frames frames
+    VIDEO const& frame() {
+        run(pc, 1);
+        if (frames == 0) {
+            (void)pc.video.update(pc.mem);
+            return pc.video;
+        }
+        auto const now = received();
+        if (stale || now != seen) {
+            seen = now;
+            stale = false;
+            ahead->share(pc);
+            run(*ahead, frames);
+        } else {
+            run(*ahead, 1);
+        }
+        (void)ahead->video.update(ahead->mem);
+        return ahead->video;
+    }
+
+    // For input handed to pc some other way, for example through an HLE hook or straight into its memory
+    void invalidate() noexcept {
+        stale = true;
+    }
+
+    [[nodiscard]] constexpr unsigned ahead_by() const noexcept {
+        return frames;
+    }
+
+    void ahead_by(unsigned count) noexcept {
+        frames = count;
+        stale = true;
+    }
+};
+
+#endif // O126_RUNAHEAD_HPP
@@ -0,0 +1,75 @@
+#ifndef O126_SCHED_HPP
+#define O126_SCHED_HPP
+#include "common.hpp"
+#include <algorithm>
+#include <array>
+
+// Fixed timer slots instead of callbacks, so the whole scheduler is plain data
+struct o126::SCHED final {
+    // CPU clock of the original PC, all timestamps are in these cycles
+    static constexpr std::uint64_t CLOCK = 4'772'727;
+    static constexpr std::uint64_t NEVER = ~std::uint64_t{};
+
+    enum class Timer : byte_t {
+        PIT,
+        SPEAKER,
+        COM1,
+        COM2,
+        COUNT,
+    };
+
+    std::uint64_t now = {};
+    std::uint64_t next = NEVER;
+    std::array<std::uint64_t, static_cast<int>(Timer::COUNT)> deadlines = [] {
+        auto result = std::array<std::uint64_t, static_cast<int>(Timer::COUNT)>{};
+        result.fill(NEVER);
+        return result;
+    }();
+
+    constexpr void charge(std::uint64_t cycles) noexcept {
+        now += cycles;
+    }
+
+    [[nodiscard]] constexpr bool due() const noexcept {
+        return now >= next;
+    }
+
+    [[nodiscard]] constexpr bool armed(Timer timer) const noexcept {
+        return deadlines[static_cast<int>(timer)] != NEVER;
+    }
+
+    [[nodiscard]] constexpr std::uint64_t when(Timer timer) const noexcept {
+        return deadlines[static_cast<int>(timer)];
+    }
+
+    constexpr void arm(Timer timer, std::uint64_t when) noexcept {
+        deadlines[static_cast<int>(timer)] = when;
+        next = *std::min_element(deadlines.begin(), deadlines.end());
+    }
+
+    constexpr void disarm(Timer timer) noexcept {
+        deadlines[static_cast<int>(timer)] = NEVER;
+        next = *std::min_element(deadlines.begin(), deadlines.end());
+    }
+
+    // Disarms and returns the earliest expired timer, Timer::COUNT when none is due
+    [[nodiscard]] constexpr Timer pop() noexcept {
+        if (!due()) {
+            return Timer::COUNT;
+        }
+        auto const it = std::min_element(deadlines.begin(), deadlines.end());
+        auto const timer = static_cast<Timer>(it - deadlines.begin());
+        disarm(timer);
+        return timer;
+    }
+
+    /// Machine state
+    template <typename S>
+    void serialize(S& s) {
+        s(now);
+        s(next);
+        s(deadlines);
+    }
+};
+
+#endif // O126_SCHED_HPP
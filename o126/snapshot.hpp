@@ -0,0 +1,176 @@
+#ifndef O126_SNAPSHOT_HPP
+#define O126_SNAPSHOT_HPP
+#include "common.hpp"
+#include "mapping.hpp"
+#include "mem.hpp"
+#include "pc.hpp"
+#include "state.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+// Versioned machine state file: header, one section per component, a page directory, then the non-zero RAM pages
+// Also caches the state after boot, restored by every later instance with the same firmware and configuration
+struct o126::SNAPSHOT final {
+    static constexpr char MAGIC[8] = { 'O', '1', '2', '6', 'S', 'N', 'A', 'P' };
+    static constexpr dword_t VERSION = 5;
+    static constexpr std::size_t HEADER_SIZE = 48;
+    // Stored pages start on a page boundary of the file so they can be mapped instead of read
+    static constexpr std::size_t ALIGN = 4096;
+    // Page directory entries, anything else is the one based index of a stored page
+    static constexpr dword_t PAGE_ZERO = 0;
+    static constexpr dword_t PAGE_ROM = ~dword_t{};
+
+    // FNV-1a over the firmware image followed by a caller supplied description of the configuration
+    [[nodiscard]] static std::uint64_t key(std::span<byte_t const> firmware, std::string_view config) noexcept {
+        auto result = std::uint64_t{0xCBF2'9CE4'8422'2325};
+        auto const mix = [&](byte_t val) {
+            result = (result ^ val) * 0x0000'0100'0000'01B3;
+        };
+        for (auto const val : firmware) {
+            mix(val);
+        }
+        mix(0);
+        for (auto const val : config) {
+            mix(static_cast<byte_t>(val));
+        }
+        return result;
+    }
+
+    [[nodiscard]] static std::filesystem::path path(std::filesystem::path const& dir, std::uint64_t key) {
+        char name[32] = {};
+        std::snprintf(name, sizeof(name), "%016llx.snap", static_cast<unsigned long long>(key));
+        return dir / name;
+    }
+
+    // Written to a temporary file first so a concurrent reader never sees a partial snapshot
+    static void save(PC& pc, std::filesystem::path const& filename, std::uint64_t key) {
+        pc.device_check();
+        auto state = STATE::Writer{};
+        pc.serialize(state);
+        auto directory = STATE::Writer{};
+        auto pages = std::vector<std::span<byte_t const>>{};
+        for (auto page = dword_t{}; page != MEM::PAGES; ++page) {
+            // The EMS frame is stored with the board, the page keeps the RAM it covers
+            auto const data = pc.mem.page_under(page << MEM::PAGE_BITS);
+            if (pc.mem.page_rom(page)) {
+                directory(PAGE_ROM);
+            } else if (std::all_of(data.begin(), data.end(), [](byte_t val) { return val == 0; })) {
+                directory(PAGE_ZERO);
+            } else {
+                pages.push_back(data);
+                directory(static_cast<dword_t>(pages.size()));
+            }
+        }
+        auto const used = HEADER_SIZE + state.data.size() + directory.data.size();
+        auto const offset = (used + ALIGN - 1) / ALIGN * ALIGN;
+        auto header = STATE::Writer{};
+        for (auto const c : MAGIC) {
+            header(static_cast<byte_t>(c));
+        }
+        header(VERSION);
+        header(static_cast<dword_t>(pages.size()));
+        header(key);
+        header(static_cast<std::uint64_t>(state.data.size()));
+        header(static_cast<std::uint64_t>(offset));
+        header(static_cast<std::uint64_t>(MEM::SIZE));
+
+        auto const temp = filename.string() + "." + std::to_string(::getpid()) + ".tmp";
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                throw "Failed to open snapshot for writing!";
+            }
+            auto const write = [&](std::span<byte_t const> data) {
+                file.write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size()));
+            };
+            write(header.data);
+            write(state.data);
+            write(directory.data);
+            write(std::vector<byte_t>(offset - used));
+            for (auto const data : pages) {
+                write(data);
+            }
+            if (!file) {
+                throw "Failed to write snapshot!";
+            }
+        }
+        std::filesystem::rename(temp, filename);
+    }
+
+    // Stored pages are mapped from the file and only copied when the guest writes them, ROM comes from the configuration
+    static void restore(PC& pc, std::filesystem::path const& filename, std::uint64_t key) {
+        auto const file = std::make_shared<MAPPING const>(filename.string());
+        auto reader = STATE::Reader{ file->bytes() };
+        if (file->size < HEADER_SIZE || std::memcmp(file->data, MAGIC, sizeof(MAGIC)) != 0) {
+            throw "Not a snapshot!";
+        }
+        (void)reader.take(sizeof(MAGIC));
+        auto version = dword_t{};
+        auto stored = dword_t{};
+        auto stored_key = std::uint64_t{};
+        auto state_size = std::uint64_t{};
+        auto offset = std::uint64_t{};
+        auto memory_size = std::uint64_t{};
+        reader(version);
+        reader(stored);
+        reader(stored_key);
+        reader(state_size);
+        reader(offset);
+        reader(memory_size);
+        if (version != VERSION || stored_key != key || memory_size != MEM::SIZE || offset + stored * std::uint64_t{MEM::PAGE_SIZE} > file->size) {
+            throw "Snapshot does not match!";
+        }
+        auto state = STATE::Reader{ reader.take(state_size) };
+        pc.serialize(state);
+        for (auto page = dword_t{}; page != MEM::PAGES; ++page) {
+            auto slot = dword_t{};
+            reader(slot);
+            if (slot == PAGE_ROM) {
+                // Back to the configured ROM in case this instance wrote over it
+                if (!pc.mem.map_firmware(page)) {
+                    throw "Snapshot does not match!";
+                }
+                continue;
+            }
+            if (pc.mem.page_readonly(page)) {
+                continue;
+            }
+            if (slot == PAGE_ZERO) {
+                pc.mem.clear_page(page);
+            } else if (slot <= stored) {
+                pc.mem.map_image_page(page, file, offset + (slot - 1) * std::size_t{MEM::PAGE_SIZE});
+            } else {
+                throw "Snapshot does not match!";
+            }
+        }
+        if (pc.ems) {
+            pc.ems->remap();
+        }
+    }
+
+    // Restores the cached state for key when there is one, otherwise runs boot(pc) from reset and caches the result
+    template <typename F>
+    static bool boot(PC& pc, std::filesystem::path const& dir, std::uint64_t key, F&& boot) {
+        auto const filename = path(dir, key);
+        if (std::filesystem::exists(filename)) {
+            restore(pc, filename, key);
+            return true;
+        }
+        std::forward<F>(boot)(pc);
+        std::filesystem::create_directories(dir);
+        save(pc, filename, key);
+        return false;
+    }
+};
+
+#endif // O126_SNAPSHOT_HPP
@@ -0,0 +1,245 @@
+#ifndef O126_SPEAKER_HPP
+#define O126_SPEAKER_HPP
+#include "common.hpp"
+#include "sched.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <numbers>
+#include <span>
+#include <string>
+#include <vector>
+
+// Level transitions are queued with their timestamp and mixed as band-limited steps once per block
+struct o126::SPEAKER {
+public:
+    static constexpr dword_t RATE = 44'100;
+    static constexpr std::uint64_t BLOCK_CYCLES = SCHED::CLOCK / 100;
+
+    // Single producer single consumer sample queue for a host audio thread
+    struct Ring final {
+        std::vector<sword_t> data = {};
+        std::atomic<std::size_t> head = {};
+        std::atomic<std::size_t> tail = {};
+
+        // Not thread safe, call before the consumer starts
+        void resize(std::size_t capacity) {
+            data.assign(capacity, 0);
+            head = 0;
+            tail = 0;
+        }
+
+        [[nodiscard]] std::size_t capacity() const noexcept {
+            return data.size();
+        }
+
+        // Drops whatever does not fit instead of waiting for the consumer
+        std::size_t push(std::span<sword_t const> src) noexcept {
+            auto const h = head.load(std::memory_order_relaxed);
+            auto const t = tail.load(std::memory_order_acquire);
+            auto const count = std::min(src.size(), data.size() - (h - t));
+            for (auto i = std::size_t{}; i != count; ++i) {
+                data[(h + i) % data.size()] = src[i];
+            }
+            head.store(h + count, std::memory_order_release);
+            return count;
+        }
+
+        std::size_t pop(std::span<sword_t> dst) noexcept {
+            auto const t = tail.load(std::memory_order_relaxed);
+            auto const h = head.load(std::memory_order_acquire);
+            auto const count = std::min(dst.size(), h - t);
+            for (auto i = std::size_t{}; i != count; ++i) {
+                dst[i] = data[(t + i) % data.size()];
+            }
+            tail.store(t + count, std::memory_order_release);
+            return count;
+        }
+    };
+private:
+    static constexpr int WIDTH = 16;
+    static constexpr int PHASES = 32;
+
+    struct Kernel {
+        float taps[PHASES][WIDTH] = {};
+    };
+
+    struct Event {
+        std::uint64_t time = {};
+        bool level = {};
+    };
+
+    // Blackman windowed sinc impulse sampled at every sub-sample phase, each phase sums to 1
+    static Kernel const& kernel() noexcept {
+        static Kernel const result = [] {
+            constexpr auto cutoff = 0.45;
+            auto kernel = Kernel{};
+            for (auto phase = 0; phase != PHASES; ++phase) {
+                auto sum = 0.0;
+                double taps[WIDTH] = {};
+                for (auto k = 0; k != WIDTH; ++k) {
+                    auto const x = k - WIDTH / 2 + 1 - static_cast<double>(phase) / PHASES;
+                    auto const t = (x + WIDTH / 2) / WIDTH;
+                    auto const window = 0.42 - 0.5 * std::cos(2 * std::numbers::pi * t) + 0.08 * std::cos(4 * std::numbers::pi * t);
+                    auto const arg = std::numbers::pi * 2 * cutoff * x;
+                    auto const sinc = x == 0 ? 1.0 : std::sin(arg) / arg;
+                    taps[k] = sinc * window;
+                    sum += taps[k];
+                }
+                for (auto k = 0; k != WIDTH; ++k) {
+                    kernel.taps[phase][k] = static_cast<float>(taps[k] / sum);
+                }
+            }
+            return kernel;
+        }();
+        return result;
+    }
+
+    std::vector<Event> events = {};
+    bool level_last = {};
+    std::uint64_t samples_done = {};
+    std::vector<float> deltas = std::vector<float>(WIDTH, 0.0f);
+    float accum = {};
+    float highpass_in = {};
+    float highpass_out = {};
+    std::vector<sword_t> samples = {};
+    std::ofstream wav = {};
+    std::uint64_t wav_bytes = {};
+
+    void write_le(std::uint64_t value, int size) {
+        for (auto i = 0; i != size; ++i) {
+            wav.put(static_cast<char>(value >> (i * 8)));
+        }
+    }
+
+    void write_header() {
+        wav.seekp(0);
+        auto const data_size = static_cast<dword_t>(std::min<std::uint64_t>(wav_bytes, 0xFFFF'FFFF - 36));
+        wav.write("RIFF", 4);
+        write_le(36 + data_size, 4);
+        wav.write("WAVEfmt ", 8);
+        write_le(16, 4);
+        write_le(1, 2);
+        write_le(1, 2);
+        write_le(RATE, 4);
+        write_le(RATE * 2, 4);
+        write_le(2, 2);
+        write_le(16, 2);
+        wav.write("data", 4);
+        write_le(data_size, 4);
+    }
+public:
+    Ring ring = {};
+    float volume = 0.25f;
+
+    SPEAKER() noexcept = default;
+    SPEAKER(SPEAKER const&) = delete;
+    SPEAKER& operator=(SPEAKER const&) = delete;
+
+    ~SPEAKER() {
+        close_wav();
+    }
+
+    [[nodiscard]] bool active() const noexcept {
+        return wav.is_open() || ring.capacity() != 0;
+    }
+
+    void open_wav(std::string filename) {
+        close_wav();
+        wav.open(filename, std::ios::binary | std::ios::trunc);
+        if (!wav) {
+            throw "Failed to open WAV file!";
+        }
+        wav_bytes = 0;
+        write_header();
+    }
+
+    void close_wav() noexcept {
+        if (wav.is_open()) {
+            write_header();
+            wav.close();
+        }
+    }
+
+    // Timestamps are CPU cycles and must not go backwards
+    void level(std::uint64_t time, bool high) {
+        if (high == level_last) {
+            return;
+        }
+        level_last = high;
+        if (active()) {
+            events.push_back({ time, high });
+        }
+    }
+
+    // Renders every sample up to time, the result stays valid until the next call
+    std::span<sword_t const> render(std::uint64_t time) {
+        auto const end = time * RATE / SCHED::CLOCK;
+        if (end <= samples_done) {
+            return {};
+        }
+        auto const count = static_cast<std::size_t>(end - samples_done);
+        if (!active()) {
+            events.clear();
+            samples_done = end;
+            return {};
+        }
+
+        auto const& taps = kernel().taps;
+        deltas.resize(count + WIDTH, 0.0f);
+        auto const origin = samples_done * SCHED::CLOCK;
+        auto const last = std::find_if(events.begin(), events.end(), [&](Event const& event) {
+            return event.time > time;
+        });
+        for (auto it = events.begin(); it != last; ++it) {
+            auto const offset = it->time * RATE > origin ? it->time * RATE - origin : 0;
+            auto const index = offset / SCHED::CLOCK;
+            auto const phase = (offset % SCHED::CLOCK) * PHASES / SCHED::CLOCK;
+            auto const delta = it->level ? 1.0f : -1.0f;
+            for (auto k = 0; k != WIDTH; ++k) {
+                deltas[index + k] += delta * taps[phase][k];
+            }
+        }
+        events.erase(events.begin(), last);
+
+        samples.resize(count);
+        for (auto i = std::size_t{}; i != count; ++i) {
+            accum += deltas[i];
+            highpass_out = accum - highpass_in + 0.999f * highpass_out;
+            highpass_in = accum;
+            auto const value = std::clamp(highpass_out * volume, -1.0f, 1.0f);
+            samples[i] = static_cast<sword_t>(value * 32767.0f);
+        }
+        std::copy(deltas.begin() + static_cast<std::ptrdiff_t>(count), deltas.end(), deltas.begin());
+        deltas.resize(WIDTH);
+        samples_done = end;
+
+        if (wav.is_open()) {
+            auto bytes = std::vector<char>(count * 2);
+            for (auto i = std::size_t{}; i != count; ++i) {
+                auto const [lo, hi] = word_unpack(static_cast<word_t>(samples[i]));
+                bytes[i * 2 + 0] = static_cast<char>(lo);
+                bytes[i * 2 + 1] = static_cast<char>(hi);
+            }
+            wav.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+            wav_bytes += bytes.size();
+        }
+        if (ring.capacity()) {
+            (void)ring.push(samples);
+        }
+        return samples;
+    }
+
+    /// Machine state, pending samples belong to the host and are dropped
+    template <typename S>
+    void serialize(S& s) {
+        s(level_last);
+        s(samples_done);
+        if constexpr (S::LOADING) {
+            events.clear();
+        }
+    }
+};
+
+#endif // O126_SPEAKER_HPP
@@ -0,0 +1,180 @@
+#ifndef O126_STATE_HPP
+#define O126_STATE_HPP
+#include "common.hpp"
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Little-endian field streams, every component has a single serialize(S&) walked by both of them
+struct o126::STATE final {
+    // Four character section name, stored as a little-endian dword
+    [[nodiscard]] static constexpr dword_t tag(char const (&name)[5]) noexcept {
+        return static_cast<dword_t>(static_cast<byte_t>(name[0]) | (static_cast<byte_t>(name[1]) << 8)
+            | (static_cast<byte_t>(name[2]) << 16) | (static_cast<byte_t>(name[3]) << 24));
+    }
+
+    template <typename T>
+    static constexpr bool scalar = std::is_integral_v<T> || std::is_enum_v<T>;
+
+    // Unsigned integer with the stored width of a scalar, bool takes one byte
+    template <typename T>
+    static auto raw() noexcept {
+        if constexpr (std::is_enum_v<T>) {
+            return std::make_unsigned_t<std::underlying_type_t<T>>{};
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return byte_t{};
+        } else {
+            return std::make_unsigned_t<T>{};
+        }
+    }
+
+    template <typename T>
+    using raw_t = decltype(raw<T>());
+
+    struct Writer final {
+        static constexpr bool LOADING = false;
+
+        std::vector<byte_t> data = {};
+
+        template <typename T> requires scalar<T>
+        void operator()(T const& value) {
+            using U = raw_t<T>;
+            auto raw = static_cast<U>(value);
+            for (auto i = std::size_t{}; i != sizeof(U); ++i) {
+                data.push_back(static_cast<byte_t>(raw));
+                raw = static_cast<U>(raw >> 8);
+            }
+        }
+
+        void operator()(float const& value) {
+            (*this)(std::bit_cast<dword_t>(value));
+        }
+
+        void operator()(FAR const& value) {
+            (*this)(value.disp);
+            (*this)(value.seg);
+        }
+
+        template <typename T, std::size_t N>
+        void operator()(T const (&values)[N]) {
+            for (auto const& value : values) {
+                (*this)(value);
+            }
+        }
+
+        template <typename T, std::size_t N>
+        void operator()(std::array<T, N> const& values) {
+            for (auto const& value : values) {
+                (*this)(value);
+            }
+        }
+
+        void bytes(std::span<byte_t const> values) {
+            data.insert(data.end(), values.begin(), values.end());
+        }
+
+        // Tag, version and size ahead of the fields, so readers can skip sections they do not know
+        template <typename F>
+        void section(dword_t tag, dword_t version, F&& fields) {
+            (*this)(tag);
+            (*this)(version);
+            auto const at = data.size();
+            (*this)(dword_t{});
+            std::forward<F>(fields)(*this);
+            auto size = static_cast<dword_t>(data.size() - at - sizeof(dword_t));
+            for (auto i = std::size_t{}; i != sizeof(dword_t); ++i, size >>= 8) {
+                data[at + i] = static_cast<byte_t>(size);
+            }
+        }
+    };
+
+    struct Reader final {
+        static constexpr bool LOADING = true;
+
+        std::span<byte_t const> data = {};
+        std::size_t pos = {};
+
+        template <typename T> requires scalar<T>
+        void operator()(T& value) {
+            using U = raw_t<T>;
+            auto const src = take(sizeof(U));
+            auto raw = U{};
+            for (auto i = sizeof(U); i != 0; --i) {
+                raw = static_cast<U>((raw << 8) | src[i - 1]);
+            }
+            value = static_cast<T>(raw);
+        }
+
+        void operator()(float& value) {
+            auto raw = dword_t{};
+            (*this)(raw);
+            value = std::bit_cast<float>(raw);
+        }
+
+        void operator()(FAR& value) {
+            (*this)(value.disp);
+            (*this)(value.seg);
+        }
+
+        template <typename T, std::size_t N>
+        void operator()(T (&values)[N]) {
+            for (auto& value : values) {
+                (*this)(value);
+            }
+        }
+
+        template <typename T, std::size_t N>
+        void operator()(std::array<T, N>& values) {
+            for (auto& value : values) {
+                (*this)(value);
+            }
+        }
+
+        void bytes(std::span<byte_t> values) {
+            auto const src = take(values.size());
+            std::memcpy(values.data(), src.data(), values.size());
+        }
+
+        // Sections are found in order, anything in between is skipped
+        template <typename F>
+        void section(dword_t tag, dword_t version, F&& fields) {
+            for (;;) {
+                auto stored_tag = dword_t{};
+                auto stored_version = dword_t{};
+                auto size = dword_t{};
+                (*this)(stored_tag);
+                (*this)(stored_version);
+                (*this)(size);
+                auto const body = take(size);
+                if (stored_tag != tag) {
+                    continue;
+                }
+                if (stored_version != version) {
+                    throw "Unsupported state section version!";
+                }
+                auto reader = Reader{ body };
+                std::forward<F>(fields)(reader);
+                if (reader.pos != body.size()) {
+                    throw "Corrupt state section!";
+                }
+                return;
+            }
+        }
+
+        [[nodiscard]] std::span<byte_t const> take(std::size_t size) {
+            if (size > data.size() - pos) {
+                throw "Truncated state!";
+            }
+            auto const result = data.subspan(pos, size);
+            pos += size;
+            return result;
+        }
+    };
+};
+
+#endif // O126_STATE_HPP
@@ -0,0 +1,366 @@
+#ifndef O126_TRACE_HPP
+#define O126_TRACE_HPP
+#include "common.hpp"
+#include "bus.hpp"
+#include "cpu.hpp"
+#include "mapping.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Log of every instruction the CPU retires and every interupt it takes, with what each one changed
+// A record starts with a head byte: bit 0 a CS follows, bit 1 an IP delta follows, bit 2 registers changed,
+// bit 3 memory was written and bits 4-7 the instruction length, 0 for an interupt and 15 when a varint length follows
+// Then come the CS, the zigzag varint distance from where the previous record left IP, the code bytes or the vector,
+// a varint mask of changed registers (bits 0-7 general, 8-11 segment, 12 flags) and their words, and the number of
+// writes followed by a varint (ea << 1 | word) and the value of each
+struct o126::TRACE final {
+    static constexpr char MAGIC[8] = { 'O', '1', '2', '6', 'T', 'R', 'C', 'E' };
+    static constexpr dword_t VERSION = 1;
+    static constexpr std::size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 1;
+    static constexpr std::size_t FLUSH_SIZE = 0x100000;
+
+    struct Write final {
+        dword_t ea = {};
+        word_t val = {};
+        bool word = {};
+    };
+
+    // Stands in for the machine while one instruction or interupt runs, instruction bytes come from the CPU's fetches
+    struct Bus final : BUS {
+        TRACE& trace;
+        BUS& inner;
+        FAR const at;
+
+        Bus(TRACE& trace, BUS& inner, CPU const& cpu) noexcept
+            : trace(trace), inner(inner), at(cpu.reg_get(CPU::REG::IP), cpu.seg_get(CPU::SEG::CS)) {
+            trace.code_len = {};
+            trace.writes.clear();
+        }
+
+        constexpr virtual byte_t read_byte(FAR addr) noexcept override {
+            return inner.read_byte(addr);
+        }
+        constexpr virtual void write_byte(FAR addr, byte_t val) noexcept override {
+            trace.writes.push_back({ addr.ea(), val, false });
+            inner.write_byte(addr, val);
+        }
+        constexpr virtual word_t read_word(FAR addr) noexcept override {
+            return inner.read_word(addr);
+        }
+        constexpr virtual void write_word(FAR addr, word_t val) noexcept override {
+            trace.writes.push_back({ addr.ea(), val, true });
+            inner.write_word(addr, val);
+        }
+
+        constexpr virtual byte_t in_byte(word_t port) noexcept override {
+            return inner.in_byte(port);
+        }
+        constexpr virtual void out_byte(word_t port, byte_t val) noexcept override {
+            inner.out_byte(port, val);
+        }
+        constexpr virtual word_t in_word(word_t port) noexcept override {
+            return inner.in_word(port);
+        }
+        constexpr virtual void out_word(word_t port, word_t val) noexcept override {
+            inner.out_word(port, val);
+        }
+    };
+
+    // Registers as the reader sees them after a record, IP is where the next one is expected to start
+    struct State final {
+        word_t regs[8] = {};
+        word_t segs[4] = {};
+        word_t flags = {};
+        word_t ip = {};
+    };
+
+    // One decoded record, the state is the one right after it
+    struct Record final {
+        FAR at = {};
+        bool interupt = {};
+        byte_t vector = {};
+        std::vector<byte_t> code = {};
+        // Mask of the registers that changed, laid out like in the file
+        dword_t changed = {};
+        State state = {};
+        std::vector<Write> writes = {};
+    };
+
+    // Walks a trace file front to back
+    struct Reader final {
+    private:
+        std::shared_ptr<MAPPING const> log;
+        std::span<byte_t const> source;
+        std::size_t pos = HEADER_SIZE;
+        Record current = {};
+
+        [[nodiscard]] bool get(std::uint64_t& val) noexcept {
+            val = 0;
+            for (auto shift = 0; pos != source.size() && shift < 64; shift += 7) {
+                auto const byte = source[pos++];
+                val |= std::uint64_t{byte & 0x7Fu} << shift;
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        [[nodiscard]] bool get_word(word_t& val) noexcept {
+            if (source.size() - pos < 2) {
+                return false;
+            }
+            val = word_pack(source[pos], source[pos + 1]);
+            pos += 2;
+            return true;
+        }
+
+        [[nodiscard]] bool decode() {
+            auto& state = current.state;
+            auto const head = source[pos++];
+            auto len = static_cast<std::uint64_t>(head >> 4);
+            auto val = std::uint64_t{};
+            if (head & 1 && !get_word(state.segs[1])) {
+                return false;
+            }
+            if (head & 2) {
+                if (!get(val)) {
+                    return false;
+                }
+                state.ip = static_cast<word_t>(state.ip + static_cast<word_t>((val >> 1) ^ (~(val & 1) + 1)));
+            }
+            current.at = { state.ip, state.segs[1] };
+            if (len == 15 && !get(len)) {
+                return false;
+            }
+            current.interupt = len == 0;
+            if (source.size() - pos < std::max<std::uint64_t>(len, 1)) {
+                return false;
+            }
+            if (current.interupt) {
+                current.vector = source[pos++];
+                current.code.clear();
+            } else {
+                current.code.assign(source.begin() + static_cast<std::ptrdiff_t>(pos), source.begin() + static_cast<std::ptrdiff_t>(pos + len));
+                pos += len;
+                state.ip = static_cast<word_t>(state.ip + len);
+            }
+            current.changed = {};
+            if (head & 4) {
+                if (!get(val)) {
+                    return false;
+                }
+                current.changed = static_cast<dword_t>(val);
+                for (auto i = 0; i != 13; ++i) {
+                    auto& reg = i < 8 ? state.regs[i] : i < 12 ? state.segs[i - 8] : state.flags;
+                    if (current.changed & (1u << i) && !get_word(reg)) {
+                        return false;
+                    }
+                }
+            }
+            current.writes.clear();
+            if (head & 8) {
+                auto count = std::uint64_t{};
+                if (!get(count)) {
+                    return false;
+                }
+                for (auto i = std::uint64_t{}; i != count; ++i) {
+                    auto write = Write{};
+                    if (!get(val)) {
+                        return false;
+                    }
+                    write.ea = static_cast<dword_t>(val >> 1);
+                    write.word = val & 1;
+                    if (write.word) {
+                        if (!get_word(write.val)) {
+                            return false;
+                        }
+                    } else if (pos != source.size()) {
+                        write.val = source[pos++];
+                    } else {
+                        return false;
+                    }
+                    current.writes.push_back(write);
+                }
+            }
+            return true;
+        }
+    public:
+        CPU::Model model = {};
+
+        explicit Reader(std::string filename) : log(std::make_shared<MAPPING const>(std::move(filename))), source(log->bytes()) {
+            if (source.size() < HEADER_SIZE || std::memcmp(source.data(), MAGIC, sizeof(MAGIC)) != 0) {
+                throw "Not a trace!";
+            }
+            auto version = dword_t{};
+            for (auto i = 4; i != 0; --i) {
+                version = (version << 8) | source[sizeof(MAGIC) + static_cast<std::size_t>(i - 1)];
+            }
+            if (version != VERSION) {
+                throw "Unsupported trace version!";
+            }
+            model = static_cast<CPU::Model>(source[sizeof(MAGIC) + 4]);
+        }
+
+        // Null at the end, a record cut short by a crash counts as the end
+        [[nodiscard]] Record const* next() {
+            if (pos == source.size() || !decode()) {
+                pos = source.size();
+                return nullptr;
+            }
+            return &current;
+        }
+    };
+private:
+    // Room for one record without its writes, the buffer always keeps this much free
+    static constexpr std::size_t RECORD_MAX = 64;
+    static constexpr std::size_t WRITE_MAX = 6;
+    static constexpr std::size_t CODE_MAX = 32;
+
+    std::FILE* file;
+    std::vector<byte_t> buffer = {};
+    std::size_t used = {};
+    // Filled by fetched while the instruction runs
+    byte_t code[CODE_MAX] = {};
+    std::size_t code_len = {};
+    std::vector<Write> writes = {};
+    State last = {};
+
+    static void put(byte_t*& out, std::uint64_t val) noexcept {
+        while (val >= 0x80) {
+            *out++ = static_cast<byte_t>(val | 0x80);
+            val >>= 7;
+        }
+        *out++ = static_cast<byte_t>(val);
+    }
+
+    static void put_word(byte_t*& out, word_t val) noexcept {
+        *out++ = static_cast<byte_t>(val);
+        *out++ = static_cast<byte_t>(val >> 8);
+    }
+
+    void record(CPU const& cpu, Bus const& bus, int vector) {
+        auto const room = RECORD_MAX + CODE_MAX + writes.size() * WRITE_MAX;
+        if (buffer.size() - used < room) {
+            flush();
+            buffer.resize(std::max(buffer.size(), room));
+        }
+        auto const len = vector < 0 ? code_len : 0;
+        auto head = static_cast<byte_t>(std::min<std::size_t>(len, 15) << 4);
+        head |= bus.at.seg != last.segs[1] ? 1 : 0;
+        head |= bus.at.disp != last.ip ? 2 : 0;
+        auto changed = dword_t{};
+        for (auto i = 0; i != 8; ++i) {
+            changed |= cpu.reg_get(static_cast<CPU::REG>(i)) != last.regs[i] ? 1u << i : 0;
+        }
+        for (auto i = 0; i != 4; ++i) {
+            changed |= cpu.seg_get(static_cast<CPU::SEG>(i)) != last.segs[i] ? 1u << (8 + i) : 0;
+        }
+        auto const flags = CPU::flags_pack(cpu.flags_get());
+        changed |= flags != last.flags ? 1u << 12 : 0;
+        head |= changed ? 4 : 0;
+        head |= writes.empty() ? 0 : 8;
+
+        auto out = buffer.data() + used;
+        *out++ = head;
+        if (head & 1) {
+            put_word(out, bus.at.seg);
+        }
+        if (head & 2) {
+            auto const delta = static_cast<sword_t>(bus.at.disp - last.ip);
+            put(out, (static_cast<std::uint64_t>(static_cast<std::int64_t>(delta)) << 1) ^ static_cast<std::uint64_t>(delta < 0 ? -1 : 0));
+        }
+        if (len >= 15) [[unlikely]] {
+            put(out, len);
+        }
+        if (vector < 0) {
+            // Whole array, the length only decides how much of it stays
+            std::memcpy(out, code, CODE_MAX);
+            out += len;
+        } else {
+            *out++ = static_cast<byte_t>(vector);
+        }
+        if (changed) {
+            put(out, changed);
+            for (auto i = 0; i != 8; ++i) {
+                if (changed & (1u << i)) {
+                    last.regs[i] = cpu.reg_get(static_cast<CPU::REG>(i));
+                    put_word(out, last.regs[i]);
+                }
+            }
+            for (auto i = 0; i != 4; ++i) {
+                if (changed & (1u << (8 + i))) {
+                    last.segs[i] = cpu.seg_get(static_cast<CPU::SEG>(i));
+                    put_word(out, last.segs[i]);
+                }
+            }
+            if (changed & (1u << 12)) {
+                last.flags = flags;
+                put_word(out, flags);
+            }
+        }
+        if (!writes.empty()) {
+            put(out, writes.size());
+            for (auto const& write : writes) {
+                put(out, (std::uint64_t{write.ea} << 1) | write.word);
+                if (write.word) {
+                    put_word(out, write.val);
+                } else {
+                    *out++ = static_cast<byte_t>(write.val);
+                }
+            }
+        }
+        last.ip = static_cast<word_t>(bus.at.disp + len);
+        used = static_cast<std::size_t>(out - buffer.data());
+        if (used >= FLUSH_SIZE) {
+            flush();
+        }
+    }
+public:
+    // Writes into file, which stays open and owned by the caller, for as long as it is set as a CPU's trace
+    TRACE(std::FILE* file, CPU::Model model) : file(file), buffer(FLUSH_SIZE + RECORD_MAX + CODE_MAX) {
+        auto out = std::copy(std::begin(MAGIC), std::end(MAGIC), buffer.data());
+        put_word(out, static_cast<word_t>(VERSION));
+        put_word(out, static_cast<word_t>(VERSION >> 16));
+        *out++ = static_cast<byte_t>(model);
+        used = static_cast<std::size_t>(out - buffer.data());
+    }
+
+    TRACE(TRACE const&) = delete;
+    TRACE& operator=(TRACE const&) = delete;
+
+    ~TRACE() {
+        flush();
+    }
+
+    // Batched so tracing costs one write per FLUSH_SIZE bytes
+    void flush() noexcept {
+        if (used) {
+            std::fwrite(buffer.data(), 1, used, file);
+            std::fflush(file);
+            used = {};
+        }
+    }
+
+    // Called by the CPU with every instruction byte it fetches, reads of data and of the interupt table go through Bus
+    void fetched(byte_t val) noexcept {
+        if (code_len != CODE_MAX) {
+            code[code_len++] = val;
+        }
+    }
+
+    void instruction(CPU const& cpu, Bus const& bus) {
+        record(cpu, bus, -1);
+    }
+
+    void interupt(CPU const& cpu, Bus const& bus, byte_t vector) {
+        record(cpu, bus, vector);
+    }
+};
+
+#endif // O126_TRACE_HPP
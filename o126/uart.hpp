@@ -0,0 +1,418 @@
+#ifndef O126_UART_HPP
+#define O126_UART_HPP
+#include "common.hpp"
+#include "sched.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// 16550 with FIFOs, the host side is only touched from poll() so guest port I/O never makes a syscall
+struct o126::UART {
+public:
+    // Non-blocking host endpoint, bytes are moved in batches of up to BUFFER_SIZE per syscall
+    struct Host final {
+        static constexpr std::size_t BUFFER_SIZE = 4096;
+
+        int fd_in = -1;
+        int fd_out = -1;
+        std::vector<byte_t> in = {};
+        std::vector<byte_t> out = {};
+        std::size_t in_pos = {};
+        std::size_t out_pos = {};
+        // Bytes read from fd_in so far, lets the host notice the guest got input without watching the descriptor
+        std::uint64_t received = {};
+
+        Host() noexcept = default;
+        Host(Host const&) = delete;
+        Host& operator=(Host const&) = delete;
+
+        ~Host() {
+            close();
+        }
+
+        void close() noexcept {
+            if (fd_in >= 0) {
+                ::close(fd_in);
+            }
+            if (fd_out >= 0 && fd_out != fd_in) {
+                ::close(fd_out);
+            }
+            fd_in = -1;
+            fd_out = -1;
+            in.clear();
+            out.clear();
+            in_pos = {};
+            out_pos = {};
+        }
+
+        // Takes ownership of already opened descriptors, for example both ends of a pipe pair
+        void open_fd(int in_fd, int out_fd) {
+            close();
+            for (auto const fd : { in_fd, out_fd }) {
+                if (fd >= 0 && ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+                    throw "Failed to make serial descriptor non-blocking!";
+                }
+            }
+            fd_in = in_fd;
+            fd_out = out_fd;
+        }
+
+        // Named pipe, character device or terminal
+        void open_path(std::string path) {
+            auto const fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+            if (fd < 0) {
+                throw "Failed to open serial path!";
+            }
+            open_fd(fd, fd);
+        }
+
+        // Output only, for capturing a guest log
+        void open_file(std::string path) {
+            auto const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+            if (fd < 0) {
+                throw "Failed to open serial file!";
+            }
+            open_fd(-1, fd);
+        }
+
+        // Returns the path of the slave side
+        std::string open_pty() {
+            auto const fd = ::posix_openpt(O_RDWR | O_NOCTTY);
+            if (fd < 0 || ::grantpt(fd) < 0 || ::unlockpt(fd) < 0) {
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                throw "Failed to open serial pty!";
+            }
+            auto const name = std::string(::ptsname(fd));
+            auto mode = termios{};
+            if (::tcgetattr(fd, &mode) == 0) {
+                ::cfmakeraw(&mode);
+                ::tcsetattr(fd, TCSANOW, &mode);
+            }
+            open_fd(fd, fd);
+            return name;
+        }
+
+        [[nodiscard]] bool attached() const noexcept {
+            return fd_in >= 0 || fd_out >= 0;
+        }
+
+        [[nodiscard]] std::size_t available() const noexcept {
+            return in.size() - in_pos;
+        }
+
+        // Bytes still waiting for fd_out, the transmitter holds off once BUFFER_SIZE of them pile up
+        [[nodiscard]] std::size_t pending() const noexcept {
+            return out.size() - out_pos;
+        }
+
+        void flush() noexcept {
+            if (out.empty()) {
+                return;
+            }
+            if (fd_out >= 0) {
+                auto const written = ::write(fd_out, out.data() + out_pos, out.size() - out_pos);
+                if (written > 0) {
+                    out_pos += static_cast<std::size_t>(written);
+                    if (out_pos != out.size()) {
+                        // Compacts only after a whole buffer went out so each byte is moved at most once more
+                        if (out_pos >= BUFFER_SIZE) {
+                            out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(out_pos));
+                            out_pos = 0;
+                        }
+                        return;
+                    }
+                } else if (written == 0 || errno == EAGAIN || errno == EINTR) {
+                    return;
+                }
+            }
+            out.clear();
+            out_pos = 0;
+        }
+
+        void fill() noexcept {
+            if (fd_in < 0 || available()) {
+                return;
+            }
+            in.resize(BUFFER_SIZE);
+            in_pos = {};
+            auto const count = ::read(fd_in, in.data(), in.size());
+            if (count > 0) {
+                in.resize(static_cast<std::size_t>(count));
+                received += static_cast<std::uint64_t>(count);
+                return;
+            }
+            in.clear();
+            if (count == 0) {
+                // EOF on a pipe or file, a pty reports a closed slave as EIO instead
+                if (fd_in != fd_out) {
+                    ::close(fd_in);
+                }
+                fd_in = -1;
+            }
+        }
+    };
+private:
+    // Input clock of 1.8432 MHz divided by 16
+    static constexpr std::uint64_t BAUD_BASE = 115'200;
+    static constexpr std::uint64_t IDLE_MAX = SCHED::CLOCK / 100;
+    static constexpr byte_t triggers[4] = { 1, 4, 8, 14 };
+
+    struct FIFO {
+        byte_t data[16] = {};
+        byte_t head = {};
+        byte_t size = {};
+
+        [[nodiscard]] constexpr bool empty() const noexcept {
+            return size == 0;
+        }
+
+        constexpr void push(byte_t val) noexcept {
+            data[(head + size) & 15] = val;
+            size += 1;
+        }
+
+        constexpr byte_t pop() noexcept {
+            auto const result = data[head];
+            head = (head + 1) & 15;
+            size -= 1;
+            return result;
+        }
+
+        constexpr void clear() noexcept {
+            head = {};
+            size = {};
+        }
+    };
+
+    FIFO rx = {};
+    FIFO tx = {};
+    word_t divisor = 12;
+    byte_t ier = {};
+    byte_t lcr = {};
+    byte_t mcr = {};
+    byte_t lsr_errors = {};
+    byte_t scr = {};
+    byte_t fcr = {};
+    bool thre_pending = {};
+    bool timeout = {};
+    std::uint64_t last_poll = {};
+    std::uint64_t idle = {};
+
+    [[nodiscard]] constexpr byte_t depth() const noexcept {
+        return fcr & 0x01 ? 16 : 1;
+    }
+
+    [[nodiscard]] constexpr bool loopback() const noexcept {
+        return mcr & 0x10;
+    }
+
+    // Interupt identification in priority order, bit 0 clear means pending
+    [[nodiscard]] constexpr byte_t iir() const noexcept {
+        auto const fifo = static_cast<byte_t>(fcr & 0x01 ? 0xC0 : 0x00);
+        if ((ier & 0x04) && lsr_errors) {
+            return fifo | 0x06;
+        }
+        if ((ier & 0x01) && rx.size >= (fcr & 0x01 ? triggers[fcr >> 6] : 1)) {
+            return fifo | 0x04;
+        }
+        if ((ier & 0x01) && timeout && !rx.empty()) {
+            return fifo | 0x0C;
+        }
+        if ((ier & 0x02) && thre_pending) {
+            return fifo | 0x02;
+        }
+        return fifo | 0x01;
+    }
+public:
+    Host host = {};
+    word_t base = {};
+    byte_t line = {};
+
+    constexpr UART(word_t base, byte_t line) noexcept : base(base), line(line) {}
+
+    [[nodiscard]] constexpr bool has_port(word_t port) const noexcept {
+        return (port & 0xFFF8) == base;
+    }
+
+    // Level of the interupt line, OUT2 gates it onto the bus on the PC
+    [[nodiscard]] constexpr bool irq() const noexcept {
+        return (mcr & 0x08) && !(iir() & 0x01);
+    }
+
+    [[nodiscard]] constexpr std::uint64_t char_cycles() const noexcept {
+        return SCHED::CLOCK * 10 * (divisor ? divisor : 0x10000) / BAUD_BASE;
+    }
+
+    // Time until the transmit FIFO has drained, when the next poll should happen at the latest
+    [[nodiscard]] constexpr std::uint64_t tx_cycles() const noexcept {
+        return tx.empty() ? SCHED::NEVER : char_cycles() * tx.size;
+    }
+
+    constexpr byte_t in_byte(word_t port) noexcept {
+        auto const dlab = lcr & 0x80;
+        switch (port & 7) {
+        case 0:
+            if (dlab) {
+                return word_unpack(divisor).lo;
+            }
+            timeout = false;
+            return rx.empty() ? 0 : rx.pop();
+        case 1:
+            return dlab ? word_unpack(divisor).hi : ier;
+        case 2: {
+            auto const result = iir();
+            if ((result & 0x0F) == 0x02) {
+                thre_pending = false;
+            }
+            return result;
+        }
+        case 3:
+            return lcr;
+        case 4:
+            return mcr;
+        case 5: {
+            auto const result = static_cast<byte_t>(lsr_errors | !rx.empty() | (tx.empty() ? 0x60 : 0x00));
+            lsr_errors = {};
+            return result;
+        }
+        case 6:
+            if (loopback()) {
+                return static_cast<byte_t>(((mcr & 0x02) << 3) | ((mcr & 0x01) << 5) | ((mcr & 0x04) << 4) | ((mcr & 0x08) << 4));
+            }
+            return host.attached() ? 0xB0 : 0x00;
+        default:
+            return scr;
+        }
+    }
+
+    constexpr void out_byte(word_t port, byte_t val) noexcept {
+        auto const dlab = lcr & 0x80;
+        switch (port & 7) {
+        case 0:
+            if (dlab) {
+                divisor = word_pack(val, word_unpack(divisor).hi);
+                break;
+            }
+            thre_pending = false;
+            if (tx.size < depth()) {
+                tx.push(val);
+            }
+            break;
+        case 1:
+            if (dlab) {
+                divisor = word_pack(word_unpack(divisor).lo, val);
+                break;
+            }
+            if ((val & 0x02) && !(ier & 0x02) && tx.empty()) {
+                thre_pending = true;
+            }
+            ier = val & 0x0F;
+            break;
+        case 2:
+            if ((val ^ fcr) & 0x01) {
+                rx.clear();
+                tx.clear();
+            }
+            if (val & 0x02) {
+                rx.clear();
+            }
+            if (val & 0x04) {
+                tx.clear();
+            }
+            fcr = val & 0xC9;
+            break;
+        case 3:
+            lcr = val;
+            break;
+        case 4:
+            mcr = val & 0x1F;
+            break;
+        case 7:
+            scr = val;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Moves bytes between the FIFOs and the host at line rate, returns cycles until the next poll
+    std::uint64_t poll(std::uint64_t now) noexcept {
+        auto const per_char = char_cycles();
+        auto const budget = std::max<std::uint64_t>((now - last_poll) / per_char, 1);
+        last_poll = now;
+
+        auto moved = std::size_t{};
+        // A host that stops taking data stops the transmitter too, the guest sees THRE stay low as with real flow control
+        host.flush();
+        auto const room = loopback() ? budget : Host::BUFFER_SIZE - std::min(host.pending(), Host::BUFFER_SIZE);
+        auto const sent = std::min<std::uint64_t>({ tx.size, budget, room });
+        for (auto i = std::uint64_t{}; i != sent; ++i) {
+            auto const val = tx.pop();
+            if (loopback()) {
+                if (rx.size < depth()) {
+                    rx.push(val);
+                } else {
+                    lsr_errors |= 0x02;
+                }
+            } else {
+                host.out.push_back(val);
+            }
+        }
+        if (sent && tx.empty()) {
+            thre_pending = true;
+        }
+        moved += sent;
+        host.flush();
+
+        if (!loopback()) {
+            host.fill();
+            auto const received = std::min<std::size_t>({ host.available(), static_cast<std::size_t>(depth() - rx.size), budget });
+            for (auto i = std::size_t{}; i != received; ++i) {
+                rx.push(host.in[host.in_pos++]);
+            }
+            // Nothing arrived for a whole poll period while data is waiting below the trigger level
+            timeout = !received && !rx.empty();
+            moved += received;
+        }
+
+        if (!tx.empty()) {
+            return tx_cycles();
+        }
+        if (moved || host.available() || host.pending()) {
+            idle = {};
+            return per_char * depth();
+        }
+        idle = std::min(std::max(idle * 2, per_char * depth()), IDLE_MAX);
+        return idle;
+    }
+
+    /// Machine state, the host endpoint stays attached as it is
+    template <typename S>
+    void serialize(S& s) {
+        for (auto* fifo : { &rx, &tx }) {
+            s(fifo->data);
+            s(fifo->head);
+            s(fifo->size);
+        }
+        s(divisor);
+        s(ier);
+        s(lcr);
+        s(mcr);
+        s(lsr_errors);
+        s(scr);
+        s(fcr);
+        s(thre_pending);
+        s(timeout);
+        s(last_poll);
+        s(idle);
+    }
+};
+
+#endif // O126_UART_HPP
@@ -0,0 +1,356 @@
+#ifndef O126_VIDEO_HPP
+#define O126_VIDEO_HPP
+#include "common.hpp"
+#include "mem.hpp"
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct o126::VIDEO {
+public:
+    // 262 lines of 304 CPU cycles each, both adapters are modeled with the CGA timing
+    static constexpr std::uint64_t LINE_CYCLES = 304;
+    static constexpr std::uint64_t FRAME_LINES = 262;
+    static constexpr std::uint64_t FRAME_CYCLES = LINE_CYCLES * FRAME_LINES;
+
+    enum class Adapter : byte_t {
+        MDA,
+        CGA,
+    };
+private:
+    enum class CRTC : byte_t {
+        H_DISPLAYED = 1,
+        V_DISPLAYED = 6,
+        MAX_SCANLINE = 9,
+        CURSOR_START = 10,
+        CURSOR_END = 11,
+        START_HI = 12,
+        START_LO = 13,
+        CURSOR_HI = 14,
+        CURSOR_LO = 15,
+        COUNT = 18,
+    };
+
+    static constexpr std::uint32_t palette[16] = {
+        0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+        0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+    };
+
+    static constexpr dword_t CELLS_MAX = 0x4000 / 2;
+
+    Adapter adapter = Adapter::CGA;
+    byte_t crtc_index = {};
+    byte_t crtc[static_cast<int>(CRTC::COUNT)] = { 113, 80, 90, 10, 31, 6, 25, 28, 2, 7, 6, 7 };
+    byte_t mode = 0b0'1001;
+    byte_t color = {};
+
+    byte_t font[256][16] = {};
+    // Video memory as last drawn, compared on every update so writes by DMA or host code show up like the CPU's
+    byte_t shadow[CELLS_MAX * 2] = {};
+    std::uint64_t dirty[CELLS_MAX / 64] = {};
+    bool dirty_all = true;
+    word_t cursor_drawn = 0xFFFF;
+
+    word_t cols = {};
+    word_t rows = {};
+    byte_t scanlines = {};
+    std::vector<byte_t> pixels = {};
+    std::string chars = {};
+
+    [[nodiscard]] constexpr byte_t reg(CRTC index) const noexcept {
+        return crtc[static_cast<int>(index)];
+    }
+
+    [[nodiscard]] constexpr word_t reg_word(CRTC hi, CRTC lo) const noexcept {
+        return word_pack(reg(lo), reg(hi) & 0x3F);
+    }
+
+    [[nodiscard]] constexpr dword_t cells() const noexcept {
+        return adapter == Adapter::MDA ? 0x1000 / 2 : 0x4000 / 2;
+    }
+
+    constexpr void mark(word_t cell) noexcept {
+        cell &= static_cast<word_t>(cells() - 1);
+        dirty[cell >> 6] |= std::uint64_t{1} << (cell & 63);
+    }
+
+    [[nodiscard]] static constexpr char to_ascii(byte_t c) noexcept {
+        if (c >= 0x20 && c < 0x7F) {
+            return static_cast<char>(c);
+        }
+        switch (c) {
+        case 0xB3: case 0xBA:
+            return '|';
+        case 0xC4: case 0xCD:
+            return '-';
+        case 0xDA: case 0xBF: case 0xC0: case 0xD9: case 0xC9: case 0xBB: case 0xC8: case 0xBC:
+        case 0xC3: case 0xB4: case 0xC2: case 0xC1: case 0xC5: case 0xCC: case 0xB9: case 0xCB:
+        case 0xCA: case 0xCE:
+            return '+';
+        case 0xB0: case 0xB1: case 0xB2: case 0xDB: case 0xDC: case 0xDD: case 0xDE: case 0xDF:
+            return '#';
+        case 0x00: case 0xFF:
+            return ' ';
+        default:
+            return '.';
+        }
+    }
+
+    [[nodiscard]] constexpr bool cursor_visible() const noexcept {
+        return (reg(CRTC::CURSOR_START) & 0x60) != 0x20;
+    }
+
+    // Marks the cells that differ from the shadow, whole pages at a time while they still match
+    void scan(MEM const& mem) noexcept {
+        auto const size = cells() * 2;
+        for (auto offset = dword_t{}; offset < size; offset += MEM::PAGE_SIZE) {
+            auto const src = mem.page_read(base() + offset).first(std::min(size - offset, MEM::PAGE_SIZE));
+            auto const old = shadow + offset;
+            if (std::equal(src.begin(), src.end(), old)) {
+                continue;
+            }
+            for (auto i = std::size_t{}; i < src.size(); i += 2) {
+                if (src[i] != old[i] || src[i + 1] != old[i + 1]) {
+                    old[i] = src[i];
+                    old[i + 1] = src[i + 1];
+                    mark(static_cast<word_t>((offset + i) >> 1));
+                }
+            }
+        }
+    }
+
+    void resize() noexcept {
+        cols = std::max<word_t>(reg(CRTC::H_DISPLAYED), 1);
+        rows = std::max<word_t>(reg(CRTC::V_DISPLAYED), 1);
+        scanlines = static_cast<byte_t>(std::min((reg(CRTC::MAX_SCANLINE) & 0x1F) + 1, 16));
+        pixels.assign(std::size_t{cols} * 8 * rows * scanlines * 3, 0);
+        chars.assign((std::size_t{cols} + 1) * rows, ' ');
+        for (auto row = std::size_t{}; row != rows; ++row) {
+            chars[row * (cols + 1u) + cols] = '\n';
+        }
+        std::fill(std::begin(dirty), std::end(dirty), ~std::uint64_t{});
+        cursor_drawn = 0xFFFF;
+        dirty_all = false;
+    }
+
+    void render(MEM const& mem, dword_t screen, word_t cell, bool cursor) noexcept {
+        auto const ea = base() + static_cast<dword_t>(cell) * 2;
+        auto const ch = mem.read_byte(ea);
+        auto const attr = mem.read_byte(ea + 1);
+        auto const row = screen / cols;
+        auto const col = screen % cols;
+        chars[row * (cols + 1u) + col] = to_ascii(ch);
+
+        auto fg = palette[attr & 0xF];
+        auto bg = palette[(attr >> 4) & (mode & 0x20 ? 0x7 : 0xF)];
+        auto underline = false;
+        if (adapter == Adapter::MDA) {
+            auto const on = (attr & 0x77) != 0 && (attr & 0x77) != 0x70;
+            auto const bright = attr & 0x08 ? 0xFFFFFF : 0xAAAAAA;
+            fg = on ? bright : 0x000000;
+            bg = (attr & 0x77) == 0x70 ? 0xAAAAAA : 0x000000;
+            if ((attr & 0x77) == 0x70) {
+                fg = 0x000000;
+            }
+            underline = (attr & 0x07) == 0x01;
+        }
+        if (!(mode & 0x08)) {
+            fg = bg = 0x000000;
+        }
+
+        auto const cursor_lo = reg(CRTC::CURSOR_START) & 0x1F;
+        auto const cursor_hi = reg(CRTC::CURSOR_END) & 0x1F;
+        auto const stride = std::size_t{cols} * 8 * 3;
+        auto out = pixels.data() + (std::size_t{row} * scanlines * stride) + std::size_t{col} * 8 * 3;
+        for (auto y = 0; y != scanlines; ++y, out += stride) {
+            auto bits = font[ch][y];
+            if (underline && y == scanlines - 1) {
+                bits = 0xFF;
+            }
+            if (cursor && y >= cursor_lo && y <= cursor_hi) {
+                bits = 0xFF;
+            }
+            for (auto x = 0; x != 8; ++x) {
+                auto const rgb = (bits & (0x80 >> x)) ? fg : bg;
+                out[x * 3 + 0] = static_cast<byte_t>(rgb >> 16);
+                out[x * 3 + 1] = static_cast<byte_t>(rgb >> 8);
+                out[x * 3 + 2] = static_cast<byte_t>(rgb);
+            }
+        }
+    }
+public:
+    constexpr VIDEO() noexcept = default;
+
+    constexpr void set_adapter(Adapter value) noexcept {
+        adapter = value;
+        crtc[static_cast<int>(CRTC::MAX_SCANLINE)] = value == Adapter::MDA ? 13 : 7;
+        crtc[static_cast<int>(CRTC::CURSOR_START)] = value == Adapter::MDA ? 11 : 6;
+        crtc[static_cast<int>(CRTC::CURSOR_END)] = value == Adapter::MDA ? 12 : 7;
+        dirty_all = true;
+    }
+
+    // Glyph rows, one byte per scanline, for example the 8x8 font at F000:FA6E of the IBM BIOS
+    void load_font(std::span<byte_t const> glyphs, byte_t glyph_height, byte_t first = 0) noexcept {
+        auto const count = glyphs.size() / glyph_height;
+        for (auto i = std::size_t{}; i != count && first + i < 256; ++i) {
+            for (auto y = 0; y != glyph_height && y != 16; ++y) {
+                font[first + i][y] = glyphs[i * glyph_height + y];
+            }
+        }
+        dirty_all = true;
+    }
+
+    /// Memory interface
+    [[nodiscard]] constexpr dword_t base() const noexcept {
+        return adapter == Adapter::MDA ? 0xB'00'00 : 0xB'80'00;
+    }
+
+    /// Port interface
+    [[nodiscard]] constexpr bool has_port(word_t port) const noexcept {
+        return (port & 0xFFF0) == (adapter == Adapter::MDA ? 0x3B0 : 0x3D0);
+    }
+
+    [[nodiscard]] constexpr byte_t in_byte(word_t port, std::uint64_t now) const noexcept {
+        switch (port & 0xF) {
+        case 0x5: case 0x1: case 0x3: case 0x7:
+            return crtc_index < 18 ? crtc[crtc_index] : 0xFF;
+        case 0xA: {
+            auto const pos = now % FRAME_CYCLES;
+            auto const line = pos / LINE_CYCLES;
+            auto const hblank = pos % LINE_CYCLES >= LINE_CYCLES * 4 / 5;
+            auto const vblank = line >= 200;
+            auto const vsync = line >= 224 && line < 240;
+            return static_cast<byte_t>(0xF0 | (hblank || vblank) | (vsync << 3));
+        }
+        default:
+            return 0xFF;
+        }
+    }
+
+    constexpr void out_byte(word_t port, byte_t val) noexcept {
+        switch (port & 0xF) {
+        case 0x4: case 0x0: case 0x2: case 0x6:
+            crtc_index = val;
+            break;
+        case 0x5: case 0x1: case 0x3: case 0x7: {
+            if (crtc_index >= 18 || crtc[crtc_index] == val) {
+                break;
+            }
+            crtc[crtc_index] = val;
+            switch (static_cast<CRTC>(crtc_index)) {
+            case CRTC::H_DISPLAYED:
+            case CRTC::V_DISPLAYED:
+            case CRTC::MAX_SCANLINE:
+            case CRTC::START_HI:
+            case CRTC::START_LO:
+                dirty_all = true;
+                break;
+            case CRTC::CURSOR_START:
+            case CRTC::CURSOR_END:
+                mark(reg_word(CRTC::CURSOR_HI, CRTC::CURSOR_LO));
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        case 0x8:
+            if (mode != val) {
+                mode = val;
+                dirty_all = true;
+            }
+            break;
+        case 0x9:
+            color = val;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /// Host interface
+    // Re-renders the cells that changed since the last update, returns how many were drawn
+    std::size_t update(MEM const& mem) noexcept {
+        if (dirty_all) {
+            resize();
+        }
+        scan(mem);
+        auto const start = reg_word(CRTC::START_HI, CRTC::START_LO);
+        auto const cursor = reg_word(CRTC::CURSOR_HI, CRTC::CURSOR_LO) & (cells() - 1);
+        auto const show_cursor = cursor_visible();
+        if (cursor_drawn != cursor) {
+            if (cursor_drawn != 0xFFFF) {
+                mark(cursor_drawn);
+            }
+            mark(static_cast<word_t>(cursor));
+            cursor_drawn = static_cast<word_t>(cursor);
+        }
+        auto const visible = std::min<dword_t>(dword_t{cols} * rows, cells());
+        auto count = std::size_t{};
+        for (auto i = dword_t{}; i != cells() / 64; ++i) {
+            for (auto bits = std::exchange(dirty[i], 0); bits; bits &= bits - 1) {
+                auto const cell = static_cast<word_t>(i * 64 + std::countr_zero(bits));
+                auto const screen = (cell - start) & (cells() - 1);
+                if (screen < visible) {
+                    render(mem, screen, cell, show_cursor && cell == cursor);
+                    ++count;
+                }
+            }
+        }
+        return count;
+    }
+
+    [[nodiscard]] constexpr word_t width() const noexcept {
+        return static_cast<word_t>(cols * 8);
+    }
+
+    [[nodiscard]] constexpr word_t height() const noexcept {
+        return static_cast<word_t>(rows * scanlines);
+    }
+
+    // RGB24, valid after update()
+    [[nodiscard]] std::span<byte_t const> framebuffer() const noexcept {
+        return pixels;
+    }
+
+    // One line per row, valid after update()
+    [[nodiscard]] std::string const& text() const noexcept {
+        return chars;
+    }
+
+    void save_ppm(std::string filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) {
+            throw "Failed to open PPM file!";
+        }
+        file << "P6\n" << width() << ' ' << height() << "\n255\n";
+        file.write(reinterpret_cast<char const*>(pixels.data()), static_cast<std::streamsize>(pixels.size()));
+    }
+
+    void save_text(std::string filename) const {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) {
+            throw "Failed to open text file!";
+        }
+        file.write(chars.data(), static_cast<std::streamsize>(chars.size()));
+    }
+
+    /// Machine state, the framebuffer is redrawn from guest memory on the next update
+    template <typename S>
+    void serialize(S& s) {
+        s(adapter);
+        s(crtc_index);
+        s(crtc);
+        s(mode);
+        s(color);
+        if constexpr (S::LOADING) {
+            dirty_all = true;
+        }
+    }
+};
+
+#endif // O126_VIDEO_HPP
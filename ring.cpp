@@ -0,0 +1,58 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "o126/ring.hpp"
+
+using namespace o126;
+
+// Follows a RING segment of a running instance and prints one line per event, plus a note whenever some were lost
+namespace {
+void print(RING::Event const& event) {
+    switch (event.kind) {
+    case RING::Kind::BLOCK:
+        std::printf("%llu block %04X:%04X\n", static_cast<unsigned long long>(event.seq), event.addr >> 16, event.addr & 0xFFFF);
+        break;
+    case RING::Kind::INTERUPT:
+        std::printf("%llu interupt 0x%02X from %04X:%04X\n", static_cast<unsigned long long>(event.seq), event.aux, event.addr >> 16, event.addr & 0xFFFF);
+        break;
+    case RING::Kind::IN:
+        std::printf(event.aux == 2 ? "%llu in %04X=%04X\n" : "%llu in %04X=%02X\n", static_cast<unsigned long long>(event.seq), event.addr, event.val);
+        break;
+    case RING::Kind::OUT:
+        std::printf(event.aux == 2 ? "%llu out %04X=%04X\n" : "%llu out %04X=%02X\n", static_cast<unsigned long long>(event.seq), event.addr, event.val);
+        break;
+    case RING::Kind::WRITE:
+        std::printf(event.aux == 2 ? "%llu write [%05X]=%04X\n" : "%llu write [%05X]=%02X\n", static_cast<unsigned long long>(event.seq), event.addr, event.val);
+        break;
+    }
+}
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s name|/proc/pid/fd/n\n", argv[0]);
+        return 1;
+    }
+    try {
+        auto reader = RING::Reader(argv[1]);
+        RING::Event events[256] = {};
+        auto lost = std::uint64_t{};
+        for (;;) {
+            auto const count = reader.read(events);
+            if (reader.lost != lost) {
+                std::printf("... %llu lost\n", static_cast<unsigned long long>(reader.lost - lost));
+                lost = reader.lost;
+            }
+            for (auto i = std::size_t{}; i != count; ++i) {
+                print(events[i]);
+            }
+            if (count == 0) {
+                std::fflush(stdout);
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+    } catch (char const* error) {
+        std::fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+}
@@ -0,0 +1,53 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "o126/disasm.hpp"
+#include "o126/trace.hpp"
+
+using namespace o126;
+
+// Prints a trace written by TRACE, one line per instruction or interupt with what it changed
+namespace {
+constexpr char const* names[13] = { "ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "es", "cs", "ss", "ds", "flags" };
+
+void print(TRACE::Record const& record, CPU::Model model) {
+    auto text = std::string{};
+    if (record.interupt) {
+        char buffer[16] = {};
+        std::snprintf(buffer, sizeof(buffer), "interupt 0x%X", record.vector);
+        text = buffer;
+    } else {
+        text = DISASM::decode(record.code, record.at.disp, model).text;
+    }
+    std::printf("%04X:%04X  %-32s", record.at.seg, record.at.disp, text.c_str());
+    auto const& state = record.state;
+    for (auto i = 0; i != 13; ++i) {
+        if (record.changed & (1u << i)) {
+            auto const val = i < 8 ? state.regs[i] : i < 12 ? state.segs[i - 8] : state.flags;
+            std::printf(" %s=%04X", names[i], val);
+        }
+    }
+    for (auto const& write : record.writes) {
+        std::printf(write.word ? " [%05X]=%04X" : " [%05X]=%02X", write.ea, write.val);
+    }
+    std::printf("\n");
+}
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s trace [count]\n", argv[0]);
+        return 1;
+    }
+    try {
+        auto reader = TRACE::Reader(argv[1]);
+        auto left = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : ~0ull;
+        for (auto record = reader.next(); record && left; record = reader.next(), --left) {
+            print(*record, reader.model);
+        }
+    } catch (char const* error) {
+        std::fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    return 0;
+}